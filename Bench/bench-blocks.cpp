@@ -0,0 +1,133 @@
+//
+//  bench-blocks.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Size and decoding speed of the hymn blocks against the loose cN.txt.
+//
+//      bench-blocks SOURCE_DIR
+//
+//  Compresses every hymn of the source with the literal code alone and
+//  with dictionaries of 4 KB to 64 KB, counting the model in the size;
+//  then trains on the odd hymns only and compresses the even ones, for how
+//  the model does on hymns it has not seen, as those of a new edition
+//  would be. Every block is decoded and compared with its source. Decoding
+//  is timed per hymn, p50 and p99, and as throughput over the whole book.
+//
+
+#include "HymnBlocks.h"
+#include "SourceBook.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+// Compresses the hymns in which against the dictionary, checks and times
+// their decoding, and prints a row.
+static bool run(const char *name, const std::vector<Slice> &hymns, const std::vector<size_t> &which,
+                const BlockModel &model)
+{
+    BlockDecoder decoder;
+    if (!decoder.open(Slice(model.dictionary), model.literalBits)) {
+        fprintf(stderr, "bench-blocks: %s: bad literal code\n", name);
+        return false;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    BlockEncoder encoder(model);
+    std::vector<std::string> blocks(which.size());
+    size_t raw = 0;
+    size_t packed = model.dictionary.size() + sizeof(model.literalBits);
+    for (size_t i = 0; i < which.size(); i++) {
+        encoder.compress(hymns[which[i]], &blocks[i]);
+        raw += hymns[which[i]].size;
+        packed += blocks[i].size();
+    }
+    double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> micros;
+    std::string out;
+    double decodeSeconds = 0;
+    for (size_t i = 0; i < which.size(); i++) {
+        Slice hymn = hymns[which[i]];
+        out.resize(hymn.size);
+        std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        bool ok = decoder.decompress(Slice(blocks[i]), out.empty() ? NULL : &out[0], out.size());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+        if (!ok || Slice(out) != hymn) {
+            fprintf(stderr, "bench-blocks: %s: hymn %zu does not decode to its source\n", name, which[i] + 1);
+            return false;
+        }
+        micros.push_back(seconds * 1e6);
+        decodeSeconds += seconds;
+    }
+    printf("%-22s %10zu %7.2fx %8.1f %8.2f %8.2f %8.0f\n", name, packed, (double)raw / std::max<size_t>(packed, 1),
+           raw / 1e6 / std::max(encodeSeconds, 1e-9), percentile(micros, 0.5), percentile(micros, 0.99),
+           raw / 1e6 / std::max(decodeSeconds, 1e-9));
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: bench-blocks SOURCE_DIR\n");
+        return 2;
+    }
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[1], &book, &error)) {
+        fprintf(stderr, "bench-blocks: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<Slice> hymns;
+    std::vector<size_t> all;
+    std::vector<Slice> odd;
+    std::vector<size_t> even;
+    size_t raw = 0;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        hymns.push_back(Slice(book.bodies[n - 1]));
+        all.push_back(n - 1);
+        if (n % 2) {
+            odd.push_back(hymns.back());
+        } else {
+            even.push_back(n - 1);
+        }
+        raw += hymns.back().size;
+    }
+    printf("%u hymns, %zu bytes of cN.txt\n\n", book.count(), raw);
+    printf("%-22s %10s %8s %8s %8s %8s %8s\n", "", "bytes", "ratio", "enc MB/s", "p50 us", "p99 us", "dec MB/s");
+
+    // The literal code alone: trained with no room for phrases.
+    BlockModel model;
+    trainBlockModel(hymns, 0, &model);
+    bool ok = run("no dictionary", hymns, all, model);
+    static const size_t kCapacities[] = { 4 * 1024, 16 * 1024, 32 * 1024, 64 * 1024 };
+    for (size_t c = 0; c < sizeof(kCapacities) / sizeof(kCapacities[0]); c++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        trainBlockModel(hymns, kCapacities[c], &model);
+        double millis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        char name[64];
+        snprintf(name, sizeof(name), "%zu KB dictionary", kCapacities[c] / 1024);
+        ok = run(name, hymns, all, model) && ok;
+        printf("%-22s trained in %.0f ms, %zu bytes\n", "", millis, model.dictionary.size());
+    }
+
+    trainBlockModel(odd, kMaxBlockDictionary, &model);
+    ok = run("even, odd model", hymns, even, model) && ok;
+    trainBlockModel(odd, 0, &model);
+    ok = run("even, odd code only", hymns, even, model) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+//
+//  bench-cache.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Hymn opening through the prepared hymn cache during a made-up service.
+//
+//      bench-cache [--budget KB] [--opens N] [--no-prefetch] CORPUS
+//
+//  Opens N hymns (default 2000) of a packed corpus in a seeded walk: mostly
+//  the next hymn, sometimes the one before, now and then one anywhere in
+//  the book. Between opens the prefetch worker is given time to finish, as
+//  a reader would. Reports the counters, the latency of hits and misses,
+//  and the page faults taken by hits (Linux only), which should be none:
+//  a hit reads nothing of the corpus. The budget defaults to 1024 KB.
+//
+
+#include "Corpus.h"
+#include "HymnCache.h"
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace canticos;
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+// Page faults of the calling thread so far; the worker's are its own.
+static long threadFaults()
+{
+#ifdef RUSAGE_THREAD
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        return usage.ru_minflt + usage.ru_majflt;
+    }
+#endif
+    return 0;
+}
+
+static void report(const char *name, const std::vector<double> &micros)
+{
+    printf("%-6s %6zu opens: p50 %.1f us, p99 %.1f us, max %.1f us\n", name, micros.size(), percentile(micros, 0.5),
+           percentile(micros, 0.99), percentile(micros, 1.0));
+}
+
+int main(int argc, char **argv)
+{
+    size_t budget = 1024 * 1024;
+    int opens = 2000;
+    bool prefetch = true;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--budget") == 0 && arg + 1 < argc) {
+            budget = (size_t)atol(argv[++arg]) * 1024;
+        } else if (strcmp(argv[arg], "--opens") == 0 && arg + 1 < argc) {
+            opens = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--no-prefetch") == 0) {
+            prefetch = false;
+        } else {
+            break;
+        }
+    }
+    if (arg + 1 != argc) {
+        fprintf(stderr, "usage: bench-cache [--budget KB] [--opens N] [--no-prefetch] CORPUS\n");
+        return 2;
+    }
+    Corpus corpus;
+    std::string error;
+    if (!corpus.open(argv[arg], &error)) {
+        fprintf(stderr, "bench-cache: %s\n", error.c_str());
+        return 1;
+    }
+    if (corpus.count() == 0) {
+        fprintf(stderr, "bench-cache: the corpus is empty\n");
+        return 1;
+    }
+
+    HymnCache cache(corpus, budget, prefetch);
+    uint32_t seed = 2013;
+    uint32_t number = 1 + nextRandom(&seed) % corpus.count();
+    std::vector<double> hits;
+    std::vector<double> misses;
+    long hitFaults = 0;
+    size_t characters = 0;
+    for (int i = 0; i < opens; i++) {
+        uint32_t step = nextRandom(&seed) % 100;
+        if (step < 15) {
+            number = 1 + nextRandom(&seed) % corpus.count();
+        } else if (step < 40) {
+            number = number > 1 ? number - 1 : number + 1;
+        } else {
+            number = number < corpus.count() ? number + 1 : number - 1;
+        }
+        if (corpus.count() == 1) {
+            number = 1;
+        }
+
+        uint64_t hitsBefore = cache.stats().hits;
+        long faults = threadFaults();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        HymnCache::Hymn hymn = cache.open(number);
+        double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        faults = threadFaults() - faults;
+        characters += hymn ? hymn->text.size() : 0;
+        if (cache.stats().hits > hitsBefore) {
+            hits.push_back(micros);
+            hitFaults += faults;
+        } else {
+            misses.push_back(micros);
+        }
+        hymn.reset();
+        cache.waitForPrefetch();
+    }
+
+    HymnCacheStats stats = cache.stats();
+    printf("%u hymns, budget %zu KB, prefetch %s\n", corpus.count(), budget / 1024, prefetch ? "on" : "off");
+    printf("hits %llu, misses %llu (%.1f%% hit), prefetched %llu, evicted %llu\n", (unsigned long long)stats.hits,
+           (unsigned long long)stats.misses, 100.0 * stats.hits / std::max<uint64_t>(stats.hits + stats.misses, 1),
+           (unsigned long long)stats.prefetched, (unsigned long long)stats.evicted);
+    printf("cached %u hymns in %zu KB; %zu characters opened\n", stats.hymns, stats.bytes / 1024, characters);
+    report("hit", hits);
+    report("miss", misses);
+    printf("page faults during hits: %ld\n", hitFaults);
+    return 0;
+}
@@ -0,0 +1,201 @@
+//
+//  bench-catalog.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Latency of a search over the books of a catalog as books are added.
+//
+//      bench-catalog [--shards N] [--threads T] [--count N] [--passes N] ARTIFACT_DIR
+//
+//  ARTIFACT_DIR is what canticos-build wrote for a catalog (or a single
+//  book). --shards N searches N shards, going round the catalog's books as
+//  often as it takes, so one book opened again stands for another of its
+//  size (default: the catalog's books). For 1, 2, 4... up to N shards, each
+//  query is searched in a loop over the shards and fanned out on a pool of
+//  T threads (default: one per core besides the caller's), and the p50 and
+//  p99 of both are printed, and how much faster the fan-out's p50 is. The
+//  two must find the same hits in the same order.
+//
+//  Queries are N runs of one to three words (default 500) from hymns of
+//  the main book picked with a fixed seed; each is searched --passes times
+//  (default 3).
+//
+
+#include "Catalog.h"
+#include "Corpus.h"
+#include "SearchIndex.h"
+#include "ShardedSearch.h"
+#include "Tokenizer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: bench-catalog [--shards N] [--threads T] [--count N] [--passes N] ARTIFACT_DIR\n");
+    return 2;
+}
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+// One to three words in a row from hymns picked at random.
+static void makeQueries(const Corpus &corpus, size_t count, std::vector<std::string> *queries)
+{
+    uint32_t seed = 2013;
+    std::vector<Token> words;
+    while (queries->size() < count && corpus.count()) {
+        uint32_t number = nextRandom(&seed) % corpus.count() + 1;
+        words.clear();
+        Tokenizer tokenizer(corpus.body(number));
+        Token token;
+        while (tokenizer.next(&token)) {
+            words.push_back(token);
+        }
+        if (words.empty()) {
+            continue;
+        }
+        size_t first = nextRandom(&seed) % words.size();
+        size_t last = std::min(words.size() - 1, first + nextRandom(&seed) % 3);
+        queries->push_back(std::string(words[first].text.begin(), words[last].text.end()));
+    }
+}
+
+static bool sameHits(const std::vector<ShardHit> &a, const std::vector<ShardHit> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].shard != b[i].shard || a[i].number != b[i].number || a[i].score != b[i].score) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    size_t shards = 0;
+    unsigned threads = WorkerPool::defaultThreads();
+    size_t queryCount = 500;
+    int passes = 3;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (arg + 1 >= argc) {
+            return usage();
+        }
+        if (strcmp(argv[arg], "--shards") == 0) {
+            shards = (size_t)std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--threads") == 0) {
+            threads = (unsigned)std::max(0, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--count") == 0) {
+            queryCount = (size_t)std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--passes") == 0) {
+            passes = std::max(1, atoi(argv[++arg]));
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 1) {
+        return usage();
+    }
+    std::string dir = argv[arg];
+
+    std::string error;
+    std::vector<CatalogBook> books;
+    if (!loadCatalog(dir, &books, &error)) {
+        fprintf(stderr, "bench-catalog: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<std::unique_ptr<SearchIndex> > indices;
+    for (size_t b = 0; b < books.size(); b++) {
+        indices.push_back(std::unique_ptr<SearchIndex>(new SearchIndex));
+        if (!indices.back()->open((dir + "/" + books[b].key + ".index").c_str(), &error)) {
+            fprintf(stderr, "bench-catalog: %s\n", error.c_str());
+            return 1;
+        }
+    }
+    Corpus corpus;
+    if (!corpus.open((dir + "/" + books[0].key + ".corpus").c_str(), &error)) {
+        fprintf(stderr, "bench-catalog: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<std::string> queries;
+    makeQueries(corpus, queryCount, &queries);
+    if (shards == 0) {
+        shards = books.size();
+    }
+
+    WorkerPool serial(0);
+    WorkerPool pool(threads);
+    printf("%zu books, %zu queries x %d, %u threads besides the caller\n\n", books.size(), queries.size(), passes,
+           threads);
+    printf("%6s %9s %10s %10s %10s %10s %8s\n", "shards", "hymns", "loop p50", "loop p99", "fan p50", "fan p99",
+           "speedup");
+    bool ok = true;
+    for (size_t n = 1; n <= shards; n = n < shards && n * 2 > shards ? shards : n * 2) {
+        ShardedSearch loop(&serial);
+        ShardedSearch fanned(&pool);
+        uint64_t hymns = 0;
+        for (size_t s = 0; s < n; s++) {
+            const SearchIndex *index = indices[s % indices.size()].get();
+            loop.addShard(index, NULL);
+            fanned.addShard(index, NULL);
+            hymns += index->docCount();
+        }
+        SearchOptions options;
+        std::vector<ShardHit> expected;
+        std::vector<ShardHit> hits;
+        std::vector<double> loopMicros;
+        std::vector<double> fanMicros;
+        for (int pass = 0; pass < passes; pass++) {
+            for (size_t q = 0; q < queries.size(); q++) {
+                // Every other query goes first to the fan-out, so neither
+                // always finds the postings warm.
+                for (int turn = 0; turn < 2; turn++) {
+                    bool fan = (turn + q) % 2 == 1;
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    (fan ? fanned : loop).search(Slice(queries[q]), options, fan ? &hits : &expected);
+                    std::chrono::duration<double, std::micro> took = std::chrono::steady_clock::now() - start;
+                    (fan ? fanMicros : loopMicros).push_back(took.count());
+                }
+                if (!sameHits(expected, hits)) {
+                    fprintf(stderr, "bench-catalog: \"%s\" over %zu shards: the fan-out finds other hits\n",
+                            queries[q].c_str(), n);
+                    ok = false;
+                }
+            }
+        }
+        double loopP50 = percentile(loopMicros, 0.5);
+        double fanP50 = percentile(fanMicros, 0.5);
+        printf("%6zu %9llu %10.1f %10.1f %10.1f %10.1f %7.2fx\n", n, (unsigned long long)hymns, loopP50,
+               percentile(loopMicros, 0.99), fanP50, percentile(fanMicros, 0.99), loopP50 / std::max(fanP50, 1e-9));
+        if (n == shards) {
+            break;
+        }
+    }
+    return ok ? 0 : 1;
+}
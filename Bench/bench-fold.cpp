@@ -0,0 +1,135 @@
+//
+//  bench-fold.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Throughput of the accent and case folding kernel.
+//
+//      bench-fold [--synthetic-mb N] SOURCE_DIR
+//
+//  Folds the real hymns (all cN.txt and indice.txt) and a synthetic text of
+//  N MB (default 64) built from the same words, with the vector and the
+//  scalar code, and reports GB/s for each.
+//
+
+#include "Fold.h"
+#include "SourceBook.h"
+#include "Tokenizer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+typedef size_t (*FoldFunction)(const char *, size_t, char *);
+
+static double gigabytesPerSecond(FoldFunction fold, const std::string &text, std::vector<char> &out)
+{
+    // Repeat until at least 200 ms have passed so small inputs are timed
+    // over many runs.
+    size_t bytes = 0;
+    size_t checksum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    do {
+        checksum += fold(text.data(), text.size(), out.data());
+        bytes += text.size();
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (seconds < 0.2);
+    if (checksum == 0 && !text.empty()) {
+        fprintf(stderr, "unexpected empty output\n");
+    }
+    return bytes / seconds / 1e9;
+}
+
+static void report(const char *name, const std::string &text)
+{
+    std::vector<char> vectorOut(text.size());
+    std::vector<char> scalarOut(text.size());
+    size_t a = foldUtf8(text.data(), text.size(), vectorOut.data());
+    size_t b = foldUtf8Scalar(text.data(), text.size(), scalarOut.data());
+    if (a != b || memcmp(vectorOut.data(), scalarOut.data(), a) != 0) {
+        fprintf(stderr, "%s: vector and scalar folding disagree\n", name);
+        exit(1);
+    }
+
+    double vector = gigabytesPerSecond(foldUtf8, text, vectorOut);
+    double scalar = gigabytesPerSecond(foldUtf8Scalar, text, scalarOut);
+    printf("%-10s %10zu bytes  vector %6.2f GB/s  scalar %6.2f GB/s  (%.1fx)\n",
+           name, text.size(), vector, scalar, vector / scalar);
+}
+
+// Synthetic text with the corpus' own words and line lengths: mostly lower
+// case verses, some all-caps refrain lines, CR line breaks.
+static std::string synthesize(const std::string &corpus, size_t size)
+{
+    std::vector<Slice> words;
+    Tokenizer tokenizer((Slice(corpus)));
+    Token token;
+    while (tokenizer.next(&token)) {
+        words.push_back(token.text);
+    }
+
+    std::string text;
+    text.reserve(size + 256);
+    uint32_t seed = 2013;
+    while (text.size() < size && !words.empty()) {
+        seed = seed * 1103515245 + 12345;
+        bool refrain = (seed >> 16) % 5 == 0;
+        int length = 4 + (int)((seed >> 8) % 5);
+        for (int w = 0; w < length; w++) {
+            seed = seed * 1103515245 + 12345;
+            Slice word = words[(seed >> 8) % words.size()];
+            std::string piece = word.str();
+            if (refrain) {
+                for (size_t i = 0; i < piece.size(); i++) {
+                    if (piece[i] >= 'a' && piece[i] <= 'z') {
+                        piece[i] -= 32;
+                    }
+                }
+            }
+            if (w > 0) {
+                text += ' ';
+            }
+            text += piece;
+        }
+        text += '\r';
+    }
+    return text;
+}
+
+int main(int argc, char **argv)
+{
+    size_t syntheticMegabytes = 64;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "--synthetic-mb") == 0) {
+        syntheticMegabytes = (size_t)atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (argc - arg != 1) {
+        fprintf(stderr, "usage: bench-fold [--synthetic-mb N] SOURCE_DIR\n");
+        return 2;
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-fold: %s\n", error.c_str());
+        return 1;
+    }
+    std::string corpus;
+    for (uint32_t n = 0; n < book.count(); n++) {
+        corpus += book.titles[n];
+        corpus += '\n';
+        corpus += book.bodies[n];
+    }
+
+    report("corpus", corpus);
+    report("synthetic", synthesize(corpus, syntheticMegabytes << 20));
+    return 0;
+}
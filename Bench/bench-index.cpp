@@ -0,0 +1,107 @@
+//
+//  bench-index.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Throughput of the parallel index build as threads are added.
+//
+//      bench-index [--threads T] [--runs N] SOURCE_DIR
+//
+//  SOURCE_DIR is a book as canticos-build reads it; canticos-synth writes
+//  one of any size. For 1, 2, 4... up to T threads (default: one per core)
+//  the index is built --runs times (default 3), and the best time of each
+//  phase is printed (tokenize, merge, write; see IndexMerge.h) with the
+//  hymns per second and how much faster than one thread that is. Every
+//  build must give the bytes of the first.
+//
+
+#include "IndexMerge.h"
+#include "SourceBook.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: bench-index [--threads T] [--runs N] SOURCE_DIR\n");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int runs = 3;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (arg + 1 >= argc) {
+            return usage();
+        }
+        if (strcmp(argv[arg], "--threads") == 0) {
+            threads = (unsigned)std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--runs") == 0) {
+            runs = std::max(1, atoi(argv[++arg]));
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 1) {
+        return usage();
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-index: %s\n", error.c_str());
+        return 1;
+    }
+    IndexSource source = [&book](uint32_t number, Slice *title, Slice *body) {
+        *title = Slice(book.titles[number - 1]);
+        *body = Slice(book.bodies[number - 1]);
+    };
+
+    printf("%u hymns, best of %d runs\n\n", book.count(), runs);
+    printf("%7s %9s %9s %9s %9s %11s %8s\n", "threads", "tokenize", "merge", "write", "total", "hymns/s", "speedup");
+    std::string expected;
+    double single = 0;
+    bool ok = true;
+    for (unsigned n = 1; n <= threads; n = n < threads && n * 2 > threads ? threads : n * 2) {
+        WorkerPool pool(n - 1);
+        IndexBuildTimes best = { 0, 0, 0 };
+        double bestTotal = 0;
+        for (int r = 0; r < runs; r++) {
+            std::string bytes;
+            IndexBuildTimes times;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            buildIndex(book.count(), source, &pool, &bytes, &times);
+            double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (r == 0 || total < bestTotal) {
+                best = times;
+                bestTotal = total;
+            }
+            if (expected.empty()) {
+                expected.swap(bytes);
+            } else if (bytes != expected) {
+                fprintf(stderr, "bench-index: %u threads build other bytes\n", n);
+                ok = false;
+            }
+        }
+        if (n == 1) {
+            single = bestTotal;
+        }
+        printf("%7u %8.3fs %8.3fs %8.3fs %8.3fs %11.0f %7.2fx\n", n, best.tokenize, best.merge, best.write, bestTotal,
+               book.count() / std::max(bestTotal, 1e-9), single / std::max(bestTotal, 1e-9));
+        if (n == threads) {
+            break;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+//
+//  bench-layout.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Line breaking and pagination of the whole corpus, checked and timed.
+//
+//      bench-layout CORPUS TABLE...
+//
+//  TABLE is a recorded advance table (Bench/advances). For each table the
+//  corpus is laid out at four sizes and four widths (phone and tablet,
+//  portrait and landscape) from scratch, and every layout is checked:
+//  every line fits unless one character is wider than the line, a line
+//  breaks only after a space, a hyphen or a line break unless its word is
+//  too wide for a line of its own, the next line's first word would not
+//  have fitted, and no page holds more lines than fit. Then the corpus is
+//  laid out again after turning the screen and after a size change,
+//  starting from the layouts before, which must give the same lines and
+//  pages as from scratch; the stanzas kept are counted. With more than
+//  one table, the same runs once more with the text in the first table's
+//  face and the titles and refrains in the second's, as Cantico sets them
+//  in bold and italic.
+//
+
+#include "Corpus.h"
+#include "HymnCache.h"
+#include "Layout.h"
+#include "MappedFile.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+static double millisSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool isSpace(uint16_t unit)
+{
+    return unit == ' ' || unit == '\t';
+}
+
+static bool isBreak(uint16_t unit)
+{
+    return unit == '\n' || unit == '\r' || unit == 0x2028 || unit == 0x2029;
+}
+
+static bool isHyphen(uint16_t unit)
+{
+    return unit == '-' || unit == 0x2010 || unit == 0x2013 || unit == 0x2014;
+}
+
+static uint32_t widthOf(const PreparedHymn &hymn, const AdvanceTable &table, uint32_t start, uint32_t end)
+{
+    uint32_t width = 0;
+    for (uint32_t i = start; i < end; i++) {
+        width += table.advance(hymn.text[i]);
+    }
+    return width;
+}
+
+// Describes the first thing wrong with a layout, or returns "".
+static std::string checkLayout(const PreparedHymn &hymn, const LayoutFaces &faces, const LayoutParams &params,
+                               const HymnLayout &layout)
+{
+    char what[128];
+    for (uint32_t b = 0; b < layout.blocks.size(); b++) {
+        const AdvanceTable *face = b == 0 ? faces.title : hymn.stanzas[b - 1].refrain ? faces.refrain : NULL;
+        const AdvanceTable &table = face ? *face : *faces.text;
+        uint32_t limit = layoutLimit(table, params);
+        const LayoutBlock &block = layout.blocks[b];
+        uint32_t blockStart = b ? hymn.stanzas[b - 1].utf16Offset : 0;
+        uint32_t blockEnd = b ? blockStart + hymn.stanzas[b - 1].utf16Size : hymn.titleUtf16Size;
+        if (block.lineCount == 0 || layout.lineStarts[block.firstLine] != blockStart) {
+            snprintf(what, sizeof(what), "block %u does not start a line", b);
+            return what;
+        }
+        for (uint32_t l = 0; l < block.lineCount; l++) {
+            uint32_t start = layout.lineStarts[block.firstLine + l];
+            uint32_t end = l + 1 < block.lineCount ? layout.lineStarts[block.firstLine + l + 1] : blockEnd;
+            uint32_t contentEnd = end;
+            while (contentEnd > start && (isSpace(hymn.text[contentEnd - 1]) || isBreak(hymn.text[contentEnd - 1]))) {
+                contentEnd--;
+            }
+            uint32_t width = widthOf(hymn, table, start, contentEnd);
+            uint32_t units = contentEnd - start;
+            bool single = units == 1 || (units == 2 && hymn.text[start + 1] >= 0xDC00 && hymn.text[start + 1] < 0xE000);
+            if (width > limit && !single) {
+                snprintf(what, sizeof(what), "block %u line %u is %u units wide for %u", b, l, width, limit);
+                return what;
+            }
+            if (l + 1 == block.lineCount) {
+                break;
+            }
+
+            // Where the next line starts, and its first word.
+            uint16_t before = hymn.text[end - 1];
+            uint32_t wordEnd = end;
+            while (wordEnd < blockEnd && !isSpace(hymn.text[wordEnd]) && !isBreak(hymn.text[wordEnd])) {
+                if (isHyphen(hymn.text[wordEnd++])) {
+                    break;
+                }
+            }
+            if (isBreak(before)) {
+                continue;
+            }
+            if (!isSpace(before) && !isHyphen(before)) {
+                uint32_t wordStart = end;
+                while (wordStart > blockStart && !isSpace(hymn.text[wordStart - 1]) && !isBreak(hymn.text[wordStart - 1])
+                       && !isHyphen(hymn.text[wordStart - 1])) {
+                    wordStart--;
+                }
+                uint32_t wholeEnd = end;
+                while (wholeEnd < blockEnd && !isSpace(hymn.text[wholeEnd]) && !isBreak(hymn.text[wholeEnd])
+                       && !isHyphen(hymn.text[wholeEnd])) {
+                    wholeEnd++;
+                }
+                if (wholeEnd < blockEnd && isHyphen(hymn.text[wholeEnd])) {
+                    wholeEnd++;
+                }
+                if (widthOf(hymn, table, wordStart, wholeEnd) <= limit) {
+                    snprintf(what, sizeof(what), "block %u line %u breaks inside a word that fits", b, l);
+                    return what;
+                }
+                wordEnd = end + 1;
+            }
+            if (widthOf(hymn, table, start, wordEnd) <= limit) {
+                snprintf(what, sizeof(what), "block %u line %u could have taken more", b, l);
+                return what;
+            }
+        }
+    }
+
+    for (size_t p = 0; p < layout.pages.size(); p++) {
+        const LayoutPage &page = layout.pages[p];
+        LayoutPage next = { (uint32_t)layout.blocks.size(), 0 };
+        if (p + 1 < layout.pages.size()) {
+            next = layout.pages[p + 1];
+        }
+        uint64_t lines = 0;
+        for (uint32_t b = page.block; b < next.block || (b == next.block && next.line > 0); b++) {
+            uint32_t from = b == page.block ? page.line : 0;
+            uint32_t to = b == next.block ? next.line : layout.blocks[b].lineCount;
+            lines += (b > page.block ? 1 : 0) + to - from;
+        }
+        if (lines > layout.linesPerPage) {
+            snprintf(what, sizeof(what), "page %zu holds %llu lines of %u", p, (unsigned long long)lines,
+                     layout.linesPerPage);
+            return what;
+        }
+    }
+    return "";
+}
+
+static bool sameLayout(const HymnLayout &a, const HymnLayout &b)
+{
+    if (a.lineStarts != b.lineStarts || a.blocks.size() != b.blocks.size() || a.pages.size() != b.pages.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.blocks.size(); i++) {
+        if (a.blocks[i].lineCount != b.blocks[i].lineCount) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.pages.size(); i++) {
+        if (a.pages[i].block != b.pages[i].block || a.pages[i].line != b.pages[i].line) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const float kSizes[] = { 15, 20, 28, 40 };
+static const float kWidths[] = { 320, 480, 768, 1024 };
+static const float kHeight = 440;
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: bench-layout CORPUS TABLE...\n");
+        return 2;
+    }
+    Corpus corpus;
+    std::string error;
+    if (!corpus.open(argv[1], &error)) {
+        fprintf(stderr, "bench-layout: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<PreparedHymn> hymns(corpus.count());
+    size_t blocks = 0;
+    for (uint32_t n = 1; n <= corpus.count(); n++) {
+        prepareHymn(corpus, n, &hymns[n - 1]);
+        blocks += hymns[n - 1].stanzas.size() + 1;
+    }
+    printf("%u hymns, %zu blocks\n", corpus.count(), blocks);
+
+    std::vector<AdvanceTable> tables(argc - 2);
+    std::vector<LayoutFaces> runs;
+    for (int t = 2; t < argc; t++) {
+        std::string text;
+        if (!readWholeFile(argv[t], &text, &error) || !parseAdvanceTable(Slice(text), &tables[t - 2], &error)) {
+            fprintf(stderr, "bench-layout: %s: %s\n", argv[t], error.c_str());
+            return 1;
+        }
+        LayoutFaces alone = { &tables[t - 2], NULL, NULL };
+        runs.push_back(alone);
+    }
+    if (tables.size() > 1) {
+        LayoutFaces mixed = { &tables[0], &tables[1], &tables[1] };
+        runs.push_back(mixed);
+    }
+
+    bool ok = true;
+    for (size_t r = 0; r < runs.size(); r++) {
+        const LayoutFaces &faces = runs[r];
+        if (faces.title) {
+            printf("\n%s, titles and refrains in %s\n", faces.text->font.c_str(), faces.title->font.c_str());
+        } else {
+            printf("\n%s\n", faces.text->font.c_str());
+        }
+        printf("%6s %6s  %10s %8s %8s\n", "size", "width", "lines", "pages", "ms");
+
+        // From scratch, kept for the relayouts below.
+        std::vector<std::vector<HymnLayout> > layouts(4 * 4, std::vector<HymnLayout>(hymns.size()));
+        for (int s = 0; s < 4; s++) {
+            for (int w = 0; w < 4; w++) {
+                LayoutParams params = { kSizes[s], kWidths[w], kHeight };
+                std::vector<HymnLayout> &all = layouts[s * 4 + w];
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (size_t h = 0; h < hymns.size(); h++) {
+                    layoutHymn(hymns[h], faces, params, NULL, &all[h]);
+                }
+                double millis = millisSince(start);
+                size_t lines = 0;
+                size_t pages = 0;
+                for (size_t h = 0; h < hymns.size(); h++) {
+                    lines += all[h].lineCount();
+                    pages += all[h].pages.size();
+                    std::string wrong = checkLayout(hymns[h], faces, params, all[h]);
+                    if (!wrong.empty()) {
+                        fprintf(stderr, "bench-layout: hymn %u at %g pt, %g wide: %s\n", hymns[h].number, kSizes[s],
+                                kWidths[w], wrong.c_str());
+                        ok = false;
+                        break;
+                    }
+                }
+                printf("%6g %6g  %10zu %8zu %8.1f\n", kSizes[s], kWidths[w], lines, pages, millis);
+            }
+        }
+
+        // Turning the screen (each width from the one before) and changing
+        // the size (each size from the one before, at each width).
+        const char *names[] = { "turn", "resize" };
+        for (int kind = 0; kind < 2; kind++) {
+            size_t reused = 0;
+            size_t total = 0;
+            double millis = 0;
+            for (int s = 0; s < 4; s++) {
+                for (int w = 0; w < 4; w++) {
+                    int from = kind == 0 ? s * 4 + (w + 3) % 4 : ((s + 3) % 4) * 4 + w;
+                    LayoutParams params = { kSizes[s], kWidths[w], kHeight };
+                    HymnLayout out;
+                    for (size_t h = 0; h < hymns.size(); h++) {
+                        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                        reused += layoutHymn(hymns[h], faces, params, &layouts[from][h], &out);
+                        millis += millisSince(start);
+                        total += out.blocks.size();
+                        if (!sameLayout(out, layouts[s * 4 + w][h])) {
+                            fprintf(stderr, "bench-layout: hymn %u at %g pt, %g wide: %s differs from scratch\n",
+                                    hymns[h].number, kSizes[s], kWidths[w], names[kind]);
+                            ok = false;
+                        }
+                    }
+                }
+            }
+            printf("%-6s relayout: %.1f ms per corpus, %.1f%% of stanzas kept\n", names[kind], millis / 16,
+                   100.0 * reused / std::max<size_t>(total, 1));
+        }
+
+        // Through the cache, flipping between two orientations.
+        LayoutCache cache(64 * 1024 * 1024);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int round = 0; round < 4; round++) {
+            LayoutParams params = { 20, round % 2 ? 480.0f : 320.0f, kHeight };
+            for (size_t h = 0; h < hymns.size(); h++) {
+                cache.layout(hymns[h], faces, params);
+            }
+        }
+        const LayoutCacheStats &stats = cache.stats();
+        printf("cache: %.1f ms for 4 passes, hits %llu, misses %llu, relayouts %llu, %zu KB for %u layouts\n",
+               millisSince(start), (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+               (unsigned long long)stats.relayouts, stats.bytes / 1024, stats.layouts);
+    }
+    if (!ok) {
+        return 1;
+    }
+    printf("\nevery layout checked\n");
+    return 0;
+}
@@ -0,0 +1,164 @@
+//
+//  bench-queue.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  What a book costs to index one hymn call at a time through an
+//  IndexingQueue, against one call with every hymn.
+//
+//      bench-queue [--direct] SOURCE_DIR
+//
+//  Every hymn of SOURCE_DIR goes into an empty SegmentedIndex, once with
+//  one apply of them all, and once with an addOrReplace call each on a
+//  queue; one hymn in ten is handed in twice, first without its last
+//  line, so the queue has something to coalesce. The times are up to
+//  when the hymns are searchable and the merges are done. With --direct
+//  the calls also go to the index straight, an apply each. The queue's
+//  counters are printed, and queries from the hymns must find the same
+//  hymns either way.
+//
+
+#include "IndexingQueue.h"
+#include "SearchIndex.h"
+#include "SegmentedIndex.h"
+#include "SourceBook.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: bench-queue [--direct] SOURCE_DIR\n");
+    return 2;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<uint32_t> numbers(const std::vector<SearchHit> &hits)
+{
+    std::vector<uint32_t> found;
+    for (size_t i = 0; i < hits.size(); i++) {
+        found.push_back(hits[i].number);
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    bool direct = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--direct") == 0) {
+            direct = true;
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 1) {
+        return usage();
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-queue: %s\n", error.c_str());
+        return 1;
+    }
+
+    // The calls in the order they are made.
+    std::vector<HymnChange> calls;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        HymnChange change;
+        change.number = n;
+        change.removed = false;
+        change.title = book.titles[n - 1];
+        if (n % 10 == 0) {
+            change.body = book.bodies[n - 1].substr(0, book.bodies[n - 1].rfind('\n'));
+            calls.push_back(change);
+        }
+        change.body = book.bodies[n - 1];
+        calls.push_back(change);
+    }
+
+    SegmentedIndex bulk;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bulk.apply(calls);
+    bulk.waitForMerges();
+    double bulkSeconds = secondsSince(start);
+    printf("%u hymns in %zu calls\n", book.count(), calls.size());
+    printf("bulk: %.3f s, %zu segments\n", bulkSeconds, bulk.segmentCount());
+
+    SegmentedIndex queued;
+    IndexingQueueStats stats;
+    double callSeconds;
+    double queuedSeconds;
+    {
+        IndexingQueue queue(&queued);
+        start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < calls.size(); c++) {
+            queue.enqueue(calls[c]);
+        }
+        callSeconds = secondsSince(start);
+        queue.waitUntilIndexingIsFinished();
+        queued.waitForMerges();
+        queuedSeconds = secondsSince(start);
+        stats = queue.stats();
+    }
+    printf("queued: %.3f s (%.2fx bulk), %zu segments; the calls returned in %.3f s\n", queuedSeconds,
+           queuedSeconds / bulkSeconds, queued.segmentCount(), callSeconds);
+    printf("  %llu queued, %llu coalesced, %llu committed in %llu batches, backlog up to %u\n",
+           (unsigned long long)stats.queued, (unsigned long long)stats.coalesced,
+           (unsigned long long)stats.committed, (unsigned long long)stats.batches, stats.maxBacklog);
+    printf("  commits %.3f s in all, %.1f ms the longest; a change waited %.1f ms at most\n", stats.commitSeconds,
+           stats.maxCommitSeconds * 1e3, stats.maxWaitSeconds * 1e3);
+
+    if (direct) {
+        SegmentedIndex straight;
+        start = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < calls.size(); c++) {
+            straight.apply(std::vector<HymnChange>(1, calls[c]));
+        }
+        straight.waitForMerges();
+        double directSeconds = secondsSince(start);
+        printf("direct: %.3f s (%.2fx bulk), %zu segments\n", directSeconds, directSeconds / bulkSeconds,
+               straight.segmentCount());
+    }
+
+    SearchOptions all;
+    all.limit = book.count();
+    std::vector<SearchHit> hits;
+    std::vector<SearchHit> expected;
+    bool ok = true;
+    uint32_t seed = 2013;
+    for (size_t q = 0; q < 100; q++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t number = (seed >> 8) % book.count() + 1;
+        Tokenizer tokenizer(Slice(book.bodies[number - 1]));
+        Token token;
+        std::string query;
+        for (int w = 0; w < 2 && tokenizer.next(&token); w++) {
+            query += token.text.str() + " ";
+        }
+        queued.search(Slice(query), all, &hits);
+        bulk.search(Slice(query), all, &expected);
+        if (numbers(hits) != numbers(expected)) {
+            fprintf(stderr, "bench-queue: \"%s\" finds %zu hymns queued, %zu in bulk\n", query.c_str(), hits.size(),
+                    expected.size());
+            ok = false;
+        }
+    }
+    printf("100 queries find the same hymns%s\n", ok ? "" : " (but see above)");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+//
+//  bench-relevance.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Relevance and latency regression check for the text search.
+//
+//      bench-relevance [--repeat N] [--stem] [--synonyms] [-v] SOURCE_DIR QUERY_FILE
+//
+//  Indexes the hymns in SOURCE_DIR the way canticos-build does, runs every
+//  query of QUERY_FILE (see Bench/relevance-queries.txt for the format) N
+//  times (default 200), and reports the mean reciprocal rank of the
+//  expected hymns, how often one came first and within the first ten, and
+//  the query latency. Exits with 1 when a floor set in QUERY_FILE is not
+//  met; --stem searches with stemming and --synonyms with the thesaurus
+//  of SOURCE_DIR/sinonimos.csv, as the app does; -v lists every query with
+//  the rank it got.
+//
+
+#include "SearchIndex.h"
+#include "SourceBook.h"
+#include "Thesaurus.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+struct Judgement {
+    std::vector<uint32_t> expected;
+    std::string query;
+};
+
+struct Floors {
+    double mrr;
+    double top10;
+    double p99Micros;
+};
+
+static bool parseFloor(const std::string &line, const char *name, double *value)
+{
+    std::string prefix = std::string("# ") + name + " ";
+    if (line.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    *value = atof(line.c_str() + prefix.size());
+    return true;
+}
+
+static bool loadJudgements(const char *path, std::vector<Judgement> *judgements, Floors *floors)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (parseFloor(line, "min-mrr", &floors->mrr) || parseFloor(line, "min-top10", &floors->top10)
+            || parseFloor(line, "max-p99-us", &floors->p99Micros) || line.empty() || line[0] == '#') {
+            continue;
+        }
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+            fprintf(stderr, "bench-relevance: no tab in \"%s\"\n", line.c_str());
+            return false;
+        }
+        Judgement j;
+        for (const char *p = line.c_str(); p < line.c_str() + tab;) {
+            j.expected.push_back((uint32_t)strtoul(p, (char **)&p, 10));
+            p += *p == ',';
+        }
+        j.query = line.substr(tab + 1);
+        judgements->push_back(j);
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+int main(int argc, char **argv)
+{
+    int repeat = 200;
+    bool verbose = false;
+    bool stemming = false;
+    bool synonyms = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--repeat") == 0 && arg + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--stem") == 0) {
+            stemming = true;
+        } else if (strcmp(argv[arg], "--synonyms") == 0) {
+            synonyms = true;
+        } else if (strcmp(argv[arg], "-v") == 0) {
+            verbose = true;
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: bench-relevance [--repeat N] [--stem] [--synonyms] [-v] SOURCE_DIR QUERY_FILE\n");
+        return 2;
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-relevance: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<Judgement> judgements;
+    Floors floors = { 0, 0, 0 };
+    if (!loadJudgements(argv[arg + 1], &judgements, &floors) || judgements.empty()) {
+        fprintf(stderr, "bench-relevance: cannot read queries from %s\n", argv[arg + 1]);
+        return 1;
+    }
+
+    IndexBuilder builder;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        builder.addDocument(n, Slice(book.titles[n - 1]), Slice(book.bodies[n - 1]));
+    }
+    std::string data;
+    builder.serialize(&data);
+    SearchIndex index;
+    if (!index.openMemory(data.data(), data.size(), &error)) {
+        fprintf(stderr, "bench-relevance: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::vector<SynonymLine> lines;
+    std::string thesaurusData;
+    Thesaurus thesaurus;
+    if (!parseSynonyms(Slice(book.synonyms), &lines, &error)) {
+        fprintf(stderr, "bench-relevance: sinonimos.csv: %s\n", error.c_str());
+        return 1;
+    }
+    buildThesaurus(index, lines, &thesaurusData);
+    if (!thesaurus.openMemory(thesaurusData.data(), thesaurusData.size(), &error)) {
+        fprintf(stderr, "bench-relevance: %s\n", error.c_str());
+        return 1;
+    }
+
+    SearchOptions options;
+    options.limit = 10;
+    options.stemming = stemming;
+    options.thesaurus = synonyms ? &thesaurus : NULL;
+    std::vector<SearchHit> hits;
+    std::vector<double> micros;
+    double reciprocalRanks = 0;
+    size_t first = 0;
+    size_t topTen = 0;
+    for (size_t q = 0; q < judgements.size(); q++) {
+        const Judgement &j = judgements[q];
+        for (int r = 0; r < repeat; r++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            index.search(Slice(j.query), options, &hits);
+            micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        size_t rank = 0;
+        for (size_t i = 0; i < hits.size() && rank == 0; i++) {
+            if (std::find(j.expected.begin(), j.expected.end(), hits[i].number) != j.expected.end()) {
+                rank = i + 1;
+            }
+        }
+        reciprocalRanks += rank ? 1.0 / rank : 0;
+        first += rank == 1;
+        topTen += rank != 0;
+        if (verbose || rank != 1) {
+            printf("%s %-45s rank %s%zu, first %u\n", rank == 1 ? "  " : (rank ? " ~" : "!!"), j.query.c_str(),
+                   rank ? "" : ">", rank ? rank : options.limit, hits.empty() ? 0 : hits[0].number);
+        }
+    }
+
+    double count = (double)judgements.size();
+    double mrr = reciprocalRanks / count;
+    double p99 = percentile(micros, 0.99);
+    printf("%zu queries: MRR %.3f, first %.1f%%, top 10 %.1f%%\n", judgements.size(), mrr, 100 * first / count,
+           100 * topTen / count);
+    printf("latency over %d runs each: p50 %.1f us, p99 %.1f us, max %.1f us\n", repeat, percentile(micros, 0.5), p99,
+           percentile(micros, 1.0));
+
+    int failed = 0;
+    if (mrr < floors.mrr) {
+        printf("FAIL: MRR %.3f is below %.3f\n", mrr, floors.mrr);
+        failed = 1;
+    }
+    if (topTen / count < floors.top10) {
+        printf("FAIL: top 10 %.3f is below %.3f\n", topTen / count, floors.top10);
+        failed = 1;
+    }
+    if (floors.p99Micros > 0 && p99 > floors.p99Micros) {
+        printf("FAIL: p99 %.1f us is above %.1f us\n", p99, floors.p99Micros);
+        failed = 1;
+    }
+    return failed;
+}
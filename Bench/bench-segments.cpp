@@ -0,0 +1,261 @@
+//
+//  bench-segments.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Latency of corrections to single hymns of a segmented index, and a
+//  check that its searches stay right while segments merge.
+//
+//      bench-segments [--updates N] [--seed S] SOURCE_DIR ARTIFACT_DIR
+//
+//  ARTIFACT_DIR is what canticos-build wrote for SOURCE_DIR. Its index is
+//  opened as a SegmentedIndex and N hymns picked at random (default 1000)
+//  are corrected one at a time: a line of each is swapped for a line of
+//  another hymn with a word no other hymn has. One in ten is removed
+//  instead, and one in ten is added past the end. Right after each change
+//  the word must find that hymn alone, and the hymn's word of its last
+//  correction must find nothing; a thread searches all the while, as the
+//  segments merge behind both. The p50, p99 and worst time of a change are
+//  printed.
+//
+//  Once the merges are done, queries from the hymns must find the same
+//  hymns as an index rebuilt from the corrected texts.
+//
+
+#include "SearchIndex.h"
+#include "SegmentedIndex.h"
+#include "SourceBook.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: bench-segments [--updates N] [--seed S] SOURCE_DIR ARTIFACT_DIR\n");
+    return 2;
+}
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+static void splitLines(const std::string &text, std::vector<std::string> *lines)
+{
+    lines->clear();
+    size_t start = 0;
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i == text.size() || text[i] == '\n') {
+            lines->push_back(text.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+}
+
+// A word that the tokenizer keeps whole and no hymn has.
+static std::string marker(size_t k)
+{
+    std::string word = "zqx";
+    for (; k > 0 || word.size() == 3; k /= 26) {
+        word.push_back((char)('a' + k % 26));
+    }
+    return word;
+}
+
+static std::vector<uint32_t> numbers(const std::vector<SearchHit> &hits)
+{
+    std::vector<uint32_t> found;
+    for (size_t i = 0; i < hits.size(); i++) {
+        found.push_back(hits[i].number);
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+int main(int argc, char **argv)
+{
+    size_t updates = 1000;
+    uint32_t seed = 2013;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (arg + 1 >= argc) {
+            return usage();
+        }
+        if (strcmp(argv[arg], "--updates") == 0) {
+            updates = (size_t)std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--seed") == 0) {
+            seed = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 2) {
+        return usage();
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-segments: %s\n", error.c_str());
+        return 1;
+    }
+    SegmentedIndex index;
+    if (!index.open((std::string(argv[arg + 1]) + "/livro.index").c_str(), &error)) {
+        fprintf(stderr, "bench-segments: %s\n", error.c_str());
+        return 1;
+    }
+    if (book.count() == 0) {
+        fprintf(stderr, "bench-segments: no hymns in %s\n", argv[arg]);
+        return 1;
+    }
+
+    // Searches all the while, with the words of the first hymn.
+    std::atomic<bool> done(false);
+    std::atomic<unsigned long> background(0);
+    std::string busyQuery = book.titles[0].substr(book.titles[0].find(' ') + 1);
+    std::thread searcher([&] {
+        SearchOptions options;
+        options.mode = SearchOptions::AnyWord;
+        std::vector<SearchHit> hits;
+        while (!done) {
+            index.search(Slice(busyQuery), options, &hits);
+            background++;
+        }
+    });
+
+    // Each correction starts from the hymn as it was, so a hymn has the
+    // word of its last correction only.
+    std::vector<std::string> originals = book.bodies;
+    std::vector<std::string> markers(book.count() + updates + 1);
+    std::vector<double> micros;
+    std::vector<std::string> lines;
+    std::vector<std::string> donor;
+    SearchOptions exact;
+    exact.limit = 10;
+    std::vector<SearchHit> hits;
+    bool ok = true;
+    size_t removed = 0;
+    size_t added = 0;
+    for (size_t k = 0; k < updates; k++) {
+        uint32_t kind = nextRandom(&seed) % 10;
+        uint32_t number = nextRandom(&seed) % book.count() + 1;
+        std::string word = marker(k);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (kind == 0 && !book.bodies[number - 1].empty()) {
+            index.removeHymn(number);
+            book.bodies[number - 1].clear();
+            removed++;
+        } else {
+            if (kind == 1) {
+                book.titles.push_back(book.titles[number - 1]);
+                book.bodies.push_back(book.bodies[number - 1]);
+                originals.push_back(originals[number - 1]);
+                number = book.count();
+                added++;
+            }
+            splitLines(originals[number - 1], &lines);
+            splitLines(originals[nextRandom(&seed) % book.count()], &donor);
+            std::string line = donor[nextRandom(&seed) % donor.size()] + " " + word;
+            if (lines.size() < 2) {
+                lines.push_back(line);    // the first line is the title's
+            } else {
+                lines[1 + nextRandom(&seed) % (lines.size() - 1)] = line;
+            }
+            std::string body;
+            for (size_t i = 0; i < lines.size(); i++) {
+                body += lines[i] + (i + 1 < lines.size() ? "\n" : "");
+            }
+            book.bodies[number - 1] = body;
+            start = std::chrono::steady_clock::now();
+            index.replaceHymn(number, Slice(book.titles[number - 1]), Slice(body));
+        }
+        micros.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+
+        std::string previous = markers[number];
+        markers[number] = book.bodies[number - 1].empty() ? std::string() : word;
+        if (!markers[number].empty()) {
+            index.search(Slice(word), exact, &hits);
+            if (hits.size() != 1 || hits[0].number != number) {
+                fprintf(stderr, "bench-segments: %s does not find hymn %u alone\n", word.c_str(), number);
+                ok = false;
+            }
+        }
+        if (!previous.empty()) {
+            index.search(Slice(previous), exact, &hits);
+            if (!hits.empty()) {
+                fprintf(stderr, "bench-segments: %s still finds hymn %u\n", previous.c_str(), hits[0].number);
+                ok = false;
+            }
+        }
+    }
+    done = true;
+    searcher.join();
+    printf("%zu changes (%zu removals, %zu additions) to %u hymns: p50 %.0f us, p99 %.0f us, worst %.0f us\n",
+           updates, removed, added, book.count(), percentile(micros, 0.5), percentile(micros, 0.99),
+           percentile(micros, 1.0));
+    printf("%lu searches alongside, %zu segments before the last merges\n", background.load(), index.segmentCount());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    index.waitForMerges();
+    printf("merges done %.0f ms later, %zu segments, %u hymns\n",
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+           index.segmentCount(), index.hymnCount());
+
+    IndexBuilder builder;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        if (!book.bodies[n - 1].empty()) {
+            builder.addDocument(n, Slice(book.titles[n - 1]), Slice(book.bodies[n - 1]));
+        }
+    }
+    std::string bytes;
+    builder.serialize(&bytes);
+    SearchIndex rebuilt;
+    if (!rebuilt.openMemory(bytes.data(), bytes.size(), &error)) {
+        fprintf(stderr, "bench-segments: %s\n", error.c_str());
+        return 1;
+    }
+    SearchOptions all;
+    all.limit = book.count();
+    std::vector<SearchHit> expected;
+    size_t checked = 0;
+    for (size_t q = 0; q < 200; q++) {
+        uint32_t number = nextRandom(&seed) % book.count() + 1;
+        Tokenizer tokenizer(Slice(book.bodies[number - 1]));
+        Token token;
+        std::string query;
+        for (int w = 0; w < 2 && tokenizer.next(&token); w++) {
+            query += token.text.str() + " ";
+        }
+        index.search(Slice(query), all, &hits);
+        rebuilt.search(Slice(query), all, &expected);
+        if (numbers(hits) != numbers(expected)) {
+            fprintf(stderr, "bench-segments: \"%s\" finds %zu hymns, %zu rebuilt\n", query.c_str(), hits.size(),
+                    expected.size());
+            ok = false;
+        }
+        checked++;
+    }
+    printf("%zu queries find the hymns of a rebuilt index%s\n", checked, ok ? "" : " (but see above)");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+//
+//  bench-spell.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Latency of trigram spelling correction on a large vocabulary.
+//
+//      bench-spell [--words N] [--queries Q] SOURCE_DIR
+//
+//  Indexes the words of the real hymns plus made-up Portuguese-looking
+//  words up to N distinct terms (default 1000000), builds the spelling
+//  index, then misspells Q (default 2000) random terms with one edit each
+//  (drop, insert, replace or swap letters) and reports the latency of
+//  candidate generation and of the whole correction, and how often the
+//  original word came back.
+//
+
+#include "SearchIndex.h"
+#include "SourceBook.h"
+#include "SpellIndex.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace canticos;
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static std::string madeUpWord(uint32_t *seed)
+{
+    static const char *const onsets[] = {
+        "", "b", "c", "d", "f", "g", "j", "l", "m", "n", "p", "r", "s", "t", "v",
+        "ch", "lh", "nh", "br", "cr", "dr", "gr", "pr", "tr", "pl", "cl",
+    };
+    static const char *const vowels[] = { "a", "e", "i", "o", "u", "ai", "ei", "ou", "ao" };
+    static const char *const codas[] = { "", "", "", "s", "r", "m", "l", "n" };
+    std::string word;
+    int syllables = 2 + (int)(nextRandom(seed) % 4);
+    for (int s = 0; s < syllables; s++) {
+        word += onsets[nextRandom(seed) % (sizeof(onsets) / sizeof(onsets[0]))];
+        word += vowels[nextRandom(seed) % (sizeof(vowels) / sizeof(vowels[0]))];
+        if (s == syllables - 1 || nextRandom(seed) % 4 == 0) {
+            word += codas[nextRandom(seed) % (sizeof(codas) / sizeof(codas[0]))];
+        }
+    }
+    return word;
+}
+
+static std::string misspell(const std::string &word, uint32_t *seed)
+{
+    std::string typo = word;
+    size_t at = nextRandom(seed) % typo.size();
+    char letter = (char)('a' + nextRandom(seed) % 26);
+    switch (nextRandom(seed) % 4) {
+    case 0:
+        typo.erase(at, 1);
+        break;
+    case 1:
+        typo.insert(typo.begin() + at, letter);
+        break;
+    case 2:
+        typo[at] = letter;
+        break;
+    default:
+        if (at + 1 < typo.size()) {
+            std::swap(typo[at], typo[at + 1]);
+        } else {
+            typo.erase(at, 1);
+        }
+        break;
+    }
+    return typo;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+static void report(const char *name, const std::vector<double> &micros)
+{
+    double total = 0;
+    for (size_t i = 0; i < micros.size(); i++) {
+        total += micros[i];
+    }
+    printf("%-12s mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name,
+           total / std::max<size_t>(micros.size(), 1), percentile(micros, 0.5), percentile(micros, 0.99),
+           percentile(micros, 1.0));
+}
+
+int main(int argc, char **argv)
+{
+    size_t wordCount = 1000000;
+    size_t queryCount = 2000;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "--words") == 0) {
+            wordCount = (size_t)atol(argv[arg + 1]);
+        } else if (strcmp(argv[arg], "--queries") == 0) {
+            queryCount = (size_t)atol(argv[arg + 1]);
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 1) {
+        fprintf(stderr, "usage: bench-spell [--words N] [--queries Q] SOURCE_DIR\n");
+        return 2;
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &book, &error)) {
+        fprintf(stderr, "bench-spell: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Distinct folded words: the book's, then made-up ones.
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> words;
+    for (uint32_t n = 0; n < book.count(); n++) {
+        Tokenizer tokenizer((Slice(book.bodies[n])));
+        Token token;
+        char term[kMaxTermBytes];
+        while (tokenizer.next(&token)) {
+            std::string word(term, normalizeTerm(token.text, term));
+            if (seen.insert(word).second) {
+                words.push_back(word);
+            }
+        }
+    }
+    uint32_t seed = 2013;
+    while (words.size() < wordCount) {
+        std::string word = madeUpWord(&seed);
+        if (seen.insert(word).second) {
+            words.push_back(word);
+        }
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    IndexBuilder builder;
+    const size_t perDocument = 1000;
+    for (size_t i = 0; i < words.size(); i += perDocument) {
+        // As a cN.txt: the first line is the numbered title, which the
+        // builder leaves to the title field.
+        std::string body = std::to_string(i / perDocument + 1) + " TITULO\n";
+        for (size_t j = i; j < std::min(words.size(), i + perDocument); j++) {
+            body += words[j];
+            body += ' ';
+        }
+        builder.addDocument((uint32_t)(i / perDocument + 1), Slice(""), Slice(body));
+    }
+    std::string indexData;
+    builder.serialize(&indexData);
+    SearchIndex index;
+    if (!index.openMemory(indexData.data(), indexData.size(), &error)) {
+        fprintf(stderr, "bench-spell: %s\n", error.c_str());
+        return 1;
+    }
+    std::chrono::steady_clock::time_point indexed = std::chrono::steady_clock::now();
+    std::string spellData;
+    buildSpellIndex(index, &spellData);
+    SpellIndex spell;
+    if (!spell.openMemory(spellData.data(), spellData.size(), &error)) {
+        fprintf(stderr, "bench-spell: %s\n", error.c_str());
+        return 1;
+    }
+    std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+    printf("%u terms: index %.2f s, spelling index %.2f s, %.1f MB\n", index.termCount(),
+           std::chrono::duration<double>(indexed - start).count(),
+           std::chrono::duration<double>(built - indexed).count(), spellData.size() / 1048576.0);
+
+    Speller speller(index, spell);
+    std::vector<uint32_t> slots;
+    std::vector<double> candidateMicros;
+    std::vector<double> correctMicros;
+    size_t first = 0;
+    size_t listed = 0;
+    size_t candidateTotal = 0;
+    SpellCorrection corrections[8];
+    for (size_t q = 0; q < queryCount; q++) {
+        const std::string &word = words[nextRandom(&seed) % words.size()];
+        if (word.size() < 3) {
+            continue;
+        }
+        std::string typo = misspell(word, &seed);
+
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        candidateTotal += speller.candidates(Slice(typo), &slots);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        size_t count = speller.correct(Slice(typo), corrections, 8);
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        candidateMicros.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+        correctMicros.push_back(std::chrono::duration<double, std::micro>(t2 - t1).count());
+
+        for (size_t i = 0; i < count; i++) {
+            if (index.termText(index.term(corrections[i].term)) == Slice(word)) {
+                first += i == 0;
+                listed++;
+            }
+        }
+    }
+
+    size_t runs = std::max<size_t>(candidateMicros.size(), 1);
+    report("candidates", candidateMicros);
+    report("correct", correctMicros);
+    printf("%zu misspellings, %.1f candidates each; original first %.1f%%, in top 8 %.1f%%\n",
+           candidateMicros.size(), (double)candidateTotal / runs, 100.0 * first / runs, 100.0 * listed / runs);
+    return 0;
+}
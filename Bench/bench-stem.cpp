@@ -0,0 +1,183 @@
+//
+//  bench-stem.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Throughput of the stemmer against a plain rule list.
+//
+//      bench-stem SOURCE_DIR [WORD...]
+//
+//  Stems the distinct words of the hymns with the compiled tries (stemTerm)
+//  and with the algorithm as the RSLP paper states it, every rule of a step
+//  tried in turn on a std::string, checks that both agree on every word,
+//  and reports the words stemmed per second by each. WORDs, if any, are
+//  printed with their stems.
+//
+
+#include "Fold.h"
+#include "SourceBook.h"
+#include "Stemmer.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+struct NaiveRule {
+    std::string suffix;
+    size_t minStem;
+    std::string replacement;
+    std::vector<std::string> exceptions;
+};
+
+static std::string folded(const std::string &text)
+{
+    std::string out(text.size(), '\0');
+    out.resize(foldUtf8(text.data(), text.size(), &out[0]));
+    return out;
+}
+
+static void addRule(std::vector<NaiveRule> *steps, StemStep step, const char *suffix, size_t minStem,
+                    const char *replacement, const char *exceptions)
+{
+    NaiveRule rule;
+    rule.suffix = folded(suffix);
+    rule.minStem = minStem;
+    rule.replacement = folded(replacement);
+    std::string list(exceptions);
+    for (size_t start = 0; start < list.size();) {
+        size_t end = std::min(list.find(' ', start), list.size());
+        if (end > start) {
+            rule.exceptions.push_back(folded(list.substr(start, end - start)));
+        }
+        start = end + 1;
+    }
+    steps[step].push_back(rule);
+}
+
+static bool endsWith(const std::string &word, const std::string &suffix)
+{
+    return word.size() >= suffix.size() && word.compare(word.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool applyNaive(const std::vector<NaiveRule> &rules, std::string *word)
+{
+    for (size_t i = 0; i < rules.size(); i++) {
+        const NaiveRule &rule = rules[i];
+        if (endsWith(*word, rule.suffix) && word->size() >= rule.suffix.size() + rule.minStem
+            && std::find(rule.exceptions.begin(), rule.exceptions.end(), *word) == rule.exceptions.end()) {
+            word->replace(word->size() - rule.suffix.size(), rule.suffix.size(), rule.replacement);
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string stemNaive(const std::vector<NaiveRule> *steps, std::string word)
+{
+    if (endsWith(word, "s")) {
+        applyNaive(steps[kStemPlural], &word);
+    }
+    if (endsWith(word, "a")) {
+        applyNaive(steps[kStemFeminine], &word);
+    }
+    applyNaive(steps[kStemAugmentative], &word);
+    applyNaive(steps[kStemAdverb], &word);
+    if (!applyNaive(steps[kStemNoun], &word) && !applyNaive(steps[kStemVerb], &word)) {
+        applyNaive(steps[kStemVowel], &word);
+    }
+    return word;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: bench-stem SOURCE_DIR [WORD...]\n");
+        return 2;
+    }
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(argv[1], &book, &error)) {
+        fprintf(stderr, "bench-stem: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::vector<NaiveRule> steps[kStemStepCount];
+#define STEM_RULE(step, suffix, minStem, replacement, exceptions) \
+    addRule(steps, kStem##step, suffix, minStem, replacement, exceptions);
+#include "StemmerRules.inc"
+
+    std::vector<std::string> words;
+    char term[kMaxTermBytes];
+    for (uint32_t n = 0; n < book.count(); n++) {
+        const std::string *texts[2] = { &book.titles[n], &book.bodies[n] };
+        for (size_t t = 0; t < 2; t++) {
+            Tokenizer tokenizer((Slice(*texts[t])));
+            Token token;
+            while (tokenizer.next(&token)) {
+                words.push_back(std::string(term, normalizeTerm(token.text, term)));
+            }
+        }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+
+    size_t stems = 0;
+    {
+        std::vector<std::string> seen;
+        for (size_t i = 0; i < words.size(); i++) {
+            std::string naive = stemNaive(steps, words[i]);
+            size_t size = stemTerm(words[i].data(), words[i].size(), term);
+            if (naive != std::string(term, size)) {
+                fprintf(stderr, "bench-stem: \"%s\" stems to \"%.*s\", the rule list says \"%s\"\n",
+                        words[i].c_str(), (int)size, term, naive.c_str());
+                return 1;
+            }
+            seen.push_back(naive);
+        }
+        std::sort(seen.begin(), seen.end());
+        stems = (size_t)(std::unique(seen.begin(), seen.end()) - seen.begin());
+    }
+
+    // Each over the whole vocabulary until 200 ms have passed.
+    size_t checksum = 0;
+    double rates[2];
+    for (int method = 0; method < 2; method++) {
+        size_t count = 0;
+        double seconds = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        do {
+            for (size_t i = 0; i < words.size(); i++) {
+                if (method == 0) {
+                    checksum += stemTerm(words[i].data(), words[i].size(), term);
+                } else {
+                    checksum += stemNaive(steps, words[i]).size();
+                }
+            }
+            count += words.size();
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        } while (seconds < 0.2);
+        rates[method] = count / seconds;
+    }
+    if (checksum == 0 && !words.empty()) {
+        fprintf(stderr, "bench-stem: unexpected empty stems\n");
+    }
+
+    printf("%zu words, %zu stems; all agree with the rule list\n", words.size(), stems);
+    printf("tries      %8.2f M words/s  %6.1f ns/word\n", rates[0] / 1e6, 1e9 / rates[0]);
+    printf("rule list  %8.2f M words/s  %6.1f ns/word  (%.1fx slower)\n", rates[1] / 1e6, 1e9 / rates[1],
+           rates[0] / rates[1]);
+
+    for (int i = 2; i < argc; i++) {
+        size_t length = normalizeTerm(Slice(argv[i]), term);
+        length = stemTerm(term, length, term);
+        printf("%-20s %.*s\n", argv[i], (int)length, term);
+    }
+    return 0;
+}
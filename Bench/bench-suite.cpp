@@ -0,0 +1,425 @@
+//
+//  bench-suite.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  The paths the app takes, timed headless, as JSON for comparing builds.
+//
+//      bench-suite [--label TEXT] [--queries FILE] [--count N] [--passes N] [--runs N] ARTIFACT_DIR > run.json
+//
+//  ARTIFACT_DIR is what canticos-build wrote. Each stage reports the
+//  latency of one operation in microseconds (count, mean, min, p50, p99,
+//  p999, max), and the stages over text their throughput too:
+//
+//    corpus_open       open and close livro.corpus (Cantico, on launch)
+//    index_list_load   open livro.titles and read every row (Indice)
+//    index_open        open livro.index (FirstViewController)
+//    hymn_fetch        prepare a hymn for display, from anywhere in the book
+//    tokenize          every word of a hymn, title and body
+//    index_build       the whole index, from the corpus, one thread
+//    query             a ranked search, all words required
+//    highlight         the ranges of a query in its best hit, title and body
+//
+//  Queries are N runs of one to three words (default 2000) taken from the
+//  hymns with a fixed seed, so the same corpus gives the same queries;
+//  --queries reads them from FILE instead, one a line, the text after a tab
+//  if there is one (Bench/relevance-queries.txt works), # for comments.
+//  Each is searched --passes times (default 5). The cheap stages run
+//  --runs times (default 1000), the index build a tenth as often, once
+//  to three times. --label is copied into the output, for the commit:
+//
+//      bench-suite --label "$(git rev-parse --short HEAD)" out > run.json
+//
+//  The JSON carries the compiler, its flags as the binary sees them, the
+//  CPU and the kernel; a summary goes to stderr.
+//
+
+#include "Corpus.h"
+#include "HymnCache.h"
+#include "MappedFile.h"
+#include "SearchIndex.h"
+#include "TitleTable.h"
+#include "Tokenizer.h"
+
+#include <sys/utsname.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace canticos;
+
+static void usage()
+{
+    fprintf(stderr, "usage: bench-suite [--label TEXT] [--queries FILE] [--count N] [--passes N] [--runs N] ARTIFACT_DIR\n");
+}
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double microsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+// The samples of one stage, and the bytes they went through if any.
+struct Stage {
+    std::string name;
+    std::vector<double> micros;
+    uint64_t bytes;
+
+    explicit Stage(const char *n) : name(n), bytes(0) {}
+};
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+static std::string jsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string cpuModel()
+{
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 10, "model name") == 0 || line.compare(0, 9, "Processor") == 0) {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                return line.substr(line.find_first_not_of(" \t", colon + 1));
+            }
+        }
+    }
+    return "unknown";
+}
+
+static std::string compiler()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#else
+    return "unknown";
+#endif
+}
+
+// Queries from a file, as described above.
+static bool readQueries(const char *path, std::vector<std::string> *queries, std::string *error)
+{
+    std::string text;
+    if (!readWholeFile(path, &text, error)) {
+        return false;
+    }
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            line = line.substr(tab + 1);
+        }
+        if (!line.empty() && line[0] != '#') {
+            queries->push_back(line);
+        }
+    }
+    return true;
+}
+
+// One to three words in a row from hymns picked at random.
+static void makeQueries(const Corpus &corpus, size_t count, std::vector<std::string> *queries)
+{
+    uint32_t seed = 2013;
+    std::vector<Token> words;
+    while (queries->size() < count && corpus.count()) {
+        uint32_t number = nextRandom(&seed) % corpus.count() + 1;
+        words.clear();
+        Tokenizer tokenizer(corpus.body(number));
+        Token token;
+        while (tokenizer.next(&token)) {
+            words.push_back(token);
+        }
+        if (words.empty()) {
+            continue;
+        }
+        size_t first = nextRandom(&seed) % words.size();
+        size_t last = std::min(words.size() - 1, first + nextRandom(&seed) % 3);
+        queries->push_back(std::string(words[first].text.begin(), words[last].text.end()));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string label;
+    const char *queryFile = NULL;
+    size_t queryCount = 2000;
+    int passes = 5;
+    int runs = 1000;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (arg + 1 >= argc) {
+            usage();
+            return 2;
+        }
+        if (strcmp(argv[arg], "--label") == 0) {
+            label = argv[++arg];
+        } else if (strcmp(argv[arg], "--queries") == 0) {
+            queryFile = argv[++arg];
+        } else if (strcmp(argv[arg], "--count") == 0) {
+            queryCount = (size_t)atol(argv[++arg]);
+        } else if (strcmp(argv[arg], "--passes") == 0) {
+            passes = std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--runs") == 0) {
+            runs = std::max(1, atoi(argv[++arg]));
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (arg + 1 != argc) {
+        usage();
+        return 2;
+    }
+    std::string dir = argv[arg];
+    std::string corpusPath = dir + "/livro.corpus";
+    std::string titlesPath = dir + "/livro.titles";
+    std::string indexPath = dir + "/livro.index";
+    std::string error;
+
+    std::vector<Stage> stages;
+    stages.push_back(Stage("corpus_open"));
+    for (int r = 0; r < runs; r++) {
+        Clock::time_point start = Clock::now();
+        Corpus corpus;
+        if (!corpus.open(corpusPath.c_str(), &error)) {
+            fprintf(stderr, "bench-suite: %s\n", error.c_str());
+            return 1;
+        }
+        corpus.close();
+        stages.back().micros.push_back(microsSince(start));
+    }
+
+    stages.push_back(Stage("index_list_load"));
+    for (int r = 0; r < runs; r++) {
+        Clock::time_point start = Clock::now();
+        TitleTable titles;
+        if (!titles.open(titlesPath.c_str(), &error)) {
+            fprintf(stderr, "bench-suite: %s\n", error.c_str());
+            return 1;
+        }
+        uint64_t bytes = 0;
+        for (uint32_t n = 1; n <= titles.count(); n++) {
+            bytes += titles.title(n).size;
+        }
+        titles.close();
+        stages.back().micros.push_back(microsSince(start));
+        stages.back().bytes += bytes;
+    }
+
+    stages.push_back(Stage("index_open"));
+    for (int r = 0; r < runs; r++) {
+        Clock::time_point start = Clock::now();
+        SearchIndex index;
+        if (!index.open(indexPath.c_str(), &error)) {
+            fprintf(stderr, "bench-suite: %s\n", error.c_str());
+            return 1;
+        }
+        index.close();
+        stages.back().micros.push_back(microsSince(start));
+    }
+
+    Corpus corpus;
+    SearchIndex index;
+    if (!corpus.open(corpusPath.c_str(), &error) || !index.open(indexPath.c_str(), &error)) {
+        fprintf(stderr, "bench-suite: %s\n", error.c_str());
+        return 1;
+    }
+    if (corpus.count() == 0) {
+        fprintf(stderr, "bench-suite: the corpus is empty\n");
+        return 1;
+    }
+    uint64_t corpusBytes = 0;
+    for (uint32_t n = 1; n <= corpus.count(); n++) {
+        corpusBytes += corpus.title(n).size + corpus.body(n).size;
+    }
+
+    stages.push_back(Stage("hymn_fetch"));
+    uint32_t seed = 1;
+    PreparedHymn hymn;
+    for (int r = 0; r < runs; r++) {
+        uint32_t number = nextRandom(&seed) % corpus.count() + 1;
+        Clock::time_point start = Clock::now();
+        prepareHymn(corpus, number, &hymn);
+        stages.back().micros.push_back(microsSince(start));
+        stages.back().bytes += corpus.body(number).size;
+    }
+
+    stages.push_back(Stage("tokenize"));
+    uint64_t words = 0;
+    for (uint32_t n = 1; n <= corpus.count(); n++) {
+        Clock::time_point start = Clock::now();
+        Token token;
+        Tokenizer title(corpus.title(n));
+        while (title.next(&token)) {
+            words++;
+        }
+        Tokenizer body(corpus.body(n));
+        while (body.next(&token)) {
+            words++;
+        }
+        stages.back().micros.push_back(microsSince(start));
+    }
+    stages.back().bytes = corpusBytes;
+
+    stages.push_back(Stage("index_build"));
+    size_t indexSize = 0;
+    for (int r = 0; r < std::max(1, runs / 10) && r < 3; r++) {
+        Clock::time_point start = Clock::now();
+        IndexBuilder builder;
+        for (uint32_t n = 1; n <= corpus.count(); n++) {
+            builder.addDocument(n, corpus.title(n), corpus.body(n));
+        }
+        std::string bytes;
+        builder.serialize(&bytes);
+        stages.back().micros.push_back(microsSince(start));
+        stages.back().bytes += corpusBytes;
+        indexSize = bytes.size();
+    }
+
+    std::vector<std::string> queries;
+    if (queryFile) {
+        if (!readQueries(queryFile, &queries, &error)) {
+            fprintf(stderr, "bench-suite: %s\n", error.c_str());
+            return 1;
+        }
+    } else {
+        makeQueries(corpus, queryCount, &queries);
+    }
+    stages.push_back(Stage("query"));
+    stages.push_back(Stage("highlight"));
+    Stage &query = stages[stages.size() - 2];
+    Stage &highlight = stages.back();
+    SearchOptions options;
+    std::vector<SearchHit> hits;
+    static const size_t kMaxRanges = 256;
+    TextRange ranges[kMaxRanges];
+    uint64_t hitCount = 0;
+    for (int p = 0; p < passes; p++) {
+        for (size_t q = 0; q < queries.size(); q++) {
+            Clock::time_point start = Clock::now();
+            index.search(Slice(queries[q]), options, &hits);
+            query.micros.push_back(microsSince(start));
+            hitCount += hits.size();
+            if (hits.empty()) {
+                continue;
+            }
+            start = Clock::now();
+            index.highlight(Slice(queries[q]), hits[0].number, kHighlightTitle, ranges, kMaxRanges);
+            index.highlight(Slice(queries[q]), hits[0].number, kHighlightBody, ranges, kMaxRanges);
+            highlight.micros.push_back(microsSince(start));
+            highlight.bytes += corpus.title(hits[0].number).size + corpus.body(hits[0].number).size;
+        }
+    }
+
+    // The report.
+    time_t now = time(NULL);
+    char timestamp[32];
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    struct utsname host;
+    std::string kernel = "unknown";
+    if (uname(&host) == 0) {
+        kernel = std::string(host.sysname) + " " + host.release + " " + host.machine;
+    }
+#ifdef __OPTIMIZE__
+    bool optimized = true;
+#else
+    bool optimized = false;
+#endif
+#ifdef NDEBUG
+    bool assertions = false;
+#else
+    bool assertions = true;
+#endif
+
+    printf("{\n");
+    printf("  \"label\": %s,\n", jsonString(label).c_str());
+    printf("  \"timestamp\": \"%s\",\n", timestamp);
+    printf("  \"build\": {\"compiler\": %s, \"cplusplus\": %ld, \"optimized\": %s, \"assertions\": %s, "
+           "\"pointer_bits\": %zu},\n",
+           jsonString(compiler()).c_str(), (long)__cplusplus, optimized ? "true" : "false",
+           assertions ? "true" : "false", sizeof(void *) * 8);
+    printf("  \"host\": {\"cpu\": %s, \"cores\": %u, \"kernel\": %s},\n", jsonString(cpuModel()).c_str(),
+           std::thread::hardware_concurrency(), jsonString(kernel).c_str());
+    printf("  \"corpus\": {\"dir\": %s, \"hymns\": %u, \"bytes\": %llu, \"words\": %llu, \"index_bytes\": %zu},\n",
+           jsonString(dir).c_str(), corpus.count(), (unsigned long long)corpusBytes, (unsigned long long)words,
+           indexSize);
+    printf("  \"queries\": {\"source\": %s, \"count\": %zu, \"passes\": %d, \"hits\": %llu},\n",
+           jsonString(queryFile ? queryFile : "generated").c_str(), queries.size(), passes,
+           (unsigned long long)hitCount);
+    printf("  \"stages\": [\n");
+    fprintf(stderr, "%-16s %8s %10s %10s %10s %10s %10s %8s\n", "", "count", "mean us", "p50 us", "p99 us",
+            "p999 us", "max us", "MB/s");
+    for (size_t s = 0; s < stages.size(); s++) {
+        std::vector<double> sorted = stages[s].micros;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            total += sorted[i];
+        }
+        double mean = sorted.empty() ? 0 : total / sorted.size();
+        double mbps = total > 0 ? stages[s].bytes / total : 0;
+        printf("    {\"name\": \"%s\", \"unit\": \"us\", \"count\": %zu, \"mean\": %.3f, \"min\": %.3f, "
+               "\"p50\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f",
+               stages[s].name.c_str(), sorted.size(), mean, sorted.empty() ? 0 : sorted.front(),
+               percentile(sorted, 0.5), percentile(sorted, 0.99), percentile(sorted, 0.999),
+               sorted.empty() ? 0 : sorted.back());
+        if (stages[s].bytes) {
+            printf(", \"bytes\": %llu, \"mb_per_s\": %.1f", (unsigned long long)stages[s].bytes, mbps);
+        }
+        printf("}%s\n", s + 1 < stages.size() ? "," : "");
+        fprintf(stderr, "%-16s %8zu %10.2f %10.2f %10.2f %10.2f %10.2f %8.1f\n", stages[s].name.c_str(),
+                sorted.size(), mean, percentile(sorted, 0.5), percentile(sorted, 0.99), percentile(sorted, 0.999),
+                sorted.empty() ? 0 : sorted.back(), mbps);
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+//
+//  bench-titles.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Load time and memory of the Indice rows, with the title table against
+//  one string per title.
+//
+//      bench-titles [--visible N] SOURCE_DIR [COUNT...]
+//
+//  For each COUNT (default 1000 10000 50000 100000) makes a hymnal of that
+//  many titles from the lines of SOURCE_DIR/indice.txt, writes it as
+//  livro.titles and as indice.txt into a temporary directory, and loads it
+//  both ways: TitleTable::open and the first N rows (default 20, a screen)
+//  read, and the whole file read and split into one std::string per line,
+//  as the tab used to. Reports the time and how much anonymous memory the
+//  process gained (Linux only), which for the table should not depend on
+//  COUNT. The mapped pages are left out: they are clean page cache the
+//  kernel maps ahead in large runs and takes back under pressure.
+//
+
+#include "MappedFile.h"
+#include "SourceBook.h"
+#include "TitleTable.h"
+
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+// Resident memory not backed by a file, in KB, or 0 where /proc is not
+// there.
+static long anonymousKB()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    long size = 0;
+    long resident = 0;
+    long shared = 0;
+    if (fscanf(f, "%ld %ld %ld", &size, &resident, &shared) != 3) {
+        resident = shared = 0;
+    }
+    fclose(f);
+    return (resident - shared) * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double microsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t visible = 20;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "--visible") == 0) {
+        visible = (uint32_t)atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: bench-titles [--visible N] SOURCE_DIR [COUNT...]\n");
+        return 2;
+    }
+    SourceBook source;
+    std::string error;
+    if (!loadSourceBook(argv[arg], &source, &error)) {
+        fprintf(stderr, "bench-titles: %s\n", error.c_str());
+        return 1;
+    }
+    std::vector<uint32_t> counts;
+    for (arg++; arg < argc; arg++) {
+        counts.push_back((uint32_t)atoi(argv[arg]));
+    }
+    if (counts.empty()) {
+        uint32_t defaults[] = { 1000, 10000, 50000, 100000 };
+        counts.assign(defaults, defaults + 4);
+    }
+
+    char dir[] = "/tmp/bench-titles-XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "bench-titles: cannot make a temporary directory\n");
+        return 1;
+    }
+    std::string tablePath = std::string(dir) + "/livro.titles";
+    std::string linesPath = std::string(dir) + "/indice.txt";
+
+    printf("%8s  %12s %10s  %12s %10s\n", "titles", "table us", "table KB", "lines us", "lines KB");
+    for (size_t c = 0; c < counts.size(); c++) {
+        uint32_t count = counts[c];
+        SourceBook book;
+        std::string lines;
+        book.titles.resize(count);
+        book.bodies.resize(count);
+        for (uint32_t n = 1; n <= count; n++) {
+            char number[16];
+            snprintf(number, sizeof(number), "%u. ", n);
+            Slice title = titleWithoutNumber(Slice(source.titles[(n - 1) % source.titles.size()]));
+            book.titles[n - 1] = number + title.str();
+            lines += book.titles[n - 1] + "\n";
+        }
+        std::string table;
+        buildTitleTable(book, &table);
+        if (!writeWholeFile(tablePath, table, &error) || !writeWholeFile(linesPath, lines, &error)) {
+            fprintf(stderr, "bench-titles: %s\n", error.c_str());
+            return 1;
+        }
+        book = SourceBook();
+        lines = std::string();
+
+        size_t checksum = 0;
+        long before = anonymousKB();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        TitleTable titles;
+        if (!titles.open(tablePath.c_str(), &error)) {
+            fprintf(stderr, "bench-titles: %s\n", error.c_str());
+            return 1;
+        }
+        for (uint32_t n = 1; n <= visible && n <= titles.count(); n++) {
+            checksum += titles.title(n).size;
+        }
+        double tableMicros = microsSince(start);
+        long tableKB = anonymousKB() - before;
+        titles.close();
+
+        before = anonymousKB();
+        start = std::chrono::steady_clock::now();
+        std::vector<std::string> rows;
+        {
+            std::string text;
+            if (!readWholeFile(linesPath, &text, &error)) {
+                fprintf(stderr, "bench-titles: %s\n", error.c_str());
+                return 1;
+            }
+            for (size_t s = 0; s < text.size();) {
+                size_t end = text.find('\n', s);
+                if (end == std::string::npos) {
+                    end = text.size();
+                }
+                if (end > s) {
+                    rows.push_back(text.substr(s, end - s));
+                }
+                s = end + 1;
+            }
+        }
+        for (uint32_t n = 1; n <= visible && n <= rows.size(); n++) {
+            checksum -= rows[n - 1].size();
+        }
+        double linesMicros = microsSince(start);
+        long linesKB = anonymousKB() - before;
+        if (checksum != 0) {
+            fprintf(stderr, "bench-titles: the two loads disagree\n");
+            return 1;
+        }
+
+        printf("%8u  %12.1f %10ld  %12.1f %10ld\n", count, tableMicros, tableKB, linesMicros, linesKB);
+    }
+    unlink(tablePath.c_str());
+    unlink(linesPath.c_str());
+    rmdir(dir);
+    return 0;
+}
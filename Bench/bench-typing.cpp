@@ -0,0 +1,247 @@
+//
+//  bench-typing.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Searches at every keystroke of fast typing, through a SearchExecutor
+//  that supersedes stale requests and through one that runs them all.
+//
+//      bench-typing [--sessions N] [--gap MS] [--seed S] [--any] ARTIFACT_DIR
+//
+//  ARTIFACT_DIR is what canticos-build wrote. N sessions (default 20) are
+//  replayed, each the first two to four words of a title picked at random,
+//  typed a character at a time with gaps of half to one and a half times
+//  MS milliseconds (default 40), seeded. Every keystroke submits a search
+//  of the text so far as the app makes it, stemmed and with the book's
+//  synonyms (with --any, for any of its words, ranked: far more work),
+//  and the session waits until the last one is delivered before
+//  the next starts. Both executors get the same replay; the time spent on
+//  searches whose results were thrown away, and how much of it came after
+//  a newer keystroke had made them stale, the process CPU time (Linux),
+//  and how long after the last keystroke the result came are printed for
+//  each. The last result of a session must be what the text finds.
+//
+
+#include "SearchExecutor.h"
+#include "SearchIndex.h"
+#include "Thesaurus.h"
+#include "TitleTable.h"
+#include "Tokenizer.h"
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: bench-typing [--sessions N] [--gap MS] [--seed S] [--any] ARTIFACT_DIR\n");
+    return 2;
+}
+
+static uint32_t nextRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static double cpuSeconds()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+}
+
+struct Keystroke {
+    std::string text;       // the search bar after it
+    double at;              // milliseconds into the session
+};
+
+struct Result {
+    uint64_t generation;
+    std::vector<SearchHit> hits;
+    std::chrono::steady_clock::time_point at;
+};
+
+static bool sameHits(const std::vector<SearchHit> &a, const std::vector<SearchHit> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].number != b[i].number || a[i].score != b[i].score) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Replays every session through an executor; false when a session's last
+// result is not what its text finds.
+static bool replay(const std::vector<std::vector<Keystroke> > &sessions, const SearchIndex &index,
+                   const SearchOptions &options, bool supersede)
+{
+    SearchExecutor executor(supersede);
+    std::mutex lock;
+    Result delivered;
+    std::vector<double> waits;
+    bool ok = true;
+    double cpuStart = cpuSeconds();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (size_t s = 0; s < sessions.size(); s++) {
+        std::chrono::steady_clock::time_point sessionStart = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point lastKey = sessionStart;
+        for (size_t k = 0; k < sessions[s].size(); k++) {
+            lastKey = sessionStart + std::chrono::microseconds((long long)(sessions[s][k].at * 1e3));
+            std::this_thread::sleep_until(lastKey);
+            std::string text = sessions[s][k].text;
+            std::shared_ptr<std::vector<SearchHit> > hits = std::make_shared<std::vector<SearchHit> >();
+            executor.submit(
+                [&index, &options, text, hits](const SearchGeneration &generation) {
+                    SearchOptions request = options;
+                    request.generation = generation;
+                    index.search(Slice(text), request, hits.get());
+                },
+                [&lock, &delivered, hits](uint64_t generation) {
+                    std::lock_guard<std::mutex> guard(lock);
+                    delivered.generation = generation;
+                    delivered.hits.swap(*hits);
+                    delivered.at = std::chrono::steady_clock::now();
+                });
+        }
+        executor.waitUntilIdle();
+
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<SearchHit> expected;
+        index.search(Slice(sessions[s].back().text), options, &expected);
+        if (!executor.isLatest(delivered.generation) || !sameHits(delivered.hits, expected)) {
+            fprintf(stderr, "bench-typing: \"%s\" was not delivered as searched\n", sessions[s].back().text.c_str());
+            ok = false;
+        }
+        waits.push_back(std::chrono::duration<double, std::milli>(delivered.at - lastKey).count());
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = cpuSeconds() - cpuStart;
+    SearchExecutorStats stats = executor.stats();
+    printf("%s: %llu searches, %llu delivered, %llu skipped, %llu aborted, %llu discarded\n",
+           supersede ? "supersede" : "run all", (unsigned long long)stats.submitted,
+           (unsigned long long)stats.delivered, (unsigned long long)stats.skipped, (unsigned long long)stats.aborted,
+           (unsigned long long)stats.discarded);
+    printf("  %.3f s searching for nothing, %.3f s for what was delivered; %.3f s CPU in %.3f s\n",
+           stats.wastedSeconds, stats.deliveredSeconds, cpu, seconds);
+    uint64_t stale = stats.aborted + stats.discarded;
+    printf("  %.3f s of it after a newer keystroke, %.3f ms a stale search\n", stats.overrunSeconds,
+           stale ? stats.overrunSeconds * 1e3 / stale : 0.0);
+    printf("  last keystroke to its result: p50 %.1f ms, p90 %.1f ms, worst %.1f ms\n", percentile(waits, 0.5),
+           percentile(waits, 0.9), percentile(waits, 1.0));
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    size_t sessionCount = 20;
+    double gap = 40;
+    uint32_t seed = 2013;
+    bool any = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--any") == 0) {
+            any = true;
+            continue;
+        }
+        if (arg + 1 >= argc) {
+            return usage();
+        }
+        if (strcmp(argv[arg], "--sessions") == 0) {
+            sessionCount = (size_t)std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--gap") == 0) {
+            gap = std::max(0.0, atof(argv[++arg]));
+        } else if (strcmp(argv[arg], "--seed") == 0) {
+            seed = (uint32_t)strtoul(argv[++arg], NULL, 10);
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 1) {
+        return usage();
+    }
+
+    std::string dir = argv[arg];
+    SearchIndex index;
+    TitleTable titles;
+    Thesaurus thesaurus;
+    std::string error;
+    if (!index.open((dir + "/livro.index").c_str(), &error)
+        || !titles.open((dir + "/livro.titles").c_str(), &error)) {
+        fprintf(stderr, "bench-typing: %s\n", error.c_str());
+        return 1;
+    }
+    if (titles.count() == 0) {
+        fprintf(stderr, "bench-typing: no hymns in %s\n", dir.c_str());
+        return 1;
+    }
+    SearchOptions options;
+    options.stemming = true;
+    options.mode = any ? SearchOptions::AnyWord : SearchOptions::AllWords;
+    if (thesaurus.open((dir + "/livro.thesaurus").c_str())) {
+        options.thesaurus = &thesaurus;
+    }
+
+    std::vector<std::vector<Keystroke> > sessions(sessionCount);
+    for (size_t s = 0; s < sessionCount; s++) {
+        uint32_t number = nextRandom(&seed) % titles.count() + 1;
+        std::string title;
+        Tokenizer tokenizer(titles.title(number));
+        Token token;
+        size_t words = 2 + nextRandom(&seed) % 3;
+        for (size_t w = 0; w < words && tokenizer.next(&token);) {
+            if (!token.text.empty() && (token.text[0] < '0' || token.text[0] > '9')) {
+                title += (w++ ? " " : "") + token.text.str();
+            }
+        }
+        double at = 0;
+        for (size_t c = 1; c <= title.size(); c++) {
+            if (c < title.size() && (title[c] & 0xC0) == 0x80) {
+                continue;   // the rest of a UTF-8 character comes with its first byte
+            }
+            Keystroke key = { title.substr(0, c), at };
+            sessions[s].push_back(key);
+            at += gap * (0.5 + (nextRandom(&seed) % 1001) / 1000.0);
+        }
+        if (sessions[s].empty()) {
+            Keystroke key = { std::string(), 0 };
+            sessions[s].push_back(key);
+        }
+    }
+    size_t keystrokes = 0;
+    for (size_t s = 0; s < sessionCount; s++) {
+        keystrokes += sessions[s].size();
+    }
+    printf("%zu sessions, %zu keystrokes, %.1f ms apart on average, over %u hymns\n", sessionCount, keystrokes, gap,
+           index.docCount());
+
+    bool ok = replay(sessions, index, options, false);
+    ok = replay(sessions, index, options, true) && ok;
+    return ok ? 0 : 1;
+}
@@ -11,5 +11,7 @@
 @interface Cantico : UIViewController
 @property (weak, nonatomic) IBOutlet UITextView *canticoText;
 @property int canticoNum;
+// Texto procurado, cujas palavras ficam realçadas; nil se nenhum.
+@property (copy, nonatomic) NSString *procura;
 
 @end
@@ -7,13 +7,22 @@
 //
 
 #import "Cantico.h"
+#import "Livro.h"
 
-@interface Cantico ()
+@interface Cantico () {
+    // as fontes do texto, do titulo e dos refroes, para as paginas partirem
+    // as linhas como o texto mostrado
+    UIFont *fonteDoTexto;
+    UIFont *fonteNegrita;
+    UIFont *fonteItalica;
+    // o caracter no topo do texto antes de rodar o ecra
+    NSUInteger noTopo;
+}
 
 @end
 
 @implementation Cantico
-@synthesize canticoText, canticoNum;
+@synthesize canticoText, canticoNum, procura;
 
 - (id)initWithNibName:(NSString *)nibNameOrNil bundle:(NSBundle *)nibBundleOrNil
 {
@@ -31,40 +40,86 @@
     
     //canticoNum = 20;
     
-    NSLog(@"Numero do cantico: %i", canticoNum);
-    
-    // lê ficheiro do texto seleccionado
-    NSString* path = [[NSBundle mainBundle] pathForResource:[@"c" stringByAppendingString: [NSString stringWithFormat:@"%d", canticoNum]]
-                                                     ofType:@"txt"];
-    NSString* content = [NSString stringWithContentsOfFile:path
-                                                  encoding:NSUTF8StringEncoding
-                                                     error:NULL];
-    int i = 0;
-    //    NSString* texto = @"";
-    //    for (NSString *line in [content componentsSeparatedByString:@"\n"]) {
-    //        if (i == 0){
-    self.title= [NSString stringWithFormat:@"Cântico %d", canticoNum];
-    //            self.title = line;
-    CGRect frame = CGRectMake(0, 0, [self.title sizeWithFont:[UIFont boldSystemFontOfSize:10.0]].width, 44);
+    // o numero no livro; dos outros livros, com o nome do livro
+    int livro = [[Livro livro] livroDoCantico:canticoNum];
+    int numero = [[Livro livro] numeroNoLivro:canticoNum];
+    if (livro == 0) {
+        self.title = [NSString stringWithFormat:@"Cântico %d", numero];
+    } else {
+        self.title = [NSString stringWithFormat:@"%@ %d", [[Livro livro] nomeDoLivro:livro], numero];
+    }
+    // da largura do titulo na fonte do label, que o nome do livro alonga
+    UIFont *fonteDoTitulo = [UIFont fontWithName:@"Arial-BoldMT" size:18];
+    CGRect frame = CGRectMake(0, 0, [self.title sizeWithFont:fonteDoTitulo].width, 44);
     UILabel *label = [[UILabel alloc] initWithFrame:frame];
     label.backgroundColor = [UIColor clearColor];
     label.textColor = [UIColor whiteColor];
-    label.font = [UIFont fontWithName:@"Arial-BoldMT" size:18];
+    label.font = fonteDoTitulo;
     self.navigationItem.titleView = label;
     label.text = self.title;
-    i++;
-    //        }
-    //        if (i == 1){
-    //            i++;
-    //        }
-    //        else{
-    //            texto = [texto stringByAppendingString:line];
-    //            texto = [texto stringByAppendingString:@"\n"];
-    //            i++;
-    //        }
-    //}
-    
-    canticoText.text = content;
+
+    // o texto ja preparado pelo livro, com o titulo e as estrofes marcados
+    NSDictionary *preparado = [[Livro livro] canticoPreparado:canticoNum];
+    NSString *texto = preparado != nil ? [preparado objectForKey:@"texto"] : @"";
+    // depois do attributedText, canticoText.font ja e a do titulo
+    fonteDoTexto = canticoText.font;
+    fonteNegrita = [UIFont boldSystemFontOfSize:fonteDoTexto.pointSize];
+    fonteItalica = [UIFont italicSystemFontOfSize:fonteDoTexto.pointSize];
+    NSMutableAttributedString *formatado =
+        [[NSMutableAttributedString alloc] initWithString:texto attributes:@{ NSFontAttributeName: fonteDoTexto }];
+    if (preparado != nil) {
+        [formatado addAttribute:NSFontAttributeName value:fonteNegrita
+                          range:[[preparado objectForKey:@"titulo"] rangeValue]];
+        // os refroes em italico
+        for (NSDictionary *estrofe in [preparado objectForKey:@"estrofes"]) {
+            if ([[estrofe objectForKey:@"refrao"] boolValue]) {
+                [formatado addAttribute:NSFontAttributeName value:fonteItalica
+                                  range:[[estrofe objectForKey:@"intervalo"] rangeValue]];
+            }
+        }
+    }
+
+    if (procura.length > 0) {
+        for (NSValue *realce in [[Livro livro] realcesDoCantico:canticoNum paraTexto:procura]) {
+            NSRange r = [realce rangeValue];
+            if (NSMaxRange(r) <= texto.length) {
+                [formatado addAttribute:NSBackgroundColorAttributeName value:[UIColor yellowColor] range:r];
+            }
+        }
+    }
+    canticoText.attributedText = formatado;
+}
+
+- (void)willRotateToInterfaceOrientation:(UIInterfaceOrientation)orientacao duration:(NSTimeInterval)duracao
+{
+    [super willRotateToInterfaceOrientation:orientacao duration:duracao];
+    UITextPosition *topo = [canticoText closestPositionToPoint:CGPointMake(0, canticoText.contentOffset.y)];
+    noTopo = topo != nil ? [canticoText offsetFromPosition:canticoText.beginningOfDocument toPosition:topo] : 0;
+}
+
+- (void)didRotateFromInterfaceOrientation:(UIInterfaceOrientation)anterior
+{
+    [super didRotateFromInterfaceOrientation:anterior];
+    // a pagina, na nova largura, com o que estava no topo passa a comecar
+    // no topo; o UITextView deixa 8 pontos de cada lado
+    CGSize caixa = canticoText.bounds.size;
+    NSArray *paginas = [[Livro livro] paginasDoCantico:canticoNum fonte:fonteDoTexto.fontName
+                                         fonteDoTitulo:fonteNegrita.fontName fonteDosRefroes:fonteItalica.fontName
+                                               tamanho:fonteDoTexto.pointSize
+                                               largura:caixa.width - 16 altura:caixa.height - 16];
+    for (NSValue *pagina in paginas) {
+        NSRange r = [pagina rangeValue];
+        if (NSMaxRange(r) <= noTopo) {
+            continue;
+        }
+        UITextPosition *inicio = [canticoText positionFromPosition:canticoText.beginningOfDocument offset:r.location];
+        if (inicio != nil) {
+            CGFloat y = [canticoText caretRectForPosition:inicio].origin.y;
+            y = MAX(0, MIN(y, canticoText.contentSize.height - caixa.height));
+            [canticoText setContentOffset:CGPointMake(0, y) animated:NO];
+        }
+        break;
+    }
 }
 
 - (void)didReceiveMemoryWarning
@@ -0,0 +1,204 @@
+//
+//  Catalog.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Catalog.h"
+#include "MappedFile.h"
+#include "Tokenizer.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+
+namespace canticos {
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool fail(std::string *error, uint32_t lineNumber, const std::string &why)
+{
+    if (error) {
+        char where[32];
+        snprintf(where, sizeof(where), "line %u: ", lineNumber);
+        *error = where + why;
+    }
+    return false;
+}
+
+bool parseCatalog(Slice text, std::vector<CatalogBook> *books, std::string *error)
+{
+    books->clear();
+    uint32_t lineNumber = 0;
+    for (size_t start = 0; start < text.size;) {
+        size_t end = start;
+        while (end < text.size && text.data[end] != '\n') {
+            end++;
+        }
+        Slice line(text.data + start, end - start);
+        lineNumber++;
+        start = end + 1;
+        while (line.size > 0 && isBlank(line.data[line.size - 1])) {
+            line.size--;
+        }
+        if (line.empty() || line.data[0] == '#') {
+            continue;
+        }
+
+        size_t k = 0;
+        while (k < line.size && ((line.data[k] >= 'a' && line.data[k] <= 'z') || isDigit(line.data[k]))) {
+            k++;
+        }
+        if (k == 0 || (k < line.size && !isBlank(line.data[k]))) {
+            return fail(error, lineNumber, "a book key is lower case letters and digits");
+        }
+        CatalogBook book;
+        book.key.assign(line.data, k);
+        while (k < line.size && isBlank(line.data[k])) {
+            k++;
+        }
+        book.name = k < line.size ? std::string(line.data + k, line.size - k) : book.key;
+        for (size_t b = 0; b < books->size(); b++) {
+            if ((*books)[b].key == book.key) {
+                return fail(error, lineNumber, book.key + " is listed twice");
+            }
+        }
+        if (books->size() == kMaxCatalogBooks) {
+            return fail(error, lineNumber, "too many books");
+        }
+        books->push_back(book);
+    }
+    if (books->empty()) {
+        if (error) {
+            *error = "no books";
+        }
+        return false;
+    }
+    return true;
+}
+
+bool loadCatalog(const std::string &dir, std::vector<CatalogBook> *books, std::string *error)
+{
+    std::string path = dir + "/" + kCatalogFileName;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        CatalogBook book = { kMainBookKey, kMainBookKey };
+        books->assign(1, book);
+        return true;
+    }
+    std::string text;
+    if (!readWholeFile(path, &text, error)) {
+        return false;
+    }
+    if (!parseCatalog(Slice(text), books, error)) {
+        if (error) {
+            *error = path + ": " + *error;
+        }
+        return false;
+    }
+    return true;
+}
+
+std::string catalogSourceDir(const std::string &dir, const std::vector<CatalogBook> &books, size_t book)
+{
+    return book == 0 ? dir : dir + "/" + books[book].key;
+}
+
+static bool startsWith(Slice text, Slice prefix)
+{
+    return prefix.size <= text.size && memcmp(text.data, prefix.data, prefix.size) == 0;
+}
+
+// Whether the folded word starts the book's key or a word of its name.
+static bool namesBook(Slice word, const CatalogBook &book)
+{
+    if (startsWith(Slice(book.key), word)) {
+        return true;
+    }
+    Tokenizer tokenizer((Slice(book.name)));
+    Token token;
+    while (tokenizer.next(&token)) {
+        char term[kMaxTermBytes];
+        if (startsWith(Slice(term, normalizeTerm(token.text, term)), word)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseHymnReference(Slice text, const std::vector<CatalogBook> &books, HymnRef *ref)
+{
+    const char *p = text.begin();
+    const char *end = text.end();
+    while (p < end && isBlank(*p)) {
+        p++;
+    }
+    while (end > p && isBlank(end[-1])) {
+        end--;
+    }
+
+    // The book's word runs up to the number, with or without a blank.
+    const char *digits = p;
+    while (digits < end && !isDigit(*digits)) {
+        digits++;
+    }
+    const char *wordEnd = digits;
+    while (wordEnd > p && isBlank(wordEnd[-1])) {
+        wordEnd--;
+    }
+    uint32_t book = 0;
+    if (wordEnd > p) {
+        for (const char *c = p; c < wordEnd; c++) {
+            if (isBlank(*c)) {
+                return false;
+            }
+        }
+        char word[kMaxTermBytes];
+        Slice folded(word, normalizeTerm(Slice(p, wordEnd - p), word));
+        if (folded.empty()) {
+            return false;
+        }
+        size_t matches = 0;
+        for (size_t b = 0; b < books.size(); b++) {
+            if (Slice(books[b].key) == folded) {
+                matches = 1;
+                book = (uint32_t)b;
+                break;
+            }
+            if (namesBook(folded, books[b])) {
+                matches++;
+                book = (uint32_t)b;
+            }
+        }
+        if (matches != 1) {
+            return false;
+        }
+    }
+
+    if (digits == end || end - digits > 8) {
+        return false;
+    }
+    uint32_t number = 0;
+    for (const char *d = digits; d < end; d++) {
+        if (!isDigit(*d)) {
+            return false;
+        }
+        number = number * 10 + (uint32_t)(*d - '0');
+    }
+    if (number == 0 || number > kHymnRefNumberMask || book >= books.size()) {
+        return false;
+    }
+    ref->book = book;
+    ref->number = number;
+    return true;
+}
+
+}
@@ -0,0 +1,79 @@
+//
+//  Catalog.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Catalog__
+#define __LivroDeCanticos__Catalog__
+
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// The hymnals the app carries, listed in livros.txt, one per line:
+//
+//   KEY Name of the book
+//
+// KEY, lower case ASCII letters and digits, names the book's artifacts
+// (KEY.corpus, KEY.index, ...) and qualifies its numbers ("jovens 12").
+// The first book is the main one: its source is the catalog's directory
+// itself, the others' are subdirectories named by their keys, and its
+// numbers need no qualifying. Blank lines and lines starting with # are
+// skipped. Without livros.txt there is one book, "livro".
+static const char *const kCatalogFileName = "livros.txt";
+static const char *const kMainBookKey = "livro";
+
+// Books a catalog may hold, so that a hymn reference packs into an int.
+static const size_t kMaxCatalogBooks = 127;
+
+struct CatalogBook {
+    std::string key;
+    std::string name;   // the key when the line gives none
+};
+
+bool parseCatalog(Slice text, std::vector<CatalogBook> *books, std::string *error = NULL);
+
+// The books of dir/livros.txt, or the main book alone when there is none.
+bool loadCatalog(const std::string &dir, std::vector<CatalogBook> *books, std::string *error = NULL);
+
+// Source directory of a book of the catalog in dir.
+std::string catalogSourceDir(const std::string &dir, const std::vector<CatalogBook> &books, size_t book);
+
+// A hymn of the catalog: the book's place in it, and the hymn's number in
+// the book. Packed, the book goes in the top bits, so the numbers of the
+// main book are what they always were.
+struct HymnRef {
+    uint32_t book;
+    uint32_t number;
+};
+
+static const uint32_t kHymnRefBookShift = 24;
+static const uint32_t kHymnRefNumberMask = (1u << kHymnRefBookShift) - 1;
+
+inline uint32_t packHymnRef(HymnRef ref)
+{
+    return ref.book << kHymnRefBookShift | (ref.number & kHymnRefNumberMask);
+}
+
+inline HymnRef unpackHymnRef(uint32_t packed)
+{
+    HymnRef ref = { packed >> kHymnRefBookShift, packed & kHymnRefNumberMask };
+    return ref;
+}
+
+// Reads a number typed to open a hymn: "12" is hymn 12 of the main book;
+// "jovens 12", "jovens12" or "jov 12" is hymn 12 of the book whose key, or
+// a word of whose name, starts with the word typed, accents and case
+// aside. False when the text is not a number, or the word names no book
+// or more than one. Whether the book has the number is left to the caller.
+bool parseHymnReference(Slice text, const std::vector<CatalogBook> &books, HymnRef *ref);
+
+}
+
+#endif /* defined(__LivroDeCanticos__Catalog__) */
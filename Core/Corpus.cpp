@@ -0,0 +1,158 @@
+//
+//  Corpus.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Corpus.h"
+#include "SourceBook.h"
+
+#include <cstring>
+#include <vector>
+
+namespace canticos {
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+void packCorpus(const SourceBook &book, std::string *out)
+{
+    uint32_t count = book.count();
+
+    CorpusHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kCorpusMagic, sizeof(header.magic));
+    header.version = kCorpusVersion;
+    header.hymnCount = count;
+    header.entriesOffset = sizeof(CorpusHeader);
+
+    std::string titles;
+    std::string bodies;
+    std::string entries(count * sizeof(CorpusEntry), '\0');
+    std::vector<StanzaSpan> stanzas;
+    HymnStructure structure;
+    for (uint32_t i = 0; i < count; i++) {
+        parseHymn(Slice(book.bodies[i]), &structure);
+        CorpusEntry e;
+        memset(&e, 0, sizeof(e));
+        e.titleOffset = (uint32_t)titles.size();
+        e.titleSize = (uint32_t)book.titles[i].size();
+        e.bodyOffset = bodies.size();
+        e.bodySize = (uint32_t)book.bodies[i].size();
+        e.titleLineOffset = structure.titleOffset;
+        e.titleLineSize = structure.titleSize;
+        e.firstStanza = (uint32_t)stanzas.size();
+        e.stanzaCount = (uint32_t)structure.stanzas.size();
+        stanzas.insert(stanzas.end(), structure.stanzas.begin(), structure.stanzas.end());
+        titles += book.titles[i];
+        bodies += book.bodies[i];
+        memcpy(&entries[i * sizeof(CorpusEntry)], &e, sizeof(e));
+    }
+
+    out->assign(sizeof(CorpusHeader), '\0');
+    *out += entries;
+    padTo8(out);
+    header.stanzasOffset = out->size();
+    header.stanzaCount = stanzas.size();
+    out->append((const char *)stanzas.data(), stanzas.size() * sizeof(StanzaSpan));
+    padTo8(out);
+    header.titlesOffset = out->size();
+    header.titlesSize = titles.size();
+    *out += titles;
+    padTo8(out);
+    header.bodiesOffset = out->size();
+    header.bodiesSize = bodies.size();
+    *out += bodies;
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+Corpus::Corpus() : _header(NULL), _entries(NULL), _stanzas(NULL), _titles(NULL), _bodies(NULL)
+{
+}
+
+bool Corpus::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt corpus: ") + why;
+    }
+    return false;
+}
+
+bool Corpus::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(CorpusHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const CorpusHeader *h = (const CorpusHeader *)data;
+    if (memcmp(h->magic, kCorpusMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kCorpusVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size
+        || h->entriesOffset + (uint64_t)h->hymnCount * sizeof(CorpusEntry) > size
+        || h->stanzasOffset + h->stanzaCount * sizeof(StanzaSpan) > size
+        || h->titlesOffset + h->titlesSize > size
+        || h->bodiesOffset + h->bodiesSize > size) {
+        return corrupt(error, "section out of bounds");
+    }
+
+    const CorpusEntry *entries = (const CorpusEntry *)(data + h->entriesOffset);
+    for (uint32_t i = 0; i < h->hymnCount; i++) {
+        if ((uint64_t)entries[i].titleOffset + entries[i].titleSize > h->titlesSize
+            || entries[i].bodyOffset + entries[i].bodySize > h->bodiesSize
+            || (uint64_t)entries[i].titleLineOffset + entries[i].titleLineSize > entries[i].bodySize
+            || (uint64_t)entries[i].firstStanza + entries[i].stanzaCount > h->stanzaCount) {
+            return corrupt(error, "entry out of bounds");
+        }
+    }
+    const StanzaSpan *stanzas = (const StanzaSpan *)(data + h->stanzasOffset);
+    for (uint32_t i = 0; i < h->hymnCount; i++) {
+        for (uint32_t k = 0; k < entries[i].stanzaCount; k++) {
+            const StanzaSpan &span = stanzas[entries[i].firstStanza + k];
+            if ((uint64_t)span.offset + span.size > entries[i].bodySize) {
+                return corrupt(error, "stanza out of bounds");
+            }
+        }
+    }
+
+    _header = h;
+    _entries = entries;
+    _stanzas = stanzas;
+    _titles = data + h->titlesOffset;
+    _bodies = data + h->bodiesOffset;
+    return true;
+}
+
+void Corpus::close()
+{
+    _header = NULL;
+    _entries = NULL;
+    _stanzas = NULL;
+    _titles = NULL;
+    _bodies = NULL;
+    _file.close();
+}
+
+}
@@ -0,0 +1,139 @@
+//
+//  Corpus.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Corpus__
+#define __LivroDeCanticos__Corpus__
+
+#include "MappedFile.h"
+#include "Slice.h"
+#include "Stanza.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace canticos {
+
+struct SourceBook;
+
+// Packed corpus file, all integers little endian:
+//
+//   CorpusHeader
+//   CorpusEntry[hymnCount]      indexed by hymn number - 1
+//   StanzaSpan[stanzaCount]     per hymn, its stanzas in order (Stanza.h)
+//   title pool                  indice.txt lines, UTF-8, no separators
+//   body pool                   cN.txt contents, byte for byte
+//
+// Sections start on 8 byte boundaries so the tables can be used in place.
+// The stanzas are parsed when packing, so nothing is parsed at runtime.
+static const char kCorpusMagic[8] = { 'L', 'D', 'C', 'C', 'O', 'R', 'P', 'S' };
+static const uint32_t kCorpusVersion = 3;
+
+struct CorpusHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t hymnCount;
+    uint64_t entriesOffset;
+    uint64_t stanzasOffset;
+    uint64_t stanzaCount;
+    uint64_t titlesOffset;
+    uint64_t titlesSize;
+    uint64_t bodiesOffset;
+    uint64_t bodiesSize;
+    uint64_t fileSize;
+};
+
+struct CorpusEntry {
+    uint64_t bodyOffset;    // relative to the body pool
+    uint32_t bodySize;
+    uint32_t titleOffset;   // relative to the title pool
+    uint32_t titleSize;
+    uint32_t titleLineOffset;   // the numbered title line, relative to the body
+    uint32_t titleLineSize;
+    uint32_t firstStanza;       // into the stanza table
+    uint32_t stanzaCount;
+    uint32_t reserved;
+};
+
+// Builds the packed representation of a source book.
+void packCorpus(const SourceBook &book, std::string *out);
+
+// Read-only view over a packed corpus. Lookups are a table access; the
+// returned slices point into the mapping and stay valid while the Corpus
+// is open.
+class Corpus {
+public:
+    Corpus();
+
+    bool open(const char *path, std::string *error = NULL);
+    // Same as open() but over bytes the caller keeps alive.
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t count() const { return _header ? _header->hymnCount : 0; }
+    bool contains(uint32_t number) const { return number >= 1 && number <= count(); }
+
+    // Numbers are 1-based, as in the book. Out of range gives an empty slice.
+    Slice body(uint32_t number) const
+    {
+        if (!contains(number)) {
+            return Slice();
+        }
+        const CorpusEntry &e = _entries[number - 1];
+        return Slice(_bodies + e.bodyOffset, e.bodySize);
+    }
+    Slice title(uint32_t number) const
+    {
+        if (!contains(number)) {
+            return Slice();
+        }
+        const CorpusEntry &e = _entries[number - 1];
+        return Slice(_titles + e.titleOffset, e.titleSize);
+    }
+    // The title line the text itself starts with.
+    Slice titleLine(uint32_t number) const
+    {
+        if (!contains(number)) {
+            return Slice();
+        }
+        const CorpusEntry &e = _entries[number - 1];
+        return Slice(_bodies + e.bodyOffset + e.titleLineOffset, e.titleLineSize);
+    }
+
+    uint32_t stanzaCount(uint32_t number) const { return contains(number) ? _entries[number - 1].stanzaCount : 0; }
+    // Stanza index (0-based) of a hymn; out of range gives an empty stanza.
+    Stanza stanza(uint32_t number, uint32_t index) const
+    {
+        Stanza s = { Slice(), 0, 0, 0, false, false };
+        if (index < stanzaCount(number)) {
+            const CorpusEntry &e = _entries[number - 1];
+            const StanzaSpan &span = _stanzas[e.firstStanza + index];
+            s.text = Slice(_bodies + e.bodyOffset + span.offset, span.size);
+            s.utf16Offset = span.utf16Offset;
+            s.utf16Size = span.utf16Size;
+            s.lineCount = span.lineCount;
+            s.refrain = (span.flags & kStanzaRefrain) != 0;
+            s.repeat = (span.flags & kStanzaRepeat) != 0;
+        }
+        return s;
+    }
+
+private:
+    Corpus(const Corpus &) = delete;
+    Corpus &operator=(const Corpus &) = delete;
+
+    MappedFile _file;
+    const CorpusHeader *_header;
+    const CorpusEntry *_entries;
+    const StanzaSpan *_stanzas;
+    const char *_titles;
+    const char *_bodies;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__Corpus__) */
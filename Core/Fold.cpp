@@ -0,0 +1,210 @@
+//
+//  Fold.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Fold.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CANTICOS_FOLD_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CANTICOS_FOLD_NEON 1
+#endif
+
+namespace canticos {
+
+// Folded form of U+00C0 to U+017F, one or two ASCII letters. { 0, 0 } keeps
+// the character as it is (× and ÷).
+static const char kFoldLatin[0x180 - 0xC0][2] = {
+    { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 'e' }, { 'c', 0 },   // U+00C0 ÀÁÂÃÄÅÆÇ
+    { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 },   // U+00C8 ÈÉÊËÌÍÎÏ
+    { 'd', 0 }, { 'n', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 0, 0 },   // U+00D0 ÐÑÒÓÔÕÖ×
+    { 'o', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'y', 0 }, { 't', 'h' }, { 's', 's' },   // U+00D8 ØÙÚÛÜÝÞß
+    { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 'e' }, { 'c', 0 },   // U+00E0 àáâãäåæç
+    { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 },   // U+00E8 èéêëìíîï
+    { 'd', 0 }, { 'n', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 0, 0 },   // U+00F0 ðñòóôõö÷
+    { 'o', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'y', 0 }, { 't', 'h' }, { 'y', 0 },   // U+00F8 øùúûüýþÿ
+    { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'c', 0 }, { 'c', 0 },   // U+0100 ĀāĂăĄąĆć
+    { 'c', 0 }, { 'c', 0 }, { 'c', 0 }, { 'c', 0 }, { 'c', 0 }, { 'c', 0 }, { 'd', 0 }, { 'd', 0 },   // U+0108 ĈĉĊċČčĎď
+    { 'd', 0 }, { 'd', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 },   // U+0110 ĐđĒēĔĕĖė
+    { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'g', 0 }, { 'g', 0 }, { 'g', 0 }, { 'g', 0 },   // U+0118 ĘęĚěĜĝĞğ
+    { 'g', 0 }, { 'g', 0 }, { 'g', 0 }, { 'g', 0 }, { 'h', 0 }, { 'h', 0 }, { 'h', 0 }, { 'h', 0 },   // U+0120 ĠġĢģĤĥĦħ
+    { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 },   // U+0128 ĨĩĪīĬĭĮį
+    { 'i', 0 }, { 'i', 0 }, { 'i', 'j' }, { 'i', 'j' }, { 'j', 0 }, { 'j', 0 }, { 'k', 0 }, { 'k', 0 },   // U+0130 İıĲĳĴĵĶķ
+    { 'k', 0 }, { 'l', 0 }, { 'l', 0 }, { 'l', 0 }, { 'l', 0 }, { 'l', 0 }, { 'l', 0 }, { 'l', 0 },   // U+0138 ĸĹĺĻļĽľĿ
+    { 'l', 0 }, { 'l', 0 }, { 'l', 0 }, { 'n', 0 }, { 'n', 0 }, { 'n', 0 }, { 'n', 0 }, { 'n', 0 },   // U+0140 ŀŁłŃńŅņŇ
+    { 'n', 0 }, { 'n', 0 }, { 'n', 0 }, { 'n', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 },   // U+0148 ňŉŊŋŌōŎŏ
+    { 'o', 0 }, { 'o', 0 }, { 'o', 'e' }, { 'o', 'e' }, { 'r', 0 }, { 'r', 0 }, { 'r', 0 }, { 'r', 0 },   // U+0150 ŐőŒœŔŕŖŗ
+    { 'r', 0 }, { 'r', 0 }, { 's', 0 }, { 's', 0 }, { 's', 0 }, { 's', 0 }, { 's', 0 }, { 's', 0 },   // U+0158 ŘřŚśŜŝŞş
+    { 's', 0 }, { 's', 0 }, { 't', 0 }, { 't', 0 }, { 't', 0 }, { 't', 0 }, { 't', 0 }, { 't', 0 },   // U+0160 ŠšŢţŤťŦŧ
+    { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 },   // U+0168 ŨũŪūŬŭŮů
+    { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { 'w', 0 }, { 'w', 0 }, { 'y', 0 }, { 'y', 0 },   // U+0170 ŰűŲųŴŵŶŷ
+    { 'y', 0 }, { 'z', 0 }, { 'z', 0 }, { 'z', 0 }, { 'z', 0 }, { 'z', 0 }, { 'z', 0 }, { 's', 0 },   // U+0178 ŸŹźŻżŽžſ
+};
+
+// Folds the code point starting at in[0]; returns bytes consumed and sets
+// *written to the bytes stored at out.
+static inline size_t foldOne(const uint8_t *in, const uint8_t *end, uint8_t *out, size_t *written)
+{
+    uint8_t b = in[0];
+    if (b < 0x80) {
+        out[0] = (b >= 'A' && b <= 'Z') ? (uint8_t)(b + 32) : b;
+        *written = 1;
+        return 1;
+    }
+
+    // U+00C0..U+017F are lead bytes C3, C4 and C5.
+    if (b >= 0xC3 && b <= 0xC5 && in + 1 < end && (in[1] & 0xC0) == 0x80) {
+        uint32_t cp = ((uint32_t)(b & 0x1F) << 6) | (in[1] & 0x3F);
+        if (cp >= 0xC0) {
+            const char *folded = kFoldLatin[cp - 0xC0];
+            if (folded[0]) {
+                out[0] = (uint8_t)folded[0];
+                if (folded[1]) {
+                    out[1] = (uint8_t)folded[1];
+                    *written = 2;
+                } else {
+                    *written = 1;
+                }
+                return 2;
+            }
+        }
+    }
+
+    // Anything else is copied, a whole sequence at a time when it is valid.
+    size_t length = 1;
+    if (b >= 0xC2 && b <= 0xDF) {
+        length = 2;
+    } else if (b >= 0xE0 && b <= 0xEF) {
+        length = 3;
+    } else if (b >= 0xF0 && b <= 0xF4) {
+        length = 4;
+    }
+    if ((size_t)(end - in) < length) {
+        length = 1;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if ((in[i] & 0xC0) != 0x80) {
+            length = 1;
+            break;
+        }
+    }
+    memmove(out, in, length);
+    *written = length;
+    return length;
+}
+
+size_t foldUtf8Scalar(const char *in, size_t size, char *out)
+{
+    const uint8_t *p = (const uint8_t *)in;
+    const uint8_t *end = p + size;
+    uint8_t *o = (uint8_t *)out;
+    while (p < end) {
+        size_t written;
+        p += foldOne(p, end, o, &written);
+        o += written;
+    }
+    return (size_t)(o - (uint8_t *)out);
+}
+
+#if CANTICOS_FOLD_SSE2
+
+size_t foldUtf8(const char *in, size_t size, char *out)
+{
+    const uint8_t *p = (const uint8_t *)in;
+    const uint8_t *end = p + size;
+    uint8_t *o = (uint8_t *)out;
+
+    const __m128i before = _mm_set1_epi8('A' - 1);
+    const __m128i after = _mm_set1_epi8('Z' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        // ASCII bytes are positive as signed chars, so the signed compares
+        // only ever flag real capitals.
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before), _mm_cmplt_epi8(v, after));
+        __m128i lowered = _mm_or_si128(v, _mm_and_si128(upper, caseBit));
+        int nonAscii = _mm_movemask_epi8(v);
+        // Output never runs ahead of input, so a full 16 byte store at o
+        // stays inside the caller's buffer.
+        _mm_storeu_si128((__m128i *)o, lowered);
+        if (nonAscii == 0) {
+            p += 16;
+            o += 16;
+            continue;
+        }
+        int ascii = __builtin_ctz((unsigned)nonAscii);
+        p += ascii;
+        o += ascii;
+        size_t written;
+        p += foldOne(p, end, o, &written);
+        o += written;
+    }
+    while (p < end) {
+        size_t written;
+        p += foldOne(p, end, o, &written);
+        o += written;
+    }
+    return (size_t)(o - (uint8_t *)out);
+}
+
+#elif CANTICOS_FOLD_NEON
+
+size_t foldUtf8(const char *in, size_t size, char *out)
+{
+    const uint8_t *p = (const uint8_t *)in;
+    const uint8_t *end = p + size;
+    uint8_t *o = (uint8_t *)out;
+
+    const uint8x16_t first = vdupq_n_u8('A');
+    const uint8x16_t last = vdupq_n_u8('Z');
+    const uint8x16_t caseBit = vdupq_n_u8(0x20);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+
+    while (end - p >= 16) {
+        uint8x16_t v = vld1q_u8(p);
+        uint8x16_t upper = vandq_u8(vcgeq_u8(v, first), vcleq_u8(v, last));
+        uint8x16_t lowered = vorrq_u8(v, vandq_u8(upper, caseBit));
+        uint8x16_t nonAscii = vtstq_u8(v, high);
+        uint64x2_t lanes = vreinterpretq_u64_u8(nonAscii);
+        if ((vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) == 0) {
+            vst1q_u8(o, lowered);
+            p += 16;
+            o += 16;
+            continue;
+        }
+        // Fold up to the next 16 byte boundary of input one code point at
+        // a time, then try the vector path again.
+        const uint8_t *stop = p + 16;
+        while (p < stop) {
+            size_t written;
+            p += foldOne(p, end, o, &written);
+            o += written;
+        }
+    }
+    while (p < end) {
+        size_t written;
+        p += foldOne(p, end, o, &written);
+        o += written;
+    }
+    return (size_t)(o - (uint8_t *)out);
+}
+
+#else
+
+size_t foldUtf8(const char *in, size_t size, char *out)
+{
+    return foldUtf8Scalar(in, size, out);
+}
+
+#endif
+
+}
@@ -0,0 +1,33 @@
+//
+//  Fold.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Fold__
+#define __LivroDeCanticos__Fold__
+
+#include <stddef.h>
+
+namespace canticos {
+
+// Accent and case folding for matching Portuguese text: "GLÓRIA",
+// "Glória" and "gloria" all fold to "gloria", "CÉUS" to "ceus", "Ç" to "c".
+//
+// ASCII capitals become lower case. Letters of the Latin-1 Supplement and
+// Latin Extended-A blocks (U+00C0 to U+017F) become their unaccented lower
+// case ASCII letter, or two letters for ligatures (ß, æ, œ). Everything else,
+// invalid UTF-8 included, is copied unchanged.
+//
+// The output is never longer than the input, so out needs size bytes and
+// must not overlap in. No memory is allocated.
+size_t foldUtf8(const char *in, size_t size, char *out);
+
+// Same result without SIMD; foldUtf8 uses it for non-ASCII stretches and
+// on targets without SSE2 or NEON.
+size_t foldUtf8Scalar(const char *in, size_t size, char *out);
+
+}
+
+#endif /* defined(__LivroDeCanticos__Fold__) */
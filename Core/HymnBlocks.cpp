@@ -0,0 +1,672 @@
+//
+//  HymnBlocks.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "HymnBlocks.h"
+#include "SourceBook.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace canticos {
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+// trainBlockModel
+
+// Text sampled for training, at most; a big book is sampled evenly.
+static const size_t kTrainingBytes = 4 * 1024 * 1024;
+
+// Longest run of words taken as one phrase.
+static const size_t kMaxPhraseWords = 6;
+
+namespace {
+
+struct PhraseCount {
+    uint32_t samples;       // how many samples have it
+    uint32_t last;          // the last sample counted, + 1
+};
+
+struct Phrase {
+    uint64_t score;
+    std::string text;
+};
+
+struct BetterPhrase {
+    bool operator()(const Phrase &a, const Phrase &b) const
+    {
+        return a.score != b.score ? a.score > b.score : a.text < b.text;
+    }
+};
+
+}
+
+static void countPhrase(std::unordered_map<std::string, PhraseCount> *counts, const char *start, const char *end,
+                        uint32_t sample)
+{
+    // Shorter than a match is worth nothing.
+    if (end - start < 5) {
+        return;
+    }
+    PhraseCount &count = (*counts)[std::string(start, end)];
+    if (count.last != sample + 1) {
+        count.samples++;
+        count.last = sample + 1;
+    }
+}
+
+static void trainDictionary(const std::vector<Slice> &samples, size_t stride, size_t capacity,
+                            std::string *dictionary)
+{
+    // Every line, and every run of up to kMaxPhraseWords words within a
+    // line, counted once per sample: repeats inside one hymn are the
+    // block's own business.
+    std::unordered_map<std::string, PhraseCount> counts;
+    std::vector<Token> words;
+    for (size_t s = 0; s < samples.size(); s += stride) {
+        Slice text = samples[s];
+        for (size_t start = 0; start < text.size;) {
+            size_t end = start;
+            while (end < text.size && text.data[end] != '\n' && text.data[end] != '\r') {
+                end++;
+            }
+            Slice line(text.data + start, end - start);
+            start = end + 1;
+            countPhrase(&counts, line.begin(), line.end(), (uint32_t)s);
+
+            words.clear();
+            Tokenizer tokenizer(line);
+            Token token;
+            while (tokenizer.next(&token)) {
+                words.push_back(token);
+            }
+            for (size_t w = 0; w < words.size(); w++) {
+                for (size_t n = 1; n <= kMaxPhraseWords && w + n <= words.size(); n++) {
+                    countPhrase(&counts, words[w].text.begin(), words[w + n - 1].text.end(), (uint32_t)s);
+                }
+            }
+        }
+    }
+
+    // A phrase is worth what it saves in the samples that have it, less
+    // what a reference costs there and what it costs in the dictionary.
+    std::vector<Phrase> phrases;
+    for (std::unordered_map<std::string, PhraseCount>::iterator it = counts.begin(); it != counts.end(); ++it) {
+        uint64_t saved = (uint64_t)it->second.samples * (it->first.size() - 3);
+        if (it->second.samples >= 3 && saved > 2 * it->first.size()) {
+            Phrase phrase = { saved - 2 * it->first.size(), it->first };
+            phrases.push_back(phrase);
+        }
+    }
+    counts.clear();
+    std::sort(phrases.begin(), phrases.end(), BetterPhrase());
+
+    std::vector<const Phrase *> chosen;
+    std::string joined;
+    for (size_t p = 0; p < phrases.size() && joined.size() < capacity; p++) {
+        if (joined.size() + phrases[p].text.size() > capacity || joined.find(phrases[p].text) != std::string::npos) {
+            continue;
+        }
+        chosen.push_back(&phrases[p]);
+        joined += phrases[p].text;
+    }
+    for (size_t c = chosen.size(); c-- > 0;) {
+        *dictionary += chosen[c]->text;
+    }
+}
+
+// Huffman code lengths for the counts, none over kMaxLiteralBits: while
+// the tree is too deep the counts are halved, which flattens it.
+static void huffmanBits(const uint64_t counts[256], uint8_t bits[256])
+{
+    std::vector<uint64_t> weights(counts, counts + 256);
+    for (;;) {
+        typedef std::pair<uint64_t, uint32_t> Node;     // weight, then id for ties
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node> > queue;
+        std::vector<uint32_t> parent(2 * 256 - 1, 0);
+        for (uint32_t i = 0; i < 256; i++) {
+            queue.push(Node(weights[i], i));
+        }
+        for (uint32_t next = 256; queue.size() > 1; next++) {
+            Node a = queue.top();
+            queue.pop();
+            Node b = queue.top();
+            queue.pop();
+            parent[a.second] = parent[b.second] = next;
+            queue.push(Node(a.first + b.first, next));
+        }
+        uint32_t root = 2 * 256 - 2;
+        uint32_t deepest = 0;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t depth = 0;
+            for (uint32_t n = i; n != root; n = parent[n]) {
+                depth++;
+            }
+            bits[i] = (uint8_t)depth;
+            deepest = std::max(deepest, depth);
+        }
+        if (deepest <= kMaxLiteralBits) {
+            return;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            weights[i] = weights[i] / 2 + 1;
+        }
+    }
+}
+
+void trainBlockModel(const std::vector<Slice> &samples, size_t capacity, BlockModel *model)
+{
+    size_t total = 0;
+    for (size_t s = 0; s < samples.size(); s++) {
+        total += samples[s].size;
+    }
+    size_t stride = total / kTrainingBytes + 1;
+    model->dictionary.clear();
+    trainDictionary(samples, stride, capacity, &model->dictionary);
+
+    // The parse does not depend on the code; any will do for it.
+    memset(model->literalBits, 8, sizeof(model->literalBits));
+    uint64_t counts[256];
+    std::fill(counts, counts + 256, 1);
+    BlockEncoder encoder(*model);
+    std::string sequences;
+    std::string literals;
+    for (size_t s = 0; s < samples.size(); s += stride) {
+        encoder.parse(samples[s], &sequences, &literals);
+        for (size_t i = 0; i < literals.size(); i++) {
+            counts[(uint8_t)literals[i]]++;
+        }
+    }
+    huffmanBits(counts, model->literalBits);
+}
+
+// Canonical codes for the lengths, in order of length then byte, bit
+// reversed for the least significant bit first stream.
+static void canonicalCodes(const uint8_t bits[256], uint32_t codes[256])
+{
+    uint32_t code = 0;
+    for (uint32_t length = 1; length <= kMaxLiteralBits; length++) {
+        for (uint32_t symbol = 0; symbol < 256; symbol++) {
+            if (bits[symbol] != length) {
+                continue;
+            }
+            uint32_t reversed = 0;
+            for (uint32_t b = 0; b < length; b++) {
+                reversed |= ((code >> b) & 1) << (length - 1 - b);
+            }
+            codes[symbol] = reversed;
+            code++;
+        }
+        code <<= 1;
+    }
+}
+
+// BlockEncoder
+
+static const uint32_t kMinMatch = 4;
+static const int kDictionaryHashBits = 16;
+static const int kBlockHashBits = 14;
+static const int kMaxChain = 32;
+
+static uint32_t hash4(const char *p, int bits)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+static size_t matchLength(const char *a, const char *b, size_t max)
+{
+    size_t n = 0;
+    while (n < max && a[n] == b[n]) {
+        n++;
+    }
+    return n;
+}
+
+static size_t varintSize(size_t value)
+{
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static void putVarint(std::string *out, size_t value)
+{
+    while (value >= 0x80) {
+        out->push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+static void putLength(std::string *out, size_t extra)
+{
+    while (extra >= 255) {
+        out->push_back((char)255);
+        extra -= 255;
+    }
+    out->push_back((char)extra);
+}
+
+static void putSequence(std::string *sequences, std::string *literals, const char *start, size_t literalCount,
+                        size_t matchCount, size_t offset)
+{
+    size_t lengthCode = matchCount ? matchCount - kMinMatch : 0;
+    sequences->push_back((char)((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(lengthCode, 15)));
+    if (literalCount >= 15) {
+        putLength(sequences, literalCount - 15);
+    }
+    literals->append(start, literalCount);
+    if (!matchCount) {
+        return;
+    }
+    putVarint(sequences, offset);
+    if (lengthCode >= 15) {
+        putLength(sequences, lengthCode - 15);
+    }
+}
+
+// What a match saves, in quarter bytes: a coded literal takes about two
+// thirds of a byte, and a match its token and offset.
+static int matchGain(size_t length, size_t offset)
+{
+    return (int)(length * 3) - (int)(1 + varintSize(offset)) * 4;
+}
+
+BlockEncoder::BlockEncoder(const BlockModel &model)
+    : _dictionary(model.dictionary), _dictionaryHead(1 << kDictionaryHashBits, -1),
+      _dictionaryPrev(model.dictionary.size(), -1)
+{
+    memcpy(_bits, model.literalBits, sizeof(_bits));
+    canonicalCodes(_bits, _codes);
+    for (size_t i = 0; i + kMinMatch <= _dictionary.size; i++) {
+        uint32_t h = hash4(_dictionary.data + i, kDictionaryHashBits);
+        _dictionaryPrev[i] = _dictionaryHead[h];
+        _dictionaryHead[h] = (int32_t)i;
+    }
+}
+
+// Greedy parse: at each position the match the hash chains find, in the
+// hymn so far or in the dictionary, that saves the most.
+void BlockEncoder::parse(Slice input, std::string *sequences, std::string *literals)
+{
+    sequences->clear();
+    literals->clear();
+    const char *in = input.data;
+    size_t size = input.size;
+    _head.assign(1 << kBlockHashBits, -1);
+    _prev.resize(size);
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + kMinMatch <= size) {
+        size_t bestLength = 0;
+        size_t bestOffset = 0;
+        int bestGain = 0;
+        uint32_t h = hash4(in + pos, kBlockHashBits);
+        int32_t candidate = _head[h];
+        for (int chain = 0; candidate >= 0 && chain < kMaxChain; chain++) {
+            size_t length = matchLength(in + candidate, in + pos, size - pos);
+            int gain = matchGain(length, pos - candidate);
+            if (length >= kMinMatch && gain > bestGain) {
+                bestLength = length;
+                bestOffset = pos - candidate;
+                bestGain = gain;
+            }
+            candidate = _prev[candidate];
+        }
+        candidate = _dictionaryHead[hash4(in + pos, kDictionaryHashBits)];
+        for (int chain = 0; candidate >= 0 && chain < kMaxChain; chain++) {
+            size_t length = matchLength(_dictionary.data + candidate, in + pos,
+                                        std::min(_dictionary.size - candidate, size - pos));
+            size_t offset = pos + _dictionary.size - candidate;
+            int gain = matchGain(length, offset);
+            if (length >= kMinMatch && gain > bestGain) {
+                bestLength = length;
+                bestOffset = offset;
+                bestGain = gain;
+            }
+            candidate = _dictionaryPrev[candidate];
+        }
+
+        if (!bestLength) {
+            _prev[pos] = _head[h];
+            _head[h] = (int32_t)pos;
+            pos++;
+            continue;
+        }
+        putSequence(sequences, literals, in + anchor, pos - anchor, bestLength, bestOffset);
+        for (size_t end = pos + bestLength; pos < end; pos++) {
+            if (pos + kMinMatch <= size) {
+                uint32_t hp = hash4(in + pos, kBlockHashBits);
+                _prev[pos] = _head[hp];
+                _head[hp] = (int32_t)pos;
+            }
+        }
+        anchor = pos;
+    }
+    putSequence(sequences, literals, in + anchor, size - anchor, 0, 0);
+}
+
+void BlockEncoder::compress(Slice input, std::string *out)
+{
+    parse(input, &_sequences, &_literals);
+    out->clear();
+    putVarint(out, _sequences.size());
+    *out += _sequences;
+    uint64_t pending = 0;
+    uint32_t count = 0;
+    for (size_t i = 0; i < _literals.size(); i++) {
+        uint8_t symbol = (uint8_t)_literals[i];
+        pending |= (uint64_t)_codes[symbol] << count;
+        count += _bits[symbol];
+        while (count >= 8) {
+            out->push_back((char)pending);
+            pending >>= 8;
+            count -= 8;
+        }
+    }
+    if (count) {
+        out->push_back((char)pending);
+    }
+}
+
+// BlockDecoder
+
+bool BlockDecoder::open(Slice dictionary, const uint8_t literalBits[256])
+{
+    _dictionary = Slice();
+    _table.clear();
+    uint32_t space = 0;
+    for (uint32_t symbol = 0; symbol < 256; symbol++) {
+        if (literalBits[symbol] < 1 || literalBits[symbol] > kMaxLiteralBits) {
+            return false;
+        }
+        space += 1u << (kMaxLiteralBits - literalBits[symbol]);
+    }
+    if (space > 1u << kMaxLiteralBits) {
+        return false;
+    }
+
+    uint32_t codes[256];
+    canonicalCodes(literalBits, codes);
+    Entry none = { 0, 0 };
+    _table.assign(1u << kMaxLiteralBits, none);
+    for (uint32_t symbol = 0; symbol < 256; symbol++) {
+        uint32_t bits = literalBits[symbol];
+        Entry entry = { (uint8_t)symbol, (uint8_t)bits };
+        for (uint32_t high = 0; high < 1u << (kMaxLiteralBits - bits); high++) {
+            _table[codes[symbol] | high << bits] = entry;
+        }
+    }
+    _dictionary = dictionary;
+    return true;
+}
+
+static bool getLength(const uint8_t **p, const uint8_t *end, size_t *length)
+{
+    uint8_t b;
+    do {
+        if (*p >= end) {
+            return false;
+        }
+        b = *(*p)++;
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+static bool getVarint(const uint8_t **p, const uint8_t *end, size_t *value)
+{
+    *value = 0;
+    for (int shift = 0;; shift += 7) {
+        if (*p >= end || shift > 56) {
+            return false;
+        }
+        uint8_t b = *(*p)++;
+        *value |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+}
+
+bool BlockDecoder::decompress(Slice block, char *out, size_t rawSize) const
+{
+    if (_table.empty()) {
+        return false;
+    }
+    const uint8_t *p = (const uint8_t *)block.data;
+    const uint8_t *end = p + block.size;
+    size_t sequencesSize;
+    if (!getVarint(&p, end, &sequencesSize) || sequencesSize > (size_t)(end - p)) {
+        return false;
+    }
+    const uint8_t *sequencesEnd = p + sequencesSize;
+
+    // The literals, read ahead into bits; past the end of the block they
+    // read as zeros, and a code that would need those is corrupt.
+    const uint8_t *q = sequencesEnd;
+    uint64_t bits = 0;
+    uint32_t count = 0;
+    const Entry *table = &_table[0];
+    const uint32_t mask = (1u << kMaxLiteralBits) - 1;
+
+    size_t o = 0;
+    for (;;) {
+        if (p >= sequencesEnd) {
+            return false;
+        }
+        uint8_t token = *p++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(&p, sequencesEnd, &literals)) {
+            return false;
+        }
+        if (literals > rawSize - o) {
+            return false;
+        }
+        for (size_t i = 0; i < literals; i++) {
+            if (count < kMaxLiteralBits) {
+                while (count <= 56 && q < end) {
+                    bits |= (uint64_t)*q++ << count;
+                    count += 8;
+                }
+            }
+            Entry entry = table[bits & mask];
+            if (entry.bits == 0 || entry.bits > count) {
+                return false;
+            }
+            out[o++] = (char)entry.symbol;
+            bits >>= entry.bits;
+            count -= entry.bits;
+        }
+        if (o == rawSize) {
+            // Nothing left over but the padding of the last byte.
+            return p == sequencesEnd && q == end && count < 8;
+        }
+
+        size_t offset;
+        if (!getVarint(&p, sequencesEnd, &offset)) {
+            return false;
+        }
+        size_t length = (token & 15) + kMinMatch;
+        if ((token & 15) == 15 && !getLength(&p, sequencesEnd, &length)) {
+            return false;
+        }
+        if (length > rawSize - o || offset == 0 || offset > o + _dictionary.size) {
+            return false;
+        }
+        if (offset > o) {
+            // Starts in the dictionary, and may run on into the hymn.
+            size_t from = _dictionary.size - (offset - o);
+            size_t n = std::min(length, _dictionary.size - from);
+            memcpy(out + o, _dictionary.data + from, n);
+            o += n;
+            length -= n;
+            for (size_t i = 0; i < length; i++) {
+                out[o + i] = out[i];
+            }
+        } else if (offset >= length) {
+            memcpy(out + o, out + o - offset, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                out[o + i] = out[o - offset + i];
+            }
+        }
+        o += length;
+    }
+}
+
+// buildHymnBlocks
+
+void buildHymnBlocks(const SourceBook &book, std::string *out)
+{
+    std::vector<Slice> samples;
+    size_t total = 0;
+    for (uint32_t i = 0; i < book.count(); i++) {
+        samples.push_back(Slice(book.bodies[i]));
+        total += book.bodies[i].size();
+    }
+    BlockModel model;
+    trainBlockModel(samples, std::min(kMaxBlockDictionary, total / 10), &model);
+
+    BlockEncoder encoder(model);
+    std::string entries(book.count() * sizeof(HymnBlockEntry), '\0');
+    std::string blocks;
+    std::string block;
+    for (uint32_t i = 0; i < book.count(); i++) {
+        encoder.compress(samples[i], &block);
+        HymnBlockEntry e;
+        e.offset = blocks.size();
+        e.size = (uint32_t)block.size();
+        e.rawSize = (uint32_t)samples[i].size;
+        memcpy(&entries[i * sizeof(HymnBlockEntry)], &e, sizeof(e));
+        blocks += block;
+    }
+
+    HymnBlocksHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kHymnBlocksMagic, sizeof(header.magic));
+    header.version = kHymnBlocksVersion;
+    header.hymnCount = book.count();
+    memcpy(header.literalBits, model.literalBits, sizeof(header.literalBits));
+
+    out->assign(sizeof(HymnBlocksHeader), '\0');
+    header.entriesOffset = out->size();
+    *out += entries;
+    padTo8(out);
+    header.dictionaryOffset = out->size();
+    header.dictionarySize = model.dictionary.size();
+    *out += model.dictionary;
+    padTo8(out);
+    header.blocksOffset = out->size();
+    header.blocksSize = blocks.size();
+    *out += blocks;
+    padTo8(out);
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+// HymnBlocks
+
+HymnBlocks::HymnBlocks() : _header(NULL), _entries(NULL), _blocks(NULL)
+{
+}
+
+bool HymnBlocks::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt hymn blocks: ") + why;
+    }
+    return false;
+}
+
+bool HymnBlocks::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(HymnBlocksHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const HymnBlocksHeader *h = (const HymnBlocksHeader *)data;
+    if (memcmp(h->magic, kHymnBlocksMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kHymnBlocksVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size
+        || h->entriesOffset + (uint64_t)h->hymnCount * sizeof(HymnBlockEntry) > size
+        || h->dictionaryOffset + h->dictionarySize > size
+        || h->blocksOffset + h->blocksSize > size) {
+        return corrupt(error, "section out of bounds");
+    }
+    // The blocks themselves are checked as they are decoded.
+    const HymnBlockEntry *entries = (const HymnBlockEntry *)(data + h->entriesOffset);
+    for (uint32_t i = 0; i < h->hymnCount; i++) {
+        if (entries[i].offset + entries[i].size > h->blocksSize) {
+            return corrupt(error, "block out of bounds");
+        }
+    }
+
+    if (!_decoder.open(Slice(data + h->dictionaryOffset, h->dictionarySize), h->literalBits)) {
+        return corrupt(error, "bad literal code");
+    }
+
+    _header = h;
+    _entries = entries;
+    _blocks = data + h->blocksOffset;
+    return true;
+}
+
+void HymnBlocks::close()
+{
+    _header = NULL;
+    _entries = NULL;
+    _blocks = NULL;
+    _file.close();
+}
+
+bool HymnBlocks::text(uint32_t number, std::string *out) const
+{
+    if (!contains(number)) {
+        out->clear();
+        return false;
+    }
+    out->resize(rawSize(number));
+    if (!_decoder.decompress(block(number), out->empty() ? NULL : &(*out)[0], out->size())) {
+        out->clear();
+        return false;
+    }
+    return true;
+}
+
+}
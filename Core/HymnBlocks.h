@@ -0,0 +1,176 @@
+//
+//  HymnBlocks.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__HymnBlocks__
+#define __LivroDeCanticos__HymnBlocks__
+
+#include "MappedFile.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+struct SourceBook;
+
+// The cN.txt texts of a hymnal compressed one hymn a block, every block
+// against the same model trained on the whole book: a dictionary of
+// phrases, so "povo de Deus" or a refrain shared by several hymns costs a
+// reference even in the first hymn that has it, and a Huffman code for the
+// literals. A hymn decodes alone, from its block and the model, without
+// touching the other blocks.
+//
+// A block is LZ77 sequences, then the literals they carry. A sequence is a
+// token byte (literal count in the high nibble, match length - 4 in the low
+// one, 15 meaning more follows in bytes up to and including the first that
+// is not 255) and then, unless the hymn is complete, the match offset as a
+// varint. Offsets count back from the end of the output through the
+// dictionary, as if the dictionary came right before the hymn. Layout:
+//
+//   varint      size of the sequences
+//   sequences
+//   literals    canonical Huffman codes, least significant bit first
+//
+// File layout, all integers little endian:
+//
+//   HymnBlocksHeader
+//   HymnBlockEntry[hymnCount]   indexed by hymn number - 1
+//   dictionary
+//   blocks
+static const char kHymnBlocksMagic[8] = { 'L', 'D', 'C', 'B', 'L', 'O', 'C', 'K' };
+static const uint32_t kHymnBlocksVersion = 1;
+
+// Longest literal code, in bits.
+static const uint32_t kMaxLiteralBits = 12;
+
+struct HymnBlocksHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t hymnCount;
+    uint64_t entriesOffset;
+    uint64_t dictionaryOffset;
+    uint64_t dictionarySize;
+    uint64_t blocksOffset;
+    uint64_t blocksSize;
+    uint64_t fileSize;
+    uint8_t literalBits[256];   // code length of each byte, 1 to kMaxLiteralBits
+};
+
+struct HymnBlockEntry {
+    uint64_t offset;        // relative to the blocks
+    uint32_t size;
+    uint32_t rawSize;       // of the cN.txt
+};
+
+// Largest dictionary trained, in bytes; a small book gets a tenth of its
+// text. Past this the longer offsets cost more than the phrases save.
+static const size_t kMaxBlockDictionary = 16 * 1024;
+
+struct BlockModel {
+    std::string dictionary;
+    uint8_t literalBits[256];
+};
+
+// Phrases that recur across the samples, most useful last (nearest the
+// block, so the cheapest to refer to), at most capacity bytes; then the
+// literal code, from the literals left once the samples are compressed
+// against those phrases. Every byte gets a code, seen or not.
+void trainBlockModel(const std::vector<Slice> &samples, size_t capacity, BlockModel *model);
+
+// Compresses blocks against one model, whose match tables are built once
+// for all of them. The model must outlive the encoder.
+class BlockEncoder {
+public:
+    explicit BlockEncoder(const BlockModel &model);
+
+    void compress(Slice input, std::string *out);
+
+    // The LZ77 pass alone: the sequences, and the literals uncoded.
+    void parse(Slice input, std::string *sequences, std::string *literals);
+
+private:
+    Slice _dictionary;
+    uint32_t _codes[256];       // bit reversed, to be written first bit first
+    uint8_t _bits[256];
+    std::vector<int32_t> _dictionaryHead;
+    std::vector<int32_t> _dictionaryPrev;
+    std::vector<int32_t> _head;
+    std::vector<int32_t> _prev;
+    std::string _sequences;
+    std::string _literals;
+};
+
+// Decodes blocks of one model.
+class BlockDecoder {
+public:
+    BlockDecoder() {}
+
+    // False if the code lengths do not make a prefix code.
+    bool open(Slice dictionary, const uint8_t literalBits[256]);
+
+    // Decodes a block of rawSize bytes into out; false if it is corrupt.
+    bool decompress(Slice block, char *out, size_t rawSize) const;
+
+    Slice dictionary() const { return _dictionary; }
+
+private:
+    struct Entry {
+        uint8_t symbol;
+        uint8_t bits;           // 0 for no code
+    };
+
+    Slice _dictionary;
+    std::vector<Entry> _table;  // by the next kMaxLiteralBits bits
+};
+
+// Trains the model on the book and writes its blocks file.
+void buildHymnBlocks(const SourceBook &book, std::string *out);
+
+// Read-only view over a mapped blocks file.
+class HymnBlocks {
+public:
+    HymnBlocks();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t count() const { return _header ? _header->hymnCount : 0; }
+    bool contains(uint32_t number) const { return number >= 1 && number <= count(); }
+    Slice dictionary() const { return _header ? _decoder.dictionary() : Slice(); }
+
+    uint32_t rawSize(uint32_t number) const { return contains(number) ? _entries[number - 1].rawSize : 0; }
+    Slice block(uint32_t number) const
+    {
+        if (!contains(number)) {
+            return Slice();
+        }
+        const HymnBlockEntry &e = _entries[number - 1];
+        return Slice(_blocks + e.offset, e.size);
+    }
+
+    // The cN.txt of a hymn (1-based), into out, whose capacity is reused;
+    // false when out of range or corrupt.
+    bool text(uint32_t number, std::string *out) const;
+
+private:
+    HymnBlocks(const HymnBlocks &) = delete;
+    HymnBlocks &operator=(const HymnBlocks &) = delete;
+
+    MappedFile _file;
+    const HymnBlocksHeader *_header;
+    const HymnBlockEntry *_entries;
+    BlockDecoder _decoder;
+    const char *_blocks;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__HymnBlocks__) */
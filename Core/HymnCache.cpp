@@ -0,0 +1,222 @@
+//
+//  HymnCache.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "HymnCache.h"
+#include "Tokenizer.h"
+
+#include <cstring>
+
+namespace canticos {
+
+static void appendUtf16(Slice text, std::vector<uint16_t> *out)
+{
+    const uint8_t *p = (const uint8_t *)text.data;
+    const uint8_t *end = p + text.size;
+    while (p < end) {
+        if (*p < 0x80) {
+            out->push_back(*p++);
+            continue;
+        }
+        uint32_t cp;
+        p += decodeUtf8(p, end, &cp);
+        if (cp > 0xFFFF) {
+            cp -= 0x10000;
+            out->push_back((uint16_t)(0xD800 + (cp >> 10)));
+            out->push_back((uint16_t)(0xDC00 + (cp & 0x3FF)));
+        } else {
+            out->push_back((uint16_t)cp);
+        }
+    }
+}
+
+bool prepareHymn(const Corpus &corpus, uint32_t number, PreparedHymn *out)
+{
+    if (!corpus.contains(number)) {
+        return false;
+    }
+    out->number = number;
+    out->text.clear();
+    out->stanzas.clear();
+
+    // UTF-16 never takes more units than UTF-8 takes bytes.
+    uint32_t count = corpus.stanzaCount(number);
+    size_t reserve = corpus.title(number).size;
+    for (uint32_t i = 0; i < count; i++) {
+        reserve += 2 + corpus.stanza(number, i).text.size;
+    }
+    out->text.reserve(reserve);
+    out->stanzas.reserve(count);
+
+    appendUtf16(corpus.title(number), &out->text);
+    out->titleUtf16Size = (uint32_t)out->text.size();
+    for (uint32_t i = 0; i < count; i++) {
+        Stanza stanza = corpus.stanza(number, i);
+        out->text.push_back('\n');
+        out->text.push_back('\n');
+        PreparedStanza prepared;
+        prepared.utf16Offset = (uint32_t)out->text.size();
+        appendUtf16(stanza.text, &out->text);
+        prepared.utf16Size = (uint32_t)out->text.size() - prepared.utf16Offset;
+        prepared.lineCount = stanza.lineCount;
+        prepared.refrain = stanza.refrain;
+        prepared.repeat = stanza.repeat;
+        out->stanzas.push_back(prepared);
+    }
+    out->text.shrink_to_fit();
+    return true;
+}
+
+HymnCache::HymnCache(const Corpus &corpus, size_t budgetBytes, bool prefetch)
+    : _corpus(corpus), _budget(budgetBytes), _busy(false), _stop(false)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    if (prefetch) {
+        _worker = std::thread(&HymnCache::prefetchLoop, this);
+    }
+}
+
+HymnCache::~HymnCache()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_one();
+    if (_worker.joinable()) {
+        _worker.join();
+    }
+}
+
+HymnCache::Hymn HymnCache::findLocked(uint32_t number)
+{
+    std::unordered_map<uint32_t, Entry>::iterator it = _entries.find(number);
+    if (it == _entries.end()) {
+        return Hymn();
+    }
+    _uses.splice(_uses.begin(), _uses, it->second.use);
+    return it->second.hymn;
+}
+
+void HymnCache::insertLocked(const Hymn &hymn, bool opened)
+{
+    // A hymn bigger than the whole budget is handed out but not kept.
+    if (hymn->bytes() > _budget || _entries.count(hymn->number)) {
+        return;
+    }
+    // A prefetched hymn goes behind the one being read, which stays first.
+    std::list<uint32_t>::iterator where = _uses.begin();
+    if (!opened && where != _uses.end()) {
+        ++where;
+    }
+    Entry entry = { hymn, _uses.insert(where, hymn->number) };
+    _entries[hymn->number] = entry;
+    _stats.bytes += hymn->bytes();
+    while (_stats.bytes > _budget) {
+        std::unordered_map<uint32_t, Entry>::iterator it = _entries.find(_uses.back());
+        _stats.bytes -= it->second.hymn->bytes();
+        _entries.erase(it);
+        _uses.pop_back();
+        _stats.evicted++;
+    }
+    _stats.hymns = (uint32_t)_entries.size();
+}
+
+HymnCache::Hymn HymnCache::open(uint32_t number)
+{
+    if (!_corpus.contains(number)) {
+        return Hymn();
+    }
+    Hymn hymn;
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        hymn = findLocked(number);
+        if (hymn) {
+            _stats.hits++;
+        } else {
+            _stats.misses++;
+        }
+        // The neighbours asked for before are not wanted any more; the
+        // next hymn goes first, as the book is mostly read forwards.
+        if (_worker.joinable()) {
+            _pending.clear();
+            if (_corpus.contains(number + 1) && !_entries.count(number + 1)) {
+                _pending.push_back(number + 1);
+            }
+            if (_corpus.contains(number - 1) && !_entries.count(number - 1)) {
+                _pending.push_back(number - 1);
+            }
+            // Nothing to wake the worker for when both are cached already.
+            wake = !_pending.empty();
+        }
+    }
+    if (wake) {
+        _wake.notify_one();
+    }
+    if (hymn) {
+        return hymn;
+    }
+
+    // Prepared without the lock, so a prefetch does not wait for it; if the
+    // worker got there first its copy is handed out and this one dropped.
+    std::shared_ptr<PreparedHymn> prepared = std::make_shared<PreparedHymn>();
+    prepareHymn(_corpus, number, prepared.get());
+    std::lock_guard<std::mutex> guard(_lock);
+    hymn = findLocked(number);
+    if (hymn) {
+        return hymn;
+    }
+    insertLocked(prepared, true);
+    return prepared;
+}
+
+void HymnCache::prefetchLoop()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    for (;;) {
+        while (!_stop && _pending.empty()) {
+            _busy = false;
+            _idle.notify_all();
+            _wake.wait(guard);
+        }
+        if (_stop) {
+            break;
+        }
+        _busy = true;
+        uint32_t number = _pending.front();
+        _pending.pop_front();
+        if (_entries.count(number)) {
+            continue;
+        }
+        guard.unlock();
+        std::shared_ptr<PreparedHymn> prepared = std::make_shared<PreparedHymn>();
+        prepareHymn(_corpus, number, prepared.get());
+        guard.lock();
+        if (!_entries.count(number)) {
+            insertLocked(prepared, false);
+            _stats.prefetched++;
+        }
+    }
+    _busy = false;
+    _idle.notify_all();
+}
+
+void HymnCache::waitForPrefetch()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    while (_worker.joinable() && !_stop && (_busy || !_pending.empty())) {
+        _idle.wait(guard);
+    }
+}
+
+HymnCacheStats HymnCache::stats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+}
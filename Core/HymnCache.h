@@ -0,0 +1,122 @@
+//
+//  HymnCache.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__HymnCache__
+#define __LivroDeCanticos__HymnCache__
+
+#include "Corpus.h"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace canticos {
+
+// A stanza of a prepared hymn, in UTF-16 units of its text.
+struct PreparedStanza {
+    uint32_t utf16Offset;
+    uint32_t utf16Size;
+    uint32_t lineCount;
+    bool refrain;
+    bool repeat;
+};
+
+// A hymn as Cantico shows it: the title, a blank line, and the stanzas
+// separated by blank lines, decoded to UTF-16 for NSString, with where the
+// title and each stanza are in it for the attributes. Repeated refrains
+// are written out again. The same layout realcesDoCantico counts in.
+struct PreparedHymn {
+    uint32_t number;
+    std::vector<uint16_t> text;
+    uint32_t titleUtf16Size;    // the title is text[0, titleUtf16Size)
+    std::vector<PreparedStanza> stanzas;
+
+    // What the hymn is charged against the cache budget.
+    size_t bytes() const
+    {
+        return sizeof(PreparedHymn) + text.capacity() * sizeof(uint16_t)
+            + stanzas.capacity() * sizeof(PreparedStanza);
+    }
+};
+
+// Builds the prepared hymn of a number; false when the corpus lacks it.
+bool prepareHymn(const Corpus &corpus, uint32_t number, PreparedHymn *out);
+
+struct HymnCacheStats {
+    uint64_t hits;          // opens served from the cache
+    uint64_t misses;        // opens that prepared the hymn themselves
+    uint64_t prefetched;    // hymns the worker prepared ahead
+    uint64_t evicted;
+    uint32_t hymns;         // in the cache now
+    size_t bytes;
+};
+
+// Prepared hymns, least recently opened out first once their bytes pass
+// the budget. Opening hymn N hands N - 1 and N + 1 to a worker thread,
+// which prepares them unless they are cached already, so paging through
+// the book finds the next hymn ready: a hit is a hash lookup and a list
+// splice, with no page of the corpus touched.
+//
+// Hymns are shared, so one the cache drops stays valid for whoever holds
+// it. open() and stats() may be called from any thread.
+class HymnCache {
+public:
+    typedef std::shared_ptr<const PreparedHymn> Hymn;
+
+    // The corpus must outlive the cache. Without prefetch there is no
+    // worker thread.
+    HymnCache(const Corpus &corpus, size_t budgetBytes, bool prefetch = true);
+    ~HymnCache();
+
+    // The prepared hymn of a number, NULL when the corpus lacks it.
+    Hymn open(uint32_t number);
+
+    // Waits until the worker has nothing left to prepare.
+    void waitForPrefetch();
+
+    HymnCacheStats stats() const;
+
+private:
+    HymnCache(const HymnCache &) = delete;
+    HymnCache &operator=(const HymnCache &) = delete;
+
+    struct Entry {
+        Hymn hymn;
+        std::list<uint32_t>::iterator use;
+    };
+
+    // All under _lock.
+    Hymn findLocked(uint32_t number);
+    void insertLocked(const Hymn &hymn, bool opened);
+
+    void prefetchLoop();
+
+    const Corpus &_corpus;
+    const size_t _budget;
+
+    mutable std::mutex _lock;
+    std::unordered_map<uint32_t, Entry> _entries;
+    std::list<uint32_t> _uses;      // most recently opened first
+    HymnCacheStats _stats;
+
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::deque<uint32_t> _pending;
+    bool _busy;
+    bool _stop;
+    std::thread _worker;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__HymnCache__) */
@@ -0,0 +1,223 @@
+//
+//  IncrementalSearch.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "IncrementalSearch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace canticos {
+
+// Rough cost of checking one candidate's forward list, in postings bytes.
+static const size_t kForwardCheckCost = 24;
+
+// States kept for backspacing; deeper typing keeps only the newest ones.
+static const size_t kMaxStates = 64;
+
+IncrementalSearch::IncrementalSearch(const SearchIndex &index) : _index(index)
+{
+    // Per keystroke scoring only multiplies and divides cached parts.
+    _idf.resize(index.termCount());
+    for (uint32_t t = 0; t < index.termCount(); t++) {
+        _idf[t] = index.idf(index.term(t));
+    }
+    reset();
+    resetStats();
+}
+
+void IncrementalSearch::reset()
+{
+    _states.clear();
+    _states.push_back(State());
+    _states[0].all = true;
+    _states[0].hitsLimit = 0;
+}
+
+void IncrementalSearch::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+static bool startsWith(const std::string &text, const std::string &prefix)
+{
+    return text.size() >= prefix.size() && memcmp(text.data(), prefix.data(), prefix.size()) == 0;
+}
+
+void IncrementalSearch::narrowByPostings(const State &from, uint32_t first, uint32_t last, bool finished, State *to)
+{
+    uint32_t docs = _index.docCount();
+    if (_scratch.size() != docs + 1) {
+        _scratch.assign(docs + 1, 0);
+    }
+    for (uint32_t t = first; t < last; t++) {
+        PostingCursor c = _index.cursor(_index.term(t));
+        while (c.next()) {
+            float s = SearchIndex::termScore(_idf[t], _index.weightedFrequency(c.doc, c.fieldTf));
+            _scratch[c.doc] = std::max(_scratch[c.doc], s);
+        }
+    }
+
+    if (from.all) {
+        for (uint32_t n = 1; n <= docs; n++) {
+            if (_scratch[n] > 0) {
+                Candidate c = { n, finished ? _scratch[n] : 0, finished ? 0 : _scratch[n] };
+                to->candidates.push_back(c);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < from.candidates.size(); i++) {
+            const Candidate &f = from.candidates[i];
+            float s = _scratch[f.number];
+            if (s > 0) {
+                Candidate c = { f.number, f.base + (finished ? s : 0), finished ? 0 : s };
+                to->candidates.push_back(c);
+            }
+        }
+    }
+    std::fill(_scratch.begin(), _scratch.end(), 0.0f);
+}
+
+void IncrementalSearch::narrowByForward(const State &from, uint32_t first, uint32_t last, bool finished, State *to)
+{
+    uint32_t low = first << 8;
+    for (size_t i = 0; i < from.candidates.size(); i++) {
+        const Candidate &f = from.candidates[i];
+        const uint32_t *end = _index.forwardEnd(f.number);
+        const uint32_t *p = std::lower_bound(_index.forwardBegin(f.number), end, low);
+        float best = 0;
+        for (; p < end && (*p >> 8) < last; p++) {
+            best = std::max(best, SearchIndex::termScore(_idf[*p >> 8], SearchIndex::forwardFrequency(*p)));
+        }
+        if (best > 0) {
+            Candidate c = { f.number, f.base + (finished ? best : 0), finished ? 0 : best };
+            to->candidates.push_back(c);
+        }
+    }
+}
+
+void IncrementalSearch::narrow(const State &from, Slice word, bool finished, State *to)
+{
+    to->all = false;
+    to->candidates.clear();
+
+    uint32_t first;
+    uint32_t last;
+    if (finished) {
+        const IndexTerm *term = _index.find(word);
+        first = term ? _index.termIndex(*term) : 0;
+        last = term ? first + 1 : 0;
+    } else {
+        _index.prefixRange(word, &first, &last);
+    }
+    if (first >= last || (!from.all && from.candidates.empty())) {
+        return;
+    }
+
+    if (from.all) {
+        narrowByPostings(from, first, last, finished, to);
+        return;
+    }
+    size_t postingsCost = 0;
+    for (uint32_t t = first; t < last && postingsCost < from.candidates.size() * kForwardCheckCost; t++) {
+        postingsCost += _index.term(t).postingsSize;
+    }
+    if (postingsCost < from.candidates.size() * kForwardCheckCost) {
+        narrowByPostings(from, first, last, finished, to);
+    } else {
+        narrowByForward(from, first, last, finished, to);
+    }
+}
+
+// Best first; ties by hymn number.
+static bool betterHit(const SearchHit &a, const SearchHit &b)
+{
+    if (a.score != b.score) {
+        return a.score > b.score;
+    }
+    return a.number < b.number;
+}
+
+void IncrementalSearch::update(Slice text, size_t limit, std::vector<SearchHit> *hits)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    char buffer[kMaxPrefixBytes];
+    std::string key(buffer, normalizePrefix(text, buffer));
+
+    // Back off to the deepest state the new text extends.
+    while (_states.size() > 1 && !startsWith(key, _states.back().key)) {
+        _states.pop_back();
+    }
+    bool reused = _states.back().key == key;
+    bool fromScratch = _states.size() == 1 && !key.empty();
+
+    // Words of key from the one the top state was typing (or after its
+    // last finished word) on.
+    size_t pos = _states.back().key.size();
+    while (pos > 0 && key[pos - 1] != ' ') {
+        pos--;
+    }
+    while (!reused && pos < key.size()) {
+        size_t end = key.find(' ', pos);
+        bool finished = end != std::string::npos;
+        if (!finished) {
+            end = key.size();
+            if (end - pos < kMinPrefixBytes) {
+                // Too short to narrow: answer with what the top state has.
+                reused = true;
+                break;
+            }
+        }
+        State next;
+        next.key = key.substr(0, finished ? end + 1 : end);
+        narrow(_states.back(), Slice(key.data() + pos, end - pos), finished, &next);
+        if (_states.size() >= kMaxStates) {
+            _states.erase(_states.begin() + 1);
+        }
+        _states.push_back(State());
+        _states.back().key.swap(next.key);
+        _states.back().all = next.all;
+        _states.back().candidates.swap(next.candidates);
+        _states.back().hitsLimit = 0;
+        pos = finished ? end + 1 : end;
+    }
+
+    // Ranking is kept with the state, so going back to it costs nothing.
+    State &top = _states.back();
+    if (!top.all && top.hitsLimit != limit) {
+        top.hits.clear();
+        for (size_t i = 0; i < top.candidates.size(); i++) {
+            SearchHit hit = { top.candidates[i].number, top.candidates[i].base + top.candidates[i].partial };
+            top.hits.push_back(hit);
+        }
+        size_t keep = std::min(limit, top.hits.size());
+        std::partial_sort(top.hits.begin(), top.hits.begin() + keep, top.hits.end(), betterHit);
+        top.hits.resize(keep);
+        top.hitsLimit = limit;
+    }
+    hits->assign(top.hits.begin(), top.hits.end());
+
+    double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    _stats.keystrokes++;
+    if (reused) {
+        _stats.reused++;
+    } else if (fromScratch) {
+        _stats.fromScratch++;
+    } else {
+        _stats.narrowed++;
+    }
+    if (micros > kKeystrokeBudgetMicros) {
+        _stats.overBudget++;
+    }
+    _stats.lastMicros = micros;
+    _stats.maxMicros = std::max(_stats.maxMicros, micros);
+    _stats.totalMicros += micros;
+    _stats.lastCandidates = candidateCount();
+}
+
+}
@@ -0,0 +1,88 @@
+//
+//  IncrementalSearch.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__IncrementalSearch__
+#define __LivroDeCanticos__IncrementalSearch__
+
+#include "SearchIndex.h"
+#include "Slice.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// Frame budget a keystroke should fit in, in microseconds.
+static const double kKeystrokeBudgetMicros = 8000;
+
+struct KeystrokeStats {
+    uint64_t keystrokes;
+    uint64_t reused;        // answered from a cached state (backspace, no change)
+    uint64_t narrowed;      // filtered the previous candidates
+    uint64_t fromScratch;   // first word, read from the postings
+    uint64_t overBudget;    // took longer than kKeystrokeBudgetMicros
+    double lastMicros;
+    double maxMicros;
+    double totalMicros;
+    size_t lastCandidates;
+};
+
+// Words being typed narrow the search only from this many bytes on; a
+// single letter matches nearly every hymn and would cost a corpus scan.
+static const size_t kMinPrefixBytes = 2;
+
+// Search-as-you-type session over one index.
+//
+// The text typed so far means: every finished word must occur in the hymn,
+// and the word being typed must start some word of the hymn. Each state
+// (the candidates for one typed text) is kept on a stack. Typing more only
+// ever narrows the candidates, so a keystroke filters the deepest state
+// whose text is a prefix of the new text; a backspace pops back to a state
+// that is already there. Filtering picks whichever is cheaper: checking
+// each candidate's forward list, or reading the postings of the new word.
+class IncrementalSearch {
+public:
+    explicit IncrementalSearch(const SearchIndex &index);
+
+    // text is the whole search bar content. hits gets the best limit hymns.
+    void update(Slice text, size_t limit, std::vector<SearchHit> *hits);
+    void reset();
+
+    size_t candidateCount() const { return _states.back().all ? _index.docCount() : _states.back().candidates.size(); }
+    const KeystrokeStats &stats() const { return _stats; }
+    void resetStats();
+
+private:
+    struct Candidate {
+        uint32_t number;
+        float base;     // score of the finished words
+        float partial;  // score of the word being typed
+    };
+    struct State {
+        std::string key;   // normalized text, see normalizePrefix()
+        bool all;          // no constraint yet: every hymn
+        std::vector<Candidate> candidates;
+        std::vector<SearchHit> hits;   // best candidates, once asked for
+        size_t hitsLimit;
+    };
+
+    void narrow(const State &from, Slice word, bool finished, State *to);
+    void narrowByPostings(const State &from, uint32_t first, uint32_t last, bool finished, State *to);
+    void narrowByForward(const State &from, uint32_t first, uint32_t last, bool finished, State *to);
+
+    const SearchIndex &_index;
+    std::vector<State> _states;   // _states[0] is the empty text
+    std::vector<float> _scratch;  // per hymn, used by narrowByPostings
+    std::vector<float> _idf;      // per term
+    KeystrokeStats _stats;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__IncrementalSearch__) */
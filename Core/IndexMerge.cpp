@@ -0,0 +1,551 @@
+//
+//  IndexMerge.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "IndexMerge.h"
+#include "Stemmer.h"
+#include "Varint.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace canticos {
+
+// Per field: weight, and how much the field's length normalizes it. A
+// title word counts three verse words and a refrain word two; titles are
+// all short, so their length matters less.
+static const float kFieldWeight[kFieldCount] = { 3.0f, 2.0f, 1.0f };
+static const float kFieldB[kFieldCount] = { 0.5f, 0.75f, 0.75f };
+
+// Ranges of terms merged apart, and terms sampled from each run to cut
+// them; enough ranges that threads finishing early find more to take.
+static const size_t kMergeRanges = 256;
+static const size_t kSamplesPerRun = 64;
+
+// Hymns whose forward lists are put together by one task.
+static const uint32_t kForwardBlockHymns = 1024;
+
+// Runs of a book for buildIndex when the pool has threads: about
+// kIndexRuns, of kMinRunHymns hymns at least, so a small book is not cut
+// finer than is worth a builder.
+static const uint32_t kIndexRuns = 256;
+static const uint32_t kMinRunHymns = 32;
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint64_t padded(uint64_t size)
+{
+    return (size + 7) & ~(uint64_t)7;
+}
+
+// A section into the file; an empty one may have no data to copy from.
+static void copySection(char *to, const void *from, size_t size)
+{
+    if (size > 0) {
+        memcpy(to, from, size);
+    }
+}
+
+// Byte order, as std::string compares.
+static int compareTerms(Slice a, Slice b)
+{
+    int order = memcmp(a.data, b.data, std::min(a.size, b.size));
+    if (order != 0) {
+        return order;
+    }
+    return a.size < b.size ? -1 : a.size > b.size;
+}
+
+namespace {
+
+// One range of terms, merged: its sections as they go in the file, with
+// offsets and term indexes from the range's start, and the forward list
+// entries of its terms per block of hymns, as hymn << 32 | term << 8 |
+// weighted frequency.
+struct MergedRange {
+    std::vector<IndexTerm> terms;
+    std::string lexicon;
+    std::string postings;
+    std::string positions;
+    std::string offsets;
+    std::vector<IndexSkip> skips;
+    std::vector<std::vector<uint64_t> > forward;
+};
+
+// Where a run is in a range's merge, and in the hymns of its head term.
+struct RunHead {
+    const IndexRun *run;
+    uint32_t index;
+    size_t term;
+    size_t end;
+    size_t posting;
+    size_t position;
+
+    Slice text() const { return run->term(term); }
+};
+
+// Min-heap on the head terms, equal terms in run order, which is hymn
+// order.
+struct LaterHead {
+    bool operator()(const RunHead &a, const RunHead &b) const
+    {
+        int order = compareTerms(a.text(), b.text());
+        return order != 0 ? order > 0 : a.index > b.index;
+    }
+};
+
+struct TermBefore {
+    const IndexRun *run;
+    bool operator()(size_t t, const std::string &cut) const { return compareTerms(run->term(t), Slice(cut)) < 0; }
+};
+
+}
+
+// First term of run at cut or after it.
+static size_t runTermAt(const IndexRun &run, const std::string &cut)
+{
+    TermBefore before = { &run };
+    size_t first = 0;
+    size_t count = run.termCount();
+    while (count > 0) {
+        size_t half = count / 2;
+        if (before(first + half, cut)) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+// Cuts between ranges: terms sampled evenly from every run, at even steps
+// through their sorted list. They only decide the work of each task.
+static void cutTerms(const std::vector<IndexRun> &runs, std::vector<std::string> *cuts)
+{
+    std::vector<std::string> samples;
+    for (size_t r = 0; r < runs.size(); r++) {
+        size_t count = runs[r].termCount();
+        for (size_t s = 0; s < std::min(count, kSamplesPerRun); s++) {
+            samples.push_back(runs[r].term(count * s / std::min(count, kSamplesPerRun)).str());
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    samples.erase(std::unique(samples.begin(), samples.end()), samples.end());
+    cuts->clear();
+    for (size_t c = 1; c < kMergeRanges; c++) {
+        size_t s = samples.size() * c / kMergeRanges;
+        if (s > 0 && s < samples.size() && (cuts->empty() || cuts->back() < samples[s])) {
+            cuts->push_back(samples[s]);
+        }
+    }
+}
+
+// The terms from cut first on to cut last (NULL for the first and past the
+// last term). The hymns of a term come a run at a time when the runs are
+// in hymn order, and else always from the run with the lowest next.
+static void mergeRange(const std::vector<IndexRun> &runs, bool ordered, const std::string *first,
+                       const std::string *last, const std::vector<float> &scales, MergedRange *range)
+{
+    std::vector<RunHead> heap;
+    for (size_t r = 0; r < runs.size(); r++) {
+        RunHead head = { &runs[r], (uint32_t)r, first ? runTermAt(runs[r], *first) : 0,
+                         last ? runTermAt(runs[r], *last) : runs[r].termCount(), 0, 0 };
+        if (head.term < head.end) {
+            heap.push_back(head);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), LaterHead());
+
+    const size_t stride = 1 + kFieldCount;
+    std::vector<RunHead> sharing;
+    while (!heap.empty()) {
+        sharing.clear();
+        do {
+            std::pop_heap(heap.begin(), heap.end(), LaterHead());
+            sharing.push_back(heap.back());
+            heap.pop_back();
+        } while (!heap.empty() && heap.front().text() == sharing[0].text());
+
+        Slice text = sharing[0].text();
+        bool forward = !isStemTerm(text);
+        uint64_t index = range->terms.size();
+        IndexTerm t;
+        memset(&t, 0, sizeof(t));
+        t.lexiconOffset = (uint32_t)range->lexicon.size();
+        t.lexiconSize = (uint32_t)text.size;
+        t.postingsOffset = range->postings.size();
+        t.positionsOffset = range->positions.size();
+        t.offsetsOffset = range->offsets.size();
+        t.firstSkip = (uint32_t)range->skips.size();
+        range->lexicon.append(text.data, text.size);
+
+        for (size_t h = 0; h < sharing.size(); h++) {
+            const IndexRun &run = *sharing[h].run;
+            size_t term = sharing[h].term;
+            sharing[h].posting = term ? (size_t)run.postingsEnds[term - 1] : 0;
+            sharing[h].position = term ? (size_t)run.positionsEnds[term - 1] : 0;
+        }
+        uint32_t previous = 0;
+        uint32_t hymns = 0;
+        for (size_t h = 0;; hymns++) {
+            if (ordered) {
+                while (h < sharing.size() && sharing[h].posting == sharing[h].run->postingsEnds[sharing[h].term]) {
+                    h++;
+                }
+            } else {
+                h = sharing.size();
+                for (size_t i = 0; i < sharing.size(); i++) {
+                    const RunHead &head = sharing[i];
+                    if (head.posting < head.run->postingsEnds[head.term]
+                        && (h == sharing.size() || head.run->postings[head.posting]
+                                                       < sharing[h].run->postings[sharing[h].posting])) {
+                        h = i;
+                    }
+                }
+            }
+            if (h == sharing.size()) {
+                break;
+            }
+            const IndexRun &run = *sharing[h].run;
+            uint32_t doc = run.postings[sharing[h].posting];
+            const uint32_t *tf = &run.postings[sharing[h].posting + 1];
+            size_t nextPosition = sharing[h].position;
+            if (hymns > 0 && hymns % kSkipInterval == 0) {
+                IndexSkip skip = { previous, (uint32_t)(range->postings.size() - t.postingsOffset),
+                                   (uint32_t)(range->positions.size() - t.positionsOffset),
+                                   (uint32_t)(range->offsets.size() - t.offsetsOffset) };
+                range->skips.push_back(skip);
+            }
+            putVarint(&range->postings, doc - previous);
+            putVarint(&range->postings, tf[kVerseField] << 2 | (tf[kTitleField] > 0) << 1 | (tf[kRefrainField] > 0));
+            if (tf[kTitleField] > 0) {
+                putVarint(&range->postings, tf[kTitleField]);
+            }
+            if (tf[kRefrainField] > 0) {
+                putVarint(&range->postings, tf[kRefrainField]);
+            }
+            previous = doc;
+            uint32_t lastPosition = 0;
+            uint32_t lastOffset = 0;
+            uint32_t count = tf[kTitleField] + tf[kRefrainField] + tf[kVerseField];
+            for (uint32_t n = 0; n < count; n++, nextPosition++) {
+                putVarint(&range->positions, run.positions[nextPosition] - lastPosition);
+                lastPosition = run.positions[nextPosition];
+                if (n == tf[kTitleField]) {
+                    lastOffset = 0;   // the body's words count from its start
+                }
+                putVarint(&range->offsets, run.offsets[2 * nextPosition] - lastOffset);
+                putVarint(&range->offsets, run.offsets[2 * nextPosition + 1]);
+                lastOffset = run.offsets[2 * nextPosition];
+            }
+            sharing[h].posting += stride;
+            sharing[h].position = nextPosition;
+
+            // Stems match no typed prefix, so they have no forward entries.
+            if (forward) {
+                const float *scale = &scales[(size_t)(doc - 1) * kFieldCount];
+                float frequency = 0;
+                for (size_t f = 0; f < kFieldCount; f++) {
+                    frequency += tf[f] * scale[f];
+                }
+                uint64_t quantized = (uint64_t)std::min(255.0f, std::max(1.0f, frequency * kForwardScale + 0.5f));
+                range->forward[(doc - 1) / kForwardBlockHymns].push_back((uint64_t)doc << 32 | index << 8 | quantized);
+            }
+        }
+        t.docFrequency = hymns;
+        t.postingsSize = (uint32_t)(range->postings.size() - t.postingsOffset);
+        t.positionsSize = (uint32_t)(range->positions.size() - t.positionsOffset);
+        t.offsetsSize = (uint32_t)(range->offsets.size() - t.offsetsOffset);
+        t.skipCount = (uint32_t)(range->skips.size() - t.firstSkip);
+        range->terms.push_back(t);
+
+        for (size_t h = 0; h < sharing.size(); h++) {
+            if (++sharing[h].term < sharing[h].end) {
+                heap.push_back(sharing[h]);
+                std::push_heap(heap.begin(), heap.end(), LaterHead());
+            }
+        }
+    }
+}
+
+void readIndexRun(const SearchIndex &index, const uint64_t *deleted, IndexRun *run)
+{
+    *run = IndexRun();
+    std::vector<uint32_t> lengths((size_t)index.docCount() * kFieldCount, 0);
+    std::vector<uint8_t> present(index.docCount(), 0);
+    for (uint32_t i = 0; i < index.termCount(); i++) {
+        const IndexTerm &term = index.term(i);
+        Slice text = index.termText(term);
+        bool word = !isStemTerm(text);
+        bool any = false;
+        PostingCursor cursor = index.cursor(term);
+        while (cursor.next()) {
+            uint32_t doc = cursor.doc;
+            if (deleted && (deleted[doc / 64] >> (doc % 64) & 1)) {
+                continue;
+            }
+            any = true;
+            run->postings.push_back(doc);
+            run->postings.insert(run->postings.end(), cursor.fieldTf, cursor.fieldTf + kFieldCount);
+            for (PositionReader reader = cursor.positions(); reader.position != PositionReader::kEnd; reader.next()) {
+                run->positions.push_back(reader.position);
+            }
+            const uint8_t *p = cursor.offsets();
+            uint32_t offset = 0;
+            for (uint32_t n = 0; n < cursor.tf; n++) {
+                if (n == cursor.fieldTf[kTitleField]) {
+                    offset = 0;
+                }
+                offset += getVarint(p, cursor.offsetsEnd());
+                run->offsets.push_back(offset);
+                run->offsets.push_back(getVarint(p, cursor.offsetsEnd()));
+            }
+            present[doc - 1] = 1;
+            for (size_t f = 0; word && f < kFieldCount; f++) {
+                lengths[(size_t)(doc - 1) * kFieldCount + f] += cursor.fieldTf[f];
+            }
+        }
+        if (any) {
+            run->lexicon.append(text.data, text.size);
+            run->termEnds.push_back(run->lexicon.size());
+            run->postingsEnds.push_back(run->postings.size());
+            run->positionsEnds.push_back(run->positions.size());
+        }
+    }
+    for (uint32_t d = 1; d <= index.docCount(); d++) {
+        if (!present[d - 1]) {
+            continue;
+        }
+        if (run->firstDoc == 0) {
+            run->firstDoc = d;
+        }
+        run->lastDoc = d;
+        run->hymnCount++;
+        for (size_t f = 0; f < kFieldCount; f++) {
+            run->totalFieldLength[f] += lengths[(size_t)(d - 1) * kFieldCount + f];
+        }
+    }
+    if (run->firstDoc) {
+        run->fieldLengths.assign(lengths.begin() + (size_t)(run->firstDoc - 1) * kFieldCount,
+                                 lengths.begin() + (size_t)run->lastDoc * kFieldCount);
+    }
+}
+
+void mergeIndexRuns(const std::vector<IndexRun> &runs, WorkerPool *pool, std::string *out, IndexBuildTimes *times,
+                    const float *averageFieldLength)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Field factors per hymn: weight / (1 - b + b * length / average).
+    // Runs that hold no hymns of another's are in hymn order.
+    uint32_t docCount = 0;
+    uint32_t hymnCount = 0;
+    uint64_t totals[kFieldCount] = { 0, 0, 0 };
+    bool ordered = true;
+    for (size_t r = 0; r < runs.size(); r++) {
+        if (runs[r].firstDoc == 0) {
+            continue;
+        }
+        ordered = ordered && runs[r].firstDoc > docCount;
+        docCount = std::max(docCount, runs[r].lastDoc);
+        hymnCount += runs[r].hymnCount;
+        for (size_t f = 0; f < kFieldCount; f++) {
+            totals[f] += runs[r].totalFieldLength[f];
+        }
+    }
+    std::vector<uint32_t> lengths((size_t)docCount * kFieldCount, 0);
+    for (size_t r = 0; r < runs.size(); r++) {
+        if (runs[r].firstDoc == 0) {
+            continue;
+        }
+        std::vector<uint32_t>::iterator to = lengths.begin() + (size_t)(runs[r].firstDoc - 1) * kFieldCount;
+        for (size_t i = 0; i < runs[r].fieldLengths.size(); i++) {
+            to[i] += runs[r].fieldLengths[i];
+        }
+    }
+    float averages[kFieldCount];
+    for (size_t f = 0; f < kFieldCount; f++) {
+        if (averageFieldLength) {
+            averages[f] = averageFieldLength[f];
+        } else {
+            averages[f] = hymnCount ? (float)((double)totals[f] / hymnCount) : 0;
+        }
+    }
+    std::vector<float> scales((size_t)docCount * kFieldCount);
+    for (size_t i = 0; i < scales.size(); i++) {
+        size_t f = i % kFieldCount;
+        float relative = averages[f] > 0 ? (float)lengths[i] / averages[f] : 0;
+        scales[i] = kFieldWeight[f] / (1 - kFieldB[f] + kFieldB[f] * relative);
+    }
+
+    // Without threads to share them, more ranges only cost their cuts.
+    std::vector<std::string> cuts;
+    if (pool->threadCount() > 0) {
+        cutTerms(runs, &cuts);
+    }
+    size_t blocks = (docCount + kForwardBlockHymns - 1) / kForwardBlockHymns;
+    std::vector<MergedRange> ranges(cuts.size() + 1);
+    pool->run(ranges.size(), [&](size_t r) {
+        ranges[r].forward.resize(blocks);
+        mergeRange(runs, ordered, r > 0 ? &cuts[r - 1] : NULL, r < cuts.size() ? &cuts[r] : NULL, scales, &ranges[r]);
+    });
+    if (times) {
+        times->merge = secondsSince(start);
+    }
+    start = std::chrono::steady_clock::now();
+
+    // Where each range's part of every section starts, and each block's
+    // part of the forward lists.
+    struct Bases {
+        uint64_t terms, lexicon, postings, positions, offsets, skips;
+    };
+    std::vector<Bases> bases(ranges.size() + 1);
+    memset(&bases[0], 0, sizeof(Bases));
+    for (size_t r = 0; r < ranges.size(); r++) {
+        bases[r + 1].terms = bases[r].terms + ranges[r].terms.size();
+        bases[r + 1].lexicon = bases[r].lexicon + ranges[r].lexicon.size();
+        bases[r + 1].postings = bases[r].postings + ranges[r].postings.size();
+        bases[r + 1].positions = bases[r].positions + ranges[r].positions.size();
+        bases[r + 1].offsets = bases[r].offsets + ranges[r].offsets.size();
+        bases[r + 1].skips = bases[r].skips + ranges[r].skips.size();
+    }
+    const Bases &total = bases[ranges.size()];
+    std::vector<uint64_t> blockStarts(blocks + 1, 0);
+    for (size_t b = 0; b < blocks; b++) {
+        blockStarts[b + 1] = blockStarts[b];
+        for (size_t r = 0; r < ranges.size(); r++) {
+            blockStarts[b + 1] += ranges[r].forward[b].size();
+        }
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+    header.version = kIndexVersion;
+    header.docCount = docCount;
+    header.termCount = (uint32_t)total.terms;
+    for (size_t f = 0; f < kFieldCount; f++) {
+        header.averageFieldLength[f] = averages[f];
+    }
+    header.termsOffset = sizeof(IndexHeader);
+    header.lexiconOffset = header.termsOffset + total.terms * sizeof(IndexTerm);
+    header.lexiconSize = total.lexicon;
+    header.postingsOffset = padded(header.lexiconOffset + total.lexicon);
+    header.postingsSize = total.postings;
+    header.positionsOffset = padded(header.postingsOffset + total.postings);
+    header.positionsSize = total.positions;
+    header.offsetsOffset = padded(header.positionsOffset + total.positions);
+    header.offsetsSize = total.offsets;
+    header.skipsOffset = padded(header.offsetsOffset + total.offsets);
+    header.skipCount = total.skips;
+    header.fieldScalesOffset = padded(header.skipsOffset + total.skips * sizeof(IndexSkip));
+    header.forwardStartsOffset = padded(header.fieldScalesOffset + scales.size() * sizeof(float));
+    header.forwardOffset = header.forwardStartsOffset + ((uint64_t)docCount + 1) * sizeof(uint64_t);
+    header.forwardCount = blockStarts[blocks];
+    header.fileSize = header.forwardOffset + header.forwardCount * sizeof(uint32_t);
+
+    out->assign(header.fileSize, '\0');
+    char *file = &(*out)[0];
+    memcpy(file, &header, sizeof(header));
+    copySection(file + header.fieldScalesOffset, scales.data(), scales.size() * sizeof(float));
+    memcpy(file + header.forwardStartsOffset + (uint64_t)docCount * sizeof(uint64_t), &header.forwardCount,
+           sizeof(uint64_t));
+
+    // Tasks for the ranges' sections, then for the blocks' forward lists,
+    // each writing bytes of its own.
+    pool->run(ranges.size() + blocks, [&](size_t task) {
+        if (task < ranges.size()) {
+            const MergedRange &range = ranges[task];
+            const Bases &base = bases[task];
+            char *terms = file + header.termsOffset + base.terms * sizeof(IndexTerm);
+            for (size_t t = 0; t < range.terms.size(); t++) {
+                IndexTerm term = range.terms[t];
+                term.lexiconOffset += (uint32_t)base.lexicon;
+                term.postingsOffset += base.postings;
+                term.positionsOffset += base.positions;
+                term.offsetsOffset += base.offsets;
+                term.firstSkip += (uint32_t)base.skips;
+                memcpy(terms + t * sizeof(IndexTerm), &term, sizeof(term));
+            }
+            copySection(file + header.lexiconOffset + base.lexicon, range.lexicon.data(), range.lexicon.size());
+            copySection(file + header.postingsOffset + base.postings, range.postings.data(), range.postings.size());
+            copySection(file + header.positionsOffset + base.positions, range.positions.data(),
+                        range.positions.size());
+            copySection(file + header.offsetsOffset + base.offsets, range.offsets.data(), range.offsets.size());
+            copySection(file + header.skipsOffset + base.skips * sizeof(IndexSkip), range.skips.data(),
+                        range.skips.size() * sizeof(IndexSkip));
+            return;
+        }
+
+        // Each hymn's entries come range by range and, within a range, in
+        // term order, so its list comes out sorted.
+        size_t b = task - ranges.size();
+        uint32_t firstDoc = (uint32_t)b * kForwardBlockHymns + 1;
+        uint32_t docs = std::min(kForwardBlockHymns, docCount - firstDoc + 1);
+        std::vector<uint64_t> starts(docs + 1, 0);
+        for (size_t r = 0; r < ranges.size(); r++) {
+            const std::vector<uint64_t> &entries = ranges[r].forward[b];
+            for (size_t e = 0; e < entries.size(); e++) {
+                starts[(uint32_t)(entries[e] >> 32) - firstDoc + 1]++;
+            }
+        }
+        starts[0] = blockStarts[b];
+        for (uint32_t d = 0; d < docs; d++) {
+            starts[d + 1] += starts[d];
+        }
+        memcpy(file + header.forwardStartsOffset + (uint64_t)(firstDoc - 1) * sizeof(uint64_t), starts.data(),
+               docs * sizeof(uint64_t));
+        char *forward = file + header.forwardOffset;
+        for (size_t r = 0; r < ranges.size(); r++) {
+            const std::vector<uint64_t> &entries = ranges[r].forward[b];
+            uint32_t shift = (uint32_t)bases[r].terms << 8;
+            for (size_t e = 0; e < entries.size(); e++) {
+                uint32_t entry = (uint32_t)entries[e] + shift;
+                uint64_t &at = starts[(uint32_t)(entries[e] >> 32) - firstDoc];
+                memcpy(forward + at++ * sizeof(uint32_t), &entry, sizeof(entry));
+            }
+        }
+    });
+    if (times) {
+        times->write = secondsSince(start);
+    }
+}
+
+void buildIndex(uint32_t count, const IndexSource &source, WorkerPool *pool, std::string *out,
+                IndexBuildTimes *times)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t hymnsPerRun = std::max(kMinRunHymns, (count + kIndexRuns - 1) / kIndexRuns);
+    if (pool->threadCount() == 0) {
+        // The caller alone gains nothing from runs but their merge.
+        hymnsPerRun = std::max(count, 1u);
+    }
+    std::vector<IndexRun> runs((count + hymnsPerRun - 1) / hymnsPerRun);
+    pool->run(runs.size(), [&](size_t r) {
+        uint32_t first = (uint32_t)r * hymnsPerRun + 1;
+        uint32_t last = std::min(count, first + hymnsPerRun - 1);
+        IndexBuilder builder;
+        for (uint32_t n = first; n <= last; n++) {
+            Slice title;
+            Slice body;
+            source(n, &title, &body);
+            builder.addDocument(n, title, body);
+        }
+        builder.takeRun(&runs[r]);
+    });
+    if (times) {
+        times->tokenize = secondsSince(start);
+    }
+    mergeIndexRuns(runs, pool, out, times);
+}
+
+}
@@ -0,0 +1,86 @@
+//
+//  IndexMerge.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__IndexMerge__
+#define __LivroDeCanticos__IndexMerge__
+
+#include "SearchIndex.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+class WorkerPool;
+
+// The hymns of one IndexBuilder, or of an index read back, frozen for the
+// merge: its terms in byte order, each with its postings (doc, then tf per
+// field), positions and offsets as the builder kept them, laid end to end.
+struct IndexRun {
+    std::string lexicon;                 // the terms' bytes, in order
+    std::vector<uint64_t> termEnds;      // per term, where it ends in lexicon
+    std::vector<uint64_t> postingsEnds;  // per term, where its postings end
+    std::vector<uint64_t> positionsEnds; // per term, where its positions end
+    std::vector<uint32_t> postings;
+    std::vector<uint32_t> positions;
+    std::vector<uint32_t> offsets;       // two per position
+    std::vector<uint32_t> fieldLengths;  // per hymn from firstDoc: words per field
+    uint64_t totalFieldLength[kFieldCount];
+    uint32_t firstDoc;                   // 0 when the run has no hymns
+    uint32_t lastDoc;
+    uint32_t hymnCount;                  // not every number between need be one
+
+    size_t termCount() const { return termEnds.size(); }
+    Slice term(size_t t) const
+    {
+        size_t start = t ? (size_t)termEnds[t - 1] : 0;
+        return Slice(lexicon.data() + start, (size_t)termEnds[t] - start);
+    }
+};
+
+// The hymns of an index but those set in deleted (a bitmap by hymn number,
+// NULL for none) as a run, as its builder would give it. Field lengths are
+// counted back from the frequencies of the word terms, so a hymn with no
+// words at all is left out.
+void readIndexRun(const SearchIndex &index, const uint64_t *deleted, IndexRun *run);
+
+// Wall clock seconds of each phase of buildIndex.
+struct IndexBuildTimes {
+    double tokenize;    // hymns into runs
+    double merge;       // runs into the sections of the file, by term
+    double write;       // forward lists and the sections into place
+};
+
+// Writes the index file of runs no two of which hold the same hymn. The
+// term space is cut into ranges that are merged apart on the pool, a k-way
+// merge of the runs each, or is one range on a pool without threads; the
+// forward lists are then put together by blocks of hymns. Every cut falls
+// between whole terms or whole hymns, so the bytes are those of one
+// builder given every hymn, whatever the runs and the pool. Runs of
+// consecutive hymns given in hymn order merge fastest. Field lengths are
+// normalized by averageFieldLength when it is given, and else by the
+// averages over the runs' hymns.
+void mergeIndexRuns(const std::vector<IndexRun> &runs, WorkerPool *pool, std::string *out,
+                    IndexBuildTimes *times = NULL, const float *averageFieldLength = NULL);
+
+// Gives the title and body of hymn number; called from any thread of the
+// pool, for every number once.
+typedef std::function<void(uint32_t number, Slice *title, Slice *body)> IndexSource;
+
+// The index of hymns 1 ... count, built on the pool: hymns are tokenized,
+// folded and stemmed by runs of consecutive hymns, one builder each, and
+// the runs are merged as above; a pool without threads gets one builder
+// for all of them. The bytes are the same with any number of threads.
+void buildIndex(uint32_t count, const IndexSource &source, WorkerPool *pool, std::string *out,
+                IndexBuildTimes *times = NULL);
+
+}
+
+#endif /* defined(__LivroDeCanticos__IndexMerge__) */
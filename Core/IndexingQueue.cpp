@@ -0,0 +1,173 @@
+//
+//  IndexingQueue.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "IndexingQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace canticos {
+
+// A batch commits once this many changes are queued, or once its first
+// has waited kBatchWait.
+static const size_t kMaxBatch = 4096;
+static const std::chrono::milliseconds kBatchWait(2);
+
+IndexingQueue::IndexingQueue(SegmentedIndex *index)
+    : _index(index), _writing(0), _flushes(0), _stop(false)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _worker = std::thread(&IndexingQueue::commitLoop, this);
+}
+
+IndexingQueue::~IndexingQueue()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _worker.join();
+}
+
+void IndexingQueue::addOrReplace(uint32_t number, Slice title, Slice body)
+{
+    HymnChange change;
+    change.number = number;
+    change.removed = false;
+    change.title = title.str();
+    change.body = body.str();
+    enqueue(change);
+}
+
+void IndexingQueue::remove(uint32_t number)
+{
+    HymnChange change;
+    change.number = number;
+    change.removed = true;
+    enqueue(change);
+}
+
+void IndexingQueue::enqueue(const HymnChange &change)
+{
+    if (change.number == 0) {
+        return;
+    }
+    bool wake;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stats.queued++;
+        std::unordered_map<uint32_t, size_t>::iterator it = _positions.find(change.number);
+        if (it != _positions.end()) {
+            // Waits in the place, and since the time, of the one it overtakes.
+            _pending[it->second] = change;
+            _stats.coalesced++;
+            return;
+        }
+        _positions[change.number] = _pending.size();
+        _pending.push_back(change);
+        _queuedAt.push_back(Clock::now());
+        _stats.backlog = (uint32_t)_pending.size() + _writing;
+        _stats.maxBacklog = std::max(_stats.maxBacklog, _stats.backlog);
+        // The worker only needs waking for a batch to start or to fill.
+        wake = _pending.size() == 1 || _pending.size() == kMaxBatch;
+    }
+    if (wake) {
+        _wake.notify_one();
+    }
+}
+
+uint32_t IndexingQueue::queuedOperationCount() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats.backlog;
+}
+
+void IndexingQueue::cancelIndexing()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _stats.cancelled += _pending.size();
+    _pending.clear();
+    _positions.clear();
+    _queuedAt.clear();
+    _stats.backlog = _writing;
+    if (_writing == 0) {
+        _idle.notify_all();
+    }
+}
+
+void IndexingQueue::waitUntilIndexingIsFinished()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    _flushes++;
+    _wake.notify_one();
+    while (!_stop && (_writing > 0 || !_pending.empty())) {
+        _idle.wait(guard);
+    }
+    _flushes--;
+}
+
+IndexingQueueStats IndexingQueue::stats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+void IndexingQueue::commitLoop()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    for (;;) {
+        while (!_stop && _pending.empty()) {
+            _wake.wait(guard);
+        }
+        // Lets the batch fill, unless someone waits for it.
+        while (!_stop && !_pending.empty() && _pending.size() < kMaxBatch && _flushes == 0
+               && Clock::now() < _queuedAt.front() + kBatchWait) {
+            _wake.wait_until(guard, _queuedAt.front() + kBatchWait);
+        }
+        if (_stop) {
+            break;
+        }
+        if (_pending.empty()) {
+            continue;   // cancelled meanwhile
+        }
+
+        std::vector<HymnChange> batch;
+        std::vector<Clock::time_point> queuedAt;
+        batch.swap(_pending);
+        queuedAt.swap(_queuedAt);
+        _positions.clear();
+        _writing = (uint32_t)batch.size();
+        guard.unlock();
+
+        Clock::time_point start = Clock::now();
+        _index->apply(batch);
+        Clock::time_point end = Clock::now();
+
+        guard.lock();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        _stats.committed += batch.size();
+        _stats.batches++;
+        _stats.commitSeconds += seconds;
+        _stats.maxCommitSeconds = std::max(_stats.maxCommitSeconds, seconds);
+        _stats.maxWaitSeconds = std::max(_stats.maxWaitSeconds,
+                                         std::chrono::duration<double>(end - queuedAt.front()).count());
+        _writing = 0;
+        _stats.backlog = (uint32_t)_pending.size();
+        if (_pending.empty()) {
+            _idle.notify_all();
+        }
+    }
+    _stats.cancelled += _pending.size();
+    _pending.clear();
+    _positions.clear();
+    _queuedAt.clear();
+    _stats.backlog = 0;
+    _idle.notify_all();
+}
+
+}
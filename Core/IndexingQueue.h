@@ -0,0 +1,97 @@
+//
+//  IndexingQueue.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__IndexingQueue__
+#define __LivroDeCanticos__IndexingQueue__
+
+#include "SegmentedIndex.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace canticos {
+
+struct IndexingQueueStats {
+    uint64_t queued;        // changes handed in
+    uint64_t coalesced;     // of them, overtaken by a later change of the same hymn before it was written
+    uint64_t cancelled;     // dropped by cancelIndexing
+    uint64_t committed;     // changes written
+    uint64_t batches;       // commits, one segment each
+    uint32_t backlog;       // queued or being written now: queuedOperationCount
+    uint32_t maxBacklog;
+    double commitSeconds;   // spent in every commit, SegmentedIndex::apply
+    double maxCommitSeconds;
+    double maxWaitSeconds;  // longest a change waited from queued to searchable
+};
+
+// Changes for a SegmentedIndex, written in the background in batches, as
+// LSLocaytaSearchIndexer's queue of addOrReplaceRecord: calls was. A
+// change waits in the queue until its batch commits: a later change of
+// the same hymn takes its place there, so only the last is written, and
+// every change queued meanwhile commits with it, as one apply and one new
+// segment. A batch is held back until 4096 changes are queued or the
+// first of them has waited 2 ms, so a loop of single calls costs
+// about what one call with them all does; a commit running meanwhile
+// holds the next batch back further, and it grows the bigger.
+//
+// Every call may come from any thread. The index must outlive the queue.
+class IndexingQueue {
+public:
+    explicit IndexingQueue(SegmentedIndex *index);
+    ~IndexingQueue();   // cancels what is still queued
+
+    void addOrReplace(uint32_t number, Slice title, Slice body);
+    void remove(uint32_t number);
+    void enqueue(const HymnChange &change);
+
+    // Changes queued or being written, as queuedOperationCount.
+    uint32_t queuedOperationCount() const;
+
+    // Drops every queued change. A batch already being written lands
+    // whole, as SegmentedIndex::apply does.
+    void cancelIndexing();
+
+    // Commits what is queued at once, without waiting for the batch to
+    // fill, and returns when searches see it.
+    void waitUntilIndexingIsFinished();
+
+    IndexingQueueStats stats() const;
+
+private:
+    IndexingQueue(const IndexingQueue &) = delete;
+    IndexingQueue &operator=(const IndexingQueue &) = delete;
+
+    typedef std::chrono::steady_clock Clock;
+
+    void commitLoop();
+
+    SegmentedIndex *_index;
+
+    // All under _lock.
+    mutable std::mutex _lock;
+    std::vector<HymnChange> _pending;                   // in the order they came, a hymn once
+    std::unordered_map<uint32_t, size_t> _positions;    // hymn number to its place in _pending
+    std::vector<Clock::time_point> _queuedAt;           // per change of _pending, when it first came
+    uint32_t _writing;                                  // changes of the batch being written
+    uint32_t _flushes;                                  // waitUntilIndexingIsFinished calls waiting
+    IndexingQueueStats _stats;
+
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    bool _stop;
+    std::thread _worker;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__IndexingQueue__) */
@@ -0,0 +1,379 @@
+//
+//  Layout.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Layout.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace canticos {
+
+// Advance tables
+
+static bool badTable(std::string *error, uint32_t line, const char *why)
+{
+    if (error) {
+        char where[32];
+        snprintf(where, sizeof(where), "line %u: ", line);
+        *error = where + std::string(why);
+    }
+    return false;
+}
+
+bool parseAdvanceTable(Slice text, AdvanceTable *table, std::string *error)
+{
+    *table = AdvanceTable();
+    uint32_t lineNumber = 0;
+    for (size_t start = 0; start < text.size;) {
+        size_t end = start;
+        while (end < text.size && text.data[end] != '\n') {
+            end++;
+        }
+        std::string line(text.data + start, end > start && text.data[end - 1] == '\r' ? end - start - 1 : end - start);
+        lineNumber++;
+        start = end + 1;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t space = line.find(' ');
+        if (space == std::string::npos) {
+            return badTable(error, lineNumber, "expected a name and a value");
+        }
+        std::string name = line.substr(0, space);
+        std::string value = line.substr(space + 1);
+        if (name == "font") {
+            table->font = value;
+            continue;
+        }
+        char *rest = NULL;
+        unsigned long number = strtoul(value.c_str(), &rest, 10);
+        if (value.empty() || *rest != '\0' || number > 0xFFFF) {
+            return badTable(error, lineNumber, "bad value");
+        }
+        if (name == "unitsPerEm") {
+            table->unitsPerEm = (uint32_t)number;
+        } else if (name == "ascent") {
+            table->ascent = (uint32_t)number;
+        } else if (name == "descent") {
+            table->descent = (uint32_t)number;
+        } else if (name == "leading") {
+            table->leading = (uint32_t)number;
+        } else if (name == "default") {
+            table->defaultAdvance = (uint32_t)number;
+        } else {
+            unsigned long unit = strtoul(name.c_str(), &rest, 16);
+            if (*rest != '\0' || unit > 0xFFFF || number == 0) {
+                return badTable(error, lineNumber, "bad code point");
+            }
+            if (table->advances.size() <= unit) {
+                table->advances.resize(unit + 1, 0);
+            }
+            table->advances[unit] = (uint16_t)number;
+        }
+    }
+    if (table->unitsPerEm == 0 || table->lineHeight() == 0 || table->defaultAdvance == 0) {
+        return badTable(error, lineNumber, "unitsPerEm, ascent and default are required");
+    }
+    return true;
+}
+
+void writeAdvanceTable(const AdvanceTable &table, std::string *out)
+{
+    char line[64];
+    *out = "font " + table.font + "\n";
+    snprintf(line, sizeof(line), "unitsPerEm %u\nascent %u\ndescent %u\nleading %u\ndefault %u\n", table.unitsPerEm,
+             table.ascent, table.descent, table.leading, table.defaultAdvance);
+    *out += line;
+    for (size_t unit = 0; unit < table.advances.size(); unit++) {
+        if (table.advances[unit]) {
+            snprintf(line, sizeof(line), "%04X %u\n", (unsigned)unit, table.advances[unit]);
+            *out += line;
+        }
+    }
+}
+
+uint32_t layoutLimit(const AdvanceTable &table, const LayoutParams &params)
+{
+    if (params.size <= 0 || params.width <= 0) {
+        return 0;
+    }
+    double limit = floor((double)params.width * table.unitsPerEm / params.size);
+    return limit < kNoLayoutBreak ? (uint32_t)limit : kNoLayoutBreak - 1;
+}
+
+// Line breaking
+
+static bool isLineBreak(uint16_t unit)
+{
+    return unit == '\n' || unit == '\r' || unit == 0x2028 || unit == 0x2029;
+}
+
+static bool isBreakingSpace(uint16_t unit)
+{
+    return unit == ' ' || unit == '\t';
+}
+
+// A line may break after these, inside a word: "Alegrem-|se".
+static bool isHyphen(uint16_t unit)
+{
+    return unit == '-' || unit == 0x2010 || unit == 0x2013 || unit == 0x2014;
+}
+
+// Greedy breaking, as UIKit wraps words: a line takes words while they
+// fit, trailing spaces hanging past the edge; a word wider than a line of
+// its own is cut between characters. Only the decisions that depend on
+// the limit are recorded in fits and breaks.
+static void layoutBlock(const uint16_t *text, uint32_t start, uint32_t end, const AdvanceTable &table,
+                        uint32_t limit, std::vector<uint32_t> *lineStarts, LayoutBlock *block)
+{
+    block->firstLine = (uint32_t)lineStarts->size();
+    block->fits = 0;
+    block->breaks = kNoLayoutBreak;
+
+    uint32_t p = start;
+    for (;;) {
+        lineStarts->push_back(p);
+        uint32_t width = 0;         // up to the end of the last word
+        uint32_t pending = 0;       // the spaces after it
+        bool used = false;
+        while (p < end && isBreakingSpace(text[p])) {
+            width += table.advance(text[p++]);
+            used = true;
+        }
+        while (p < end && !isLineBreak(text[p])) {
+            uint32_t wordStart = p;
+            uint32_t word = 0;
+            while (p < end && !isLineBreak(text[p]) && !isBreakingSpace(text[p])) {
+                uint16_t unit = text[p++];
+                word += table.advance(unit);
+                if (isHyphen(unit) && p < end && !isLineBreak(text[p]) && !isBreakingSpace(text[p])) {
+                    break;
+                }
+            }
+            uint32_t wordEnd = p;
+
+            uint32_t candidate = width + pending + word;
+            bool placed = candidate <= limit;
+            if (placed) {
+                block->fits = std::max(block->fits, candidate);
+                width = candidate;
+            } else {
+                block->breaks = std::min(block->breaks, candidate);
+                if (used) {
+                    lineStarts->push_back(wordStart);
+                    width = 0;
+                    placed = word <= limit;
+                    if (placed) {
+                        block->fits = std::max(block->fits, word);
+                        width = word;
+                    } else {
+                        block->breaks = std::min(block->breaks, word);
+                    }
+                }
+            }
+            if (!placed) {
+                // The line is empty here. A character wider than a whole
+                // line has one to itself, whatever the limit.
+                bool fresh = true;
+                for (uint32_t q = wordStart; q < wordEnd; q++) {
+                    uint32_t a = table.advance(text[q]);
+                    if (a == 0) {
+                        continue;
+                    }
+                    if (width + a <= limit) {
+                        block->fits = std::max(block->fits, width + a);
+                        width += a;
+                    } else if (fresh) {
+                        width += a;
+                    } else {
+                        block->breaks = std::min(block->breaks, width + a);
+                        lineStarts->push_back(q);
+                        width = a;
+                        if (a <= limit) {
+                            block->fits = std::max(block->fits, a);
+                        }
+                    }
+                    fresh = false;
+                }
+            }
+            used = true;
+
+            pending = 0;
+            while (p < end && isBreakingSpace(text[p])) {
+                pending += table.advance(text[p++]);
+            }
+        }
+        if (p >= end) {
+            break;
+        }
+        p += text[p] == '\r' && p + 1 < end && text[p + 1] == '\n' ? 2 : 1;
+        if (p >= end) {
+            break;
+        }
+    }
+    block->lineCount = (uint32_t)lineStarts->size() - block->firstLine;
+}
+
+static void paginate(const AdvanceTable &table, const LayoutParams &params, HymnLayout *out)
+{
+    double lineHeight = (double)table.lineHeight() * params.size / table.unitsPerEm;
+    uint32_t perPage = 0xFFFFFFFF;
+    if (params.height > 0 && lineHeight > 0) {
+        perPage = (uint32_t)std::max(1.0, std::min(floor(params.height / lineHeight), 65536.0));
+    }
+    out->linesPerPage = perPage;
+    out->pages.clear();
+    LayoutPage first = { 0, 0 };
+    out->pages.push_back(first);
+
+    uint64_t used = 0;
+    for (uint32_t b = 0; b < out->blocks.size(); b++) {
+        uint32_t lines = out->blocks[b].lineCount;
+        uint64_t need = used ? (uint64_t)lines + 1 : lines;
+        if (used + need <= perPage) {
+            used += need;
+            continue;
+        }
+        if (used) {
+            LayoutPage page = { b, 0 };
+            out->pages.push_back(page);
+        }
+        uint32_t line = 0;
+        while (lines - line > perPage) {
+            line += perPage;
+            LayoutPage page = { b, line };
+            out->pages.push_back(page);
+        }
+        used = lines - line;
+    }
+}
+
+// The face block b is set in: 0 is the title, the others the stanzas.
+static const AdvanceTable &blockFace(const PreparedHymn &hymn, const LayoutFaces &faces, uint32_t b)
+{
+    const AdvanceTable *face = b == 0 ? faces.title : hymn.stanzas[b - 1].refrain ? faces.refrain : NULL;
+    return face ? *face : *faces.text;
+}
+
+uint32_t layoutHymn(const PreparedHymn &hymn, const LayoutFaces &faces, const LayoutParams &params,
+                    const HymnLayout *base, HymnLayout *out)
+{
+    uint32_t limit = layoutLimit(*faces.text, params);
+    uint32_t blockCount = (uint32_t)hymn.stanzas.size() + 1;
+    out->number = hymn.number;
+    out->limit = limit;
+    out->blocks.resize(blockCount);
+    out->lineStarts.clear();
+    if (base && (base->number != hymn.number || base->blocks.size() != blockCount)) {
+        base = NULL;
+    }
+
+    uint32_t reused = 0;
+    for (uint32_t b = 0; b < blockCount; b++) {
+        const AdvanceTable &face = blockFace(hymn, faces, b);
+        uint32_t blockLimit = &face == faces.text ? limit : layoutLimit(face, params);
+        if (base) {
+            const LayoutBlock &old = base->blocks[b];
+            if (old.fits <= blockLimit && blockLimit < old.breaks) {
+                LayoutBlock &block = out->blocks[b];
+                block = old;
+                block.firstLine = (uint32_t)out->lineStarts.size();
+                out->lineStarts.insert(out->lineStarts.end(), base->lineStarts.begin() + old.firstLine,
+                                       base->lineStarts.begin() + old.firstLine + old.lineCount);
+                reused++;
+                continue;
+            }
+        }
+        uint32_t start = b ? hymn.stanzas[b - 1].utf16Offset : 0;
+        uint32_t end = b ? start + hymn.stanzas[b - 1].utf16Size : hymn.titleUtf16Size;
+        layoutBlock(hymn.text.data(), start, end, face, blockLimit, &out->lineStarts, &out->blocks[b]);
+    }
+    paginate(*faces.text, params, out);
+    return reused;
+}
+
+// LayoutCache
+
+// Layouts a hymn keeps per faces: a couple of sizes, both orientations.
+static const size_t kLayoutVersions = 4;
+
+LayoutCache::LayoutCache(size_t budgetBytes) : _budget(budgetBytes)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+static bool sameParams(const LayoutParams &a, const LayoutParams &b)
+{
+    return a.size == b.size && a.width == b.width && a.height == b.height;
+}
+
+LayoutCache::Layout LayoutCache::layout(const PreparedHymn &hymn, const LayoutFaces &faces,
+                                        const LayoutParams &params)
+{
+    Key key = { faces, hymn.number };
+    std::unordered_map<Key, Entry, KeyHash>::iterator it = _entries.find(key);
+    if (it == _entries.end()) {
+        _uses.push_front(key);
+        Entry entry;
+        entry.use = _uses.begin();
+        it = _entries.insert(std::make_pair(key, entry)).first;
+    } else {
+        _uses.splice(_uses.begin(), _uses, it->second.use);
+    }
+    std::vector<Entry::Version> &versions = it->second.versions;
+    for (size_t v = 0; v < versions.size(); v++) {
+        if (sameParams(versions[v].params, params)) {
+            std::rotate(versions.begin(), versions.begin() + v, versions.begin() + v + 1);
+            _stats.hits++;
+            return versions[0].layout;
+        }
+    }
+
+    _stats.misses++;
+    std::shared_ptr<HymnLayout> layout = std::make_shared<HymnLayout>();
+    const HymnLayout *base = versions.empty() ? NULL : versions[0].layout.get();
+    uint32_t reused = layoutHymn(hymn, faces, params, base, layout.get());
+    if (base) {
+        _stats.relayouts++;
+    }
+    _stats.blocksReused += reused;
+    _stats.blocksLaidOut += layout->blocks.size() - reused;
+
+    Entry::Version version = { params, layout };
+    versions.insert(versions.begin(), version);
+    _stats.bytes += layout->bytes();
+    _stats.layouts++;
+    if (versions.size() > kLayoutVersions) {
+        _stats.bytes -= versions.back().layout->bytes();
+        _stats.layouts--;
+        _stats.evicted++;
+        versions.pop_back();
+    }
+    evict();
+    return layout;
+}
+
+void LayoutCache::evict()
+{
+    // The hymn just laid out stays, even over the budget.
+    while (_stats.bytes > _budget && _uses.size() > 1) {
+        std::unordered_map<Key, Entry, KeyHash>::iterator it = _entries.find(_uses.back());
+        for (size_t v = 0; v < it->second.versions.size(); v++) {
+            _stats.bytes -= it->second.versions[v].layout->bytes();
+            _stats.layouts--;
+            _stats.evicted++;
+        }
+        _entries.erase(it);
+        _uses.pop_back();
+    }
+}
+
+}
@@ -0,0 +1,210 @@
+//
+//  Layout.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Layout__
+#define __LivroDeCanticos__Layout__
+
+#include "HymnCache.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace canticos {
+
+// Advance widths of one font, in font units, as recorded from the font
+// itself: by advance-table from a font file, or by CoreText on the device.
+// Text format, one field or code point a line, # starts a comment:
+//
+//   font Arial-BoldMT
+//   unitsPerEm 2048
+//   ascent 1854
+//   descent 434
+//   leading 67
+//   default 1536
+//   0020 569
+//   0021 682
+//
+// Code points are hex. Those the table lacks take the default advance, as
+// they would take a fallback font's glyph.
+struct AdvanceTable {
+    std::string font;           // PostScript name
+    uint32_t unitsPerEm;
+    uint32_t ascent;
+    uint32_t descent;           // below the baseline, positive
+    uint32_t leading;
+    uint32_t defaultAdvance;
+    std::vector<uint16_t> advances;     // by UTF-16 unit; 0 is not recorded
+
+    AdvanceTable() : unitsPerEm(0), ascent(0), descent(0), leading(0), defaultAdvance(0) {}
+
+    uint32_t advance(uint16_t unit) const
+    {
+        // A surrogate pair counts once, on its first half.
+        if (unit >= 0xDC00 && unit < 0xE000) {
+            return 0;
+        }
+        uint32_t a = unit < advances.size() ? advances[unit] : 0;
+        return a ? a : defaultAdvance;
+    }
+    uint32_t lineHeight() const { return ascent + descent + leading; }
+};
+
+// What a table records: the Latin of the hymns, their accents and the
+// typographic punctuation (’ « » … –).
+struct AdvanceRange {
+    uint16_t first;
+    uint16_t last;
+};
+static const AdvanceRange kAdvanceRanges[] = { { 0x0020, 0x007E }, { 0x00A0, 0x024F }, { 0x2010, 0x205F } };
+
+bool parseAdvanceTable(Slice text, AdvanceTable *table, std::string *error = NULL);
+void writeAdvanceTable(const AdvanceTable &table, std::string *out);
+
+// The faces a hymn is set in. The title and the refrains may have faces
+// of their own, as Cantico sets them in bold and italic, and break by
+// those faces' advances; NULL sets them in the text's face. Every line is
+// as tall as a line of the text's face.
+struct LayoutFaces {
+    const AdvanceTable *text;
+    const AdvanceTable *title;
+    const AdvanceTable *refrain;
+};
+
+// Size and the box to fill, in points. A height of 0 makes one page.
+struct LayoutParams {
+    float size;
+    float width;
+    float height;
+};
+
+// Widest a line may be at these params, in font units; breaking depends on
+// the table and this alone.
+uint32_t layoutLimit(const AdvanceTable &table, const LayoutParams &params);
+
+// The title or a stanza of a laid out hymn.
+struct LayoutBlock {
+    uint32_t firstLine;     // into lineStarts
+    uint32_t lineCount;
+    // The lines break the same way for any limit from fits up to, but not
+    // including, breaks: every word placed made its line at most fits
+    // wide, and every break saved a line at least breaks wide. In units
+    // of the block's own face.
+    uint32_t fits;
+    uint32_t breaks;
+};
+
+static const uint32_t kNoLayoutBreak = 0xFFFFFFFF;
+
+// Where a page begins: a line of a block.
+struct LayoutPage {
+    uint32_t block;
+    uint32_t line;          // within the block
+};
+
+// Lines and pages of a prepared hymn, for one font and params. Lines start
+// at UTF-16 offsets of the prepared text; a line runs up to the next one's
+// start, or its block's end, with its trailing spaces and line break.
+// Blocks follow each other with one blank line between them, as the text
+// does; a page holds whole blocks while they fit, and a block longer than
+// a page starts one of its own and goes on over the next.
+struct HymnLayout {
+    uint32_t number;
+    uint32_t limit;             // of the text's face
+    uint32_t linesPerPage;
+    std::vector<LayoutBlock> blocks;    // the title, then the stanzas
+    std::vector<uint32_t> lineStarts;
+    std::vector<LayoutPage> pages;
+
+    uint32_t lineCount() const { return (uint32_t)lineStarts.size(); }
+    size_t bytes() const
+    {
+        return sizeof(HymnLayout) + blocks.capacity() * sizeof(LayoutBlock)
+            + lineStarts.capacity() * sizeof(uint32_t) + pages.capacity() * sizeof(LayoutPage);
+    }
+};
+
+// Lays out a prepared hymn. With a base laid out from the same hymn and
+// faces, blocks whose lines hold at the new limit are copied, not laid out
+// again; returns how many were.
+uint32_t layoutHymn(const PreparedHymn &hymn, const LayoutFaces &faces, const LayoutParams &params,
+                    const HymnLayout *base, HymnLayout *out);
+
+struct LayoutCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t relayouts;     // misses that started from another layout
+    uint64_t blocksReused;
+    uint64_t blocksLaidOut;
+    uint64_t evicted;
+    uint32_t layouts;       // in the cache now
+    size_t bytes;
+};
+
+// Layouts of the hymns per faces and params, least recently used out first
+// once their bytes pass the budget. A hymn keeps its latest few layouts
+// per faces, and a new one starts from the latest, so changing the size or
+// turning the screen lays out again only the stanzas it changes.
+//
+// Tables are told apart by address and must outlive the cache. Not for use
+// from more than one thread.
+class LayoutCache {
+public:
+    typedef std::shared_ptr<const HymnLayout> Layout;
+
+    explicit LayoutCache(size_t budgetBytes);
+
+    Layout layout(const PreparedHymn &hymn, const LayoutFaces &faces, const LayoutParams &params);
+
+    const LayoutCacheStats &stats() const { return _stats; }
+
+private:
+    LayoutCache(const LayoutCache &) = delete;
+    LayoutCache &operator=(const LayoutCache &) = delete;
+
+    struct Key {
+        LayoutFaces faces;
+        uint32_t number;
+        bool operator==(const Key &other) const
+        {
+            return faces.text == other.faces.text && faces.title == other.faces.title
+                && faces.refrain == other.faces.refrain && number == other.number;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const
+        {
+            std::hash<const void *> address;
+            return address(key.faces.text) ^ address(key.faces.title) * 31 ^ address(key.faces.refrain) * 961
+                ^ key.number * 0x9E3779B9u;
+        }
+    };
+    struct Entry {
+        struct Version {
+            LayoutParams params;
+            Layout layout;
+        };
+        std::vector<Version> versions;  // latest first
+        std::list<Key>::iterator use;
+    };
+
+    void evict();
+
+    const size_t _budget;
+    std::unordered_map<Key, Entry, KeyHash> _entries;
+    std::list<Key> _uses;       // most recently used first
+    LayoutCacheStats _stats;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__Layout__) */
@@ -0,0 +1,117 @@
+//
+//  MappedFile.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace canticos {
+
+static bool fail(std::string *error, const std::string &what, const char *path)
+{
+    if (error) {
+        *error = what + " " + path + ": " + strerror(errno);
+    }
+    return false;
+}
+
+MappedFile::MappedFile() : _data(NULL), _size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char *path, std::string *error)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return fail(error, "cannot open", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return fail(error, "cannot stat", path);
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        errno = EINVAL;
+        return fail(error, "empty file", path);
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return fail(error, "cannot map", path);
+    }
+    _data = (const char *)p;
+    _size = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (_data) {
+        munmap((void *)_data, _size);
+        _data = NULL;
+        _size = 0;
+    }
+}
+
+bool readWholeFile(const std::string &path, std::string *out, std::string *error)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return fail(error, "cannot open", path.c_str());
+    }
+    out->clear();
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        out->append(buffer, n);
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok) {
+        return fail(error, "cannot read", path.c_str());
+    }
+    return true;
+}
+
+bool writeWholeFile(const std::string &path, const std::string &bytes, std::string *error)
+{
+    // Write next to the target and rename, so a reader never maps a half
+    // written artifact.
+    std::string temp = path + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        return fail(error, "cannot create", temp.c_str());
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    ok = (fclose(f) == 0) && ok;
+    if (!ok) {
+        unlink(temp.c_str());
+        return fail(error, "cannot write", temp.c_str());
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return fail(error, "cannot rename to", path.c_str());
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,43 @@
+//
+//  MappedFile.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__MappedFile__
+#define __LivroDeCanticos__MappedFile__
+
+#include <cstddef>
+#include <string>
+
+namespace canticos {
+
+// Read-only mmap of a whole file. The mapping lives as long as the object.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char *path, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _data != NULL; }
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *_data;
+    size_t _size;
+};
+
+// Whole-file helpers for the offline tools; the app only ever maps.
+bool readWholeFile(const std::string &path, std::string *out, std::string *error = NULL);
+bool writeWholeFile(const std::string &path, const std::string &bytes, std::string *error = NULL);
+
+}
+
+#endif /* defined(__LivroDeCanticos__MappedFile__) */
@@ -0,0 +1,148 @@
+//
+//  SearchExecutor.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "SearchExecutor.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace canticos {
+
+SearchExecutor::SearchExecutor(bool supersede)
+    : _supersede(supersede), _latest(0), _running(false), _overtaken(false), _stop(false)
+{
+    memset(&_stats, 0, sizeof(_stats));
+    _worker = std::thread(&SearchExecutor::runLoop, this);
+}
+
+SearchExecutor::~SearchExecutor()
+{
+    cancel();
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stop = true;
+    }
+    _wake.notify_one();
+    _worker.join();
+}
+
+uint64_t SearchExecutor::submit(const Request &request, const Delivery &delivery)
+{
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        // Under the lock, so the pending requests are in generation order.
+        generation = ++_latest;
+        _stats.submitted++;
+        overtake();
+        if (_supersede) {
+            _stats.skipped += _pending.size();
+            _pending.clear();
+        }
+        Pending pending = { generation, request, delivery };
+        _pending.push_back(pending);
+    }
+    _wake.notify_one();
+    return generation;
+}
+
+void SearchExecutor::cancel()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    ++_latest;
+    overtake();
+    if (_supersede) {
+        _stats.skipped += _pending.size();
+        _pending.clear();
+    }
+}
+
+void SearchExecutor::overtake()
+{
+    if (_running && !_overtaken) {
+        _overtaken = true;
+        _overtakenAt = std::chrono::steady_clock::now();
+    }
+}
+
+bool SearchExecutor::searchRequestInProgress() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _running || !_pending.empty();
+}
+
+void SearchExecutor::waitUntilIdle()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    while (_running || !_pending.empty()) {
+        _idle.wait(guard);
+    }
+}
+
+SearchExecutorStats SearchExecutor::stats() const
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _stats;
+}
+
+void SearchExecutor::runLoop()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    for (;;) {
+        while (!_stop && _pending.empty()) {
+            _wake.wait(guard);
+        }
+        if (_stop) {
+            break;
+        }
+        Pending pending = _pending.front();
+        _pending.erase(_pending.begin());
+        _running = true;
+        // Without supersede one may already be stale as it starts.
+        _overtaken = false;
+        if (_latest.load() != pending.generation) {
+            overtake();
+        }
+        guard.unlock();
+
+        // Without supersede the search never sees the newer ones.
+        std::atomic<bool> stopped(false);
+        SearchGeneration generation = { _supersede ? &_latest : NULL, pending.generation, &stopped };
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        pending.request(generation);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - start).count();
+        bool latest = isLatest(pending.generation);
+        if (latest) {
+            pending.delivery(pending.generation);
+        }
+
+        guard.lock();
+        if (latest) {
+            _stats.delivered++;
+            _stats.deliveredSeconds += seconds;
+        } else {
+            // A search that stopped early still took until it saw it was
+            // stale; one that ended before it went stale was all spent for
+            // nothing.
+            (stopped.load() ? _stats.aborted : _stats.discarded)++;
+            _stats.wastedSeconds += seconds;
+            if (_overtaken) {
+                _stats.overrunSeconds += std::chrono::duration<double>(end - _overtakenAt).count();
+            }
+        }
+        _running = false;
+        if (_pending.empty()) {
+            _idle.notify_all();
+        }
+    }
+    _stats.skipped += _pending.size();
+    _pending.clear();
+    _idle.notify_all();
+}
+
+}
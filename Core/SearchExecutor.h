@@ -0,0 +1,108 @@
+//
+//  SearchExecutor.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__SearchExecutor__
+#define __LivroDeCanticos__SearchExecutor__
+
+#include "SearchIndex.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace canticos {
+
+struct SearchExecutorStats {
+    uint64_t submitted;
+    uint64_t delivered;         // ran to the end still the newest, and handed on
+    uint64_t skipped;           // superseded before they started, never run
+    uint64_t aborted;           // superseded while running: stopped at the next check
+    uint64_t discarded;         // ran to the end, but superseded by then
+    double deliveredSeconds;    // spent running the delivered
+    double wastedSeconds;       // spent running the aborted and discarded
+    double overrunSeconds;      // of that, spent after a newer request or a cancel made them stale
+};
+
+// Searches off the main thread for a search bar that searches at every
+// keystroke, as LSLocaytaSearchRequest's cancel and
+// searchRequestInProgress let it. Every request submitted gets the next
+// generation and makes every older one stale: one still waiting is
+// dropped unrun, and the one running sees it at its next check of
+// SearchOptions::generation and stops. Only a request that is still the
+// newest when it ends has its result delivered, so typing faster than
+// the searches run costs one search at a time, not one per keystroke.
+//
+// Requests run one at a time on a thread of the executor's own. Without
+// supersede every one runs whole, in order, as a plain serial queue
+// would; the stale ones are still not delivered.
+class SearchExecutor {
+public:
+    // Makes the search, with generation in its SearchOptions; it may be
+    // superseded before, during or after.
+    typedef std::function<void(const SearchGeneration &generation)> Request;
+    // Called on the executor's thread with the request's generation when
+    // its result is the newest. By the time the call lands elsewhere a
+    // newer one may have been submitted: check isLatest there.
+    typedef std::function<void(uint64_t generation)> Delivery;
+
+    explicit SearchExecutor(bool supersede = true);
+    ~SearchExecutor();      // cancels what is waiting or running
+
+    // Returns the request's generation.
+    uint64_t submit(const Request &request, const Delivery &delivery);
+
+    // Makes every request stale, with no new one.
+    void cancel();
+
+    bool isLatest(uint64_t generation) const { return _latest.load() == generation; }
+
+    // A request waiting or running, stale or not.
+    bool searchRequestInProgress() const;
+
+    // Returns once no request is waiting or running.
+    void waitUntilIdle();
+
+    SearchExecutorStats stats() const;
+
+private:
+    SearchExecutor(const SearchExecutor &) = delete;
+    SearchExecutor &operator=(const SearchExecutor &) = delete;
+
+    struct Pending {
+        uint64_t generation;
+        Request request;
+        Delivery delivery;
+    };
+
+    void runLoop();
+    void overtake();    // under _lock: notes when the running request went stale
+
+    bool _supersede;
+    std::atomic<uint64_t> _latest;
+
+    // All under _lock.
+    mutable std::mutex _lock;
+    std::vector<Pending> _pending;      // the newest alone with supersede
+    bool _running;
+    bool _overtaken;                    // the running request is stale, since _overtakenAt
+    std::chrono::steady_clock::time_point _overtakenAt;
+    SearchExecutorStats _stats;
+
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    bool _stop;
+    std::thread _worker;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__SearchExecutor__) */
@@ -0,0 +1,984 @@
+//
+//  SearchIndex.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "SearchIndex.h"
+#include "IndexMerge.h"
+#include "Stanza.h"
+#include "Stemmer.h"
+#include "Thesaurus.h"
+#include "Tokenizer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace canticos {
+
+// IndexBuilder
+
+IndexBuilder::IndexBuilder() : _firstDoc(0), _docCount(0), _hymnCount(0)
+{
+    for (size_t f = 0; f < kFieldCount; f++) {
+        _totalFieldLength[f] = 0;
+    }
+}
+
+static const uint32_t kNoStem = 0xFFFFFFFF;
+
+uint32_t IndexBuilder::termId(const std::string &term)
+{
+    std::unordered_map<std::string, uint32_t>::iterator it = _termIds.find(term);
+    if (it != _termIds.end()) {
+        return it->second;
+    }
+    uint32_t id = (uint32_t)_terms.size();
+    _termIds[term] = id;
+    _terms.push_back(term);
+    _postings.push_back(std::vector<uint32_t>());
+    _positions.push_back(std::vector<uint32_t>());
+    _offsets.push_back(std::vector<uint32_t>());
+    _stemIds.push_back(kNoStem);
+    return id;
+}
+
+uint32_t IndexBuilder::stemId(uint32_t word)
+{
+    if (_stemIds[word] == kNoStem) {
+        char stem[kMaxTermBytes];
+        size_t length = stemIndexTerm(Slice(_terms[word]), stem);
+        uint32_t id = termId(std::string(stem, length));
+        _stemIds[word] = id;
+    }
+    return _stemIds[word];
+}
+
+// Words of one hymn as they are added. Entries are term id << 34 |
+// position << 2 | field, so sorting them groups a term's words with their
+// positions in order; ranges hold each position's UTF-16 offset and length
+// in its source text, counted as the text is walked.
+struct DocumentWords {
+    std::vector<uint64_t> entries;
+    std::vector<uint32_t> ranges;
+    uint32_t position;
+    const char *counted;
+    uint32_t units;
+
+    void startText(Slice source)
+    {
+        counted = source.data;
+        units = 0;
+    }
+};
+
+void IndexBuilder::addText(Slice text, IndexField field, DocumentWords *words)
+{
+    Tokenizer tokenizer(text);
+    Token token;
+    char term[kMaxTermBytes];
+    while (tokenizer.next(&token)) {
+        size_t length = normalizeTerm(token.text, term);
+        uint64_t id = termId(std::string(term, length));
+        uint64_t stem = stemId((uint32_t)id);
+        uint32_t position = words->position++;
+        words->entries.push_back(id << 34 | (uint64_t)position << 2 | field);
+        words->entries.push_back(stem << 34 | (uint64_t)position << 2 | field);
+        words->units += (uint32_t)utf16Length(Slice(words->counted, token.text.data - words->counted));
+        words->counted = token.text.data;
+        words->ranges.resize(2 * (position + 1), 0);
+        words->ranges[2 * position] = words->units;
+        words->ranges[2 * position + 1] = (uint32_t)utf16Length(token.text);
+    }
+}
+
+static bool hasWord(Slice line)
+{
+    Token token;
+    return Tokenizer(line).next(&token);
+}
+
+void IndexBuilder::addDocument(uint32_t number, Slice title, Slice body)
+{
+    DocumentWords words;
+    words.position = 0;
+    words.startText(title);
+    addText(title, kTitleField, &words);
+    uint32_t titleWords = words.position;
+    words.position += kPositionGap;
+    words.startText(body);
+
+    // Line by line; CR, LF and CRLF all end a line. The first line with
+    // words is the numbered title again and is skipped.
+    bool titleLine = true;
+    uint32_t refrainWords = 0;
+    size_t start = 0;
+    for (size_t i = 0; i <= body.size; i++) {
+        if (i < body.size && body.data[i] != '\r' && body.data[i] != '\n') {
+            continue;
+        }
+        Slice line(body.data + start, i - start);
+        start = i + 1;
+        if (!hasWord(line)) {
+            continue;
+        }
+        if (titleLine) {
+            titleLine = false;
+            continue;
+        }
+        uint32_t before = words.position;
+        bool refrain = isCapitalLine(line);
+        addText(line, refrain ? kRefrainField : kVerseField, &words);
+        if (refrain) {
+            refrainWords += words.position - before;
+        }
+    }
+
+    uint32_t lengths[kFieldCount];
+    lengths[kTitleField] = titleWords;
+    lengths[kRefrainField] = refrainWords;
+    lengths[kVerseField] = words.position - kPositionGap - titleWords - refrainWords;
+    if (_firstDoc == 0) {
+        _firstDoc = number;
+    }
+    if ((number - _firstDoc + 1) * kFieldCount > _fieldLengths.size()) {
+        _fieldLengths.resize((number - _firstDoc + 1) * kFieldCount, 0);
+    }
+    for (size_t f = 0; f < kFieldCount; f++) {
+        _fieldLengths[(number - _firstDoc) * kFieldCount + f] = lengths[f];
+        _totalFieldLength[f] += lengths[f];
+    }
+    _docCount = std::max(_docCount, number);
+    _hymnCount++;
+
+    std::vector<uint64_t> &entries = words.entries;
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size();) {
+        uint32_t id = (uint32_t)(entries[i] >> 34);
+        uint32_t tf[kFieldCount] = { 0, 0, 0 };
+        std::vector<uint32_t> &positions = _positions[id];
+        std::vector<uint32_t> &offsets = _offsets[id];
+        for (; i < entries.size() && (uint32_t)(entries[i] >> 34) == id; i++) {
+            uint32_t position = (uint32_t)(entries[i] >> 2);
+            tf[entries[i] & 3]++;
+            positions.push_back(position);
+            offsets.push_back(words.ranges[2 * position]);
+            offsets.push_back(words.ranges[2 * position + 1]);
+        }
+        std::vector<uint32_t> &postings = _postings[id];
+        postings.push_back(number);
+        postings.insert(postings.end(), tf, tf + kFieldCount);
+    }
+}
+
+struct TermOrder {
+    const std::vector<std::string> *terms;
+    bool operator()(uint32_t a, uint32_t b) const { return (*terms)[a] < (*terms)[b]; }
+};
+
+void IndexBuilder::fillRun(IndexRun *run) const
+{
+    std::vector<uint32_t> order(_terms.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    TermOrder byText = { &_terms };
+    std::sort(order.begin(), order.end(), byText);
+
+    size_t lexiconSize = 0;
+    size_t postingsSize = 0;
+    size_t positionsSize = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        lexiconSize += _terms[order[i]].size();
+        postingsSize += _postings[order[i]].size();
+        positionsSize += _positions[order[i]].size();
+    }
+    *run = IndexRun();
+    run->lexicon.reserve(lexiconSize);
+    run->termEnds.reserve(order.size());
+    run->postingsEnds.reserve(order.size());
+    run->positionsEnds.reserve(order.size());
+    run->postings.reserve(postingsSize);
+    run->positions.reserve(positionsSize);
+    run->offsets.reserve(2 * positionsSize);
+    for (size_t i = 0; i < order.size(); i++) {
+        uint32_t id = order[i];
+        run->lexicon += _terms[id];
+        run->postings.insert(run->postings.end(), _postings[id].begin(), _postings[id].end());
+        run->positions.insert(run->positions.end(), _positions[id].begin(), _positions[id].end());
+        run->offsets.insert(run->offsets.end(), _offsets[id].begin(), _offsets[id].end());
+        run->termEnds.push_back(run->lexicon.size());
+        run->postingsEnds.push_back(run->postings.size());
+        run->positionsEnds.push_back(run->positions.size());
+    }
+    run->fieldLengths = _fieldLengths;
+    for (size_t f = 0; f < kFieldCount; f++) {
+        run->totalFieldLength[f] = _totalFieldLength[f];
+    }
+    run->firstDoc = _firstDoc;
+    run->lastDoc = _docCount;
+    run->hymnCount = _hymnCount;
+}
+
+void IndexBuilder::takeRun(IndexRun *run)
+{
+    fillRun(run);
+    *this = IndexBuilder();
+}
+
+void IndexBuilder::serialize(std::string *out) const
+{
+    std::vector<IndexRun> runs(1);
+    fillRun(&runs[0]);
+    WorkerPool caller(0);
+    mergeIndexRuns(runs, &caller, out);
+}
+
+// SearchIndex
+
+SearchIndex::SearchIndex()
+    : _header(NULL), _terms(NULL), _lexicon(NULL), _postings(NULL), _positions(NULL), _offsets(NULL), _skips(NULL), _fieldScales(NULL),
+      _forwardStarts(NULL), _forward(NULL)
+{
+}
+
+bool SearchIndex::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt index: ") + why;
+    }
+    return false;
+}
+
+bool SearchIndex::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(IndexHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const IndexHeader *h = (const IndexHeader *)data;
+    if (memcmp(h->magic, kIndexMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kIndexVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size
+        || h->termsOffset + (uint64_t)h->termCount * sizeof(IndexTerm) > size
+        || h->lexiconOffset + h->lexiconSize > size
+        || h->postingsOffset + h->postingsSize > size
+        || h->positionsOffset + h->positionsSize > size
+        || h->offsetsOffset + h->offsetsSize > size
+        || h->skipsOffset + h->skipCount * sizeof(IndexSkip) > size
+        || h->fieldScalesOffset + (uint64_t)h->docCount * kFieldCount * sizeof(float) > size
+        || h->forwardStartsOffset + ((uint64_t)h->docCount + 1) * sizeof(uint64_t) > size
+        || h->forwardOffset + h->forwardCount * sizeof(uint32_t) > size) {
+        return corrupt(error, "section out of bounds");
+    }
+    const IndexTerm *terms = (const IndexTerm *)(data + h->termsOffset);
+    for (uint32_t i = 0; i < h->termCount; i++) {
+        if ((uint64_t)terms[i].lexiconOffset + terms[i].lexiconSize > h->lexiconSize
+            || terms[i].postingsOffset + terms[i].postingsSize > h->postingsSize
+            || terms[i].positionsOffset + terms[i].positionsSize > h->positionsSize
+            || terms[i].offsetsOffset + terms[i].offsetsSize > h->offsetsSize
+            || (uint64_t)terms[i].firstSkip + terms[i].skipCount > h->skipCount) {
+            return corrupt(error, "term out of bounds");
+        }
+        const IndexSkip *skips = (const IndexSkip *)(data + h->skipsOffset) + terms[i].firstSkip;
+        for (uint32_t k = 0; k < terms[i].skipCount; k++) {
+            if (skips[k].postingsOffset > terms[i].postingsSize || skips[k].positionsOffset > terms[i].positionsSize
+                || skips[k].offsetsOffset > terms[i].offsetsSize) {
+                return corrupt(error, "skip out of bounds");
+            }
+        }
+    }
+
+    const uint64_t *starts = (const uint64_t *)(data + h->forwardStartsOffset);
+    const uint32_t *forward = (const uint32_t *)(data + h->forwardOffset);
+    for (uint32_t d = 0; d < h->docCount; d++) {
+        if (starts[d] > starts[d + 1] || starts[d + 1] > h->forwardCount) {
+            return corrupt(error, "forward list out of bounds");
+        }
+    }
+    for (uint64_t i = 0; i < h->forwardCount; i++) {
+        if ((forward[i] >> 8) >= h->termCount) {
+            return corrupt(error, "forward entry out of bounds");
+        }
+    }
+
+    _header = h;
+    _terms = terms;
+    _lexicon = data + h->lexiconOffset;
+    _postings = (const uint8_t *)data + h->postingsOffset;
+    _positions = (const uint8_t *)data + h->positionsOffset;
+    _offsets = (const uint8_t *)data + h->offsetsOffset;
+    _skips = (const IndexSkip *)(data + h->skipsOffset);
+    _fieldScales = (const float *)(data + h->fieldScalesOffset);
+    _forwardStarts = starts;
+    _forward = forward;
+    return true;
+}
+
+void SearchIndex::close()
+{
+    _header = NULL;
+    _terms = NULL;
+    _lexicon = NULL;
+    _postings = NULL;
+    _positions = NULL;
+    _offsets = NULL;
+    _skips = NULL;
+    _fieldScales = NULL;
+    _forwardStarts = NULL;
+    _forward = NULL;
+    _file.close();
+}
+
+static int compareBytes(Slice a, Slice b)
+{
+    int c = memcmp(a.data, b.data, std::min(a.size, b.size));
+    if (c != 0) {
+        return c;
+    }
+    return a.size < b.size ? -1 : (a.size > b.size ? 1 : 0);
+}
+
+const IndexTerm *SearchIndex::find(Slice term) const
+{
+    uint32_t lo = 0;
+    uint32_t hi = termCount();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = compareBytes(termText(_terms[mid]), term);
+        if (c == 0) {
+            return &_terms[mid];
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+void SearchIndex::prefixRange(Slice prefix, uint32_t *first, uint32_t *last) const
+{
+    // Terms starting with prefix sort at or after it and before any term
+    // that differs within the prefix bytes.
+    uint32_t lo = 0;
+    uint32_t hi = termCount();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compareBytes(termText(_terms[mid]), prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+    hi = termCount();
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        Slice text = termText(_terms[mid]);
+        if (text.size >= prefix.size && memcmp(text.data, prefix.data, prefix.size) == 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *last = lo;
+}
+
+float SearchIndex::idf(const IndexTerm &term) const
+{
+    float n = (float)docCount();
+    float df = (float)term.docFrequency;
+    return logf(1.0f + (n - df + 0.5f) / (df + 0.5f));
+}
+
+struct QueryTerm {
+    const IndexTerm *term;
+    PostingCursor cursor;
+    float idf;
+    float weight;                       // 1, or the synonym weight for a synonym only
+    bool required;
+    bool inGroup;                       // in a phrase or NEAR group, so as written
+    uint32_t synonymsStart;             // into the query's synonyms, for a plain word
+    uint32_t synonymsCount;
+    uint32_t wordFrequency;             // hymns it or, outside groups, its synonyms are in
+    uint32_t positionsDoc;              // hymn the positions below are of
+    PositionReader positions;
+};
+
+// A phrase (distance 0: its words one after the other) or a NEAR group
+// (each word at most distance words from the one before). Words are
+// indexes into the query terms.
+struct QueryGroup {
+    std::vector<size_t> words;
+    std::vector<size_t> rarestFirst;    // indexes into words
+    uint32_t distance;
+};
+
+static bool byWordFrequency(const QueryTerm *a, const QueryTerm *b)
+{
+    return a->wordFrequency < b->wordFrequency;
+}
+
+struct RarestWord {
+    const std::vector<QueryTerm> *terms;
+    const QueryGroup *group;
+    bool operator()(size_t a, size_t b) const
+    {
+        return (*terms)[group->words[a]].term->docFrequency < (*terms)[group->words[b]].term->docFrequency;
+    }
+};
+
+// Min-heap on score: the root is the weakest hit kept so far.
+static bool worseHit(const SearchHit &a, const SearchHit &b)
+{
+    if (a.score != b.score) {
+        return a.score > b.score;
+    }
+    return a.number < b.number;
+}
+
+static void offer(std::vector<SearchHit> *heap, size_t limit, uint32_t number, float score)
+{
+    SearchHit hit = { number, score };
+    if (heap->size() < limit) {
+        heap->push_back(hit);
+        std::push_heap(heap->begin(), heap->end(), worseHit);
+    } else if (worseHit(hit, heap->front())) {
+        std::pop_heap(heap->begin(), heap->end(), worseHit);
+        heap->back() = hit;
+        std::push_heap(heap->begin(), heap->end(), worseHit);
+    }
+}
+
+// Splits a query into its terms, the synonyms of its plain words, and its
+// phrase and NEAR groups.
+class QueryParser {
+public:
+    QueryParser(const SearchIndex &index, const SearchOptions &options, std::vector<QueryTerm> *terms,
+                std::vector<size_t> *synonyms, std::vector<QueryGroup> *groups)
+        : _index(index), _mode(options.mode), _stemming(options.stemming), _thesaurus(NULL),
+          _synonymWeight(options.synonymWeight), _idf(options.idf), _terms(terms), _synonyms(synonyms), _groups(groups),
+          _failed(false)
+    {
+        // Term indexes of another build of the index would be meaningless.
+        if (options.thesaurus && options.thesaurus->termCount() == index.termCount()) {
+            _thesaurus = options.thesaurus;
+        }
+    }
+
+    // False when no hymn can match: a required word the index lacks.
+    bool parse(Slice query)
+    {
+        if (_mode == SearchOptions::Phrase) {
+            addPhrase(query);
+            return !_failed;
+        }
+        size_t start = 0;
+        bool quoted = false;
+        for (size_t i = 0; i < query.size;) {
+            size_t quote = quoteAt(query, i);
+            if (quote == 0) {
+                i++;
+                continue;
+            }
+            Slice segment(query.data + start, i - start);
+            if (quoted) {
+                addPhrase(segment);
+            } else {
+                addWords(segment);
+            }
+            quoted = !quoted;
+            i += quote;
+            start = i;
+        }
+        Slice rest(query.data + start, query.size - start);
+        if (quoted) {
+            addPhrase(rest);   // not closed yet: still being typed
+        } else {
+            addWords(rest);
+        }
+        return !_failed;
+    }
+
+private:
+    // Length of the quote mark at i: " or the typographic “ ”, else 0.
+    static size_t quoteAt(Slice text, size_t i)
+    {
+        const uint8_t *p = (const uint8_t *)text.data + i;
+        if (*p == '"') {
+            return 1;
+        }
+        if (i + 3 <= text.size && p[0] == 0xE2 && p[1] == 0x80 && (p[2] == 0x9C || p[2] == 0x9D)) {
+            return 3;
+        }
+        return 0;
+    }
+
+    // Index of the word's term (its stem's, with stemming), or -1 when the
+    // index does not have it. With stemming the word as typed is added too,
+    // never required, so hymns with the very word rank above the others.
+    long termFor(Slice word)
+    {
+        char normalized[kMaxTermBytes];
+        size_t length = normalizeTerm(word, normalized);
+        const IndexTerm *exact = _index.find(Slice(normalized, length));
+        if (!_stemming || length == 0) {
+            return addTerm(exact, _mode == SearchOptions::AllWords);
+        }
+        char stem[kMaxTermBytes];
+        const IndexTerm *stemmed = _index.find(Slice(stem, stemIndexTerm(Slice(normalized, length), stem)));
+        if (exact && stemmed) {
+            addTerm(exact, false);
+        }
+        return addTerm(stemmed, _mode == SearchOptions::AllWords);
+    }
+
+    // One cursor per term, whatever the words and synonyms that name it.
+    long addTerm(const IndexTerm *term, bool required, float weight = 1.0f)
+    {
+        if (!term) {
+            return -1;
+        }
+        for (size_t i = 0; i < _terms->size(); i++) {
+            QueryTerm &q = (*_terms)[i];
+            if (q.term == term) {
+                q.required = q.required || required;
+                q.weight = std::max(q.weight, weight);
+                return (long)i;
+            }
+        }
+        QueryTerm q;
+        q.term = term;
+        q.cursor = _index.cursor(*term);
+        q.idf = _idf ? _idf(_index.termText(*term)) : _index.idf(*term);
+        q.weight = weight;
+        q.required = required;
+        q.inGroup = false;
+        q.synonymsStart = 0;
+        q.synonymsCount = 0;
+        q.wordFrequency = term->docFrequency;
+        q.positionsDoc = 0;
+        q.cursor.next();
+        _terms->push_back(q);
+        return (long)_terms->size() - 1;
+    }
+
+    // Adds the synonyms of a plain word, found with one lookup of its term,
+    // as terms of their own that are never required.
+    void expand(long word)
+    {
+        if (word < 0 || !_thesaurus || (*_terms)[word].synonymsCount > 0) {
+            return;
+        }
+        uint32_t count;
+        const uint32_t *synonyms = _thesaurus->synonyms(_index.termIndex(*(*_terms)[word].term), &count);
+        size_t start = _synonyms->size();
+        for (uint32_t i = 0; i < count; i++) {
+            _synonyms->push_back((size_t)addTerm(&_index.term(synonyms[i]), false, _synonymWeight));
+        }
+        (*_terms)[word].synonymsStart = (uint32_t)start;
+        (*_terms)[word].synonymsCount = (uint32_t)(_synonyms->size() - start);
+    }
+
+    // A word of a phrase or NEAR group.
+    void require(long word)
+    {
+        if (word < 0) {
+            _failed = true;
+        } else {
+            (*_terms)[word].required = true;
+            (*_terms)[word].inGroup = true;
+        }
+    }
+
+    void addPhrase(Slice text)
+    {
+        QueryGroup group;
+        group.distance = 0;
+        Tokenizer tokenizer(text);
+        Token token;
+        while (tokenizer.next(&token)) {
+            long word = termFor(token.text);
+            require(word);
+            group.words.push_back((size_t)word);
+        }
+        if (group.words.size() > 1 && !_failed) {
+            _groups->push_back(group);
+        }
+    }
+
+    // Plain words and NEAR/k operators between them. A word is expanded
+    // once the next token shows it is not the left side of a NEAR.
+    void addWords(Slice text)
+    {
+        Tokenizer tokenizer(text);
+        Token token;
+        long previous = -1;
+        bool hasPrevious = false;
+        long plain = -1;
+        uint32_t near = 0;
+        while (tokenizer.next(&token)) {
+            uint32_t distance = 0;
+            if (hasPrevious && nearAt(text, token, &distance)) {
+                tokenizer.next(&token);   // the distance digits
+                near = distance;
+                plain = -1;
+                continue;
+            }
+            expand(plain);
+            long word = termFor(token.text);
+            plain = near > 0 ? -1 : word;
+            if (near > 0) {
+                require(previous);
+                require(word);
+                QueryGroup *group = _groups->empty() ? NULL : &_groups->back();
+                if (!group || group->distance == 0 || group->words.back() != (size_t)previous) {
+                    QueryGroup fresh;
+                    fresh.words.push_back((size_t)previous);
+                    _groups->push_back(fresh);
+                    group = &_groups->back();
+                }
+                group->words.push_back((size_t)word);
+                group->distance = near;
+                near = 0;
+            } else if (word < 0 && _mode == SearchOptions::AllWords) {
+                _failed = true;
+            }
+            previous = word;
+            hasPrevious = true;
+        }
+        expand(plain);
+    }
+
+    // True for "NEAR/k" at the token, k the digits after the slash (at
+    // least 1).
+    static bool nearAt(Slice text, const Token &token, uint32_t *distance)
+    {
+        if (token.text.size != 4 || memcmp(token.text.data, "NEAR", 4) != 0) {
+            return false;
+        }
+        size_t i = token.offset + 4;
+        if (i >= text.size || text.data[i] != '/') {
+            return false;
+        }
+        uint32_t k = 0;
+        size_t digits = 0;
+        for (i++; i < text.size && text.data[i] >= '0' && text.data[i] <= '9'; i++, digits++) {
+            k = std::min(k * 10 + (text.data[i] - '0'), 1000u);
+        }
+        *distance = std::max(k, 1u);
+        return digits > 0;
+    }
+
+    const SearchIndex &_index;
+    SearchOptions::Mode _mode;
+    bool _stemming;
+    const Thesaurus *_thesaurus;
+    float _synonymWeight;
+    const std::function<float(Slice term)> &_idf;
+    std::vector<QueryTerm> *_terms;
+    std::vector<size_t> *_synonyms;
+    std::vector<QueryGroup> *_groups;
+    bool _failed;
+};
+
+static const PositionReader &positionsOf(QueryTerm &q, uint32_t doc)
+{
+    if (q.positionsDoc != doc) {
+        q.positions = q.cursor.positions();
+        q.positionsDoc = doc;
+    }
+    return q.positions;
+}
+
+// True when the words sit at consecutive positions somewhere. Tries where
+// the phrase would start, rarest word first: a later word is only read
+// once the earlier ones agree, so a common one like "de" is often never
+// decoded, and the others only up to the first match.
+static bool phraseMatches(std::vector<QueryTerm> &terms, const QueryGroup &group, uint32_t doc,
+                          std::vector<PositionReader> *readers)
+{
+    size_t count = group.words.size();
+    readers->resize(count);
+    size_t loaded = 0;
+    uint32_t start = 0;
+    for (size_t k = 0; k < count;) {
+        uint32_t offset = (uint32_t)group.rarestFirst[k];
+        PositionReader &r = (*readers)[k];
+        if (k == loaded) {
+            r = positionsOf(terms[group.words[offset]], doc);
+            loaded++;
+        }
+        if (!r.advanceTo(start + offset)) {
+            return false;
+        }
+        if (r.position == start + offset) {
+            k++;
+        } else {
+            start = r.position - offset;
+            k = k == 0 ? 1 : 0;
+        }
+    }
+    return true;
+}
+
+// True when two positions, one from each reader, are at most distance apart
+// (and not the same word, for a term near itself). Merges from the lower.
+static bool nearMatches(PositionReader a, PositionReader b, uint32_t distance)
+{
+    while (a.position != PositionReader::kEnd && b.position != PositionReader::kEnd) {
+        uint32_t x = a.position;
+        uint32_t y = b.position;
+        if (x != y && (x < y ? y - x : x - y) <= distance) {
+            return true;
+        }
+        if (x <= y) {
+            a.next();
+        } else {
+            b.next();
+        }
+    }
+    return false;
+}
+
+static bool groupsMatch(std::vector<QueryTerm> &terms, const std::vector<QueryGroup> &groups, uint32_t doc,
+                        std::vector<PositionReader> *readers)
+{
+    for (size_t g = 0; g < groups.size(); g++) {
+        const QueryGroup &group = groups[g];
+        if (group.distance == 0) {
+            if (!phraseMatches(terms, group, doc, readers)) {
+                return false;
+            }
+            continue;
+        }
+        for (size_t w = 1; w < group.words.size(); w++) {
+            if (!nearMatches(positionsOf(terms[group.words[w - 1]], doc), positionsOf(terms[group.words[w]], doc),
+                             group.distance)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Moves a required word's cursors to target and returns the first hymn from
+// there that has it: its own term's or, for a plain word, any synonym's.
+static uint32_t advanceWord(std::vector<QueryTerm> &terms, const std::vector<size_t> &synonyms, QueryTerm &q,
+                            uint32_t target)
+{
+    q.cursor.advanceTo(target);
+    uint32_t doc = q.cursor.doc;
+    if (!q.inGroup) {
+        for (uint32_t s = q.synonymsStart; s < q.synonymsStart + q.synonymsCount; s++) {
+            PostingCursor &c = terms[synonyms[s]].cursor;
+            c.advanceTo(target);
+            doc = std::min(doc, c.doc);
+        }
+    }
+    return doc;
+}
+
+void SearchIndex::search(Slice query, const SearchOptions &options, std::vector<SearchHit> *hits) const
+{
+    hits->clear();
+    if (!isOpen() || options.limit == 0) {
+        return;
+    }
+
+    std::vector<QueryTerm> terms;
+    std::vector<size_t> synonyms;
+    std::vector<QueryGroup> groups;
+    QueryParser parser(*this, options, &terms, &synonyms, &groups);
+    if (!parser.parse(query) || terms.empty()) {
+        return;
+    }
+    std::vector<QueryTerm *> required;
+    std::vector<QueryTerm *> optional;
+    for (size_t i = 0; i < terms.size(); i++) {
+        QueryTerm &q = terms[i];
+        (q.required ? required : optional).push_back(&q);
+        for (uint32_t s = q.synonymsStart; !q.inGroup && s < q.synonymsStart + q.synonymsCount; s++) {
+            q.wordFrequency += terms[synonyms[s]].term->docFrequency;
+        }
+    }
+    std::sort(required.begin(), required.end(), byWordFrequency);
+    for (size_t g = 0; g < groups.size(); g++) {
+        QueryGroup &group = groups[g];
+        group.rarestFirst.resize(group.words.size());
+        for (size_t w = 0; w < group.words.size(); w++) {
+            group.rarestFirst[w] = w;
+        }
+        RarestWord rarest = { &terms, &group };
+        std::stable_sort(group.rarestFirst.begin(), group.rarestFirst.end(), rarest);
+    }
+    std::vector<PositionReader> readers;
+
+    // Hymns stepped over, leapfrogging or scored, since the generation was
+    // last looked at.
+    uint32_t steps = 0;
+    while (true) {
+        uint32_t doc;
+        if (!required.empty()) {
+            // Leapfrog from the rarest word until every one agrees, then
+            // check the phrases on the positions of that one hymn. A word
+            // with synonyms is on the first hymn any of them is on.
+            doc = advanceWord(terms, synonyms, *required[0], 0);
+            size_t agreed = 1;
+            size_t i = 1 % required.size();
+            while (doc != PostingCursor::kEnd && agreed < required.size()) {
+                if (++steps >= kSkipInterval) {
+                    if (options.generation.superseded()) {
+                        options.generation.stop();
+                        hits->clear();
+                        return;
+                    }
+                    steps = 0;
+                }
+                uint32_t next = advanceWord(terms, synonyms, *required[i], doc);
+                if (next == doc) {
+                    agreed++;
+                } else {
+                    doc = next;
+                    agreed = 1;
+                }
+                i = (i + 1) % required.size();
+            }
+            if (doc == PostingCursor::kEnd) {
+                break;
+            }
+            for (size_t i = 0; i < optional.size(); i++) {
+                optional[i]->cursor.advanceTo(doc);
+            }
+        } else {
+            doc = PostingCursor::kEnd;
+            for (size_t i = 0; i < optional.size(); i++) {
+                doc = std::min(doc, optional[i]->cursor.doc);
+            }
+            if (doc == PostingCursor::kEnd) {
+                break;
+            }
+        }
+
+        if (++steps >= kSkipInterval) {
+            if (options.generation.superseded()) {
+                options.generation.stop();
+                hits->clear();
+                return;
+            }
+            steps = 0;
+        }
+        if (!options.deleted || !(options.deleted[doc / 64] >> (doc % 64) & 1)) {
+            float score = 0;
+            for (size_t i = 0; i < terms.size(); i++) {
+                const PostingCursor &c = terms[i].cursor;
+                if (c.doc == doc) {
+                    score += terms[i].weight * termScore(terms[i].idf, weightedFrequency(doc, c.fieldTf));
+                }
+            }
+            // Phrases do not change the score, so only a hymn that would
+            // make the list needs its positions read.
+            SearchHit hit = { doc, score };
+            if ((hits->size() < options.limit || worseHit(hit, hits->front()))
+                && (groups.empty() || groupsMatch(terms, groups, doc, &readers))) {
+                offer(hits, options.limit, doc, score);
+            }
+        }
+        for (size_t i = 0; i < terms.size(); i++) {
+            if (terms[i].cursor.doc == doc) {
+                terms[i].cursor.next();
+            }
+        }
+    }
+
+    std::sort_heap(hits->begin(), hits->end(), worseHit);
+}
+
+static bool byLocation(const TextRange &a, const TextRange &b)
+{
+    return a.location < b.location;
+}
+
+size_t SearchIndex::highlight(Slice query, uint32_t number, HighlightText text, TextRange *ranges, size_t max,
+                              bool stemming, const Thesaurus *thesaurus) const
+{
+    if (!isOpen() || number == 0 || number > docCount()) {
+        return 0;
+    }
+    if (thesaurus && thesaurus->termCount() != termCount()) {
+        thesaurus = NULL;
+    }
+
+    // The terms of the query's words and their synonyms, once each.
+    static const size_t kMaxTerms = 64;
+    const IndexTerm *terms[kMaxTerms];
+    size_t termsCount = 0;
+    Tokenizer tokenizer(query);
+    Token token;
+    char normalized[kMaxTermBytes];
+    while (termsCount < kMaxTerms && tokenizer.next(&token)) {
+        size_t length = normalizeTerm(token.text, normalized);
+        if (stemming && length > 0) {
+            length = stemIndexTerm(Slice(normalized, length), normalized);
+        }
+        const IndexTerm *term = find(Slice(normalized, length));
+        if (!term) {
+            continue;
+        }
+        uint32_t synonymCount = 0;
+        const uint32_t *synonyms = thesaurus ? thesaurus->synonyms(termIndex(*term), &synonymCount) : NULL;
+        for (uint32_t i = 0; i <= synonymCount && termsCount < kMaxTerms; i++) {
+            const IndexTerm *t = i == 0 ? term : &_terms[synonyms[i - 1]];
+            if (std::find(terms, terms + termsCount, t) == terms + termsCount) {
+                terms[termsCount++] = t;
+            }
+        }
+    }
+
+    size_t count = 0;
+    for (size_t k = 0; k < termsCount && count < max; k++) {
+        PostingCursor c = cursor(*terms[k]);
+        if (!c.advanceTo(number) || c.doc != number) {
+            continue;
+        }
+        // Title words come first; the body's offsets start again from 0.
+        const uint8_t *p = c.offsets();
+        const uint8_t *end = c.offsetsEnd();
+        uint32_t first = text == kHighlightTitle ? 0 : c.fieldTf[kTitleField];
+        uint32_t last = text == kHighlightTitle ? c.fieldTf[kTitleField] : c.tf;
+        skipVarints(p, end, 2 * first);
+        uint32_t offset = 0;
+        for (uint32_t i = first; i < last && count < max && p < end; i++) {
+            offset += getVarint(p, end);
+            ranges[count].location = offset;
+            ranges[count].length = p < end ? getVarint(p, end) : 0;
+            count++;
+        }
+    }
+    std::sort(ranges, ranges + count, byLocation);
+    return count;
+}
+
+}
@@ -0,0 +1,493 @@
+//
+//  SearchIndex.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__SearchIndex__
+#define __LivroDeCanticos__SearchIndex__
+
+#include "MappedFile.h"
+#include "Slice.h"
+#include "Varint.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace canticos {
+
+// Inverted index file, all integers little endian:
+//
+//   IndexHeader
+//   IndexTerm[termCount]        sorted by term bytes, for binary search
+//   lexicon                     term bytes, no separators
+//   postings                    per term and hymn: doc delta, then
+//                               verse tf << 2 | (title tf > 0) << 1 |
+//                               (refrain tf > 0), then the title and refrain
+//                               tfs that are not zero, all varints
+//   positions                   per term and hymn, in postings order: the
+//                               tf word positions, as varint deltas from
+//                               the previous one (the first from 0)
+//   offsets                     per term and hymn, in postings order: for
+//                               each position, the word's UTF-16 offset in
+//                               its text as a delta from the previous one
+//                               (from 0 for the first of the title and the
+//                               first of the body), then its UTF-16 length
+//   IndexSkip[skipCount]        per term, one every kSkipInterval hymns
+//   float[docCount][kFieldCount] per hymn, weight / length norm of each field
+//   uint64_t[docCount + 1]      start of each hymn's forward list
+//   uint32_t[]                  forward lists: per hymn, its distinct terms
+//                               but stems, as (term index << 8 | weighted
+//                               frequency * kForwardScale, 1...255), sorted
+//
+// Documents are hymn numbers. A hymn has three fields: its indice.txt
+// title, its refrain (lines in capitals) and its verses (the other lines
+// of the text, after the title line every cN.txt starts with). Ranking is
+// BM25F: a term's frequencies in the fields, each times the field's weight
+// and divided by its length norm, add up to one weighted frequency that is
+// saturated once. The per field factors are computed when the index is
+// built, so scoring a posting is a dot product with no branches.
+//
+// Word positions count the title's words from 0, then the body's from
+// kPositionGap past the title, so no phrase runs from one into the other.
+// Positions live apart from the postings: a plain AND never reads them,
+// and a cursor only skips over the ones of the hymns it passed when a
+// phrase asks for the positions of the hymn it is on. Skip entries let a
+// cursor jump a whole block of postings, and the positions with it. The
+// offsets, for highlighting, work the same way; title words count in the
+// indice.txt title, the others in the cN.txt text, as UITextView counts.
+//
+// Every word is indexed twice, as itself and as its stem term (see
+// Stemmer.h) at the same position, so phrases, NEAR and highlighting work
+// the same on stems. Lengths count words once.
+//
+// Term indexes are positions in the sorted term table, so the terms sharing
+// a prefix form one contiguous index range. The forward lists let a small
+// candidate set be checked against a term range without walking postings.
+static const char kIndexMagic[8] = { 'L', 'D', 'C', 'I', 'N', 'D', 'E', 'X' };
+static const uint32_t kIndexVersion = 6;
+
+enum IndexField { kTitleField = 0, kRefrainField = 1, kVerseField = 2 };
+static const size_t kFieldCount = 3;
+
+// BM25 saturation; the usual default works well for short lyric texts.
+static const float kBM25K1 = 1.2f;
+
+// Fixed point scale of the weighted frequencies in forward lists.
+static const float kForwardScale = 16.0f;
+
+// Postings per skip block, and the positions left free between the title
+// and the body.
+static const uint32_t kSkipInterval = 64;
+static const uint32_t kPositionGap = 16;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t docCount;
+    uint32_t termCount;
+    float averageFieldLength[kFieldCount];
+    uint64_t termsOffset;
+    uint64_t lexiconOffset;
+    uint64_t lexiconSize;
+    uint64_t postingsOffset;
+    uint64_t postingsSize;
+    uint64_t positionsOffset;
+    uint64_t positionsSize;
+    uint64_t offsetsOffset;
+    uint64_t offsetsSize;
+    uint64_t skipsOffset;
+    uint64_t skipCount;
+    uint64_t fieldScalesOffset;
+    uint64_t forwardStartsOffset;
+    uint64_t forwardOffset;
+    uint64_t forwardCount;
+    uint64_t fileSize;
+};
+
+struct IndexTerm {
+    uint64_t postingsOffset;   // relative to the postings section
+    uint32_t postingsSize;
+    uint32_t docFrequency;
+    uint32_t lexiconOffset;
+    uint32_t lexiconSize;
+    uint64_t positionsOffset;  // relative to the positions section
+    uint32_t positionsSize;
+    uint32_t firstSkip;        // index into the skip table
+    uint32_t skipCount;
+    uint32_t offsetsSize;
+    uint64_t offsetsOffset;    // relative to the offsets section
+};
+
+// Start of a term's postings block k + 1: the last hymn of block k (the
+// base of the next doc delta), and where the block's postings, positions
+// and offsets begin, relative to the term's.
+struct IndexSkip {
+    uint32_t doc;
+    uint32_t postingsOffset;
+    uint32_t positionsOffset;
+    uint32_t offsetsOffset;
+};
+
+// Walks the word positions of a term in one hymn, ascending.
+class PositionReader {
+public:
+    PositionReader() : _p(NULL), _end(NULL), _left(0), position(kEnd) {}
+    PositionReader(const uint8_t *p, const uint8_t *end, uint32_t count) : _p(p), _end(end), _left(count), position(0)
+    {
+        next();
+    }
+
+    bool next()
+    {
+        if (_left == 0 || _p >= _end) {
+            position = kEnd;
+            return false;
+        }
+        _left--;
+        position += getVarint(_p, _end);
+        return true;
+    }
+
+    // Moves to the first position >= target.
+    bool advanceTo(uint32_t target)
+    {
+        while (position < target) {
+            if (!next()) {
+                return false;
+            }
+        }
+        return position != kEnd;
+    }
+
+    static const uint32_t kEnd = 0xFFFFFFFF;
+
+private:
+    const uint8_t *_p;
+    const uint8_t *_end;
+    uint32_t _left;
+
+public:
+    uint32_t position;
+};
+
+// Walks one postings list in document order.
+class PostingCursor {
+public:
+    PostingCursor()
+        : _p(NULL), _end(NULL), _base(NULL), _positions(NULL), _positionsBase(NULL), _positionsEnd(NULL),
+          _pendingPositions(0), _offsets(NULL), _offsetsBase(NULL), _offsetsEnd(NULL), _pendingOffsets(0),
+          _skip(NULL), _skipEnd(NULL), doc(0), tf(0)
+    {
+    }
+    PostingCursor(const uint8_t *begin, const uint8_t *end, const uint8_t *positions, const uint8_t *positionsEnd,
+                  const uint8_t *offsets, const uint8_t *offsetsEnd, const IndexSkip *skips, const IndexSkip *skipsEnd)
+        : _p(begin), _end(end), _base(begin), _positions(positions), _positionsBase(positions),
+          _positionsEnd(positionsEnd), _pendingPositions(0), _offsets(offsets), _offsetsBase(offsets),
+          _offsetsEnd(offsetsEnd), _pendingOffsets(0), _skip(skips), _skipEnd(skipsEnd), doc(0), tf(0)
+    {
+    }
+
+    bool next()
+    {
+        if (_p >= _end) {
+            doc = kEnd;
+            return false;
+        }
+        _pendingPositions += tf;
+        _pendingOffsets += tf;
+        doc += getVarint(_p, _end);
+        uint32_t head = getVarint(_p, _end);
+        fieldTf[kVerseField] = head >> 2;
+        fieldTf[kTitleField] = (head & 2) ? getVarint(_p, _end) : 0;
+        fieldTf[kRefrainField] = (head & 1) ? getVarint(_p, _end) : 0;
+        tf = fieldTf[kTitleField] + fieldTf[kRefrainField] + fieldTf[kVerseField];
+        return true;
+    }
+
+    // Moves to the first document >= target, jumping the blocks that end
+    // before it. The skip entries are galloped over, so a far target (one
+    // hymn, for highlighting) costs a binary search.
+    bool advanceTo(uint32_t target)
+    {
+        if (_skip < _skipEnd && _skip->doc < target) {
+            size_t step = 1;
+            const IndexSkip *low = _skip;
+            while (step < (size_t)(_skipEnd - low) && low[step].doc < target) {
+                low += step;
+                step *= 2;
+            }
+            // Now low->doc < target, and low[step] is past it or the end.
+            const IndexSkip *high = low + std::min(step, (size_t)(_skipEnd - low));
+            while (high - low > 1) {
+                const IndexSkip *mid = low + (high - low) / 2;
+                if (mid->doc < target) {
+                    low = mid;
+                } else {
+                    high = mid;
+                }
+            }
+            if (doc <= low->doc) {
+                _p = _base + low->postingsOffset;
+                _positions = _positionsBase + low->positionsOffset;
+                _pendingPositions = 0;
+                _offsets = _offsetsBase + low->offsetsOffset;
+                _pendingOffsets = 0;
+                doc = low->doc;
+                tf = 0;
+            }
+            _skip = low + 1;
+        }
+        while (doc < target) {
+            if (!next()) {
+                return false;
+            }
+        }
+        return doc != kEnd;
+    }
+
+    // Word positions in the current document.
+    PositionReader positions()
+    {
+        skipVarints(_positions, _positionsEnd, _pendingPositions);
+        _pendingPositions = 0;
+        return PositionReader(_positions, _positionsEnd, tf);
+    }
+
+    // The offsets of the current document: tf (offset delta, length) pairs,
+    // title words first. Read up to offsetsEnd().
+    const uint8_t *offsets()
+    {
+        skipVarints(_offsets, _offsetsEnd, 2 * _pendingOffsets);
+        _pendingOffsets = 0;
+        return _offsets;
+    }
+    const uint8_t *offsetsEnd() const { return _offsetsEnd; }
+
+    static const uint32_t kEnd = 0xFFFFFFFF;
+
+private:
+    const uint8_t *_p;
+    const uint8_t *_end;
+    const uint8_t *_base;
+    const uint8_t *_positions;         // at the current document's, once
+    const uint8_t *_positionsBase;     // _pendingPositions are skipped
+    const uint8_t *_positionsEnd;
+    uint32_t _pendingPositions;
+    const uint8_t *_offsets;
+    const uint8_t *_offsetsBase;
+    const uint8_t *_offsetsEnd;
+    uint32_t _pendingOffsets;
+    const IndexSkip *_skip;
+    const IndexSkip *_skipEnd;
+
+public:
+    uint32_t doc;
+    uint32_t tf;                       // all fields together
+    uint32_t fieldTf[kFieldCount];
+};
+
+struct DocumentWords;
+struct IndexRun;
+class Thesaurus;
+
+// Accumulates hymns and writes the index file. Documents must be added in
+// increasing number order. The body is split into refrain and verse lines
+// here; its first line, the numbered title, is left to the title field.
+//
+// Builders of consecutive runs of hymns can work apart, one per thread, and
+// hand their hymns over as runs to be merged (see IndexMerge.h): terms are
+// sorted when the file is written, so the bytes are the same however the
+// hymns were split.
+class IndexBuilder {
+public:
+    IndexBuilder();
+
+    void addDocument(uint32_t number, Slice title, Slice body);
+    // Moves the hymns added so far into run, leaving the builder empty.
+    void takeRun(IndexRun *run);
+    void serialize(std::string *out) const;
+
+private:
+    void addText(Slice text, IndexField field, DocumentWords *words);
+    uint32_t termId(const std::string &term);
+    uint32_t stemId(uint32_t word);
+    void fillRun(IndexRun *run) const;
+
+    std::vector<std::string> _terms;
+    std::vector<std::vector<uint32_t> > _postings;   // per hymn: doc, then tf per field
+    std::vector<std::vector<uint32_t> > _positions;  // per hymn, in postings order
+    std::vector<std::vector<uint32_t> > _offsets;    // per position: UTF-16 offset, then length
+    std::vector<uint32_t> _stemIds;                  // per word term, its stem term's, once asked
+    std::vector<uint32_t> _fieldLengths;             // per hymn from _firstDoc: words per field
+    std::unordered_map<std::string, uint32_t> _termIds;
+    uint64_t _totalFieldLength[kFieldCount];
+    uint32_t _firstDoc;
+    uint32_t _docCount;
+    uint32_t _hymnCount;
+};
+
+struct SearchHit {
+    uint32_t number;
+    float score;
+};
+
+// A run of UTF-16 code units, like NSRange.
+struct TextRange {
+    uint32_t location;
+    uint32_t length;
+};
+
+// Which text of a hymn highlight ranges are in.
+enum HighlightText { kHighlightTitle, kHighlightBody };
+
+// A search's place among the requests of one SearchExecutor: it is
+// superseded once latest has moved past generation, by a newer request or
+// a cancel. Without latest it never is. A search that stops early for it
+// sets stopped, when there is one, so a search cut short can be told from
+// one that ran to the end and was superseded after.
+struct SearchGeneration {
+    const std::atomic<uint64_t> *latest;
+    uint64_t generation;
+    std::atomic<bool> *stopped;
+
+    bool superseded() const { return latest && latest->load(std::memory_order_relaxed) != generation; }
+    void stop() const
+    {
+        if (stopped) {
+            stopped->store(true, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Query syntax, on top of plain words: "a quoted phrase" (typographic
+// quotes too) matches its words in a row; a NEAR/k b matches a and b at
+// most k words apart, in either order, and chains (a NEAR/3 b NEAR/3 c).
+// Phrases and NEAR groups are always required; the plain words around
+// them follow the mode. Phrase mode reads the whole query as one phrase,
+// like LSLocaytaSearchQueryOperatorPhrase. With stemming, every query
+// word matches the words sharing its stem ("cantemos" finds "cantai"), as
+// Locayta's stemmingLanguage did. With a thesaurus built for this index,
+// a plain word also matches its synonyms ("piedade" finds "misericórdia"),
+// which score synonymWeight times what the word itself would; phrases and
+// NEAR groups keep to the words as written.
+struct SearchOptions {
+    enum Mode { AllWords, AnyWord, Phrase };
+
+    Mode mode;
+    size_t limit;
+    bool stemming;
+    const Thesaurus *thesaurus;
+    float synonymWeight;
+
+    // For an index searched as one part of several (see SegmentedIndex.h):
+    // the hymns set in deleted, a bitmap by number, are left out, and idf,
+    // when set, weighs a term by its frequency over all the parts, so that
+    // the parts' scores compare.
+    const uint64_t *deleted;
+    std::function<float(Slice term)> idf;
+
+    // Checked every kSkipInterval hymns the search steps over; once it is
+    // superseded the search stops where it is, with no hits.
+    SearchGeneration generation;
+
+    SearchOptions()
+        : mode(AllWords), limit(50), stemming(false), thesaurus(NULL), synonymWeight(0.5f), deleted(NULL)
+    {
+        generation.latest = NULL;
+        generation.generation = 0;
+        generation.stopped = NULL;
+    }
+};
+
+// Read-only view over a mapped index file.
+class SearchIndex {
+public:
+    SearchIndex();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t docCount() const { return _header ? _header->docCount : 0; }
+    uint32_t termCount() const { return _header ? _header->termCount : 0; }
+    float averageFieldLength(size_t field) const { return _header ? _header->averageFieldLength[field] : 0; }
+
+    // Looks up an already normalized term.
+    const IndexTerm *find(Slice term) const;
+    Slice termText(const IndexTerm &term) const
+    {
+        return Slice(_lexicon + term.lexiconOffset, term.lexiconSize);
+    }
+    PostingCursor cursor(const IndexTerm &term) const
+    {
+        const uint8_t *p = _postings + term.postingsOffset;
+        const uint8_t *positions = _positions + term.positionsOffset;
+        const uint8_t *offsets = _offsets + term.offsetsOffset;
+        const IndexSkip *skips = _skips + term.firstSkip;
+        return PostingCursor(p, p + term.postingsSize, positions, positions + term.positionsSize, offsets,
+                             offsets + term.offsetsSize, skips, skips + term.skipCount);
+    }
+    uint32_t termIndex(const IndexTerm &term) const { return (uint32_t)(&term - _terms); }
+    const IndexTerm &term(uint32_t index) const { return _terms[index]; }
+    // Indexes [*first, *last) of the terms starting with prefix.
+    void prefixRange(Slice prefix, uint32_t *first, uint32_t *last) const;
+
+    // Forward list of a hymn: see the file layout above.
+    const uint32_t *forwardBegin(uint32_t number) const { return _forward + _forwardStarts[number - 1]; }
+    const uint32_t *forwardEnd(uint32_t number) const { return _forward + _forwardStarts[number]; }
+
+    // BM25F: idf of a term; a term's weighted frequency in a hymn, from its
+    // tf in each field; and the score of that frequency.
+    float idf(const IndexTerm &term) const;
+    float weightedFrequency(uint32_t number, const uint32_t *fieldTf) const
+    {
+        const float *scale = _fieldScales + (size_t)(number - 1) * kFieldCount;
+        return fieldTf[kTitleField] * scale[kTitleField] + fieldTf[kRefrainField] * scale[kRefrainField]
+            + fieldTf[kVerseField] * scale[kVerseField];
+    }
+    static float termScore(float idf, float frequency)
+    {
+        return idf * frequency * (kBM25K1 + 1) / (frequency + kBM25K1);
+    }
+    // The weighted frequency kept in a forward list entry.
+    static float forwardFrequency(uint32_t entry) { return (entry & 0xFF) / kForwardScale; }
+
+    // Ranked hymn numbers for a free text query, best first (BM25).
+    void search(Slice query, const SearchOptions &options, std::vector<SearchHit> *hits) const;
+
+    // Where the query's words are in one text of a hymn, read from the
+    // offsets: at most max ranges, in text order. Title ranges are in the
+    // indice.txt title, body ranges in the cN.txt text. With stemming, the
+    // words sharing a query word's stem are found too, and with a thesaurus
+    // its synonyms, as search finds them. Allocates nothing.
+    size_t highlight(Slice query, uint32_t number, HighlightText text, TextRange *ranges, size_t max,
+                     bool stemming = false, const Thesaurus *thesaurus = NULL) const;
+
+private:
+    SearchIndex(const SearchIndex &) = delete;
+    SearchIndex &operator=(const SearchIndex &) = delete;
+
+    MappedFile _file;
+    const IndexHeader *_header;
+    const IndexTerm *_terms;
+    const char *_lexicon;
+    const uint8_t *_postings;
+    const uint8_t *_positions;
+    const uint8_t *_offsets;
+    const IndexSkip *_skips;
+    const float *_fieldScales;
+    const uint64_t *_forwardStarts;
+    const uint32_t *_forward;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__SearchIndex__) */
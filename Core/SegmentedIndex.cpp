@@ -0,0 +1,418 @@
+//
+//  SegmentedIndex.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "SegmentedIndex.h"
+#include "IndexMerge.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace canticos {
+
+// Segments merged at once; a segment's tier is how many times it goes
+// into its live hymns.
+static const size_t kMergeFactor = 4;
+
+typedef std::vector<uint64_t> Bitmap;
+
+static bool hasBit(const Bitmap &bits, uint32_t n)
+{
+    return n / 64 < bits.size() && (bits[n / 64] >> (n % 64) & 1);
+}
+
+static void setBit(Bitmap *bits, uint32_t n)
+{
+    if (n / 64 >= bits->size()) {
+        bits->resize(n / 64 + 1, 0);
+    }
+    (*bits)[n / 64] |= (uint64_t)1 << (n % 64);
+}
+
+struct SegmentedIndex::Segment {
+    std::string bytes;          // the index, unless it is mapped
+    SearchIndex index;
+    std::string thesaurusBytes;
+    Thesaurus thesaurus;        // open when there are synonyms
+    Bitmap hymns;               // the numbers written in it, by bit
+    uint32_t hymnCount;
+};
+
+SegmentedIndex::SegmentedIndex()
+    : _parts(std::make_shared<const Parts>()), _merging(false), _stop(false)
+{
+    _merger = std::thread(&SegmentedIndex::mergeLoop, this);
+}
+
+SegmentedIndex::~SegmentedIndex()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _merger.join();
+}
+
+void SegmentedIndex::setSynonyms(const std::vector<SynonymLine> &lines)
+{
+    _synonyms = lines;
+}
+
+void SegmentedIndex::openSegment(Segment *segment)
+{
+    // Bytes written here, so the checks pass.
+    if (!segment->bytes.empty()) {
+        segment->index.openMemory(segment->bytes.data(), segment->bytes.size());
+    }
+    if (!_synonyms.empty()) {
+        buildThesaurus(segment->index, _synonyms, &segment->thesaurusBytes);
+        segment->thesaurus.openMemory(segment->thesaurusBytes.data(), segment->thesaurusBytes.size());
+    }
+}
+
+bool SegmentedIndex::open(const char *path, std::string *error)
+{
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    if (!segment->index.open(path, error)) {
+        return false;
+    }
+    openSegment(segment.get());
+    segment->hymnCount = segment->index.docCount();
+    segment->hymns.assign(segment->hymnCount / 64 + 1, ~(uint64_t)0);
+    segment->hymns[0] &= ~(uint64_t)1;
+    for (uint32_t n = segment->hymnCount + 1; n < segment->hymns.size() * 64; n++) {
+        segment->hymns[n / 64] &= ~((uint64_t)1 << (n % 64));
+    }
+    Part part = { segment, NULL, segment->hymnCount };
+    std::shared_ptr<Parts> parts = std::make_shared<Parts>(1, part);
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _parts = parts;
+    }
+    _wake.notify_all();
+    return true;
+}
+
+std::shared_ptr<const SegmentedIndex::Parts> SegmentedIndex::parts() const
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _parts;
+}
+
+size_t SegmentedIndex::segmentCount() const
+{
+    return parts()->size();
+}
+
+uint32_t SegmentedIndex::hymnCount() const
+{
+    std::shared_ptr<const Parts> current = parts();
+    uint32_t count = 0;
+    for (size_t p = 0; p < current->size(); p++) {
+        count += (*current)[p].live;
+    }
+    return count;
+}
+
+// Each segment's averages, weighed by its live hymns.
+void SegmentedIndex::averageFieldLengths(const Parts &parts, float *averages) const
+{
+    double sums[kFieldCount] = { 0, 0, 0 };
+    double hymns = 0;
+    for (size_t p = 0; p < parts.size(); p++) {
+        for (size_t f = 0; f < kFieldCount; f++) {
+            sums[f] += (double)parts[p].segment->index.averageFieldLength(f) * parts[p].live;
+        }
+        hymns += parts[p].live;
+    }
+    for (size_t f = 0; f < kFieldCount; f++) {
+        averages[f] = hymns > 0 ? (float)(sums[f] / hymns) : 0;
+    }
+}
+
+std::shared_ptr<SegmentedIndex::Segment> SegmentedIndex::writeSegment(const std::vector<const HymnChange *> &changes,
+                                                                      const float *averages)
+{
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    IndexBuilder builder;
+    segment->hymnCount = 0;
+    for (size_t c = 0; c < changes.size(); c++) {
+        builder.addDocument(changes[c]->number, Slice(changes[c]->title), Slice(changes[c]->body));
+        setBit(&segment->hymns, changes[c]->number);
+        segment->hymnCount++;
+    }
+    std::vector<IndexRun> runs(1);
+    builder.takeRun(&runs[0]);
+    WorkerPool caller(0);
+    mergeIndexRuns(runs, &caller, &segment->bytes, NULL, averages[0] > 0 ? averages : NULL);
+    openSegment(segment.get());
+    return segment;
+}
+
+void SegmentedIndex::apply(const std::vector<HymnChange> &changes)
+{
+    // The last change of each number, in number order.
+    std::vector<const HymnChange *> last;
+    for (size_t c = 0; c < changes.size(); c++) {
+        if (changes[c].number > 0) {
+            last.push_back(&changes[c]);
+        }
+    }
+    std::stable_sort(last.begin(), last.end(),
+                     [](const HymnChange *a, const HymnChange *b) { return a->number < b->number; });
+    size_t kept = 0;
+    for (size_t c = 0; c < last.size(); c++) {
+        if (c + 1 < last.size() && last[c + 1]->number == last[c]->number) {
+            continue;
+        }
+        last[kept++] = last[c];
+    }
+    last.resize(kept);
+    if (last.empty()) {
+        return;
+    }
+    std::vector<const HymnChange *> written;
+    for (size_t c = 0; c < last.size(); c++) {
+        if (!last[c]->removed) {
+            written.push_back(last[c]);
+        }
+    }
+    std::shared_ptr<Segment> segment;
+    if (!written.empty()) {
+        float averages[kFieldCount];
+        averageFieldLengths(*parts(), averages);
+        segment = writeSegment(written, averages);
+    }
+
+    {
+        // Marks the numbers deleted wherever they are live, copying only
+        // the bitmaps that change.
+        std::lock_guard<std::mutex> lock(_lock);
+        std::shared_ptr<Parts> next = std::make_shared<Parts>();
+        for (size_t p = 0; p < _parts->size(); p++) {
+            Part part = (*_parts)[p];
+            std::shared_ptr<Bitmap> deleted;
+            for (size_t c = 0; c < last.size(); c++) {
+                uint32_t n = last[c]->number;
+                if (!hasBit(part.segment->hymns, n) || (part.deleted && hasBit(*part.deleted, n))) {
+                    continue;
+                }
+                if (!deleted) {
+                    deleted = part.deleted ? std::make_shared<Bitmap>(*part.deleted)
+                                           : std::make_shared<Bitmap>(part.segment->hymns.size(), 0);
+                }
+                setBit(deleted.get(), n);
+                part.live--;
+            }
+            if (deleted) {
+                part.deleted = deleted;
+            }
+            if (part.live > 0) {
+                next->push_back(part);
+            }
+        }
+        if (segment) {
+            Part part = { segment, NULL, segment->hymnCount };
+            next->push_back(part);
+        }
+        _parts = next;
+    }
+    _wake.notify_all();
+}
+
+void SegmentedIndex::replaceHymn(uint32_t number, Slice title, Slice body)
+{
+    std::vector<HymnChange> changes(1);
+    changes[0].number = number;
+    changes[0].removed = false;
+    changes[0].title = title.str();
+    changes[0].body = body.str();
+    apply(changes);
+}
+
+void SegmentedIndex::removeHymn(uint32_t number)
+{
+    std::vector<HymnChange> changes(1);
+    changes[0].number = number;
+    changes[0].removed = true;
+    apply(changes);
+}
+
+static bool betterHit(const SearchHit &a, const SearchHit &b)
+{
+    if (a.score != b.score) {
+        return a.score > b.score;
+    }
+    return a.number < b.number;
+}
+
+void SegmentedIndex::search(Slice query, const SearchOptions &options, std::vector<SearchHit> *hits) const
+{
+    hits->clear();
+    std::shared_ptr<const Parts> current = parts();
+    if (current->empty()) {
+        return;
+    }
+
+    // BM25's idf over every segment's hymns.
+    float n = 0;
+    for (size_t p = 0; p < current->size(); p++) {
+        n += (float)(*current)[p].segment->hymnCount;
+    }
+    SearchOptions partOptions = options;
+    partOptions.idf = [&current, n](Slice term) {
+        float df = 0;
+        for (size_t p = 0; p < current->size(); p++) {
+            const IndexTerm *found = (*current)[p].segment->index.find(term);
+            df += found ? (float)found->docFrequency : 0;
+        }
+        return logf(1.0f + (n - df + 0.5f) / (df + 0.5f));
+    };
+    std::vector<SearchHit> found;
+    for (size_t p = 0; p < current->size(); p++) {
+        const Part &part = (*current)[p];
+        partOptions.deleted = part.deleted ? part.deleted->data() : NULL;
+        partOptions.thesaurus = options.thesaurus && part.segment->thesaurus.isOpen() ? &part.segment->thesaurus : NULL;
+        part.segment->index.search(query, partOptions, &found);
+        hits->insert(hits->end(), found.begin(), found.end());
+    }
+    size_t limit = std::min(options.limit, hits->size());
+    std::partial_sort(hits->begin(), hits->begin() + limit, hits->end(), betterHit);
+    hits->resize(limit);
+}
+
+// The lowest tier with kMergeFactor segments in it, oldest first.
+bool SegmentedIndex::pickMerge(const Parts &parts, std::vector<size_t> *picked)
+{
+    std::vector<uint32_t> tiers(parts.size());
+    for (size_t p = 0; p < parts.size(); p++) {
+        for (uint32_t live = parts[p].live; live >= kMergeFactor; live /= kMergeFactor) {
+            tiers[p]++;
+        }
+    }
+    for (uint32_t tier = 0; tier < 32; tier++) {
+        picked->clear();
+        for (size_t p = 0; p < parts.size() && picked->size() < kMergeFactor; p++) {
+            if (tiers[p] == tier) {
+                picked->push_back(p);
+            }
+        }
+        if (picked->size() == kMergeFactor) {
+            return true;
+        }
+    }
+    picked->clear();
+    return false;
+}
+
+std::shared_ptr<SegmentedIndex::Segment> SegmentedIndex::mergeSegments(const Parts &parts,
+                                                                       const std::vector<size_t> &picked)
+{
+    std::shared_ptr<Segment> merged = std::make_shared<Segment>();
+    merged->hymnCount = 0;
+    std::vector<IndexRun> runs(picked.size());
+    for (size_t i = 0; i < picked.size(); i++) {
+        const Part &part = parts[picked[i]];
+        readIndexRun(part.segment->index, part.deleted ? part.deleted->data() : NULL, &runs[i]);
+        const Bitmap &hymns = part.segment->hymns;
+        for (uint32_t n = 0; n < hymns.size() * 64; n++) {
+            if (hasBit(hymns, n) && !(part.deleted && hasBit(*part.deleted, n))) {
+                setBit(&merged->hymns, n);
+            }
+        }
+        merged->hymnCount += part.live;
+    }
+
+    // A merge of every segment normalizes by its own averages, which are
+    // the index's.
+    float averages[kFieldCount];
+    averageFieldLengths(parts, averages);
+    WorkerPool caller(0);
+    mergeIndexRuns(runs, &caller, &merged->bytes, NULL,
+                   picked.size() < parts.size() && averages[0] > 0 ? averages : NULL);
+    openSegment(merged.get());
+    return merged;
+}
+
+void SegmentedIndex::mergeLoop()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    for (;;) {
+        std::vector<size_t> picked;
+        _wake.wait(lock, [&] { return _stop || pickMerge(*_parts, &picked); });
+        if (_stop) {
+            return;
+        }
+        std::shared_ptr<const Parts> start = _parts;
+        _merging = true;
+        lock.unlock();
+        std::shared_ptr<Segment> merged = mergeSegments(*start, picked);
+        lock.lock();
+
+        // Hymns deleted from the merged segments while they were merged
+        // are deleted from the merged one; a segment gone from the list
+        // lost every hymn.
+        Part part = { merged, NULL, merged->hymnCount };
+        std::shared_ptr<Bitmap> deleted;
+        for (size_t i = 0; i < picked.size(); i++) {
+            const Part &was = (*start)[picked[i]];
+            const Part *now = NULL;
+            for (size_t p = 0; p < _parts->size(); p++) {
+                if ((*_parts)[p].segment == was.segment) {
+                    now = &(*_parts)[p];
+                }
+            }
+            if (now && now->deleted == was.deleted) {
+                continue;
+            }
+            const Bitmap &hymns = was.segment->hymns;
+            for (uint32_t n = 0; n < hymns.size() * 64; n++) {
+                if (!hasBit(hymns, n) || (was.deleted && hasBit(*was.deleted, n))) {
+                    continue;
+                }
+                if (!now || (now->deleted && hasBit(*now->deleted, n))) {
+                    if (!deleted) {
+                        deleted = std::make_shared<Bitmap>(merged->hymns.size(), 0);
+                    }
+                    setBit(deleted.get(), n);
+                    part.live--;
+                }
+            }
+        }
+        part.deleted = deleted;
+        std::shared_ptr<Parts> next = std::make_shared<Parts>();
+        bool placed = false;
+        for (size_t p = 0; p < _parts->size(); p++) {
+            bool mergedAway = false;
+            for (size_t i = 0; i < picked.size(); i++) {
+                mergedAway = mergedAway || (*_parts)[p].segment == (*start)[picked[i]].segment;
+            }
+            if (!mergedAway) {
+                next->push_back((*_parts)[p]);
+            } else if (!placed && part.live > 0) {
+                next->push_back(part);
+                placed = true;
+            }
+        }
+        if (!placed && part.live > 0) {
+            next->push_back(part);
+        }
+        _parts = next;
+        _merging = false;
+        _merged.notify_all();
+    }
+}
+
+void SegmentedIndex::waitForMerges()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    std::vector<size_t> picked;
+    _merged.wait(lock, [&] { return !_merging && !pickMerge(*_parts, &picked); });
+}
+
+}
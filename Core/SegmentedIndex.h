@@ -0,0 +1,123 @@
+//
+//  SegmentedIndex.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__SegmentedIndex__
+#define __LivroDeCanticos__SegmentedIndex__
+
+#include "SearchIndex.h"
+#include "Slice.h"
+#include "Thesaurus.h"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace canticos {
+
+// A change to one hymn: it is removed, or it takes title and body, whether
+// it was in the index or not.
+struct HymnChange {
+    uint32_t number;
+    bool removed;
+    std::string title;
+    std::string body;
+};
+
+// An index that takes corrections of single hymns without a rebuild, as
+// LSLocaytaSearchIndexer's addOrReplaceRecords: and deleteRecord: did.
+//
+// The index is a list of segments, each an index file of its own. The
+// first is the book's index as canticos-build wrote it; every batch of
+// changes is written as a small new one, and the hymns it changes are
+// marked deleted in the older segments, in a bitmap per segment kept
+// beside it (the segment itself is never written again), so every hymn is
+// live in one segment at most. A thread of its own merges segments in the
+// background, size tiered: once four segments have about as many live
+// hymns as each other (the same power of four), they are read back and
+// written as one, without their deleted hymns.
+//
+// Segments and bitmaps are shared and never changed once made; a change
+// or a merge makes a new list of them and puts it in place at once. A
+// search takes the list as it finds it, so a merge or a change landing
+// meanwhile neither stops it nor shows it half done.
+//
+// Every segment is searched, its deleted hymns left out, and the hits
+// are merged by score. A term weighs the same in all of them: its idf is
+// taken over the hymns of every segment, deleted ones too until a merge
+// drops them. New segments normalize field lengths by the averages over
+// the whole index when they are written, so a corrected hymn scores as
+// it would in a rebuilt index, near enough; a merge of every segment
+// gives the rebuilt index's scores exactly.
+class SegmentedIndex {
+public:
+    SegmentedIndex();
+    ~SegmentedIndex();
+
+    // The synonyms that every segment's thesaurus is built from, for
+    // searches with options.thesaurus set. Call before open.
+    void setSynonyms(const std::vector<SynonymLine> &lines);
+
+    // Maps an index file as the first segment. Without it the index
+    // starts empty.
+    bool open(const char *path, std::string *error = NULL);
+
+    // Writes the changes as one new segment, the last change of a number
+    // winning, and returns when searches see them all. Safe from several
+    // threads at once; each call's changes land together.
+    void apply(const std::vector<HymnChange> &changes);
+    void replaceHymn(uint32_t number, Slice title, Slice body);
+    void removeHymn(uint32_t number);
+
+    // As SearchIndex::search over the live hymns of every segment. With
+    // options.thesaurus set, to anything, each segment expands with its
+    // own. Safe from several threads at once, and while changes are
+    // applied and segments merged.
+    void search(Slice query, const SearchOptions &options, std::vector<SearchHit> *hits) const;
+
+    size_t segmentCount() const;
+    uint32_t hymnCount() const;
+
+    // Returns once no merge is running or due.
+    void waitForMerges();
+
+private:
+    SegmentedIndex(const SegmentedIndex &) = delete;
+    SegmentedIndex &operator=(const SegmentedIndex &) = delete;
+
+    struct Segment;
+    struct Part {
+        std::shared_ptr<const Segment> segment;
+        std::shared_ptr<const std::vector<uint64_t> > deleted;   // NULL for none
+        uint32_t live;
+    };
+    typedef std::vector<Part> Parts;
+
+    std::shared_ptr<const Parts> parts() const;
+    void averageFieldLengths(const Parts &parts, float *averages) const;
+    std::shared_ptr<Segment> writeSegment(const std::vector<const HymnChange *> &changes, const float *averages);
+    std::shared_ptr<Segment> mergeSegments(const Parts &parts, const std::vector<size_t> &picked);
+    void openSegment(Segment *segment);
+    static bool pickMerge(const Parts &parts, std::vector<size_t> *picked);
+    void mergeLoop();
+
+    std::vector<SynonymLine> _synonyms;
+    mutable std::mutex _lock;
+    std::shared_ptr<const Parts> _parts;                // under _lock
+    std::condition_variable _wake;                      // a merge may be due
+    std::condition_variable _merged;
+    bool _merging;
+    bool _stop;
+    std::thread _merger;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__SegmentedIndex__) */
@@ -0,0 +1,104 @@
+//
+//  ShardedSearch.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "ShardedSearch.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+namespace canticos {
+
+namespace {
+
+// Where a shard's list is in the merge.
+struct ShardHead {
+    uint32_t shard;
+    uint32_t next;
+    const SearchHit *hit;
+};
+
+// Max-heap on the head hits: the root is the best hit left.
+struct WorseHead {
+    bool operator()(const ShardHead &a, const ShardHead &b) const
+    {
+        if (a.hit->score != b.hit->score) {
+            return a.hit->score < b.hit->score;
+        }
+        if (a.shard != b.shard) {
+            return a.shard > b.shard;
+        }
+        return a.hit->number > b.hit->number;
+    }
+};
+
+}
+
+void mergeShardHits(const std::vector<std::vector<SearchHit> > &shards, size_t limit, std::vector<ShardHit> *hits)
+{
+    hits->clear();
+    std::vector<ShardHead> heap;
+    heap.reserve(shards.size());
+    for (size_t s = 0; s < shards.size(); s++) {
+        if (!shards[s].empty()) {
+            ShardHead head = { (uint32_t)s, 1, &shards[s][0] };
+            heap.push_back(head);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), WorseHead());
+    while (!heap.empty() && hits->size() < limit) {
+        std::pop_heap(heap.begin(), heap.end(), WorseHead());
+        ShardHead &head = heap.back();
+        ShardHit hit = { head.shard, head.hit->number, head.hit->score };
+        hits->push_back(hit);
+        const std::vector<SearchHit> &list = shards[head.shard];
+        if (head.next < list.size()) {
+            head.hit = &list[head.next++];
+            std::push_heap(heap.begin(), heap.end(), WorseHead());
+        } else {
+            heap.pop_back();
+        }
+    }
+}
+
+ShardedSearch::ShardedSearch(WorkerPool *pool) : _pool(pool)
+{
+}
+
+void ShardedSearch::addShard(const SearchIndex *index, const Thesaurus *thesaurus)
+{
+    Shard shard = { index, thesaurus, std::make_shared<IncrementalSearch>(*index) };
+    _shards.push_back(shard);
+    _typed.resize(_shards.size());
+}
+
+void ShardedSearch::search(Slice query, const SearchOptions &options, std::vector<ShardHit> *hits) const
+{
+    std::vector<std::vector<SearchHit> > found(_shards.size());
+    _pool->run(_shards.size(), [&](size_t s) {
+        SearchOptions shardOptions = options;
+        shardOptions.thesaurus = options.thesaurus ? _shards[s].thesaurus : NULL;
+        _shards[s].index->search(query, shardOptions, &found[s]);
+    });
+    mergeShardHits(found, options.limit, hits);
+}
+
+void ShardedSearch::update(Slice text, size_t limit, std::vector<ShardHit> *hits)
+{
+    _pool->run(_shards.size(), [&](size_t s) {
+        _shards[s].typing->update(text, limit, &_typed[s]);
+    });
+    mergeShardHits(_typed, limit, hits);
+}
+
+void ShardedSearch::reset()
+{
+    for (size_t s = 0; s < _shards.size(); s++) {
+        _shards[s].typing->reset();
+    }
+}
+
+}
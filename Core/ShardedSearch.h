@@ -0,0 +1,81 @@
+//
+//  ShardedSearch.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__ShardedSearch__
+#define __LivroDeCanticos__ShardedSearch__
+
+#include "IncrementalSearch.h"
+#include "SearchIndex.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace canticos {
+
+class Thesaurus;
+class WorkerPool;
+
+// A hit in one of several indices: the shard it came from (its place in
+// the catalog, for the books of Catalog.h) and the hymn's number there.
+struct ShardHit {
+    uint32_t shard;
+    uint32_t number;
+    float score;
+};
+
+// The best limit hits over the shards, best first, from each shard's own
+// hits, best first. A heap holds the best hit left of every shard, so the
+// merge reads limit + shards hits at most. Equal scores go to the lower
+// shard, then the lower number, so the order does not depend on timing.
+void mergeShardHits(const std::vector<std::vector<SearchHit> > &shards, size_t limit, std::vector<ShardHit> *hits);
+
+// One search over several indices, one per book. Each shard is searched for
+// its own best hits on the pool and the lists are merged, so a search waits
+// for the slowest shard rather than for the sum of them, and only the top
+// of each crosses threads. Scores are BM25 within each shard: a word rare
+// in one book counts for more there, as it would searching that book
+// alone.
+class ShardedSearch {
+public:
+    // The pool must outlive the search.
+    explicit ShardedSearch(WorkerPool *pool);
+
+    // Adds the next shard. The index and the thesaurus built for it (NULL
+    // for none) must outlive the search.
+    void addShard(const SearchIndex *index, const Thesaurus *thesaurus);
+    size_t shardCount() const { return _shards.size(); }
+
+    // As SearchIndex::search over every shard. With options.thesaurus set,
+    // to any of them, each shard expands with its own thesaurus. Safe from
+    // several threads at once.
+    void search(Slice query, const SearchOptions &options, std::vector<ShardHit> *hits) const;
+
+    // As IncrementalSearch::update over every shard, each with its own
+    // session. Not for use from more than one thread.
+    void update(Slice text, size_t limit, std::vector<ShardHit> *hits);
+    void reset();
+
+private:
+    ShardedSearch(const ShardedSearch &) = delete;
+    ShardedSearch &operator=(const ShardedSearch &) = delete;
+
+    struct Shard {
+        const SearchIndex *index;
+        const Thesaurus *thesaurus;
+        std::shared_ptr<IncrementalSearch> typing;
+    };
+
+    WorkerPool *_pool;
+    std::vector<Shard> _shards;
+    std::vector<std::vector<SearchHit> > _typed;     // per shard, for update
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__ShardedSearch__) */
@@ -0,0 +1,44 @@
+//
+//  Slice.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Slice__
+#define __LivroDeCanticos__Slice__
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace canticos {
+
+// Non-owning view of bytes that live somewhere else (a mapped file, a
+// caller buffer). Copying a Slice never copies the bytes.
+struct Slice {
+    const char *data;
+    size_t size;
+
+    Slice() : data(NULL), size(0) {}
+    Slice(const char *d, size_t n) : data(d), size(n) {}
+    explicit Slice(const char *s) : data(s), size(strlen(s)) {}
+    explicit Slice(const std::string &s) : data(s.data()), size(s.size()) {}
+
+    bool empty() const { return size == 0; }
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+    char operator[](size_t i) const { return data[i]; }
+
+    std::string str() const { return std::string(data, size); }
+
+    bool operator==(const Slice &other) const
+    {
+        return size == other.size && (size == 0 || memcmp(data, other.data, size) == 0);
+    }
+    bool operator!=(const Slice &other) const { return !(*this == other); }
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__Slice__) */
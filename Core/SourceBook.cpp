@@ -0,0 +1,138 @@
+//
+//  SourceBook.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "SourceBook.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+
+namespace canticos {
+
+std::string sourceBodyPath(const std::string &dir, uint32_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/c%u.txt", number);
+    return dir + name;
+}
+
+std::string sourceIndexPath(const std::string &dir)
+{
+    return dir + "/indice.txt";
+}
+
+std::string sourceSynonymsPath(const std::string &dir)
+{
+    return dir + "/sinonimos.csv";
+}
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static Slice trim(Slice s)
+{
+    while (s.size > 0 && isBlank(s.data[0])) {
+        s = Slice(s.data + 1, s.size - 1);
+    }
+    while (s.size > 0 && isBlank(s.data[s.size - 1])) {
+        s.size--;
+    }
+    return s;
+}
+
+static Slice skipBom(Slice s)
+{
+    if (s.size >= 3 && (unsigned char)s.data[0] == 0xEF && (unsigned char)s.data[1] == 0xBB && (unsigned char)s.data[2] == 0xBF) {
+        return Slice(s.data + 3, s.size - 3);
+    }
+    return s;
+}
+
+Slice titleWithoutNumber(Slice line)
+{
+    line = skipBom(line);
+    size_t i = 0;
+    while (i < line.size && line.data[i] >= '0' && line.data[i] <= '9') {
+        i++;
+    }
+    if (i > 0 && i < line.size && line.data[i] == '.') {
+        line = Slice(line.data + i + 1, line.size - i - 1);
+    }
+    return trim(line);
+}
+
+Slice firstLyricLine(Slice body)
+{
+    body = skipBom(body);
+    bool titleSeen = false;
+    size_t start = 0;
+    while (start < body.size) {
+        size_t end = start;
+        while (end < body.size && body.data[end] != '\r' && body.data[end] != '\n') {
+            end++;
+        }
+        Slice line = trim(Slice(body.data + start, end - start));
+        if (!line.empty()) {
+            if (titleSeen) {
+                return line;
+            }
+            titleSeen = true;
+        }
+        start = end + 1;
+    }
+    return Slice();
+}
+
+bool loadSourceBook(const std::string &dir, SourceBook *book, std::string *error)
+{
+    std::string index;
+    if (!readWholeFile(sourceIndexPath(dir), &index, error)) {
+        return false;
+    }
+
+    // Same rule as Indice: every non-empty line is one row, and row N is
+    // hymn N whatever number the line itself carries (line 36 says "37.").
+    book->titles.clear();
+    book->bodies.clear();
+    size_t start = 0;
+    while (start < index.size()) {
+        size_t end = index.find_first_of("\r\n", start);
+        if (end == std::string::npos) {
+            end = index.size();
+        }
+        if (end > start) {
+            book->titles.push_back(index.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    if (book->titles.empty()) {
+        if (error) {
+            *error = "no titles in " + sourceIndexPath(dir);
+        }
+        return false;
+    }
+
+    book->bodies.resize(book->titles.size());
+    for (uint32_t n = 1; n <= book->titles.size(); n++) {
+        if (!readWholeFile(sourceBodyPath(dir, n), &book->bodies[n - 1], error)) {
+            return false;
+        }
+    }
+
+    struct stat info;
+    book->synonyms.clear();
+    if (stat(sourceSynonymsPath(dir).c_str(), &info) == 0
+        && !readWholeFile(sourceSynonymsPath(dir), &book->synonyms, error)) {
+        return false;
+    }
+    return true;
+}
+
+}
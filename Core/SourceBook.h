@@ -0,0 +1,46 @@
+//
+//  SourceBook.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__SourceBook__
+#define __LivroDeCanticos__SourceBook__
+
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// A hymnal as it is authored in the app bundle: indice.txt with one
+// "N. TITLE" line per hymn, plus cN.txt holding the text of hymn N, and
+// optionally sinonimos.csv (see Thesaurus.h). Everything is kept byte for
+// byte; line endings (CR, LF or CRLF) and BOMs are not touched.
+struct SourceBook {
+    std::vector<std::string> titles;   // titles[N - 1] is the indice.txt line of hymn N
+    std::vector<std::string> bodies;   // bodies[N - 1] is the content of cN.txt
+    std::string synonyms;              // sinonimos.csv, empty when there is none
+
+    uint32_t count() const { return (uint32_t)bodies.size(); }
+};
+
+std::string sourceBodyPath(const std::string &dir, uint32_t number);
+std::string sourceIndexPath(const std::string &dir);
+std::string sourceSynonymsPath(const std::string &dir);
+
+// Title of an indice.txt line without its "N. " prefix and trailing blanks.
+Slice titleWithoutNumber(Slice line);
+
+// First line of lyrics of a hymn text: the line after the title line and
+// any blank lines, trimmed.
+Slice firstLyricLine(Slice body);
+
+bool loadSourceBook(const std::string &dir, SourceBook *book, std::string *error = NULL);
+
+}
+
+#endif /* defined(__LivroDeCanticos__SourceBook__) */
@@ -0,0 +1,439 @@
+//
+//  SpellIndex.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "SpellIndex.h"
+#include "Stemmer.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace canticos {
+
+static const size_t kLengthStarts = kMaxTermBytes + 2;
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+// Distinct trigrams of a term, sorted; keys holds kMaxTermBytes entries.
+static size_t trigrams(Slice term, uint32_t *keys)
+{
+    size_t size = std::min(term.size, kMaxTermBytes);
+    const uint8_t *p = (const uint8_t *)term.data;
+    for (size_t i = 0; i < size; i++) {
+        uint32_t a = i > 0 ? p[i - 1] : 0;
+        uint32_t b = p[i];
+        uint32_t c = i + 1 < size ? p[i + 1] : 0;
+        keys[i] = a << 16 | b << 8 | c;
+    }
+    std::sort(keys, keys + size);
+    return (size_t)(std::unique(keys, keys + size) - keys);
+}
+
+// buildSpellIndex
+
+namespace {
+
+struct SlotOrder {
+    const SearchIndex *index;
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        uint32_t sa = index->term(a).lexiconSize;
+        uint32_t sb = index->term(b).lexiconSize;
+        return sa != sb ? sa < sb : a < b;
+    }
+};
+
+}
+
+void buildSpellIndex(const SearchIndex &index, std::string *out)
+{
+    uint32_t termCount = index.termCount();
+    std::vector<uint32_t> slotTerms(termCount);
+    for (uint32_t t = 0; t < termCount; t++) {
+        slotTerms[t] = t;
+    }
+    SlotOrder order = { &index };
+    std::sort(slotTerms.begin(), slotTerms.end(), order);
+
+    std::vector<uint32_t> lengthStarts(kLengthStarts, termCount);
+    std::vector<uint64_t> pairs;   // key << 32 | slot
+    uint32_t keys[kMaxTermBytes];
+    for (uint32_t slot = termCount; slot-- > 0;) {
+        Slice text = index.termText(index.term(slotTerms[slot]));
+        lengthStarts[std::min(text.size, kMaxTermBytes)] = slot;
+        if (isStemTerm(text)) {
+            continue;   // never typed, so never a correction
+        }
+        size_t count = trigrams(text, keys);
+        for (size_t i = 0; i < count; i++) {
+            pairs.push_back((uint64_t)keys[i] << 32 | slot);
+        }
+    }
+    // Lengths no term has start where the next longer one does.
+    for (size_t length = kLengthStarts - 1; length-- > 0;) {
+        lengthStarts[length] = std::min(lengthStarts[length], lengthStarts[length + 1]);
+    }
+    std::sort(pairs.begin(), pairs.end());
+
+    std::vector<SpellTrigram> table;
+    std::vector<uint32_t> postings(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        uint32_t key = (uint32_t)(pairs[i] >> 32);
+        if (table.empty() || table.back().key != key) {
+            SpellTrigram t = { key, 0, i };
+            table.push_back(t);
+        }
+        table.back().postingsCount++;
+        postings[i] = (uint32_t)pairs[i];
+    }
+
+    SpellHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kSpellMagic, sizeof(header.magic));
+    header.version = kSpellVersion;
+    header.termCount = termCount;
+    header.trigramCount = (uint32_t)table.size();
+
+    out->assign(sizeof(SpellHeader), '\0');
+    header.trigramsOffset = out->size();
+    out->append((const char *)table.data(), table.size() * sizeof(SpellTrigram));
+    header.postingsOffset = out->size();
+    header.postingsCount = postings.size();
+    out->append((const char *)postings.data(), postings.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.slotTermsOffset = out->size();
+    out->append((const char *)slotTerms.data(), slotTerms.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.lengthStartsOffset = out->size();
+    out->append((const char *)lengthStarts.data(), lengthStarts.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+// SpellIndex
+
+SpellIndex::SpellIndex()
+    : _header(NULL), _trigrams(NULL), _postings(NULL), _slotTerms(NULL), _lengthStarts(NULL)
+{
+}
+
+bool SpellIndex::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt spelling index: ") + why;
+    }
+    return false;
+}
+
+bool SpellIndex::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(SpellHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const SpellHeader *h = (const SpellHeader *)data;
+    if (memcmp(h->magic, kSpellMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kSpellVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size
+        || h->trigramsOffset + (uint64_t)h->trigramCount * sizeof(SpellTrigram) > size
+        || h->postingsOffset + h->postingsCount * sizeof(uint32_t) > size
+        || h->slotTermsOffset + (uint64_t)h->termCount * sizeof(uint32_t) > size
+        || h->lengthStartsOffset + kLengthStarts * sizeof(uint32_t) > size) {
+        return corrupt(error, "section out of bounds");
+    }
+    const SpellTrigram *trigrams = (const SpellTrigram *)(data + h->trigramsOffset);
+    for (uint32_t i = 0; i < h->trigramCount; i++) {
+        if (trigrams[i].postingsStart + trigrams[i].postingsCount > h->postingsCount) {
+            return corrupt(error, "trigram out of bounds");
+        }
+    }
+    const uint32_t *postings = (const uint32_t *)(data + h->postingsOffset);
+    for (uint64_t i = 0; i < h->postingsCount; i++) {
+        if (postings[i] >= h->termCount) {
+            return corrupt(error, "slot out of bounds");
+        }
+    }
+    const uint32_t *slotTerms = (const uint32_t *)(data + h->slotTermsOffset);
+    for (uint32_t i = 0; i < h->termCount; i++) {
+        if (slotTerms[i] >= h->termCount) {
+            return corrupt(error, "term out of bounds");
+        }
+    }
+    const uint32_t *lengthStarts = (const uint32_t *)(data + h->lengthStartsOffset);
+    for (size_t i = 0; i < kLengthStarts; i++) {
+        if (lengthStarts[i] > h->termCount || (i > 0 && lengthStarts[i] < lengthStarts[i - 1])) {
+            return corrupt(error, "length table out of order");
+        }
+    }
+
+    _header = h;
+    _trigrams = trigrams;
+    _postings = postings;
+    _slotTerms = slotTerms;
+    _lengthStarts = lengthStarts;
+    return true;
+}
+
+void SpellIndex::close()
+{
+    _header = NULL;
+    _trigrams = NULL;
+    _postings = NULL;
+    _slotTerms = NULL;
+    _lengthStarts = NULL;
+    _file.close();
+}
+
+const SpellTrigram *SpellIndex::find(uint32_t key) const
+{
+    uint32_t lo = 0;
+    uint32_t hi = _header ? _header->trigramCount : 0;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (_trigrams[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < (_header ? _header->trigramCount : 0) && _trigrams[lo].key == key ? &_trigrams[lo] : NULL;
+}
+
+uint32_t SpellIndex::lengthStart(size_t length) const
+{
+    return _lengthStarts[std::min(length, kLengthStarts - 1)];
+}
+
+// Speller
+
+Speller::Speller(const SearchIndex &index, const SpellIndex &spell) : _index(index), _spell(spell)
+{
+}
+
+uint32_t Speller::maxDistance(size_t size)
+{
+    return size <= 4 ? 1 : 2;
+}
+
+namespace {
+
+struct MoreShared {
+    const uint8_t *counts;
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        return counts[a] != counts[b] ? counts[a] > counts[b] : a < b;
+    }
+};
+
+}
+
+size_t Speller::candidates(Slice term, std::vector<uint32_t> *slots)
+{
+    slots->clear();
+    if (term.empty() || !_spell.isOpen() || _spell.termCount() != _index.termCount()) {
+        return 0;
+    }
+    if (_counts.size() != _spell.termCount()) {
+        _counts.assign(_spell.termCount(), 0);
+    }
+
+    uint32_t keys[kMaxTermBytes];
+    size_t keyCount = trigrams(term, keys);
+    size_t size = std::min(term.size, kMaxTermBytes);
+    uint32_t distance = maxDistance(size);
+    // An edit changes at most four trigrams of the word (a swap of two
+    // neighbours); whatever shares fewer than that cannot be close enough.
+    uint32_t threshold = keyCount > 4 * distance ? (uint32_t)(keyCount - 4 * distance) : 1;
+    uint32_t slotLo = _spell.lengthStart(size > distance ? size - distance : 1);
+    uint32_t slotHi = _spell.lengthStart(size + distance + 1);
+
+    // Byte counters for the slots of the length window only: clearing them
+    // is one memset, and they stay in cache while the postings stream by.
+    uint8_t *counts = _counts.data();
+    memset(counts + slotLo, 0, slotHi - slotLo);
+    _found.clear();
+    for (size_t k = 0; k < keyCount; k++) {
+        const SpellTrigram *trigram = _spell.find(keys[k]);
+        if (!trigram) {
+            continue;
+        }
+        const uint32_t *p = _spell.postings(*trigram);
+        const uint32_t *end = p + trigram->postingsCount;
+        p = std::lower_bound(p, end, slotLo);
+        for (; p < end && *p < slotHi; p++) {
+            if (++counts[*p] == threshold) {
+                _found.push_back(*p);
+            }
+        }
+    }
+
+    // Keep the kMaxChecked slots sharing the most, ties as found: counts are
+    // small, so a histogram finds the cut without sorting everything.
+    if (_found.size() > kMaxChecked) {
+        size_t histogram[kMaxTermBytes + 1] = { 0 };
+        for (size_t i = 0; i < _found.size(); i++) {
+            histogram[counts[_found[i]]]++;
+        }
+        size_t cut = kMaxTermBytes;
+        size_t above = 0;
+        while (above + histogram[cut] < kMaxChecked) {
+            above += histogram[cut--];
+        }
+        size_t atCut = kMaxChecked - above;
+        size_t kept = 0;
+        for (size_t i = 0; i < _found.size(); i++) {
+            uint32_t slot = _found[i];
+            if (counts[slot] > cut || (counts[slot] == cut && atCut > 0 && atCut--)) {
+                _found[kept++] = slot;
+            }
+        }
+        _found.resize(kept);
+    }
+    MoreShared more = { counts };
+    std::sort(_found.begin(), _found.end(), more);
+    slots->assign(_found.begin(), _found.end());
+    return slots->size();
+}
+
+// Optimal string alignment distance: Levenshtein plus swaps of neighbours.
+// Returns bound + 1 as soon as every alignment needs more than bound edits.
+static uint32_t editDistance(Slice a, Slice b, uint32_t bound)
+{
+    size_t m = std::min(a.size, kMaxTermBytes);
+    size_t n = std::min(b.size, kMaxTermBytes);
+    if ((m > n ? m - n : n - m) > bound) {
+        return bound + 1;
+    }
+    uint32_t rows[3][kMaxTermBytes + 1];
+    uint32_t *before = rows[0];
+    uint32_t *previous = rows[1];
+    uint32_t *current = rows[2];
+    for (size_t j = 0; j <= n; j++) {
+        previous[j] = (uint32_t)j;
+    }
+    for (size_t i = 1; i <= m; i++) {
+        current[0] = (uint32_t)i;
+        uint32_t rowMin = current[0];
+        for (size_t j = 1; j <= n; j++) {
+            uint32_t cost = a.data[i - 1] != b.data[j - 1];
+            uint32_t v = std::min(std::min(previous[j] + 1, current[j - 1] + 1), previous[j - 1] + cost);
+            if (i > 1 && j > 1 && a.data[i - 1] == b.data[j - 2] && a.data[i - 2] == b.data[j - 1]) {
+                v = std::min(v, before[j - 2] + 1);
+            }
+            current[j] = v;
+            rowMin = std::min(rowMin, v);
+        }
+        if (rowMin > bound) {
+            return bound + 1;
+        }
+        uint32_t *spare = before;
+        before = previous;
+        previous = current;
+        current = spare;
+    }
+    return std::min(previous[n], bound + 1);
+}
+
+namespace {
+
+struct CorrectionOrder {
+    const SearchIndex *index;
+    bool operator()(const SpellCorrection &a, const SpellCorrection &b) const
+    {
+        if (a.distance != b.distance) {
+            return a.distance < b.distance;
+        }
+        uint32_t fa = index->term(a.term).docFrequency;
+        uint32_t fb = index->term(b.term).docFrequency;
+        return fa != fb ? fa > fb : a.term < b.term;
+    }
+};
+
+}
+
+size_t Speller::correct(Slice word, SpellCorrection *out, size_t max)
+{
+    char buffer[kMaxTermBytes];
+    Slice term(buffer, normalizeTerm(word, buffer));
+    std::vector<uint32_t> slots;
+    if (max == 0 || candidates(term, &slots) == 0) {
+        return 0;
+    }
+
+    uint32_t bound = maxDistance(term.size);
+    std::vector<SpellCorrection> found;
+    for (size_t i = 0; i < slots.size(); i++) {
+        uint32_t t = _spell.slotTerm(slots[i]);
+        uint32_t distance = editDistance(term, _index.termText(_index.term(t)), bound);
+        if (distance <= bound) {
+            SpellCorrection c = { t, distance };
+            found.push_back(c);
+        }
+    }
+    CorrectionOrder order = { &_index };
+    size_t keep = std::min(max, found.size());
+    std::partial_sort(found.begin(), found.begin() + keep, found.end(), order);
+    std::copy(found.begin(), found.begin() + keep, out);
+    return keep;
+}
+
+bool Speller::suggestQuery(Slice query, std::string *suggested)
+{
+    suggested->clear();
+    size_t copied = 0;
+    bool changed = false;
+    Tokenizer tokenizer(query);
+    Token token;
+    while (tokenizer.next(&token)) {
+        // Numbers are hymn numbers or verse counts, never misspellings.
+        if (token.text.data[0] >= '0' && token.text.data[0] <= '9') {
+            continue;
+        }
+        char term[kMaxTermBytes];
+        size_t size = normalizeTerm(token.text, term);
+        SpellCorrection best;
+        if (size == 0 || _index.find(Slice(term, size)) || correct(token.text, &best, 1) == 0) {
+            continue;
+        }
+        suggested->append(query.data + copied, token.offset - copied);
+        Slice text = _index.termText(_index.term(best.term));
+        suggested->append(text.data, text.size);
+        copied = token.offset + token.text.size;
+        changed = true;
+    }
+    if (!changed) {
+        suggested->clear();
+        return false;
+    }
+    suggested->append(query.data + copied, query.size - copied);
+    return true;
+}
+
+}
@@ -0,0 +1,137 @@
+//
+//  SpellIndex.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__SpellIndex__
+#define __LivroDeCanticos__SpellIndex__
+
+#include "MappedFile.h"
+#include "SearchIndex.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// Typo tolerant lookup of the terms of livro.index.
+//
+// Every term but the stems, which nobody types, is cut into byte trigrams,
+// padded with one NUL on each side: "deus" gives "\0de", "deu", "eus",
+// "us\0". Terms are renumbered by length
+// ("slots"), so the postings of a trigram, sorted by slot, hold the terms
+// of each length together and a word of n bytes only reads the part for
+// lengths n - d ... n + d.
+//
+// File layout, all integers little endian:
+//
+//   SpellHeader
+//   SpellTrigram[trigramCount]      sorted by key
+//   uint32_t[postingsCount]         per trigram, the slots of its terms
+//   uint32_t[termCount]             term index in livro.index of each slot
+//   uint32_t[kMaxTermBytes + 2]     first slot of each term length
+//
+// A word is corrected by counting the trigrams each slot shares with it;
+// the slots sharing the most are checked with a bounded Damerau-Levenshtein
+// distance, where swapping two neighbouring letters is one edit.
+static const char kSpellMagic[8] = { 'L', 'D', 'C', 'S', 'P', 'E', 'L', 'L' };
+static const uint32_t kSpellVersion = 1;
+
+struct SpellHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t termCount;       // same as the index it was built from
+    uint32_t trigramCount;
+    uint32_t reserved;
+    uint64_t trigramsOffset;
+    uint64_t postingsOffset;
+    uint64_t postingsCount;
+    uint64_t slotTermsOffset;
+    uint64_t lengthStartsOffset;
+    uint64_t fileSize;
+};
+
+struct SpellTrigram {
+    uint32_t key;             // the three bytes, first one highest
+    uint32_t postingsCount;
+    uint64_t postingsStart;   // in entries, into the postings section
+};
+
+// Writes the spelling file for the terms of an index.
+void buildSpellIndex(const SearchIndex &index, std::string *out);
+
+// Read-only view over a mapped spelling file.
+class SpellIndex {
+public:
+    SpellIndex();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t termCount() const { return _header ? _header->termCount : 0; }
+
+    const SpellTrigram *find(uint32_t key) const;
+    const uint32_t *postings(const SpellTrigram &trigram) const { return _postings + trigram.postingsStart; }
+    uint32_t slotTerm(uint32_t slot) const { return _slotTerms[slot]; }
+    // First slot of the terms of at least length bytes.
+    uint32_t lengthStart(size_t length) const;
+
+private:
+    SpellIndex(const SpellIndex &) = delete;
+    SpellIndex &operator=(const SpellIndex &) = delete;
+
+    MappedFile _file;
+    const SpellHeader *_header;
+    const SpellTrigram *_trigrams;
+    const uint32_t *_postings;
+    const uint32_t *_slotTerms;
+    const uint32_t *_lengthStarts;
+};
+
+struct SpellCorrection {
+    uint32_t term;        // index in livro.index
+    uint32_t distance;
+};
+
+// Spelling session over an index and its spelling file. Holds a counter
+// per term, so it is not shared between threads.
+class Speller {
+public:
+    Speller(const SearchIndex &index, const SpellIndex &spell);
+
+    // Edits allowed for a word of this many bytes: 1 up to four, then 2.
+    static uint32_t maxDistance(size_t size);
+
+    // Slots sharing enough trigrams with a normalized term to be within
+    // maxDistance of it, most shared first, at most kMaxChecked. The first
+    // half of correct(), public for benchmarks.
+    size_t candidates(Slice term, std::vector<uint32_t> *slots);
+
+    // Closest terms to a word: fewest edits, then found in most hymns.
+    size_t correct(Slice word, SpellCorrection *out, size_t max);
+
+    // The query with every word the index does not know replaced by its
+    // best correction, the rest kept byte for byte. This is what
+    // LSLocaytaSearchResult calls the suggested query (spell correction
+    // "suggest") and, once searched for instead, the corrected query
+    // ("auto"). Returns false when nothing was replaced.
+    bool suggestQuery(Slice query, std::string *suggested);
+
+    static const size_t kMaxChecked = 256;
+
+private:
+    const SearchIndex &_index;
+    const SpellIndex &_spell;
+    std::vector<uint8_t> _counts;    // per slot, trigrams shared with the word
+    std::vector<uint32_t> _found;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__SpellIndex__) */
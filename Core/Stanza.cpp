@@ -0,0 +1,142 @@
+//
+//  Stanza.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Stanza.h"
+#include "Tokenizer.h"
+
+#include <string>
+
+namespace canticos {
+
+static bool isLowerCase(uint32_t cp)
+{
+    return (cp >= 'a' && cp <= 'z') || (cp >= 0xDF && cp <= 0xFF && cp != 0xF7) || (cp >= 0x100 && cp <= 0x17F && (cp & 1));
+}
+
+static bool isUpperCase(uint32_t cp)
+{
+    return (cp >= 'A' && cp <= 'Z') || (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) || (cp >= 0x100 && cp <= 0x17F && !(cp & 1));
+}
+
+// -1 if the line has lower case letters, 1 if it has only capitals, 0 if
+// it has no letters at all.
+static int lineCase(Slice line)
+{
+    const uint8_t *p = (const uint8_t *)line.data;
+    const uint8_t *end = p + line.size;
+    int result = 0;
+    while (p < end) {
+        uint32_t cp;
+        p += decodeUtf8(p, end, &cp);
+        if (isLowerCase(cp)) {
+            return -1;
+        }
+        if (isUpperCase(cp)) {
+            result = 1;
+        }
+    }
+    return result;
+}
+
+bool isCapitalLine(Slice line)
+{
+    return lineCase(line) > 0;
+}
+
+static bool isBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static std::string foldedWords(Slice text)
+{
+    std::string folded(text.size, '\0');
+    folded.resize(foldWords(text, &folded[0], folded.size()));
+    return folded;
+}
+
+void parseHymn(Slice body, HymnStructure *out)
+{
+    out->titleOffset = 0;
+    out->titleSize = 0;
+    out->stanzas.clear();
+
+    size_t pos = 0;
+    if (body.size >= 3 && (uint8_t)body.data[0] == 0xEF && (uint8_t)body.data[1] == 0xBB && (uint8_t)body.data[2] == 0xBF) {
+        pos = 3;
+    }
+
+    bool titleSeen = false;
+    bool open = false;
+    bool lowerCase = false;
+    bool capitals = false;
+    StanzaSpan current = { 0, 0, 0, 0, 0, 0 };
+    std::vector<std::string> folded;   // per stanza so far, to spot repeats
+    size_t counted = 0;                // UTF-16 units are counted up to here
+    uint32_t units = 0;
+    while (pos <= body.size) {
+        size_t start = pos;
+        size_t end = start;
+        while (end < body.size && body.data[end] != '\r' && body.data[end] != '\n') {
+            end++;
+        }
+        pos = end + 1;
+        if (end + 1 < body.size && body.data[end] == '\r' && body.data[end + 1] == '\n') {
+            pos++;
+        }
+        while (start < end && isBlank(body.data[start])) {
+            start++;
+        }
+        while (end > start && isBlank(body.data[end - 1])) {
+            end--;
+        }
+
+        if (start < end && !titleSeen) {
+            out->titleOffset = (uint32_t)start;
+            out->titleSize = (uint32_t)(end - start);
+            titleSeen = true;
+            continue;
+        }
+        if (start < end) {
+            if (!open) {
+                current.offset = (uint32_t)start;
+                current.lineCount = 0;
+                lowerCase = false;
+                capitals = false;
+                open = true;
+            }
+            current.size = (uint32_t)(end - current.offset);
+            current.lineCount++;
+            int c = lineCase(Slice(body.data + start, end - start));
+            lowerCase = lowerCase || c < 0;
+            capitals = capitals || c > 0;
+        }
+        if ((start == end || pos > body.size) && open) {
+            open = false;
+            current.flags = capitals && !lowerCase ? kStanzaRefrain : 0;
+            units += (uint32_t)utf16Length(Slice(body.data + counted, current.offset - counted));
+            counted = current.offset;
+            current.utf16Offset = units;
+            current.utf16Size = (uint32_t)utf16Length(Slice(body.data + current.offset, current.size));
+            std::string words = foldedWords(Slice(body.data + current.offset, current.size));
+            for (size_t i = 0; i < folded.size(); i++) {
+                if (folded[i] == words && !(out->stanzas[i].flags & kStanzaRepeat)) {
+                    current.offset = out->stanzas[i].offset;
+                    current.size = out->stanzas[i].size;
+                    current.utf16Offset = out->stanzas[i].utf16Offset;
+                    current.utf16Size = out->stanzas[i].utf16Size;
+                    current.flags |= kStanzaRepeat;
+                    break;
+                }
+            }
+            folded.push_back(words);
+            out->stanzas.push_back(current);
+        }
+    }
+}
+
+}
@@ -0,0 +1,62 @@
+//
+//  Stanza.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Stanza__
+#define __LivroDeCanticos__Stanza__
+
+#include "Slice.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace canticos {
+
+// Structure of a hymn text, worked out once when the corpus is packed.
+//
+// A cN.txt starts with its numbered title line (after a BOM, sometimes);
+// the rest is stanzas separated by blank lines. Lines end with CR, LF or
+// CRLF, mixed even within one file. A stanza whose lines are all written
+// in capitals is a refrain. A stanza with the same words as an earlier one
+// (a refrain written out again) is a repeat: its span is the earlier
+// stanza's, so it is stored and laid out once.
+static const uint32_t kStanzaRefrain = 1;
+static const uint32_t kStanzaRepeat = 2;
+
+struct StanzaSpan {
+    uint32_t offset;      // relative to the body
+    uint32_t size;        // from the first line's start to the last line's end
+    uint32_t lineCount;
+    uint32_t flags;
+    uint32_t utf16Offset; // the same span in UTF-16 units, as NSString
+    uint32_t utf16Size;   // counts it
+};
+
+struct HymnStructure {
+    uint32_t titleOffset;   // the numbered title line, trimmed
+    uint32_t titleSize;
+    std::vector<StanzaSpan> stanzas;
+};
+
+void parseHymn(Slice body, HymnStructure *out);
+
+// True for a line with capital letters and no lower case ones. Latin-1
+// and Latin Extended-A cover the accents in use.
+bool isCapitalLine(Slice line);
+
+// A stanza as the corpus hands it out.
+struct Stanza {
+    Slice text;           // points into the body, at the first occurrence
+    uint32_t utf16Offset; // of text in the body
+    uint32_t utf16Size;
+    uint32_t lineCount;
+    bool refrain;
+    bool repeat;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__Stanza__) */
@@ -0,0 +1,137 @@
+//
+//  Stemmer.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Stemmer.h"
+#include "Tokenizer.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+
+namespace canticos {
+
+// Trie of one step's reversed suffixes: node s is the root of step s. A
+// node's edges are sorted by byte; its rules are those whose suffix ends
+// there, in table order.
+struct StemNode {
+    uint16_t firstEdge;
+    uint16_t firstRule;
+    uint8_t edgeCount;
+    uint8_t ruleCount;
+};
+
+struct StemEdge {
+    uint8_t byte;
+    uint16_t node;
+};
+
+struct StemRule {
+    uint16_t order;            // in StemmerRules.inc: the first that applies wins
+    uint8_t minStem;
+    uint8_t suffixSize;
+    uint16_t replacement;      // into kStemStrings
+    uint8_t replacementSize;
+    uint16_t firstException;   // into kStemExceptions, sorted
+    uint8_t exceptionCount;
+};
+
+struct StemString {
+    uint16_t offset;           // into kStemStrings
+    uint16_t size;
+};
+
+// Generated from StemmerRules.inc by stemmer-tables.
+#include "StemmerTables.inc"
+
+static int compareException(const StemString &exception, Slice word)
+{
+    int c = memcmp(kStemStrings + exception.offset, word.data, std::min((size_t)exception.size, word.size));
+    if (c != 0) {
+        return c;
+    }
+    return exception.size < word.size ? -1 : (exception.size > word.size ? 1 : 0);
+}
+
+static bool isException(const StemRule &rule, Slice word)
+{
+    uint32_t lo = rule.firstException;
+    uint32_t hi = lo + rule.exceptionCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = compareException(kStemExceptions[mid], word);
+        if (c == 0) {
+            return true;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+// Applies the first rule of the step that fits the word, if any. Walking
+// back from the last letter meets every suffix of the word that has rules,
+// shortest first; of those that fit, the earliest in the table wins.
+static bool applyStep(StemStep step, char *word, size_t *size)
+{
+    const StemNode *node = &kStemNodes[step];
+    const StemRule *best = NULL;
+    for (size_t i = *size; i-- > 0;) {
+        const StemEdge *edge = kStemEdges + node->firstEdge;
+        const StemEdge *edgesEnd = edge + node->edgeCount;
+        uint8_t c = (uint8_t)word[i];
+        while (edge < edgesEnd && edge->byte < c) {
+            edge++;
+        }
+        if (edge == edgesEnd || edge->byte != c) {
+            break;
+        }
+        node = &kStemNodes[edge->node];
+        for (const StemRule *rule = kStemRules + node->firstRule; rule < kStemRules + node->firstRule + node->ruleCount;
+             rule++) {
+            if ((!best || rule->order < best->order) && i >= rule->minStem && !isException(*rule, Slice(word, *size))) {
+                best = rule;
+            }
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    size_t stem = *size - best->suffixSize;
+    memcpy(word + stem, kStemStrings + best->replacement, best->replacementSize);
+    *size = stem + best->replacementSize;
+    return true;
+}
+
+size_t stemTerm(const char *term, size_t size, char *out)
+{
+    memmove(out, term, size);
+    if (size > 0 && out[size - 1] == 's') {
+        applyStep(kStemPlural, out, &size);
+    }
+    if (size > 0 && out[size - 1] == 'a') {
+        applyStep(kStemFeminine, out, &size);
+    }
+    applyStep(kStemAugmentative, out, &size);
+    applyStep(kStemAdverb, out, &size);
+    if (!applyStep(kStemNoun, out, &size) && !applyStep(kStemVerb, out, &size)) {
+        applyStep(kStemVowel, out, &size);
+    }
+    return size;
+}
+
+size_t stemIndexTerm(Slice term, char *out)
+{
+    size_t size = std::min(term.size, kMaxTermBytes - 1);
+    memmove(out + 1, term.data, size);
+    out[0] = kStemMarker;
+    return 1 + stemTerm(out + 1, size, out + 1);
+}
+
+}
@@ -0,0 +1,53 @@
+//
+//  Stemmer.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Stemmer__
+#define __LivroDeCanticos__Stemmer__
+
+#include "Slice.h"
+
+#include <stddef.h>
+
+namespace canticos {
+
+// RSLP stemmer for Portuguese over folded index terms (see Fold.h), so
+// "cantemos", "cantai" and "cantar" all stem to "cant". The rules are in
+// StemmerRules.inc; stemmer-tables compiles each step's into a trie over
+// reversed suffixes when the library is built, so a step is one walk back
+// from the end of the word. No memory is allocated.
+enum StemStep {
+    kStemPlural,
+    kStemFeminine,
+    kStemAugmentative,
+    kStemAdverb,
+    kStemNoun,
+    kStemVerb,
+    kStemVowel,
+    kStemStepCount
+};
+
+// A stem is never longer than its term, so out needs size bytes; it may be
+// term itself. Returns the stem's length.
+size_t stemTerm(const char *term, size_t size, char *out);
+
+// Index terms of stems are kStemMarker and the stem. No word has that byte,
+// and it sorts before every letter, so stems neither match a typed prefix
+// nor get between the words sharing one.
+static const char kStemMarker = '\x01';
+
+inline bool isStemTerm(Slice term)
+{
+    return term.size > 0 && term.data[0] == kStemMarker;
+}
+
+// The stem index term of a word's index term, at most kMaxTermBytes; out
+// holds that many and may be term's bytes. Returns its length.
+size_t stemIndexTerm(Slice term, char *out);
+
+}
+
+#endif /* defined(__LivroDeCanticos__Stemmer__) */
@@ -0,0 +1,305 @@
+//
+//  Thesaurus.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Thesaurus.h"
+#include "Stemmer.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace canticos {
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+// parseSynonyms
+
+bool parseSynonyms(Slice csv, std::vector<SynonymLine> *lines, std::string *error)
+{
+    lines->clear();
+    uint32_t lineNumber = 0;
+    for (size_t start = 0; start < csv.size;) {
+        size_t end = start;
+        while (end < csv.size && csv.data[end] != '\n') {
+            end++;
+        }
+        Slice line(csv.data + start, end > start && csv.data[end - 1] == '\r' ? end - start - 1 : end - start);
+        lineNumber++;
+        start = end + 1;
+        if (line.empty() || line.data[0] == '#') {
+            continue;
+        }
+
+        SynonymLine words;
+        for (size_t field = 0; field <= line.size;) {
+            size_t comma = field;
+            while (comma < line.size && line.data[comma] != ',') {
+                comma++;
+            }
+            Tokenizer tokenizer(Slice(line.data + field, comma - field));
+            Token token;
+            if (tokenizer.next(&token)) {
+                char term[kMaxTermBytes];
+                words.push_back(std::string(term, normalizeTerm(token.text, term)));
+                if (tokenizer.next(&token)) {
+                    if (error) {
+                        char where[32];
+                        snprintf(where, sizeof(where), "line %u: ", lineNumber);
+                        *error = where + std::string(line.data + field, comma - field) + " is more than one word";
+                    }
+                    return false;
+                }
+            }
+            field = comma + 1;
+        }
+        if (words.size() > 1) {
+            lines->push_back(words);
+        }
+    }
+    return true;
+}
+
+// buildThesaurus
+
+namespace {
+
+struct BiggerBucket {
+    const std::vector<std::vector<uint32_t> > *buckets;
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        size_t sa = (*buckets)[a].size();
+        size_t sb = (*buckets)[b].size();
+        return sa != sb ? sa > sb : a < b;
+    }
+};
+
+}
+
+// Seeds placing every key in a slot of its own, the fullest buckets first
+// while most slots are still free. False when some bucket finds no seed.
+static bool placeKeys(const std::vector<uint32_t> &keys, uint32_t bucketCount, uint32_t slotCount,
+                      std::vector<uint32_t> *seeds, std::vector<uint32_t> *slotKeys)
+{
+    std::vector<std::vector<uint32_t> > buckets(bucketCount);
+    for (size_t i = 0; i < keys.size(); i++) {
+        buckets[Thesaurus::hash(keys[i], 0) % bucketCount].push_back(keys[i]);
+    }
+    std::vector<uint32_t> order(bucketCount);
+    for (uint32_t b = 0; b < bucketCount; b++) {
+        order[b] = b;
+    }
+    BiggerBucket bigger = { &buckets };
+    std::sort(order.begin(), order.end(), bigger);
+
+    seeds->assign(bucketCount, 0);
+    slotKeys->assign(slotCount, kNoThesaurusTerm);
+    std::vector<uint32_t> taken;
+    for (size_t i = 0; i < order.size() && !buckets[order[i]].empty(); i++) {
+        const std::vector<uint32_t> &bucket = buckets[order[i]];
+        bool placed = false;
+        for (uint32_t seed = 1; seed < (1u << 20) && !placed; seed++) {
+            taken.clear();
+            placed = true;
+            for (size_t k = 0; k < bucket.size() && placed; k++) {
+                uint32_t slot = Thesaurus::hash(bucket[k], seed) % slotCount;
+                placed = (*slotKeys)[slot] == kNoThesaurusTerm
+                    && std::find(taken.begin(), taken.end(), slot) == taken.end();
+                taken.push_back(slot);
+            }
+            if (placed) {
+                (*seeds)[order[i]] = seed;
+                for (size_t k = 0; k < bucket.size(); k++) {
+                    (*slotKeys)[taken[k]] = bucket[k];
+                }
+            }
+        }
+        if (!placed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void addEntry(std::map<uint32_t, std::vector<uint32_t> > *entries, const IndexTerm *key,
+                     const IndexTerm *synonym, const SearchIndex &index)
+{
+    if (key && synonym && key != synonym) {
+        (*entries)[index.termIndex(*key)].push_back(index.termIndex(*synonym));
+    }
+}
+
+void buildThesaurus(const SearchIndex &index, const std::vector<SynonymLine> &lines, std::string *out)
+{
+    std::map<uint32_t, std::vector<uint32_t> > entries;
+    char stem[kMaxTermBytes];
+    for (size_t l = 0; l < lines.size(); l++) {
+        const SynonymLine &line = lines[l];
+        const IndexTerm *word = index.find(Slice(line[0]));
+        const IndexTerm *wordStem = index.find(Slice(stem, stemIndexTerm(Slice(line[0]), stem)));
+        for (size_t s = 1; s < line.size(); s++) {
+            addEntry(&entries, word, index.find(Slice(line[s])), index);
+            addEntry(&entries, wordStem, index.find(Slice(stem, stemIndexTerm(Slice(line[s]), stem))), index);
+        }
+    }
+
+    std::vector<uint32_t> keys;
+    for (std::map<uint32_t, std::vector<uint32_t> >::iterator it = entries.begin(); it != entries.end(); ++it) {
+        std::sort(it->second.begin(), it->second.end());
+        it->second.erase(std::unique(it->second.begin(), it->second.end()), it->second.end());
+        keys.push_back(it->first);
+    }
+
+    // Four slots for every three entries and two entries a bucket find
+    // their seeds in a few tries each; a table that will not place grows.
+    uint32_t entryCount = (uint32_t)keys.size();
+    uint32_t bucketCount = (entryCount + 1) / 2;
+    uint32_t slotCount = entryCount ? entryCount + entryCount / 3 + 1 : 0;
+    std::vector<uint32_t> seeds;
+    std::vector<uint32_t> slotKeys;
+    while (entryCount && !placeKeys(keys, bucketCount, slotCount, &seeds, &slotKeys)) {
+        slotCount += slotCount / 4 + 1;
+    }
+
+    std::vector<ThesaurusSlot> slots(slotCount);
+    std::vector<uint32_t> expansions;
+    for (uint32_t s = 0; s < slotCount; s++) {
+        ThesaurusSlot &slot = slots[s];
+        slot.term = slotKeys[s];
+        slot.expansionStart = (uint32_t)expansions.size();
+        slot.expansionCount = 0;
+        if (slot.term != kNoThesaurusTerm) {
+            const std::vector<uint32_t> &synonyms = entries[slot.term];
+            expansions.insert(expansions.end(), synonyms.begin(), synonyms.end());
+            slot.expansionCount = (uint32_t)synonyms.size();
+        }
+    }
+
+    ThesaurusHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kThesaurusMagic, sizeof(header.magic));
+    header.version = kThesaurusVersion;
+    header.termCount = index.termCount();
+    header.entryCount = entryCount;
+    header.bucketCount = bucketCount;
+    header.slotCount = slotCount;
+
+    out->assign(sizeof(ThesaurusHeader), '\0');
+    header.seedsOffset = out->size();
+    out->append((const char *)seeds.data(), seeds.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.slotsOffset = out->size();
+    out->append((const char *)slots.data(), slots.size() * sizeof(ThesaurusSlot));
+    padTo8(out);
+    header.expansionsOffset = out->size();
+    header.expansionCount = expansions.size();
+    out->append((const char *)expansions.data(), expansions.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+// Thesaurus
+
+Thesaurus::Thesaurus() : _header(NULL), _seeds(NULL), _slots(NULL), _expansions(NULL)
+{
+}
+
+bool Thesaurus::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt thesaurus: ") + why;
+    }
+    return false;
+}
+
+bool Thesaurus::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(ThesaurusHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const ThesaurusHeader *h = (const ThesaurusHeader *)data;
+    if (memcmp(h->magic, kThesaurusMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kThesaurusVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size
+        || h->seedsOffset + (uint64_t)h->bucketCount * sizeof(uint32_t) > size
+        || h->slotsOffset + (uint64_t)h->slotCount * sizeof(ThesaurusSlot) > size
+        || h->expansionsOffset + h->expansionCount * sizeof(uint32_t) > size) {
+        return corrupt(error, "section out of bounds");
+    }
+    if ((h->bucketCount == 0) != (h->slotCount == 0) || h->entryCount > h->slotCount) {
+        return corrupt(error, "bad table size");
+    }
+    const uint32_t *seeds = (const uint32_t *)(data + h->seedsOffset);
+    const ThesaurusSlot *slots = (const ThesaurusSlot *)(data + h->slotsOffset);
+    const uint32_t *expansions = (const uint32_t *)(data + h->expansionsOffset);
+    uint32_t entries = 0;
+    for (uint32_t s = 0; s < h->slotCount; s++) {
+        const ThesaurusSlot &slot = slots[s];
+        if (slot.term == kNoThesaurusTerm) {
+            continue;
+        }
+        // Every entry must be where a lookup of its term goes.
+        uint32_t seed = seeds[hash(slot.term, 0) % h->bucketCount];
+        if (slot.term >= h->termCount || hash(slot.term, seed) % h->slotCount != s) {
+            return corrupt(error, "entry out of place");
+        }
+        if ((uint64_t)slot.expansionStart + slot.expansionCount > h->expansionCount) {
+            return corrupt(error, "synonyms out of bounds");
+        }
+        entries++;
+    }
+    if (entries != h->entryCount) {
+        return corrupt(error, "entry count mismatch");
+    }
+    for (uint64_t i = 0; i < h->expansionCount; i++) {
+        if (expansions[i] >= h->termCount) {
+            return corrupt(error, "synonym term out of bounds");
+        }
+    }
+
+    _header = h;
+    _seeds = seeds;
+    _slots = slots;
+    _expansions = expansions;
+    return true;
+}
+
+void Thesaurus::close()
+{
+    _header = NULL;
+    _seeds = NULL;
+    _slots = NULL;
+    _expansions = NULL;
+    _file.close();
+}
+
+}
@@ -0,0 +1,141 @@
+//
+//  Thesaurus.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Thesaurus__
+#define __LivroDeCanticos__Thesaurus__
+
+#include "MappedFile.h"
+#include "SearchIndex.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// Synonyms of the terms of livro.index, for query expansion.
+//
+// The source is sinonimos.csv, in the format of Locayta's locthesaurus: one
+// line per word, the word and then its synonyms, comma separated, as in
+// "piedade,misericórdia". Expansion goes one way only, so "misericórdia"
+// finds "piedade" only with a line of its own. Lines starting with # are
+// comments. Words are normalized like index terms.
+//
+// Both sides are stored as term indexes of livro.index, so the file belongs
+// to the index it was built from. A line gives two entries: the word's term
+// to its synonyms' terms, and the word's stem term to their stem terms, so
+// the expansion follows the query into stemming. Words the index lacks are
+// dropped; words sharing a stem pool their synonyms.
+//
+// The entries are a perfect hash: a term's hash picks a bucket, the
+// bucket's seed picks the term's slot, and the slot holds the term or
+// another one. A lookup is two hashes and one compare, whatever the size.
+//
+// File layout, all integers little endian:
+//
+//   ThesaurusHeader
+//   uint32_t[bucketCount]           seed of each bucket
+//   ThesaurusSlot[slotCount]
+//   uint32_t[expansionCount]        per entry, its synonyms' terms, sorted
+static const char kThesaurusMagic[8] = { 'L', 'D', 'C', 'T', 'H', 'E', 'S', 'A' };
+static const uint32_t kThesaurusVersion = 1;
+
+struct ThesaurusHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t termCount;       // same as the index it was built from
+    uint32_t entryCount;
+    uint32_t bucketCount;
+    uint32_t slotCount;
+    uint32_t reserved;
+    uint64_t expansionCount;
+    uint64_t seedsOffset;
+    uint64_t slotsOffset;
+    uint64_t expansionsOffset;
+    uint64_t fileSize;
+};
+
+static const uint32_t kNoThesaurusTerm = 0xFFFFFFFF;
+
+struct ThesaurusSlot {
+    uint32_t term;            // kNoThesaurusTerm in the slots no entry took
+    uint32_t expansionStart;  // in entries, into the expansions section
+    uint32_t expansionCount;
+};
+
+// One line of sinonimos.csv, normalized: the word, then its synonyms.
+typedef std::vector<std::string> SynonymLine;
+
+// False, naming the line, when a field holds more than one word: the
+// expansion is term for term, so "espírito santo" cannot be a synonym.
+bool parseSynonyms(Slice csv, std::vector<SynonymLine> *lines, std::string *error = NULL);
+
+// Writes the thesaurus file of the synonym lines for an index.
+void buildThesaurus(const SearchIndex &index, const std::vector<SynonymLine> &lines, std::string *out);
+
+// Read-only view over a mapped thesaurus file.
+class Thesaurus {
+public:
+    Thesaurus();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t termCount() const { return _header ? _header->termCount : 0; }
+    uint32_t entryCount() const { return _header ? _header->entryCount : 0; }
+
+    // Term indexes of the synonyms of a term, *count of them; NULL when it
+    // has none.
+    const uint32_t *synonyms(uint32_t term, uint32_t *count) const
+    {
+        *count = 0;
+        if (!_header || _header->slotCount == 0) {
+            return NULL;
+        }
+        const ThesaurusSlot &slot = _slots[slotOf(term)];
+        if (slot.term != term) {
+            return NULL;
+        }
+        *count = slot.expansionCount;
+        return _expansions + slot.expansionStart;
+    }
+
+    // murmur3's finalizer over the term mixed with a seed; seed 0 picks the
+    // bucket.
+    static uint32_t hash(uint32_t term, uint32_t seed)
+    {
+        uint32_t h = term ^ seed * 0x9E3779B9u;
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+private:
+    Thesaurus(const Thesaurus &) = delete;
+    Thesaurus &operator=(const Thesaurus &) = delete;
+
+    uint32_t slotOf(uint32_t term) const
+    {
+        return hash(term, _seeds[hash(term, 0) % _header->bucketCount]) % _header->slotCount;
+    }
+
+    MappedFile _file;
+    const ThesaurusHeader *_header;
+    const uint32_t *_seeds;
+    const ThesaurusSlot *_slots;
+    const uint32_t *_expansions;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__Thesaurus__) */
@@ -0,0 +1,110 @@
+//
+//  TitleTable.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "TitleTable.h"
+#include "SourceBook.h"
+
+#include <cstring>
+#include <vector>
+
+namespace canticos {
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+void buildTitleTable(const SourceBook &book, std::string *out)
+{
+    std::vector<uint32_t> offsets(1, 0);
+    std::string pool;
+    for (uint32_t i = 0; i < book.count(); i++) {
+        pool += book.titles[i];
+        offsets.push_back((uint32_t)pool.size());
+    }
+
+    TitleTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kTitleTableMagic, sizeof(header.magic));
+    header.version = kTitleTableVersion;
+    header.count = book.count();
+
+    out->assign(sizeof(TitleTableHeader), '\0');
+    header.offsetsOffset = out->size();
+    out->append((const char *)offsets.data(), offsets.size() * sizeof(uint32_t));
+    padTo8(out);
+    header.poolOffset = out->size();
+    header.poolSize = pool.size();
+    *out += pool;
+    padTo8(out);
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+TitleTable::TitleTable() : _header(NULL), _offsets(NULL), _pool(NULL)
+{
+}
+
+bool TitleTable::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt title table: ") + why;
+    }
+    return false;
+}
+
+bool TitleTable::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(TitleTableHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const TitleTableHeader *h = (const TitleTableHeader *)data;
+    if (memcmp(h->magic, kTitleTableMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kTitleTableVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    // The rows are checked as they are read, not here.
+    if (h->fileSize != size
+        || h->offsetsOffset + ((uint64_t)h->count + 1) * sizeof(uint32_t) > size
+        || h->poolOffset + h->poolSize > size
+        || h->poolSize > 0xFFFFFFFF) {
+        return corrupt(error, "section out of bounds");
+    }
+
+    _header = h;
+    _offsets = (const uint32_t *)(data + h->offsetsOffset);
+    _pool = data + h->poolOffset;
+    return true;
+}
+
+void TitleTable::close()
+{
+    _header = NULL;
+    _offsets = NULL;
+    _pool = NULL;
+    _file.close();
+}
+
+}
@@ -0,0 +1,86 @@
+//
+//  TitleTable.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__TitleTable__
+#define __LivroDeCanticos__TitleTable__
+
+#include "MappedFile.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace canticos {
+
+struct SourceBook;
+
+// The rows of the Indice tab: the indice.txt lines, as one UTF-8 pool and
+// an offset per row. File layout, all integers little endian:
+//
+//   TitleTableHeader
+//   uint32_t[count + 1]         row N is pool bytes [offsets[N - 1], offsets[N])
+//   pool                        indice.txt lines, UTF-8, no separators
+//
+// Opening reads the header alone and a row checks its own two offsets, so
+// neither the time to open nor the memory touched grows with the number of
+// titles; only the rows on screen are ever read.
+static const char kTitleTableMagic[8] = { 'L', 'D', 'C', 'T', 'I', 'T', 'L', 'E' };
+static const uint32_t kTitleTableVersion = 1;
+
+struct TitleTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t offsetsOffset;
+    uint64_t poolOffset;
+    uint64_t poolSize;
+    uint64_t fileSize;
+};
+
+// Builds the title table of a source book.
+void buildTitleTable(const SourceBook &book, std::string *out);
+
+// Read-only view over a mapped title table.
+class TitleTable {
+public:
+    TitleTable();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+    uint32_t count() const { return _header ? _header->count : 0; }
+
+    // Title of hymn number (1-based), pointing into the mapping; empty when
+    // out of range or when its offsets are not sane.
+    Slice title(uint32_t number) const
+    {
+        if (number < 1 || number > count()) {
+            return Slice();
+        }
+        uint32_t start = _offsets[number - 1];
+        uint32_t end = _offsets[number];
+        if (start > end || end > _header->poolSize) {
+            return Slice();
+        }
+        return Slice(_pool + start, end - start);
+    }
+
+private:
+    TitleTable(const TitleTable &) = delete;
+    TitleTable &operator=(const TitleTable &) = delete;
+
+    MappedFile _file;
+    const TitleTableHeader *_header;
+    const uint32_t *_offsets;
+    const char *_pool;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__TitleTable__) */
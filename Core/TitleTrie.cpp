@@ -0,0 +1,438 @@
+//
+//  TitleTrie.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "TitleTrie.h"
+#include "Tokenizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace canticos {
+
+static const uint32_t kLaterWord = 0x80000000u;
+
+// Longest folded text kept for one suggestion; node labels are 16 bit.
+static const size_t kMaxFoldedBytes = 1024;
+
+static void padTo8(std::string *out)
+{
+    while (out->size() % 8) {
+        out->push_back('\0');
+    }
+}
+
+// TitleTrieBuilder
+
+void TitleTrieBuilder::addHymn(uint32_t number, Slice title, Slice firstLine)
+{
+    Entry t = { number, title.str() };
+    _titles.push_back(t);
+
+    char a[kMaxFoldedBytes];
+    char b[kMaxFoldedBytes];
+    size_t aSize = foldWords(title, a, sizeof(a));
+    size_t bSize = foldWords(firstLine, b, sizeof(b));
+    if (bSize > 0 && (aSize != bSize || memcmp(a, b, aSize) != 0)) {
+        Entry f = { number, firstLine.str() };
+        _firstLines.push_back(f);
+    }
+}
+
+namespace {
+
+struct Key {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t score;
+    uint32_t suggestion;
+};
+
+struct KeyOrder {
+    const char *pool;
+    bool operator()(const Key &a, const Key &b) const
+    {
+        int c = memcmp(pool + a.offset, pool + b.offset, std::min(a.size, b.size));
+        if (c != 0) {
+            return c < 0;
+        }
+        if (a.size != b.size) {
+            return a.size < b.size;
+        }
+        return a.score < b.score;
+    }
+};
+
+struct Pending {
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t depth;
+};
+
+}
+
+template <typename Entry>
+static bool entryBefore(const Entry &a, const Entry &b)
+{
+    return a.number < b.number;
+}
+
+void TitleTrieBuilder::serialize(std::string *out) const
+{
+    std::vector<Entry> all(_titles);
+    std::stable_sort(all.begin(), all.end(), entryBefore<Entry>);
+    std::vector<Entry> lines(_firstLines);
+    std::stable_sort(lines.begin(), lines.end(), entryBefore<Entry>);
+    all.insert(all.end(), lines.begin(), lines.end());
+
+    std::string folded;
+    std::string display;
+    std::string suggestions(all.size() * sizeof(TrieSuggestion), '\0');
+    std::vector<Key> keys;
+    char buffer[kMaxFoldedBytes];
+    for (uint32_t id = 0; id < all.size(); id++) {
+        TrieSuggestion s;
+        memset(&s, 0, sizeof(s));
+        s.number = all[id].number;
+        s.displayOffset = (uint32_t)display.size();
+        s.displaySize = (uint32_t)all[id].display.size();
+        display += all[id].display;
+        memcpy(&suggestions[id * sizeof(TrieSuggestion)], &s, sizeof(s));
+
+        // A closing space lets "aleluia " (a finished word) match a
+        // suggestion that ends with that word.
+        size_t size = foldWords(Slice(all[id].display), buffer, sizeof(buffer) - 1);
+        if (size > 0) {
+            buffer[size++] = ' ';
+        }
+        uint32_t base = (uint32_t)folded.size();
+        folded.append(buffer, size);
+        for (size_t i = 0; i < size; i++) {
+            if (i == 0 || buffer[i - 1] == ' ') {
+                Key key = { base + (uint32_t)i, (uint32_t)(size - i), (i == 0 ? 0 : kLaterWord) | id, id };
+                keys.push_back(key);
+            }
+        }
+    }
+
+    KeyOrder order = { folded.data() };
+    std::sort(keys.begin(), keys.end(), order);
+
+    // Breadth first, so the children of a node end up next to each other.
+    std::vector<TrieNode> nodes;
+    std::vector<TrieValue> values;
+    std::vector<Pending> pending;
+    TrieNode root;
+    memset(&root, 0, sizeof(root));
+    nodes.push_back(root);
+    Pending all0 = { 0, (uint32_t)keys.size(), 0 };
+    pending.push_back(all0);
+    const char *pool = folded.data();
+    for (size_t n = 0; n < pending.size(); n++) {
+        Pending p = pending[n];
+        uint32_t best = 0xFFFFFFFFu;
+        for (uint32_t k = p.lo; k < p.hi; k++) {
+            best = std::min(best, keys[k].score);
+        }
+        nodes[n].best = best;
+
+        uint32_t k = p.lo;
+        nodes[n].firstValue = (uint32_t)values.size();
+        while (k < p.hi && keys[k].size == p.depth) {
+            TrieValue v = { keys[k].score, keys[k].suggestion };
+            values.push_back(v);
+            k++;
+        }
+        nodes[n].valueCount = (uint32_t)values.size() - nodes[n].firstValue;
+
+        nodes[n].firstChild = (uint32_t)nodes.size();
+        uint16_t children = 0;
+        while (k < p.hi) {
+            char c = pool[keys[k].offset + p.depth];
+            uint32_t j = k;
+            while (j < p.hi && pool[keys[j].offset + p.depth] == c) {
+                j++;
+            }
+            const Key &first = keys[k];
+            const Key &last = keys[j - 1];
+            uint32_t lcp = p.depth + 1;
+            uint32_t limit = std::min(first.size, last.size);
+            while (lcp < limit && pool[first.offset + lcp] == pool[last.offset + lcp]) {
+                lcp++;
+            }
+
+            TrieNode child;
+            memset(&child, 0, sizeof(child));
+            child.labelOffset = first.offset + p.depth;
+            child.labelSize = (uint16_t)(lcp - p.depth);
+            nodes.push_back(child);
+            Pending next = { k, j, lcp };
+            pending.push_back(next);
+            children++;
+            k = j;
+        }
+        nodes[n].childCount = children;
+    }
+
+    TrieHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kTrieMagic, sizeof(header.magic));
+    header.version = kTrieVersion;
+    header.nodeCount = (uint32_t)nodes.size();
+    header.valueCount = (uint32_t)values.size();
+    header.suggestionCount = (uint32_t)all.size();
+
+    out->assign(sizeof(TrieHeader), '\0');
+    header.nodesOffset = out->size();
+    out->append((const char *)nodes.data(), nodes.size() * sizeof(TrieNode));
+    header.valuesOffset = out->size();
+    out->append((const char *)values.data(), values.size() * sizeof(TrieValue));
+    header.suggestionsOffset = out->size();
+    *out += suggestions;
+    header.foldedOffset = out->size();
+    header.foldedSize = folded.size();
+    *out += folded;
+    header.displayOffset = out->size();
+    header.displaySize = display.size();
+    *out += display;
+    padTo8(out);
+    header.fileSize = out->size();
+    memcpy(&(*out)[0], &header, sizeof(header));
+}
+
+// TitleTrie
+
+TitleTrie::TitleTrie()
+    : _header(NULL), _nodes(NULL), _values(NULL), _suggestions(NULL), _folded(NULL), _display(NULL)
+{
+}
+
+bool TitleTrie::open(const char *path, std::string *error)
+{
+    close();
+    if (!_file.open(path, error)) {
+        return false;
+    }
+    if (!openMemory(_file.data(), _file.size(), error)) {
+        _file.close();
+        return false;
+    }
+    return true;
+}
+
+static bool corrupt(std::string *error, const char *why)
+{
+    if (error) {
+        *error = std::string("corrupt trie: ") + why;
+    }
+    return false;
+}
+
+bool TitleTrie::openMemory(const char *data, size_t size, std::string *error)
+{
+    _header = NULL;
+    if (size < sizeof(TrieHeader)) {
+        return corrupt(error, "truncated header");
+    }
+    const TrieHeader *h = (const TrieHeader *)data;
+    if (memcmp(h->magic, kTrieMagic, sizeof(h->magic)) != 0) {
+        return corrupt(error, "bad magic");
+    }
+    if (h->version != kTrieVersion) {
+        return corrupt(error, "unsupported version");
+    }
+    if (h->fileSize != size || h->nodeCount == 0
+        || h->nodesOffset + (uint64_t)h->nodeCount * sizeof(TrieNode) > size
+        || h->valuesOffset + (uint64_t)h->valueCount * sizeof(TrieValue) > size
+        || h->suggestionsOffset + (uint64_t)h->suggestionCount * sizeof(TrieSuggestion) > size
+        || h->foldedOffset + h->foldedSize > size
+        || h->displayOffset + h->displaySize > size) {
+        return corrupt(error, "section out of bounds");
+    }
+
+    const TrieNode *nodes = (const TrieNode *)(data + h->nodesOffset);
+    for (uint32_t i = 0; i < h->nodeCount; i++) {
+        const TrieNode &n = nodes[i];
+        if ((uint64_t)n.labelOffset + n.labelSize > h->foldedSize
+            || (uint64_t)n.firstChild + n.childCount > h->nodeCount
+            || (uint64_t)n.firstValue + n.valueCount > h->valueCount) {
+            return corrupt(error, "node out of bounds");
+        }
+    }
+    const TrieValue *values = (const TrieValue *)(data + h->valuesOffset);
+    for (uint32_t i = 0; i < h->valueCount; i++) {
+        if (values[i].suggestion >= h->suggestionCount) {
+            return corrupt(error, "value out of bounds");
+        }
+    }
+    const TrieSuggestion *suggestions = (const TrieSuggestion *)(data + h->suggestionsOffset);
+    for (uint32_t i = 0; i < h->suggestionCount; i++) {
+        if ((uint64_t)suggestions[i].displayOffset + suggestions[i].displaySize > h->displaySize) {
+            return corrupt(error, "suggestion out of bounds");
+        }
+    }
+
+    _header = h;
+    _nodes = nodes;
+    _values = values;
+    _suggestions = suggestions;
+    _folded = data + h->foldedOffset;
+    _display = data + h->displayOffset;
+    return true;
+}
+
+void TitleTrie::close()
+{
+    _header = NULL;
+    _nodes = NULL;
+    _values = NULL;
+    _suggestions = NULL;
+    _folded = NULL;
+    _display = NULL;
+    _file.close();
+}
+
+// Taken by reference by std::min, so it needs a definition of its own.
+const size_t TitleTrie::kMaxSuggestions;
+
+const TrieNode *TitleTrie::locate(const char *prefix, size_t size) const
+{
+    const TrieNode *node = &_nodes[0];
+    size_t i = 0;
+    while (i < size) {
+        // Children are sorted by the first byte of their label.
+        uint32_t lo = node->firstChild;
+        uint32_t hi = node->firstChild + node->childCount;
+        unsigned char c = (unsigned char)prefix[i];
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if ((unsigned char)_folded[_nodes[mid].labelOffset] < c) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == node->firstChild + node->childCount || (unsigned char)_folded[_nodes[lo].labelOffset] != c) {
+            return NULL;
+        }
+        const TrieNode *child = &_nodes[lo];
+        size_t m = std::min((size_t)child->labelSize, size - i);
+        if (memcmp(_folded + child->labelOffset, prefix + i, m) != 0) {
+            return NULL;
+        }
+        i += m;
+        node = child;
+    }
+    return node;
+}
+
+namespace {
+
+// Best-first frontier in a fixed array: either a whole subtree (value ==
+// kSubtree), scored by the best score below it, or the next value of a node.
+struct Frontier {
+    uint32_t score;
+    uint32_t node;
+    uint32_t value;
+};
+
+static const uint32_t kSubtree = 0xFFFFFFFFu;
+static const size_t kFrontierSize = 256;
+
+}
+
+static void push(Frontier *frontier, size_t *size, Frontier entry)
+{
+    if (*size < kFrontierSize) {
+        frontier[(*size)++] = entry;
+        return;
+    }
+    // Full: forget the weakest entry. Every entry promises at least one
+    // suggestion at its score, so with far more than kMaxSuggestions better
+    // entries left the answer cannot change.
+    size_t worst = 0;
+    for (size_t i = 1; i < *size; i++) {
+        if (frontier[i].score > frontier[worst].score) {
+            worst = i;
+        }
+    }
+    if (entry.score < frontier[worst].score) {
+        frontier[worst] = entry;
+    }
+}
+
+static Frontier popBest(Frontier *frontier, size_t *size)
+{
+    size_t best = 0;
+    for (size_t i = 1; i < *size; i++) {
+        if (frontier[i].score < frontier[best].score) {
+            best = i;
+        }
+    }
+    Frontier entry = frontier[best];
+    frontier[best] = frontier[--(*size)];
+    return entry;
+}
+
+size_t TitleTrie::suggest(Slice fragment, Suggestion *out, size_t max) const
+{
+    if (!isOpen() || max == 0) {
+        return 0;
+    }
+    max = std::min(max, kMaxSuggestions);
+
+    char prefix[kMaxPrefixBytes];
+    size_t size = normalizePrefix(fragment, prefix);
+    if (size == 0) {
+        return 0;
+    }
+    const TrieNode *start = locate(prefix, size);
+    if (!start) {
+        return 0;
+    }
+
+    Frontier frontier[kFrontierSize];
+    size_t pending = 0;
+    Frontier first = { start->best, (uint32_t)(start - _nodes), kSubtree };
+    push(frontier, &pending, first);
+
+    size_t count = 0;
+    uint32_t seen[kMaxSuggestions];
+    while (pending > 0 && count < max) {
+        Frontier entry = popBest(frontier, &pending);
+        const TrieNode &node = _nodes[entry.node];
+        if (entry.value == kSubtree) {
+            if (node.valueCount > 0) {
+                Frontier v = { _values[node.firstValue].score, entry.node, 0 };
+                push(frontier, &pending, v);
+            }
+            for (uint32_t c = 0; c < node.childCount; c++) {
+                Frontier child = { _nodes[node.firstChild + c].best, node.firstChild + c, kSubtree };
+                push(frontier, &pending, child);
+            }
+            continue;
+        }
+
+        uint32_t id = _values[node.firstValue + entry.value].suggestion;
+        bool duplicate = false;
+        for (size_t i = 0; i < count; i++) {
+            duplicate = duplicate || seen[i] == id;
+        }
+        if (!duplicate) {
+            const TrieSuggestion &s = _suggestions[id];
+            out[count].number = s.number;
+            out[count].text = Slice(_display + s.displayOffset, s.displaySize);
+            seen[count++] = id;
+        }
+        if (entry.value + 1 < node.valueCount) {
+            Frontier v = { _values[node.firstValue + entry.value + 1].score, entry.node, entry.value + 1 };
+            push(frontier, &pending, v);
+        }
+    }
+    return count;
+}
+
+}
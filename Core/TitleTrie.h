@@ -0,0 +1,133 @@
+//
+//  TitleTrie.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__TitleTrie__
+#define __LivroDeCanticos__TitleTrie__
+
+#include "MappedFile.h"
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace canticos {
+
+// Autocomplete over hymn titles and first lines.
+//
+// Every suggestion (a title from indice.txt, or the first line of a hymn)
+// is folded and reduced to its words separated by single spaces. The trie
+// holds that text from each word start on, so a prefix finds a suggestion
+// wherever the word sits: "piedade" finds "SENHOR TENDE PIEDADE".
+//
+// File layout, all integers little endian:
+//
+//   TrieHeader
+//   TrieNode[nodeCount]         breadth first; children are contiguous and
+//                               sorted by the first byte of their label
+//   TrieValue[valueCount]       per node, best score first
+//   TrieSuggestion[suggestionCount]
+//   folded pool                 node labels point into it
+//   display pool                suggestion text as it appears in the book
+//
+// Scores are "lower is better": suggestions matched at their first word
+// come first, then titles before first lines, then by hymn number.
+static const char kTrieMagic[8] = { 'L', 'D', 'C', 'T', 'R', 'I', 'E', '1' };
+static const uint32_t kTrieVersion = 1;
+
+struct TrieHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint32_t valueCount;
+    uint32_t suggestionCount;
+    uint64_t nodesOffset;
+    uint64_t valuesOffset;
+    uint64_t suggestionsOffset;
+    uint64_t foldedOffset;
+    uint64_t foldedSize;
+    uint64_t displayOffset;
+    uint64_t displaySize;
+    uint64_t fileSize;
+};
+
+struct TrieNode {
+    uint32_t labelOffset;   // into the folded pool
+    uint16_t labelSize;
+    uint16_t childCount;
+    uint32_t firstChild;
+    uint32_t firstValue;
+    uint32_t valueCount;
+    uint32_t best;          // lowest score anywhere below this node
+};
+
+struct TrieValue {
+    uint32_t score;
+    uint32_t suggestion;
+};
+
+struct TrieSuggestion {
+    uint32_t number;
+    uint32_t displayOffset;
+    uint32_t displaySize;
+    uint32_t reserved;
+};
+
+struct Suggestion {
+    uint32_t number;
+    Slice text;   // points into the mapped trie
+};
+
+class TitleTrieBuilder {
+public:
+    // firstLine is skipped when it folds to the same text as the title.
+    void addHymn(uint32_t number, Slice title, Slice firstLine);
+    void serialize(std::string *out) const;
+
+private:
+    struct Entry {
+        uint32_t number;
+        std::string display;
+    };
+    std::vector<Entry> _titles;
+    std::vector<Entry> _firstLines;
+};
+
+class TitleTrie {
+public:
+    TitleTrie();
+
+    bool open(const char *path, std::string *error = NULL);
+    bool openMemory(const char *data, size_t size, std::string *error = NULL);
+    void close();
+
+    bool isOpen() const { return _header != NULL; }
+
+    // Best completions of fragment, at most max of them (up to
+    // kMaxSuggestions). Allocates nothing.
+    size_t suggest(Slice fragment, Suggestion *out, size_t max) const;
+
+    static const size_t kMaxSuggestions = 32;
+
+private:
+    TitleTrie(const TitleTrie &) = delete;
+    TitleTrie &operator=(const TitleTrie &) = delete;
+
+    const TrieNode *locate(const char *prefix, size_t size) const;
+
+    MappedFile _file;
+    const TrieHeader *_header;
+    const TrieNode *_nodes;
+    const TrieValue *_values;
+    const TrieSuggestion *_suggestions;
+    const char *_folded;
+    const char *_display;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__TitleTrie__) */
@@ -0,0 +1,178 @@
+//
+//  Tokenizer.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Tokenizer.h"
+#include "Fold.h"
+
+#include <cstring>
+
+namespace canticos {
+
+size_t decodeUtf8(const uint8_t *p, const uint8_t *end, uint32_t *codePoint)
+{
+    uint32_t b = p[0];
+    if (b < 0x80) {
+        *codePoint = b;
+        return 1;
+    }
+    size_t length;
+    uint32_t cp;
+    if (b >= 0xC2 && b <= 0xDF) {
+        length = 2;
+        cp = b & 0x1F;
+    } else if (b >= 0xE0 && b <= 0xEF) {
+        length = 3;
+        cp = b & 0x0F;
+    } else if (b >= 0xF0 && b <= 0xF4) {
+        length = 4;
+        cp = b & 0x07;
+    } else {
+        *codePoint = 0xFFFD;
+        return 1;
+    }
+    if ((size_t)(end - p) < length) {
+        *codePoint = 0xFFFD;
+        return 1;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *codePoint = 0xFFFD;
+            return 1;
+        }
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+    *codePoint = cp;
+    return length;
+}
+
+size_t utf16Length(Slice text)
+{
+    const uint8_t *p = (const uint8_t *)text.data;
+    const uint8_t *end = p + text.size;
+    size_t units = 0;
+    while (p < end) {
+        if (*p < 0x80) {
+            p++;
+            units++;
+            continue;
+        }
+        uint32_t cp;
+        p += decodeUtf8(p, end, &cp);
+        units += cp > 0xFFFF ? 2 : 1;
+    }
+    return units;
+}
+
+bool isWordCodePoint(uint32_t cp)
+{
+    if (cp < 0x80) {
+        return (cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z');
+    }
+    if (cp < 0xC0) {
+        return cp == 0xAA || cp == 0xB5 || cp == 0xBA;
+    }
+    if (cp == 0xD7 || cp == 0xF7) {
+        return false;
+    }
+    // General Punctuation up to Misc Symbols, and the BOM.
+    if ((cp >= 0x2000 && cp < 0x2C00) || cp == 0xFEFF) {
+        return false;
+    }
+    return true;
+}
+
+bool Tokenizer::next(Token *token)
+{
+    const uint8_t *base = (const uint8_t *)_text.data;
+    const uint8_t *end = base + _text.size;
+
+    // Skip separators.
+    while (_pos < _text.size) {
+        uint32_t cp;
+        size_t n = decodeUtf8(base + _pos, end, &cp);
+        if (isWordCodePoint(cp)) {
+            break;
+        }
+        _pos += n;
+    }
+    if (_pos >= _text.size) {
+        return false;
+    }
+
+    size_t start = _pos;
+    while (_pos < _text.size) {
+        uint32_t cp;
+        size_t n = decodeUtf8(base + _pos, end, &cp);
+        if (!isWordCodePoint(cp)) {
+            break;
+        }
+        _pos += n;
+    }
+
+    token->text = Slice(_text.data + start, _pos - start);
+    token->offset = (uint32_t)start;
+    token->position = _count++;
+    return true;
+}
+
+size_t normalizeTerm(Slice word, char *term)
+{
+    // Folding never grows text, so cutting the word first (on a code point
+    // boundary) is enough to bound the term.
+    size_t size = word.size;
+    if (size > kMaxTermBytes) {
+        size = kMaxTermBytes;
+        while (size > 0 && ((unsigned char)word.data[size] & 0xC0) == 0x80) {
+            size--;
+        }
+    }
+    return foldUtf8(word.data, size, term);
+}
+
+static size_t foldWords(Slice text, char *out, size_t capacity, bool *endsWithBlank)
+{
+    Tokenizer tokenizer(text);
+    Token token;
+    size_t size = 0;
+    size_t end = 0;
+    char term[kMaxTermBytes];
+    while (tokenizer.next(&token)) {
+        size_t length = normalizeTerm(token.text, term);
+        size_t needed = length + (size > 0 ? 1 : 0);
+        if (size + needed > capacity) {
+            break;
+        }
+        if (size > 0) {
+            out[size++] = ' ';
+        }
+        memcpy(out + size, term, length);
+        size += length;
+        end = token.offset + token.text.size;
+    }
+    if (endsWithBlank) {
+        char last = text.size > 0 ? text.data[text.size - 1] : 0;
+        *endsWithBlank = size > 0 && end < text.size && (last == ' ' || last == '\t');
+    }
+    return size;
+}
+
+size_t foldWords(Slice text, char *out, size_t capacity)
+{
+    return foldWords(text, out, capacity, NULL);
+}
+
+size_t normalizePrefix(Slice fragment, char *out)
+{
+    bool complete;
+    size_t size = foldWords(fragment, out, kMaxPrefixBytes - 1, &complete);
+    if (complete) {
+        out[size++] = ' ';
+    }
+    return size;
+}
+
+}
@@ -0,0 +1,72 @@
+//
+//  Tokenizer.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Tokenizer__
+#define __LivroDeCanticos__Tokenizer__
+
+#include "Slice.h"
+
+#include <stdint.h>
+#include <string>
+
+namespace canticos {
+
+// Longest term kept in the index, in bytes. Longer words are cut.
+static const size_t kMaxTermBytes = 64;
+
+struct Token {
+    Slice text;          // raw bytes, pointing into the tokenized text
+    uint32_t offset;     // byte offset of text
+    uint32_t position;   // 0 for the first word, 1 for the next...
+};
+
+// Splits UTF-8 text into words. Letters and digits make words; spaces,
+// punctuation, line breaks of any flavour, the BOM and typographic marks
+// (’ « » …) separate them, so "p’ra" and "Alegrem-se" give two words each.
+// Bytes that are not valid UTF-8 are kept inside the word they appear in.
+class Tokenizer {
+public:
+    explicit Tokenizer(Slice text) : _text(text), _pos(0), _count(0) {}
+
+    bool next(Token *token);
+
+private:
+    Slice _text;
+    size_t _pos;
+    uint32_t _count;
+};
+
+// Decodes the code point at p; returns its length in bytes. Invalid
+// sequences decode as U+FFFD with length 1.
+size_t decodeUtf8(const uint8_t *p, const uint8_t *end, uint32_t *codePoint);
+
+// Length of text in UTF-16 code units, what NSString counts: two for code
+// points past U+FFFF, one for everything else, invalid bytes included.
+size_t utf16Length(Slice text);
+
+bool isWordCodePoint(uint32_t cp);
+
+// Index term for a word: accent and case folded (see Fold.h), at most
+// kMaxTermBytes. Used for documents and queries alike. term must hold
+// kMaxTermBytes; returns the term length.
+size_t normalizeTerm(Slice word, char *term);
+
+// Folded words of text joined by single spaces, at most capacity bytes;
+// returns the length.
+size_t foldWords(Slice text, char *out, size_t capacity);
+
+// Longest typed fragment kept, in folded bytes; longer input is cut.
+static const size_t kMaxPrefixBytes = 128;
+
+// Folds a typed fragment like foldWords, plus a trailing space if the
+// fragment ends with a blank (the last word is complete). out holds
+// kMaxPrefixBytes; returns the length.
+size_t normalizePrefix(Slice fragment, char *out);
+
+}
+
+#endif /* defined(__LivroDeCanticos__Tokenizer__) */
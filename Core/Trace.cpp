@@ -0,0 +1,307 @@
+//
+//  Trace.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#if CANTICOS_TRACE
+#include <pthread.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace canticos {
+
+uint64_t traceNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#if CANTICOS_TRACE
+
+// Histogram buckets: values under 32 ns have one each, and every power of
+// two above that is cut in 16, so a bucket is within 1/16 of its value.
+static const uint32_t kSubBuckets = 16;
+static const uint32_t kBuckets = 32 + kSubBuckets * (64 - 5);
+
+static uint32_t bucketOf(uint64_t value)
+{
+    if (value < 32) {
+        return (uint32_t)value;
+    }
+    uint32_t shift = 0;
+    while (value >> shift >= 2 * kSubBuckets) {
+        shift++;
+    }
+    return shift * kSubBuckets + (uint32_t)(value >> shift);
+}
+
+static uint64_t bucketLow(uint32_t bucket)
+{
+    if (bucket < 32) {
+        return bucket;
+    }
+    uint32_t shift = bucket / kSubBuckets - 1;
+    return (uint64_t)(bucket - shift * kSubBuckets) << shift;
+}
+
+static uint64_t bucketMiddle(uint32_t bucket)
+{
+    if (bucket < 32) {
+        return bucket;
+    }
+    uint32_t shift = bucket / kSubBuckets - 1;
+    return bucketLow(bucket) + ((uint64_t)1 << shift) / 2;
+}
+
+namespace {
+
+// A span in the ring. The thread writing it makes sequence odd while it
+// does; a reader keeps a copy only if sequence was the same even number
+// before and after.
+struct TraceSlot {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> event;
+    std::atomic<uint32_t> arg;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> duration;
+};
+
+// What one thread records. Only that thread writes; the counters are
+// atomics so that a dump on another thread reads whole values, but every
+// store is relaxed and uncontended.
+struct TraceBuffer {
+    uint32_t thread;
+    std::atomic<uint64_t> counts[kTraceEventCount][kBuckets];
+    std::atomic<uint64_t> totals[kTraceEventCount];
+    std::atomic<uint64_t> mins[kTraceEventCount];
+    std::atomic<uint64_t> maxes[kTraceEventCount];
+    std::atomic<uint64_t> written;
+    TraceSlot ring[kTraceRing];
+};
+
+}
+
+static void bump(std::atomic<uint64_t> &counter, uint64_t by)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+// Buffers outlive their threads, so a dump still sees what a finished
+// thread recorded; there are only ever a few threads.
+static std::mutex gBuffersLock;
+static std::vector<TraceBuffer *> gBuffers;
+static pthread_key_t gBufferKey;
+static pthread_once_t gBufferKeyOnce = PTHREAD_ONCE_INIT;
+
+static void makeBufferKey()
+{
+    pthread_key_create(&gBufferKey, NULL);
+}
+
+static TraceBuffer *threadBuffer()
+{
+    pthread_once(&gBufferKeyOnce, makeBufferKey);
+    TraceBuffer *buffer = (TraceBuffer *)pthread_getspecific(gBufferKey);
+    if (buffer) {
+        return buffer;
+    }
+    buffer = new TraceBuffer;
+    for (uint32_t e = 0; e < kTraceEventCount; e++) {
+        for (uint32_t b = 0; b < kBuckets; b++) {
+            buffer->counts[e][b].store(0, std::memory_order_relaxed);
+        }
+        buffer->totals[e].store(0, std::memory_order_relaxed);
+        buffer->mins[e].store(UINT64_MAX, std::memory_order_relaxed);
+        buffer->maxes[e].store(0, std::memory_order_relaxed);
+    }
+    buffer->written.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < kTraceRing; i++) {
+        buffer->ring[i].sequence.store(0, std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(gBuffersLock);
+        buffer->thread = (uint32_t)gBuffers.size() + 1;
+        gBuffers.push_back(buffer);
+    }
+    pthread_setspecific(gBufferKey, buffer);
+    return buffer;
+}
+
+void traceRecord(TraceEvent event, uint64_t start, uint64_t end, uint32_t arg)
+{
+    TraceBuffer *buffer = threadBuffer();
+    uint64_t duration = end > start ? end - start : 0;
+    bump(buffer->counts[event][bucketOf(duration)], 1);
+    bump(buffer->totals[event], duration);
+    if (duration < buffer->mins[event].load(std::memory_order_relaxed)) {
+        buffer->mins[event].store(duration, std::memory_order_relaxed);
+    }
+    if (duration > buffer->maxes[event].load(std::memory_order_relaxed)) {
+        buffer->maxes[event].store(duration, std::memory_order_relaxed);
+    }
+
+    uint64_t index = buffer->written.load(std::memory_order_relaxed);
+    TraceSlot &slot = buffer->ring[index % kTraceRing];
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event.store(event, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    buffer->written.store(index + 1, std::memory_order_release);
+}
+
+static std::vector<TraceBuffer *> buffers()
+{
+    std::lock_guard<std::mutex> lock(gBuffersLock);
+    return gBuffers;
+}
+
+// Merges the event's histograms into counts, and fills out.
+static void summarize(TraceEvent event, std::vector<uint64_t> *counts, TraceSummary *out)
+{
+    memset(out, 0, sizeof(*out));
+    counts->assign(kBuckets, 0);
+    std::vector<TraceBuffer *> all = buffers();
+    out->min = UINT64_MAX;
+    for (size_t t = 0; t < all.size(); t++) {
+        for (uint32_t b = 0; b < kBuckets; b++) {
+            uint64_t n = all[t]->counts[event][b].load(std::memory_order_relaxed);
+            (*counts)[b] += n;
+            out->count += n;
+        }
+        out->total += all[t]->totals[event].load(std::memory_order_relaxed);
+        out->min = std::min(out->min, all[t]->mins[event].load(std::memory_order_relaxed));
+        out->max = std::max(out->max, all[t]->maxes[event].load(std::memory_order_relaxed));
+    }
+    if (out->count == 0) {
+        out->min = 0;
+        return;
+    }
+
+    static const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t *values[] = { &out->p50, &out->p90, &out->p99, &out->p999 };
+    for (size_t q = 0; q < 4; q++) {
+        uint64_t rank = (uint64_t)(kQuantiles[q] * (out->count - 1)) + 1;
+        uint64_t seen = 0;
+        for (uint32_t b = 0; b < kBuckets; b++) {
+            seen += (*counts)[b];
+            if (seen >= rank) {
+                *values[q] = std::min(std::max(bucketMiddle(b), out->min), out->max);
+                break;
+            }
+        }
+    }
+}
+
+void traceSummary(TraceEvent event, TraceSummary *out)
+{
+    std::vector<uint64_t> counts;
+    summarize(event, &counts, out);
+}
+
+static void appendf(std::string *out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string *out, const char *format, ...)
+{
+    char text[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    out->append(text, std::min<size_t>(n > 0 ? (size_t)n : 0, sizeof(text) - 1));
+}
+
+void traceJson(std::string *out)
+{
+    out->assign("{\"enabled\": true, \"unit\": \"us\", \"events\": [");
+    std::vector<uint64_t> counts;
+    for (uint32_t e = 0; e < kTraceEventCount; e++) {
+        TraceSummary s;
+        summarize((TraceEvent)e, &counts, &s);
+        appendf(out, "%s\n  {\"name\": \"%s\", \"count\": %llu", e ? "," : "", kTraceEventNames[e],
+                (unsigned long long)s.count);
+        if (s.count) {
+            appendf(out, ", \"mean\": %.3f, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f", s.total / 1e3 / s.count,
+                    s.min / 1e3, s.p50 / 1e3, s.p90 / 1e3);
+            appendf(out, ", \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f", s.p99 / 1e3, s.p999 / 1e3, s.max / 1e3);
+        }
+        // [lowest value, count] of every bucket used.
+        out->append(", \"buckets\": [");
+        bool first = true;
+        for (uint32_t b = 0; b < kBuckets; b++) {
+            if (counts[b]) {
+                appendf(out, "%s[%.3f, %llu]", first ? "" : ", ", bucketLow(b) / 1e3, (unsigned long long)counts[b]);
+                first = false;
+            }
+        }
+        out->append("]}");
+    }
+    out->append("\n]}\n");
+}
+
+void traceChrome(std::string *out)
+{
+    out->assign("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    std::vector<TraceBuffer *> all = buffers();
+    bool first = true;
+    for (size_t t = 0; t < all.size(); t++) {
+        appendf(out, "%s\n {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                     "\"args\": {\"name\": \"thread %u\"}}",
+                first ? "" : ",", all[t]->thread, all[t]->thread);
+        first = false;
+        uint64_t written = all[t]->written.load(std::memory_order_acquire);
+        uint64_t from = written > kTraceRing ? written - kTraceRing : 0;
+        for (uint64_t i = from; i < written; i++) {
+            TraceSlot &slot = all[t]->ring[i % kTraceRing];
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            uint32_t event = slot.event.load(std::memory_order_relaxed);
+            uint32_t arg = slot.arg.load(std::memory_order_relaxed);
+            uint64_t start = slot.start.load(std::memory_order_relaxed);
+            uint64_t duration = slot.duration.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before % 2 || slot.sequence.load(std::memory_order_relaxed) != before || event >= kTraceEventCount) {
+                continue;
+            }
+            appendf(out, ",\n {\"name\": \"%s\", \"cat\": \"canticos\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                         "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"arg\": %u}}",
+                    kTraceEventNames[event], all[t]->thread, start / 1e3, duration / 1e3, arg);
+        }
+    }
+    out->append("\n]}\n");
+}
+
+#else
+
+void traceSummary(TraceEvent, TraceSummary *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+void traceJson(std::string *out)
+{
+    out->assign("{\"enabled\": false}\n");
+}
+
+void traceChrome(std::string *out)
+{
+    out->assign("{\"displayTimeUnit\": \"ms\", \"traceEvents\": []}\n");
+}
+
+#endif
+
+}
@@ -0,0 +1,104 @@
+//
+//  Trace.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Trace__
+#define __LivroDeCanticos__Trace__
+
+#include <stdint.h>
+#include <string>
+
+// Latency of what the user waits for, recorded where it happens. Built
+// with CANTICOS_TRACE=1 (the Debug configuration, or cmake
+// -DCANTICOS_TRACE=ON), a span costs two clock reads and a few stores
+// into buffers of the recording thread, which take no lock; without it
+// the macros are empty and nothing is recorded or linked in.
+//
+//   CANTICOS_TRACE_SCOPE(span, kTraceQuery);     // until the end of scope
+//   ...
+//   CANTICOS_TRACE_ARG(span, hits.size());       // shown in the trace
+//
+// Every span lands in its event's histogram (HDR: buckets within 1/16 of
+// their value, 1 ns to hours), and the latest kTraceRing spans of each
+// thread are kept for a Chrome trace (chrome://tracing, Perfetto).
+#ifndef CANTICOS_TRACE
+#define CANTICOS_TRACE 0
+#endif
+
+#if CANTICOS_TRACE
+#define CANTICOS_TRACE_SCOPE(name, event) canticos::TraceScope name(event)
+#define CANTICOS_TRACE_ARG(name, arg) name.setArg((uint32_t)(arg))
+#else
+#define CANTICOS_TRACE_SCOPE(name, event)
+#define CANTICOS_TRACE_ARG(name, arg) ((void)0)
+#endif
+
+namespace canticos {
+
+enum TraceEvent {
+    kTraceLaunch,           // process start to the first frame
+    kTraceIndexLoad,        // the Indice tab loading its titles
+    kTraceHymnOpen,         // a hymn prepared for Cantico
+    kTraceSuggest,          // a keystroke to its title suggestions
+    kTraceTypeSearch,       // a keystroke to the hymns found so far
+    kTraceQuery,            // a search to its results
+    kTraceEventCount
+};
+
+static const char *const kTraceEventNames[kTraceEventCount] = {
+    "launch", "index_load", "hymn_open", "keystroke_suggest", "keystroke_search", "query"
+};
+
+// Spans kept per thread for the Chrome trace; older ones are overwritten.
+static const uint32_t kTraceRing = 1024;
+
+// Nanoseconds on the steady clock.
+uint64_t traceNow();
+
+// Records a span from start to end (traceNow times) on the calling thread.
+void traceRecord(TraceEvent event, uint64_t start, uint64_t end, uint32_t arg = 0);
+
+class TraceScope {
+public:
+    explicit TraceScope(TraceEvent event) : _event(event), _arg(0), _start(traceNow()) {}
+    ~TraceScope() { traceRecord(_event, _start, traceNow(), _arg); }
+
+    void setArg(uint32_t arg) { _arg = arg; }
+
+private:
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    TraceEvent _event;
+    uint32_t _arg;
+    uint64_t _start;
+};
+
+// One event over every thread, in nanoseconds; percentiles are the
+// middle of their bucket.
+struct TraceSummary {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+void traceSummary(TraceEvent event, TraceSummary *out);
+
+// Every event's summary and non-empty buckets, as JSON; {"enabled": false}
+// when built without tracing.
+void traceJson(std::string *out);
+
+// The spans kept, in the Chrome trace event format.
+void traceChrome(std::string *out);
+
+}
+
+#endif /* defined(__LivroDeCanticos__Trace__) */
@@ -0,0 +1,59 @@
+//
+//  Varint.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__Varint__
+#define __LivroDeCanticos__Varint__
+
+#include <stdint.h>
+#include <string>
+
+namespace canticos {
+
+// LEB128: seven bits per byte, low bits first, high bit set on all but the
+// last byte. Small deltas (the common case in postings) take one byte.
+inline void putVarint(std::string *out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out->push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+// Decodes one value and advances p. The caller guarantees p < end; a value
+// truncated by end decodes as whatever bits were read.
+inline uint32_t getVarint(const uint8_t *&p, const uint8_t *end)
+{
+    uint32_t b = *p++;
+    if (b < 0x80) {
+        return b;
+    }
+    uint32_t value = b & 0x7F;
+    int shift = 7;
+    while (p < end && shift <= 28) {
+        b = *p++;
+        value |= (b & 0x7F) << shift;
+        if (b < 0x80) {
+            break;
+        }
+        shift += 7;
+    }
+    return value;
+}
+
+// Moves p past n values without decoding them: counts the bytes that end
+// a value (high bit clear). Runs are short, a word at a time did not pay.
+inline void skipVarints(const uint8_t *&p, const uint8_t *end, uint32_t n)
+{
+    while (n > 0 && p < end) {
+        n -= *p++ < 0x80;
+    }
+}
+
+}
+
+#endif /* defined(__LivroDeCanticos__Varint__) */
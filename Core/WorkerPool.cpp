@@ -0,0 +1,144 @@
+//
+//  WorkerPool.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#include "WorkerPool.h"
+
+namespace canticos {
+
+WorkerPool::WorkerPool(unsigned threads) : _runs(new Run[threads + 1]), _task(NULL), _job(0), _busy(0), _stop(false)
+{
+    for (unsigned t = 0; t <= threads; t++) {
+        _runs[t].next = 0;
+        _runs[t].end = 0;
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        _threads.push_back(std::thread(&WorkerPool::workerLoop, this, (size_t)t));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (size_t t = 0; t < _threads.size(); t++) {
+        _threads[t].join();
+    }
+}
+
+unsigned WorkerPool::defaultThreads()
+{
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
+bool WorkerPool::take(size_t slot, size_t *task)
+{
+    Run &run = _runs[slot];
+    std::lock_guard<std::mutex> lock(run.lock);
+    if (run.next == run.end) {
+        return false;
+    }
+    *task = run.next++;
+    return true;
+}
+
+// Looks at the others' runs from the next thread's on, so thieves spread
+// out, and moves the later half of the first with tasks left into slot's.
+bool WorkerPool::steal(size_t slot)
+{
+    size_t slots = _threads.size() + 1;
+    for (size_t i = 1; i < slots; i++) {
+        Run &victim = _runs[(slot + i) % slots];
+        size_t first;
+        size_t end;
+        {
+            std::lock_guard<std::mutex> lock(victim.lock);
+            size_t left = victim.end - victim.next;
+            if (left == 0) {
+                continue;
+            }
+            end = victim.end;
+            victim.end -= (left + 1) / 2;
+            first = victim.end;
+        }
+        Run &own = _runs[slot];
+        std::lock_guard<std::mutex> lock(own.lock);
+        own.next = first;
+        own.end = end;
+        return true;
+    }
+    return false;
+}
+
+void WorkerPool::work(size_t slot, const std::function<void(size_t)> &task)
+{
+    size_t i;
+    do {
+        while (take(slot, &i)) {
+            task(i);
+        }
+    } while (steal(slot));
+}
+
+void WorkerPool::workerLoop(size_t slot)
+{
+    unsigned long joined = 0;
+    std::unique_lock<std::mutex> lock(_lock);
+    for (;;) {
+        _wake.wait(lock, [&] { return _stop || (_task && _job != joined); });
+        if (_stop) {
+            return;
+        }
+        joined = _job;
+        _busy++;
+        const std::function<void(size_t)> &task = *_task;
+        lock.unlock();
+        work(slot, task);
+        lock.lock();
+        if (--_busy == 0) {
+            _finished.notify_all();
+        }
+    }
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)> &task)
+{
+    if (count == 0) {
+        return;
+    }
+    if (count == 1 || _threads.empty()) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> job(_runLock);
+    size_t slots = _threads.size() + 1;
+    for (size_t t = 0; t < slots; t++) {
+        std::lock_guard<std::mutex> lock(_runs[t].lock);
+        _runs[t].next = count * t / slots;
+        _runs[t].end = count * (t + 1) / slots;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _task = &task;
+        _job++;
+    }
+    _wake.notify_all();
+    work(slots - 1, task);
+
+    // Every task is taken once the caller finds nothing to steal; those
+    // still running are on threads that are busy.
+    std::unique_lock<std::mutex> lock(_lock);
+    _finished.wait(lock, [this] { return _busy == 0; });
+    _task = NULL;
+}
+
+}
@@ -0,0 +1,78 @@
+//
+//  WorkerPool.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#ifndef __LivroDeCanticos__WorkerPool__
+#define __LivroDeCanticos__WorkerPool__
+
+#include <stddef.h>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace canticos {
+
+// Threads kept waiting for the tasks of a job. The thread that runs a job
+// takes its tasks too, so a pool of n threads works on n + 1 tasks at
+// once, a job of one task never leaves the caller, and a job is never
+// slower than running its tasks in a loop by more than waking the pool.
+// Jobs asked for by several threads run one after another.
+//
+// Tasks are dealt out by work stealing: each thread starts with a run of
+// consecutive tasks of its own and takes them in order, and one that runs
+// out takes the later half of what is left of another's. Threads mostly
+// touch only their own run, neighbouring tasks stay on one thread, and
+// tasks of uneven cost still end together.
+class WorkerPool {
+public:
+    // A pool of no threads runs every task on the caller.
+    explicit WorkerPool(unsigned threads);
+    ~WorkerPool();
+
+    unsigned threadCount() const { return (unsigned)_threads.size(); }
+
+    // Runs task(0) ... task(count - 1) and returns when all have finished.
+    void run(size_t count, const std::function<void(size_t)> &task);
+
+    // One thread per core besides the caller's.
+    static unsigned defaultThreads();
+
+private:
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // The tasks next ... end - 1 left to a thread. Its own thread takes
+    // from the front and thieves from the back.
+    struct Run {
+        std::mutex lock;
+        size_t next;
+        size_t end;
+    };
+
+    bool take(size_t slot, size_t *task);
+    bool steal(size_t slot);
+    // Runs tasks of the current job from the runs while there are any.
+    void work(size_t slot, const std::function<void(size_t)> &task);
+    void workerLoop(size_t slot);
+
+    std::vector<std::thread> _threads;
+    std::unique_ptr<Run[]> _runs;   // per thread, then the caller's
+    std::mutex _runLock;            // held for a whole job
+    std::mutex _lock;               // the rest, under _lock
+    std::condition_variable _wake;
+    std::condition_variable _finished;
+    const std::function<void(size_t)> *_task;
+    unsigned long _job;             // counts jobs, so a thread joins each once
+    size_t _busy;                   // threads in the current job
+    bool _stop;
+};
+
+}
+
+#endif /* defined(__LivroDeCanticos__WorkerPool__) */
@@ -9,8 +9,12 @@
 #import <UIKit/UIKit.h>
 
 @interface FirstViewController : UIViewController
-@property (weak, nonatomic) IBOutlet UISearchDisplayController *procura;
+@property (weak, nonatomic) IBOutlet UISearchBar *procura;
+@property (strong, nonatomic) UISearchDisplayController *lista;
 @property (weak, nonatomic) IBOutlet UISegmentedControl *select;
 //@property (weak, nonatomic) IBOutlet UILabel *label;
 @property (strong, nonatomic) NSString *texto;
+@property (strong, nonatomic) NSArray *sugestoes;
+@property (strong, nonatomic) NSArray *resultados;
+@property (strong, nonatomic) NSArray *relevantes;
 @end
@@ -8,20 +8,34 @@
 
 #import "FirstViewController.h"
 #import "Cantico.h"
+#import "Livro.h"
 
-@interface FirstViewController ()
+@interface FirstViewController () <UISearchBarDelegate, UISearchDisplayDelegate, UITableViewDataSource,
+                                   UITableViewDelegate>
 
 @end
 
+// As secções da lista de resultados, pela ordem em que aparecem.
+enum {
+    SeccaoSugestoes,
+    SeccaoResultados,
+    SeccaoRelevantes,
+    NumeroDeSeccoes
+};
+
 @implementation FirstViewController
-@synthesize procura, texto, select;
+@synthesize procura, lista, texto, select, sugestoes, resultados, relevantes;
 - (void)viewDidLoad
 {
     [super viewDidLoad];
 	// Do any additional setup after loading the view, typically from a nib.
     self.title = @"Pesquisa";
-    [procura displaysSearchBarInNavigationBar];
-     NSLog(@"Pesquisa");
+    // a barra vem do storyboard; os resultados aparecem por cima, a cada tecla
+    procura.delegate = self;
+    lista = [[UISearchDisplayController alloc] initWithSearchBar:procura contentsController:self];
+    lista.delegate = self;
+    lista.searchResultsDataSource = self;
+    lista.searchResultsDelegate = self;
 }
 
 - (void)didReceiveMemoryWarning
@@ -33,39 +47,137 @@
 - (void)searchBarSearchButtonClicked:(UISearchBar *)searchBar
 {
     [self handleSearch:searchBar];
-    NSLog(@"User searched for %@", searchBar.text);
-
 }
 
 - (void)handleSearch:(UISearchBar *)searchBar
 {
-    NSLog(@"User searched for %@", searchBar.text);
     [searchBar resignFirstResponder]; // if you want the keyboard to go away
     
     texto = searchBar.text;
 }
 
+- (BOOL)searchDisplayController:(UISearchDisplayController *)controller
+    shouldReloadTableForSearchString:(NSString *)searchString
+{
+    // sugestoes de titulos a cada tecla
+    sugestoes = [[Livro livro] sugestoesPara:searchString maximo:10];
+    // e canticos que ja contem o que foi escrito
+    resultados = [[Livro livro] procuraEnquantoEscreve:searchString maximo:10];
+    // os mais relevantes, com radicais e sinonimos, chegam depois; so os
+    // do texto mais recente
+    relevantes = nil;
+    [[Livro livro] procuraPorTexto:searchString depois:^(NSArray *numeros) {
+        relevantes = numeros;
+        [controller.searchResultsTableView reloadData];
+    }];
+    return YES;
+}
+
+- (NSArray *)linhasDaSeccao:(NSInteger)seccao
+{
+    switch (seccao) {
+        case SeccaoSugestoes: return sugestoes;
+        case SeccaoResultados: return resultados;
+        case SeccaoRelevantes: return relevantes;
+    }
+    return nil;
+}
+
+- (NSInteger)numberOfSectionsInTableView:(UITableView *)tableView
+{
+    return NumeroDeSeccoes;
+}
+
+- (NSInteger)tableView:(UITableView *)tableView numberOfRowsInSection:(NSInteger)section
+{
+    return [[self linhasDaSeccao:section] count];
+}
+
+- (NSString *)tableView:(UITableView *)tableView titleForHeaderInSection:(NSInteger)section
+{
+    if ([[self linhasDaSeccao:section] count] == 0) {
+        return nil;
+    }
+    switch (section) {
+        case SeccaoSugestoes: return @"Títulos";
+        case SeccaoResultados: return @"Cânticos";
+        case SeccaoRelevantes: return @"Mais relevantes";
+    }
+    return nil;
+}
+
+- (UITableViewCell *)tableView:(UITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath
+{
+    static NSString *CellIdentifier = @"Cell";
+    UITableViewCell *cell = [tableView dequeueReusableCellWithIdentifier:CellIdentifier];
+    if (cell == nil) {
+        cell = [[UITableViewCell alloc] initWithStyle:UITableViewCellStyleDefault reuseIdentifier:CellIdentifier];
+        cell.accessoryType = UITableViewCellAccessoryDisclosureIndicator;
+    }
+    cell.textLabel.font = [UIFont fontWithName:@"ChalkboardSE-Bold" size:15];
+
+    id linha = [[self linhasDaSeccao:indexPath.section] objectAtIndex:indexPath.row];
+    if (indexPath.section == SeccaoSugestoes) {
+        cell.textLabel.text = [linha objectForKey:@"texto"];
+    } else {
+        cell.textLabel.text = [[Livro livro] tituloDoCantico:[linha intValue]];
+    }
+    return cell;
+}
+
+- (void)tableView:(UITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath
+{
+    [tableView deselectRowAtIndexPath:indexPath animated:YES];
+    id linha = [[self linhasDaSeccao:indexPath.section] objectAtIndex:indexPath.row];
+    NSNumber *numero = indexPath.section == SeccaoSugestoes ? [linha objectForKey:@"numero"] : linha;
+    // as sugestoes vem do titulo, nao ha nada a realcar no texto
+    NSMutableDictionary *escolha = [NSMutableDictionary dictionaryWithObject:numero forKey:@"numero"];
+    if (indexPath.section != SeccaoSugestoes) {
+        [escolha setObject:procura.text forKey:@"procura"];
+    }
+    [self performSegueWithIdentifier:@"barraPesquisa" sender:escolha];
+}
+
 - (void)searchBarCancelButtonClicked:(UISearchBar *) searchBar
 {
-    NSLog(@"User canceled search");
     [searchBar resignFirstResponder]; // if you want the keyboard to go away
+    [[Livro livro] cancelaProcuras];
 }
 
 -(void)prepareForSegue:(UIStoryboardSegue *)segue sender:(id)sender
 {
-    NSLog(@"Aqui");
+    if ([sender isKindOfClass:[NSDictionary class]]) {
+        // escolhido na lista de resultados
+        Cantico * cant = [segue destinationViewController];
+        cant.canticoNum = [[sender objectForKey:@"numero"] intValue];
+        cant.procura = [sender objectForKey:@"procura"];
+        return;
+    }
     if(select.selectedSegmentIndex == 0){
-        if (texto.intValue > 0 && texto.intValue < 151) {
+        // "12", ou "jovens 12" para um cantico de outro livro
+        int numero = [[Livro livro] canticoParaReferencia:texto];
+        if (numero > 0) {
             //Create a DetailViewController Object
             Cantico * cant = [[Cantico alloc]init];
             
             //Set DVC to the destinationViewController property of the segue
             cant = [segue destinationViewController];
             
-            cant.canticoNum =texto.intValue;
+            cant.canticoNum = numero;
         }
     }else{
-        // procura por texto
+        // procura por texto: abre o cantico mais relevante
+        NSArray *numeros = [[Livro livro] procuraPorTexto:texto];
+        NSString *corrigido = numeros.count == 0 ? [[Livro livro] correccaoPara:texto] : nil;
+        if (corrigido != nil) {
+            // nada encontrado: procura com as palavras corrigidas
+            numeros = [[Livro livro] procuraPorTexto:corrigido];
+        }
+        if (numeros.count > 0) {
+            Cantico * cant = [segue destinationViewController];
+            cant.canticoNum = [[numeros objectAtIndex:0] intValue];
+            cant.procura = corrigido != nil ? corrigido : texto;
+        }
     }
     
 }
@@ -10,6 +10,4 @@
 
 @interface Indice : UITableViewController
 
-@property(strong, nonatomic) NSMutableArray * indiceArray;
-
 @end
@@ -1,5 +1,5 @@
 //
-//  Indice.m
+//  Indice.mm
 //  LivroDeCanticos
 //
 //  Created by Pedro Barroso on 22/08/13.
@@ -9,12 +9,24 @@
 #import "Indice.h"
 #import "Cantico.h"
 
+#include "Catalog.h"
+#include "TitleTable.h"
+#include "Trace.h"
+
+#include <memory>
+#include <vector>
+
 @interface Indice ()
 
 @end
 
 @implementation Indice
-@synthesize indiceArray;
+{
+    // Uma secção por livro do catálogo, com os títulos de KEY.titles
+    // mapeados: cada linha só vira NSString quando aparece no ecrã.
+    std::vector<canticos::CatalogBook> livros;
+    std::vector<std::unique_ptr<canticos::TitleTable> > titulos;
+}
 
 - (id)initWithStyle:(UITableViewStyle)style
 {
@@ -27,23 +39,43 @@
 
 - (void)viewDidLoad
 {
+    CANTICOS_TRACE_SCOPE(medida, canticos::kTraceIndexLoad);
     [super viewDidLoad];
     self.title = @"Indice";
 
-    indiceArray = [[NSMutableArray alloc]init];
-    int i = 0;
-    NSString* path = [[NSBundle mainBundle] pathForResource:@"indice"
-                                                     ofType:@"txt"];
-
-    NSString *fileContents = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
-    
-    for (NSString *line in [fileContents componentsSeparatedByCharactersInSet:[NSCharacterSet newlineCharacterSet]]) {
-        if (![line isEqualToString:@""]) {
-            [indiceArray insertObject:line atIndex:i];
-            i++;
+    std::string error;
+    if (livros.empty() && !canticos::loadCatalog([[[NSBundle mainBundle] resourcePath] fileSystemRepresentation],
+                                                 &livros, &error)) {
+        NSLog(@"livros.txt: %s", error.c_str());
+        canticos::CatalogBook livro = { canticos::kMainBookKey, canticos::kMainBookKey };
+        livros.assign(1, livro);
+    }
+    uint32_t linhas = 0;
+    for (size_t l = titulos.size(); l < livros.size(); l++) {
+        titulos.push_back(std::unique_ptr<canticos::TitleTable>(new canticos::TitleTable));
+        NSString *path = [[NSBundle mainBundle] pathForResource:@(livros[l].key.c_str()) ofType:@"titles"];
+        if (path == nil) {
+            NSLog(@"%s.titles nao encontrado", livros[l].key.c_str());
+        } else if (!titulos[l]->open([path fileSystemRepresentation], &error)) {
+            NSLog(@"%s.titles: %s", livros[l].key.c_str(), error.c_str());
         }
-        
-    }    
+        linhas += titulos[l]->count();
+    }
+    CANTICOS_TRACE_ARG(medida, linhas);
+}
+
+// O título da linha, a apontar para o mapeamento, que vive tanto quanto
+// o Indice.
+- (NSString *)tituloDaLinha:(NSIndexPath *)linha
+{
+    canticos::Slice titulo = titulos[linha.section]->title((uint32_t)linha.row + 1);
+    if (titulo.empty()) {
+        return @"";
+    }
+    return [[NSString alloc] initWithBytesNoCopy:(void *)titulo.data
+                                          length:titulo.size
+                                        encoding:NSUTF8StringEncoding
+                                    freeWhenDone:NO];
 }
 
 - (void)didReceiveMemoryWarning
@@ -57,13 +89,23 @@
 - (NSInteger)numberOfSectionsInTableView:(UITableView *)tableView
 {
     // Return the number of sections.
-    return 1;
+    return titulos.size();
+}
+
+- (NSString *)tableView:(UITableView *)tableView titleForHeaderInSection:(NSInteger)section
+{
+    // so com mais de um livro
+    if (livros.size() < 2) {
+        return nil;
+    }
+    const std::string &nome = livros[section].name;
+    return [[NSString alloc] initWithBytes:nome.data() length:nome.size() encoding:NSUTF8StringEncoding];
 }
 
 - (NSInteger)tableView:(UITableView *)tableView numberOfRowsInSection:(NSInteger)section
 {
     // Return the number of rows in the section.
-    return indiceArray.count;
+    return titulos[section]->count();
 }
 
 - (UITableViewCell *)tableView:(UITableView *)tableView cellForRowAtIndexPath:(NSIndexPath *)indexPath
@@ -80,7 +122,7 @@
     }
     
     //Set the text attribute to whatever we are currently looking at in our array
-    cell.textLabel.text = [indiceArray objectAtIndex:indexPath.row];
+    cell.textLabel.text = [self tituloDaLinha:indexPath];
     
     //Set the detail disclosure indicator
     cell.accessoryType = UITableViewCellAccessoryDisclosureIndicator;
@@ -143,11 +185,9 @@
     //Get the indexpath
     NSIndexPath * path = [self.tableView indexPathForSelectedRow];
     
-     NSLog(@"do indice para cantico");
-    
-    NSString * titulo = [indiceArray objectAtIndex:path.row];
-    
-    cant.canticoNum = path.row+1;
+    // o numero do cantico leva o livro (ver Livro.h)
+    canticos::HymnRef cantico = { (uint32_t)path.section, (uint32_t)path.row + 1 };
+    cant.canticoNum = canticos::packHymnRef(cantico);
 //    cant.canticoTitulo = titulo;
 }
 @end
@@ -0,0 +1,117 @@
+//
+//  Livro.h
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#import <CoreGraphics/CoreGraphics.h>
+#import <Foundation/Foundation.h>
+
+// Os livros de cânticos empacotados (livro.corpus, e os dos outros livros
+// de livros.txt), mapeados uma única vez.
+//
+// Um número de cântico diz também de que livro ele é: os do primeiro livro
+// do catálogo são os números do livro, e os dos outros dá-os
+// cantico:doLivro:. Todos os métodos que recebem ou devolvem cânticos
+// usam estes números.
+@interface Livro : NSObject
+
++ (Livro *)livro;
+
+// Cânticos do primeiro livro.
+@property (readonly, nonatomic) int numeroDeCanticos;
+
+// Livros do catálogo, pela ordem de livros.txt; o primeiro é o principal.
+@property (readonly, nonatomic) int numeroDeLivros;
+
+- (NSString *)nomeDoLivro:(int)livro;
+- (int)numeroDeCanticosDoLivro:(int)livro;
+
+// O número do cântico com o número dado no livro, 0 se o livro não o tem.
+- (int)cantico:(int)numero doLivro:(int)livro;
+
+// O contrário: o livro de um número de cântico, e o número nesse livro.
+- (int)livroDoCantico:(int)numero;
+- (int)numeroNoLivro:(int)numero;
+
+// O cântico do que se escreveu para o abrir pelo número: "12" é o 12 do
+// primeiro livro, "jovens 12" ou "jov12" o 12 do livro cuja chave, ou uma
+// palavra do nome, começa assim. 0 se não é um cântico do catálogo.
+- (int)canticoParaReferencia:(NSString *)texto;
+
+- (NSString *)textoDoCantico:(int)numero;
+- (NSString *)tituloDoCantico:(int)numero;
+
+// Estrofes do cântico, sem a linha do título, pela ordem do livro. Cada
+// uma é um NSDictionary com @"texto" e @"refrao" (NSNumber BOOL); um
+// refrão repetido aparece de novo com o mesmo texto.
+- (NSArray *)estrofesDoCantico:(int)numero;
+
+// O cântico como Cantico o mostra, pronto: @"texto" (o título, uma linha
+// em branco, e as estrofes separadas por linhas em branco), @"titulo"
+// (NSValue com o NSRange do título no texto) e @"estrofes", cada uma um
+// NSDictionary com @"intervalo" (NSValue com NSRange) e @"refrao" (NSNumber
+// BOOL). Vem de uma cache dos cânticos já preparados; abrir um cântico
+// prepara também o anterior e o seguinte, num thread à parte. nil se o
+// livro não tem o número.
+- (NSDictionary *)canticoPreparado:(int)numero;
+
+// Contadores da cache de canticoPreparado: @"acertos", @"falhas",
+// @"antecipados", @"descartados", @"canticos" e @"bytes" (NSNumber).
+- (NSDictionary *)estatisticasDaCache;
+
+// Páginas (ou ecrãs) do cântico preparado na fonte e tamanho dados, numa
+// caixa de largura por altura pontos: NSValue com o NSRange de cada página
+// no texto de canticoPreparado. O título e os refrões partem-se nas fontes
+// deles, como Cantico os mostra (nil: na do texto). As linhas partem-se
+// como o UIKit as parte, com os avanços das fontes medidos pelo CoreText,
+// e ficam numa cache por fontes, tamanho e largura; mudar o tamanho ou
+// rodar o ecrã só volta a partir as estrofes que mudam. Só para o thread
+// principal.
+- (NSArray *)paginasDoCantico:(int)numero fonte:(NSString *)fonte fonteDoTitulo:(NSString *)fonteDoTitulo
+              fonteDosRefroes:(NSString *)fonteDosRefroes tamanho:(CGFloat)tamanho
+                      largura:(CGFloat)largura altura:(CGFloat)altura;
+
+// Números dos cânticos que contêm todas as palavras do texto, ou um
+// sinónimo delas (sinonimos.csv), do mais relevante para o menos
+// relevante (NSNumber), de todos os livros. Cada livro é procurado num
+// thread à parte e os melhores de cada um juntam-se no fim.
+- (NSArray *)procuraPorTexto:(NSString *)texto;
+
+// O mesmo, num thread à parte, para procurar a cada tecla sem parar o
+// ecrã: o bloco recebe os números no thread principal. Cada pedido torna
+// velhos os anteriores; um que ainda espera já não se faz, o que está a
+// meio pára no próximo bloco de cânticos, e só o resultado do mais
+// recente chega ao bloco. Só para o thread principal.
+- (void)procuraPorTexto:(NSString *)texto depois:(void (^)(NSArray *numeros))bloco;
+
+// Torna velhas as procuras pedidas, sem pedir outra, como o cancel do
+// LSLocaytaSearchRequest.
+- (void)cancelaProcuras;
+
+// Há uma procura de procuraPorTexto:depois: por fazer ou a fazer-se.
+@property (readonly, nonatomic) BOOL procuraEmCurso;
+
+// Onde estão as palavras do texto no cântico como Cantico o mostra (o
+// título, uma linha em branco, e as estrofes separadas por linhas em
+// branco): NSValue com NSRange, pela ordem do texto. Vem do índice, sem
+// voltar a ler o cântico.
+- (NSArray *)realcesDoCantico:(int)numero paraTexto:(NSString *)texto;
+
+// O texto com as palavras que o livro não tem trocadas pela mais
+// parecida que tem ("senhor tende piedad" dá "senhor tende piedade"), ou
+// nil se não há nada a corrigir.
+- (NSString *)correccaoPara:(NSString *)texto;
+
+// O mesmo a cada tecla: a última palavra pode estar incompleta, e o
+// trabalho da tecla anterior é aproveitado. Só para o thread principal.
+- (NSArray *)procuraEnquantoEscreve:(NSString *)texto maximo:(int)maximo;
+
+// Títulos e primeiras linhas que completam o fragmento escrito, em
+// qualquer palavra ("piedade" dá "SENHOR TENDE PIEDADE"). Cada sugestão é
+// um NSDictionary com @"numero" e @"texto"; com vários livros, vem uma de
+// cada livro à vez.
+- (NSArray *)sugestoesPara:(NSString *)fragmento maximo:(int)maximo;
+
+@end
@@ -0,0 +1,597 @@
+//
+//  Livro.mm
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+
+#import "Livro.h"
+
+#import <CoreText/CoreText.h>
+
+#include "Catalog.h"
+#include "Corpus.h"
+#include "HymnCache.h"
+#include "Layout.h"
+#include "SearchExecutor.h"
+#include "SearchIndex.h"
+#include "ShardedSearch.h"
+#include "SpellIndex.h"
+#include "Thesaurus.h"
+#include "TitleTrie.h"
+#include "Tokenizer.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+#include <map>
+#include <memory>
+
+#if CANTICOS_TRACE
+#import <UIKit/UIKit.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+// Um livro do catálogo, com tudo o que dele se mapeia.
+struct Volume {
+    canticos::Corpus corpus;
+    canticos::SearchIndex indice;
+    canticos::TitleTrie titulos;
+    canticos::SpellIndex ortografia;
+    canticos::Thesaurus sinonimos;
+    std::unique_ptr<canticos::HymnCache> preparados;
+    std::unique_ptr<canticos::LayoutCache> paginacao;
+    std::unique_ptr<canticos::Speller> corrector;
+};
+
+@implementation Livro
+{
+    std::vector<canticos::CatalogBook> catalogo;
+    std::vector<std::unique_ptr<Volume> > volumes;     // pela ordem do catálogo
+    std::map<std::string, canticos::AdvanceTable> fontes;
+    canticos::WorkerPool *trabalhadores;
+    canticos::ShardedSearch *pesquisa;
+    canticos::SearchExecutor *procuras;     // as de procuraPorTexto:depois:
+    // As de procuras com trabalhadores seus: uma procura em curso não faz
+    // esperar as de cada tecla, no thread principal.
+    canticos::WorkerPool *trabalhadoresDasProcuras;
+    canticos::ShardedSearch *pesquisaDasProcuras;
+}
+
+#if CANTICOS_TRACE
+// Do arranque do processo até o ciclo principal ficar à espera pela
+// primeira vez, já com o primeiro ecrã desenhado.
+static void primeiroEcra(CFRunLoopObserverRef observador, CFRunLoopActivity, void *)
+{
+    CFRunLoopObserverInvalidate(observador);
+    int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, getpid() };
+    struct kinfo_proc processo;
+    size_t tamanho = sizeof(processo);
+    struct timeval agora;
+    if (sysctl(mib, 4, &processo, &tamanho, NULL, 0) != 0 || gettimeofday(&agora, NULL) != 0) {
+        return;
+    }
+    struct timeval inicio = processo.kp_proc.p_starttime;
+    uint64_t decorrido = (uint64_t)(agora.tv_sec - inicio.tv_sec) * 1000000000ull
+        + (int64_t)(agora.tv_usec - inicio.tv_usec) * 1000;
+    uint64_t fim = canticos::traceNow();
+    canticos::traceRecord(canticos::kTraceLaunch, fim - decorrido, fim);
+}
+
+// As medidas ficam nos Documentos (latencias.json e, para o
+// chrome://tracing, latencias.trace.json) sempre que a app sai de cena.
+static void gravaMedidas()
+{
+    NSString *documentos = [NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES) lastObject];
+    std::string json;
+    canticos::traceJson(&json);
+    [[NSData dataWithBytes:json.data() length:json.size()]
+        writeToFile:[documentos stringByAppendingPathComponent:@"latencias.json"] atomically:YES];
+    canticos::traceChrome(&json);
+    [[NSData dataWithBytes:json.data() length:json.size()]
+        writeToFile:[documentos stringByAppendingPathComponent:@"latencias.trace.json"] atomically:YES];
+}
+
++ (void)load
+{
+    CFRunLoopObserverRef observador = CFRunLoopObserverCreate(NULL, kCFRunLoopBeforeWaiting, false, 0,
+                                                              primeiroEcra, NULL);
+    CFRunLoopAddObserver(CFRunLoopGetMain(), observador, kCFRunLoopCommonModes);
+    CFRelease(observador);
+    [[NSNotificationCenter defaultCenter] addObserverForName:UIApplicationDidEnterBackgroundNotification object:nil
+                                                       queue:nil usingBlock:^(NSNotification *) {
+        gravaMedidas();
+    }];
+}
+#endif
+
++ (Livro *)livro
+{
+    static Livro *livro = nil;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        livro = [[Livro alloc] init];
+    });
+    return livro;
+}
+
+// Cânticos preparados guardados, em bytes: umas centenas de cânticos por
+// livro; só os livros que se lêem os gastam.
+static const size_t kOrcamentoDaCache = 2 * 1024 * 1024;
+
+// Paginações guardadas, em bytes: umas poucas por cântico aberto.
+static const size_t kOrcamentoDaPaginacao = 512 * 1024;
+
+// Abre KEY.extensao do bundle, ou diz porque não.
+template <class Artefacto>
+static void abre(Artefacto *artefacto, const std::string &chave, NSString *extensao)
+{
+    NSString *path = [[NSBundle mainBundle] pathForResource:@(chave.c_str()) ofType:extensao];
+    std::string error;
+    if (path == nil) {
+        NSLog(@"%s.%@ nao encontrado", chave.c_str(), extensao);
+    } else if (!artefacto->open([path fileSystemRepresentation], &error)) {
+        NSLog(@"%s.%@: %s", chave.c_str(), extensao, error.c_str());
+    }
+}
+
+- (id)init
+{
+    self = [super init];
+    if (self) {
+        std::string error;
+        if (!canticos::loadCatalog([[[NSBundle mainBundle] resourcePath] fileSystemRepresentation], &catalogo,
+                                   &error)) {
+            NSLog(@"livros.txt: %s", error.c_str());
+            canticos::CatalogBook livro = { canticos::kMainBookKey, canticos::kMainBookKey };
+            catalogo.assign(1, livro);
+        }
+        // Uma procura espera pelo livro mais lento, não pela soma de todos.
+        trabalhadores = new canticos::WorkerPool(catalogo.size() > 1 ? canticos::WorkerPool::defaultThreads() : 0);
+        pesquisa = new canticos::ShardedSearch(trabalhadores);
+        procuras = new canticos::SearchExecutor();
+        trabalhadoresDasProcuras =
+            new canticos::WorkerPool(catalogo.size() > 1 ? canticos::WorkerPool::defaultThreads() : 0);
+        pesquisaDasProcuras = new canticos::ShardedSearch(trabalhadoresDasProcuras);
+        for (size_t l = 0; l < catalogo.size(); l++) {
+            Volume *v = new Volume;
+            volumes.push_back(std::unique_ptr<Volume>(v));
+            const std::string &chave = catalogo[l].key;
+            abre(&v->corpus, chave, @"corpus");
+            abre(&v->indice, chave, @"index");
+            abre(&v->ortografia, chave, @"spell");
+            abre(&v->sinonimos, chave, @"thesaurus");
+            abre(&v->titulos, chave, @"trie");
+            v->preparados.reset(new canticos::HymnCache(v->corpus, kOrcamentoDaCache));
+            v->paginacao.reset(new canticos::LayoutCache(kOrcamentoDaPaginacao));
+            v->corrector.reset(new canticos::Speller(v->indice, v->ortografia));
+            pesquisa->addShard(&v->indice, &v->sinonimos);
+            pesquisaDasProcuras->addShard(&v->indice, &v->sinonimos);
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    delete procuras;
+    delete pesquisaDasProcuras;
+    delete trabalhadoresDasProcuras;
+    delete pesquisa;
+    delete trabalhadores;
+}
+
+- (int)numeroDeCanticos
+{
+    return (int)volumes[0]->corpus.count();
+}
+
+- (int)numeroDeLivros
+{
+    return (int)volumes.size();
+}
+
+- (NSString *)nomeDoLivro:(int)livro
+{
+    if (livro < 0 || livro >= (int)volumes.size()) {
+        return nil;
+    }
+    const std::string &nome = catalogo[livro].name;
+    return [[NSString alloc] initWithBytes:nome.data() length:nome.size() encoding:NSUTF8StringEncoding];
+}
+
+- (int)numeroDeCanticosDoLivro:(int)livro
+{
+    return livro >= 0 && livro < (int)volumes.size() ? (int)volumes[livro]->corpus.count() : 0;
+}
+
+- (int)cantico:(int)numero doLivro:(int)livro
+{
+    if (livro < 0 || livro >= (int)volumes.size() || !volumes[livro]->corpus.contains(numero)) {
+        return 0;
+    }
+    canticos::HymnRef referencia = { (uint32_t)livro, (uint32_t)numero };
+    return (int)canticos::packHymnRef(referencia);
+}
+
+- (int)livroDoCantico:(int)numero
+{
+    return (int)canticos::unpackHymnRef((uint32_t)numero).book;
+}
+
+- (int)numeroNoLivro:(int)numero
+{
+    return (int)canticos::unpackHymnRef((uint32_t)numero).number;
+}
+
+- (int)canticoParaReferencia:(NSString *)texto
+{
+    const char *utf8 = [texto UTF8String];
+    canticos::HymnRef referencia;
+    if (utf8 == NULL || !canticos::parseHymnReference(canticos::Slice(utf8), catalogo, &referencia)) {
+        return 0;
+    }
+    return [self cantico:(int)referencia.number doLivro:(int)referencia.book];
+}
+
+// O livro de um número de cântico, e o número do cântico nele; NULL se o
+// catálogo não tem o livro.
+- (Volume *)volumeDoCantico:(int)numero numero:(uint32_t *)noLivro
+{
+    canticos::HymnRef referencia = canticos::unpackHymnRef((uint32_t)numero);
+    if (numero < 0 || referencia.book >= volumes.size()) {
+        *noLivro = 0;
+        return NULL;
+    }
+    *noLivro = referencia.number;
+    return volumes[referencia.book].get();
+}
+
+// O número de cântico de um número do livro.
+static NSNumber *numeroDoCantico(size_t livro, uint32_t numero)
+{
+    canticos::HymnRef referencia = { (uint32_t)livro, numero };
+    return [NSNumber numberWithUnsignedInt:canticos::packHymnRef(referencia)];
+}
+
+// O mapeamento vive tanto quanto o Livro partilhado, por isso as strings
+// podem apontar directamente para ele sem copiar.
+static NSString *stringFromSlice(canticos::Slice s)
+{
+    return [[NSString alloc] initWithBytesNoCopy:(void *)s.data
+                                          length:s.size
+                                        encoding:NSUTF8StringEncoding
+                                    freeWhenDone:NO];
+}
+
+- (NSString *)textoDoCantico:(int)numero
+{
+    uint32_t n;
+    Volume *v = [self volumeDoCantico:numero numero:&n];
+    return v ? stringFromSlice(v->corpus.body(n)) : stringFromSlice(canticos::Slice());
+}
+
+- (NSString *)tituloDoCantico:(int)numero
+{
+    uint32_t n;
+    Volume *v = [self volumeDoCantico:numero numero:&n];
+    return v ? stringFromSlice(v->corpus.title(n)) : stringFromSlice(canticos::Slice());
+}
+
+- (NSArray *)estrofesDoCantico:(int)numero
+{
+    uint32_t noLivro;
+    Volume *v = [self volumeDoCantico:numero numero:&noLivro];
+    uint32_t n = v ? v->corpus.stanzaCount(noLivro) : 0;
+    NSMutableArray *estrofes = [NSMutableArray arrayWithCapacity:n];
+    for (uint32_t i = 0; i < n; i++) {
+        canticos::Stanza estrofe = v->corpus.stanza(noLivro, i);
+        [estrofes addObject:@{ @"texto": stringFromSlice(estrofe.text),
+                               @"refrao": [NSNumber numberWithBool:estrofe.refrain] }];
+    }
+    return estrofes;
+}
+
+- (NSDictionary *)canticoPreparado:(int)numero
+{
+    CANTICOS_TRACE_SCOPE(medida, canticos::kTraceHymnOpen);
+    CANTICOS_TRACE_ARG(medida, numero);
+    uint32_t n;
+    Volume *v = [self volumeDoCantico:numero numero:&n];
+    canticos::HymnCache::Hymn cantico = v ? v->preparados->open(n) : canticos::HymnCache::Hymn();
+    if (!cantico) {
+        return nil;
+    }
+    // A cache pode largar o cântico a seguir, por isso o texto é copiado.
+    NSString *texto = [[NSString alloc] initWithCharacters:cantico->text.data() length:cantico->text.size()];
+    NSMutableArray *estrofes = [NSMutableArray arrayWithCapacity:cantico->stanzas.size()];
+    for (size_t i = 0; i < cantico->stanzas.size(); i++) {
+        const canticos::PreparedStanza &estrofe = cantico->stanzas[i];
+        NSRange intervalo = NSMakeRange(estrofe.utf16Offset, estrofe.utf16Size);
+        [estrofes addObject:@{ @"intervalo": [NSValue valueWithRange:intervalo],
+                               @"refrao": [NSNumber numberWithBool:estrofe.refrain] }];
+    }
+    return @{ @"texto": texto,
+              @"titulo": [NSValue valueWithRange:NSMakeRange(0, cantico->titleUtf16Size)],
+              @"estrofes": estrofes };
+}
+
+- (NSDictionary *)estatisticasDaCache
+{
+    // Os de todos os livros somados.
+    canticos::HymnCacheStats contadores = volumes[0]->preparados->stats();
+    for (size_t l = 1; l < volumes.size(); l++) {
+        canticos::HymnCacheStats doLivro = volumes[l]->preparados->stats();
+        contadores.hits += doLivro.hits;
+        contadores.misses += doLivro.misses;
+        contadores.prefetched += doLivro.prefetched;
+        contadores.evicted += doLivro.evicted;
+        contadores.hymns += doLivro.hymns;
+        contadores.bytes += doLivro.bytes;
+    }
+    return @{ @"acertos": [NSNumber numberWithUnsignedLongLong:contadores.hits],
+              @"falhas": [NSNumber numberWithUnsignedLongLong:contadores.misses],
+              @"antecipados": [NSNumber numberWithUnsignedLongLong:contadores.prefetched],
+              @"descartados": [NSNumber numberWithUnsignedLongLong:contadores.evicted],
+              @"canticos": [NSNumber numberWithUnsignedInt:contadores.hymns],
+              @"bytes": [NSNumber numberWithUnsignedLong:contadores.bytes] };
+}
+
+// Os avanços de uma fonte como o CoreText os mede, em unidades da fonte,
+// medidos na primeira vez que é pedida. NULL se o CoreText não a dá.
+- (const canticos::AdvanceTable *)avancosDaFonte:(NSString *)nome
+{
+    const char *utf8 = [nome UTF8String];
+    if (utf8 == NULL) {
+        return NULL;
+    }
+    std::map<std::string, canticos::AdvanceTable>::iterator it = fontes.find(utf8);
+    if (it != fontes.end()) {
+        return it->second.unitsPerEm ? &it->second : NULL;
+    }
+    canticos::AdvanceTable &tabela = fontes[utf8];
+    CTFontRef fonte = CTFontCreateWithName((__bridge CFStringRef)nome, 12, NULL);
+    if (fonte == NULL) {
+        return NULL;
+    }
+    // No tamanho de um em, as medidas vêm em unidades da fonte.
+    unsigned unidades = CTFontGetUnitsPerEm(fonte);
+    CTFontRef emUnidades = CTFontCreateCopyWithAttributes(fonte, unidades, NULL, NULL);
+    CFRelease(fonte);
+    if (emUnidades == NULL) {
+        return NULL;
+    }
+    tabela.font = utf8;
+    tabela.ascent = (uint32_t)lround(CTFontGetAscent(emUnidades));
+    tabela.descent = (uint32_t)lround(CTFontGetDescent(emUnidades));
+    tabela.leading = (uint32_t)lround(CTFontGetLeading(emUnidades));
+    CGGlyph notdef = 0;
+    CGSize avanco;
+    CTFontGetAdvancesForGlyphs(emUnidades, kCTFontHorizontalOrientation, &notdef, &avanco, 1);
+    tabela.defaultAdvance = (uint32_t)MAX(1, lround(avanco.width));
+    for (size_t r = 0; r < sizeof(canticos::kAdvanceRanges) / sizeof(canticos::kAdvanceRanges[0]); r++) {
+        const canticos::AdvanceRange &intervalo = canticos::kAdvanceRanges[r];
+        CFIndex n = intervalo.last - intervalo.first + 1;
+        std::vector<UniChar> letras(n);
+        std::vector<CGGlyph> glifos(n);
+        std::vector<CGSize> avancos(n);
+        for (CFIndex i = 0; i < n; i++) {
+            letras[i] = (UniChar)(intervalo.first + i);
+        }
+        CTFontGetGlyphsForCharacters(emUnidades, letras.data(), glifos.data(), n);
+        CTFontGetAdvancesForGlyphs(emUnidades, kCTFontHorizontalOrientation, glifos.data(), avancos.data(), n);
+        tabela.advances.resize(intervalo.last + 1, 0);
+        for (CFIndex i = 0; i < n; i++) {
+            if (glifos[i] != 0) {
+                tabela.advances[intervalo.first + i] = (uint16_t)MIN(0xFFFF, lround(avancos[i].width));
+            }
+        }
+    }
+    CFRelease(emUnidades);
+    tabela.unitsPerEm = unidades;
+    return &tabela;
+}
+
+- (NSArray *)paginasDoCantico:(int)numero fonte:(NSString *)fonte fonteDoTitulo:(NSString *)fonteDoTitulo
+              fonteDosRefroes:(NSString *)fonteDosRefroes tamanho:(CGFloat)tamanho
+                      largura:(CGFloat)largura altura:(CGFloat)altura
+{
+    uint32_t n;
+    Volume *v = [self volumeDoCantico:numero numero:&n];
+    canticos::HymnCache::Hymn cantico = v ? v->preparados->open(n) : canticos::HymnCache::Hymn();
+    // Uma fonte que o CoreText não dá fica NULL, e parte-se na do texto.
+    canticos::LayoutFaces fontes = { [self avancosDaFonte:fonte],
+                                     fonteDoTitulo ? [self avancosDaFonte:fonteDoTitulo] : NULL,
+                                     fonteDosRefroes ? [self avancosDaFonte:fonteDosRefroes] : NULL };
+    if (!cantico || fontes.text == NULL) {
+        return [NSArray array];
+    }
+    canticos::LayoutParams caixa = { (float)tamanho, (float)largura, (float)altura };
+    canticos::LayoutCache::Layout paginacaoDoCantico = v->paginacao->layout(*cantico, fontes, caixa);
+
+    const canticos::HymnLayout &p = *paginacaoDoCantico;
+    NSMutableArray *paginas = [NSMutableArray arrayWithCapacity:p.pages.size()];
+    for (size_t i = 0; i < p.pages.size(); i++) {
+        NSUInteger inicio = p.lineStarts[p.blocks[p.pages[i].block].firstLine + p.pages[i].line];
+        NSUInteger fim = cantico->text.size();
+        if (i + 1 < p.pages.size()) {
+            fim = p.lineStarts[p.blocks[p.pages[i + 1].block].firstLine + p.pages[i + 1].line];
+        }
+        [paginas addObject:[NSValue valueWithRange:NSMakeRange(inicio, fim - inicio)]];
+    }
+    return paginas;
+}
+
+static NSArray *numerosDosCanticos(const std::vector<canticos::ShardHit> &hits)
+{
+    NSMutableArray *numeros = [NSMutableArray arrayWithCapacity:hits.size()];
+    for (size_t i = 0; i < hits.size(); i++) {
+        [numeros addObject:numeroDoCantico(hits[i].shard, hits[i].number)];
+    }
+    return numeros;
+}
+
+// Com radicais, "cantemos" encontra também "cantai" e "cantar"; com os
+// sinónimos, "piedade" encontra também "misericórdia", mas mais abaixo;
+// cada livro com os seus.
+static canticos::SearchOptions opcoesDaProcura(const canticos::Thesaurus *sinonimos)
+{
+    canticos::SearchOptions opcoes;
+    opcoes.stemming = true;
+    opcoes.thesaurus = sinonimos;
+    return opcoes;
+}
+
+- (NSArray *)procuraPorTexto:(NSString *)texto
+{
+    const char *utf8 = [texto UTF8String];
+    if (utf8 == NULL) {
+        return [NSArray array];
+    }
+    CANTICOS_TRACE_SCOPE(medida, canticos::kTraceQuery);
+    std::vector<canticos::ShardHit> hits;
+    pesquisa->search(canticos::Slice(utf8), opcoesDaProcura(&volumes[0]->sinonimos), &hits);
+    CANTICOS_TRACE_ARG(medida, hits.size());
+    return numerosDosCanticos(hits);
+}
+
+- (void)procuraPorTexto:(NSString *)texto depois:(void (^)(NSArray *numeros))bloco
+{
+    const char *utf8 = [texto UTF8String];
+    std::string consulta = utf8 ? utf8 : "";
+    canticos::SearchOptions opcoes = opcoesDaProcura(&volumes[0]->sinonimos);
+    canticos::ShardedSearch *p = pesquisaDasProcuras;
+    canticos::SearchExecutor *e = procuras;
+    void (^copia)(NSArray *) = [bloco copy];
+    std::shared_ptr<std::vector<canticos::ShardHit> > hits = std::make_shared<std::vector<canticos::ShardHit> >();
+    procuras->submit([p, consulta, opcoes, hits](const canticos::SearchGeneration &geracao) {
+        // Uma tecla nova torna esta procura velha, e ela pára no próximo
+        // bloco de cânticos que lê.
+        canticos::SearchOptions comGeracao = opcoes;
+        comGeracao.generation = geracao;
+        p->search(canticos::Slice(consulta), comGeracao, hits.get());
+    }, [e, hits, copia](uint64_t geracao) {
+        // Pode ter chegado outra entretanto: no thread principal, onde as
+        // procuras se pedem, vê-se outra vez se ainda é a mais recente.
+        dispatch_async(dispatch_get_main_queue(), ^{
+            if (e->isLatest(geracao)) {
+                copia(numerosDosCanticos(*hits));
+            }
+        });
+    });
+}
+
+- (void)cancelaProcuras
+{
+    procuras->cancel();
+}
+
+- (BOOL)procuraEmCurso
+{
+    return procuras->searchRequestInProgress();
+}
+
+- (NSArray *)realcesDoCantico:(int)numero paraTexto:(NSString *)texto
+{
+    const char *utf8 = [texto UTF8String];
+    uint32_t noLivro;
+    Volume *v = [self volumeDoCantico:numero numero:&noLivro];
+    if (utf8 == NULL || v == NULL || !v->corpus.contains(noLivro)) {
+        return [NSArray array];
+    }
+    static const size_t kMaximo = 256;
+    canticos::TextRange intervalos[kMaximo];
+    NSMutableArray *realces = [NSMutableArray array];
+
+    size_t n = v->indice.highlight(canticos::Slice(utf8), noLivro, canticos::kHighlightTitle, intervalos, kMaximo,
+                                   true, &v->sinonimos);
+    for (size_t i = 0; i < n; i++) {
+        [realces addObject:[NSValue valueWithRange:NSMakeRange(intervalos[i].location, intervalos[i].length)]];
+    }
+
+    // Os intervalos do corpo contam-se no cN.txt; cada estrofe sabe onde
+    // começa nele, e no texto mostrado vem depois do título e de "\n\n".
+    // Um refrão repetido realça-se em todas as vezes que aparece.
+    n = v->indice.highlight(canticos::Slice(utf8), noLivro, canticos::kHighlightBody, intervalos, kMaximo, true,
+                            &v->sinonimos);
+    NSUInteger inicio = canticos::utf16Length(v->corpus.title(noLivro));
+    for (uint32_t e = 0; e < v->corpus.stanzaCount(noLivro); e++) {
+        canticos::Stanza estrofe = v->corpus.stanza(noLivro, e);
+        inicio += 2;
+        for (size_t i = 0; i < n; i++) {
+            if (intervalos[i].location >= estrofe.utf16Offset
+                && intervalos[i].location + intervalos[i].length <= estrofe.utf16Offset + estrofe.utf16Size) {
+                NSRange r = NSMakeRange(inicio + intervalos[i].location - estrofe.utf16Offset, intervalos[i].length);
+                [realces addObject:[NSValue valueWithRange:r]];
+            }
+        }
+        inicio += estrofe.utf16Size;
+    }
+    return realces;
+}
+
+- (NSString *)correccaoPara:(NSString *)texto
+{
+    const char *utf8 = [texto UTF8String];
+    if (utf8 == NULL) {
+        return nil;
+    }
+    // A correcção do primeiro livro que tem uma: só se corrige o que não
+    // se encontrou em livro nenhum.
+    std::string corrigido;
+    size_t l = 0;
+    while (l < volumes.size() && !volumes[l]->corrector->suggestQuery(canticos::Slice(utf8), &corrigido)) {
+        l++;
+    }
+    if (l == volumes.size()) {
+        return nil;
+    }
+    return [[NSString alloc] initWithBytes:corrigido.data() length:corrigido.size() encoding:NSUTF8StringEncoding];
+}
+
+- (NSArray *)procuraEnquantoEscreve:(NSString *)texto maximo:(int)maximo
+{
+    const char *utf8 = [texto UTF8String];
+    if (utf8 == NULL || maximo <= 0) {
+        return [NSArray array];
+    }
+    CANTICOS_TRACE_SCOPE(medida, canticos::kTraceTypeSearch);
+    std::vector<canticos::ShardHit> hits;
+    pesquisa->update(canticos::Slice(utf8), maximo, &hits);
+    CANTICOS_TRACE_ARG(medida, hits.size());
+
+    NSMutableArray *numeros = [NSMutableArray arrayWithCapacity:hits.size()];
+    for (size_t i = 0; i < hits.size(); i++) {
+        [numeros addObject:numeroDoCantico(hits[i].shard, hits[i].number)];
+    }
+    return numeros;
+}
+
+- (NSArray *)sugestoesPara:(NSString *)fragmento maximo:(int)maximo
+{
+    const char *utf8 = [fragmento UTF8String];
+    if (utf8 == NULL || maximo <= 0) {
+        return [NSArray array];
+    }
+    CANTICOS_TRACE_SCOPE(medida, canticos::kTraceSuggest);
+    // As de cada livro, pela ordem dele, e depois uma de cada à vez.
+    std::vector<std::vector<canticos::Suggestion> > porLivro(volumes.size());
+    for (size_t l = 0; l < volumes.size(); l++) {
+        porLivro[l].resize(canticos::TitleTrie::kMaxSuggestions);
+        porLivro[l].resize(volumes[l]->titulos.suggest(canticos::Slice(utf8), porLivro[l].data(), maximo));
+    }
+    NSMutableArray *resultado = [NSMutableArray arrayWithCapacity:maximo];
+    for (size_t i = 0; i < canticos::TitleTrie::kMaxSuggestions && (int)resultado.count < maximo; i++) {
+        for (size_t l = 0; l < volumes.size() && (int)resultado.count < maximo; l++) {
+            if (i < porLivro[l].size()) {
+                [resultado addObject:@{ @"numero": numeroDoCantico(l, porLivro[l][i].number),
+                                        @"texto": stringFromSlice(porLivro[l][i].text) }];
+            }
+        }
+    }
+    CANTICOS_TRACE_ARG(medida, resultado.count);
+    return resultado;
+}
+
+@end
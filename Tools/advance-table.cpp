@@ -0,0 +1,210 @@
+//
+//  advance-table.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Records the advance table of a TrueType or OpenType font file, in the
+//  format of Layout.h, for the code points of kAdvanceRanges.
+//
+//      advance-table FONT_FILE [FONT_INDEX] > NAME.txt
+//
+//  FONT_INDEX picks a font of a collection (.ttc), 0 by default. The
+//  metrics are those CoreText reports: unitsPerEm from head, ascent,
+//  descent and leading from hhea, advances from hmtx through the Unicode
+//  cmap. Code points without a glyph are left out and take the advance of
+//  .notdef, recorded as the default.
+//
+//  On a Mac, "/Library/Fonts/Arial Bold.ttf" gives Arial-BoldMT; on Linux,
+//  the DejaVu fonts give the tables in Bench/advances.
+//
+
+#include "Layout.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace canticos;
+
+// Big endian reads that give 0 past the end of the file; the checks below
+// catch a table that is not there.
+class FontFile {
+public:
+    explicit FontFile(const std::string &bytes) : _bytes(bytes) {}
+
+    uint32_t u8(size_t at) const { return at < _bytes.size() ? (uint8_t)_bytes[at] : 0; }
+    uint32_t u16(size_t at) const { return u8(at) << 8 | u8(at + 1); }
+    uint32_t u32(size_t at) const { return u16(at) << 16 | u16(at + 2); }
+    int32_t s16(size_t at) const { return (int16_t)u16(at); }
+    size_t size() const { return _bytes.size(); }
+
+private:
+    const std::string &_bytes;
+};
+
+static bool findTable(const FontFile &f, size_t font, const char *tag, size_t *offset, size_t *length)
+{
+    uint32_t numTables = f.u16(font + 4);
+    for (uint32_t i = 0; i < numTables; i++) {
+        size_t record = font + 12 + i * 16;
+        if (f.u8(record) == (uint8_t)tag[0] && f.u8(record + 1) == (uint8_t)tag[1]
+            && f.u8(record + 2) == (uint8_t)tag[2] && f.u8(record + 3) == (uint8_t)tag[3]) {
+            *offset = f.u32(record + 8);
+            *length = f.u32(record + 12);
+            return *offset + *length <= f.size();
+        }
+    }
+    return false;
+}
+
+// Glyph of a code point in a cmap subtable of format 4 or 12; 0 if none.
+static uint32_t glyphOf(const FontFile &f, size_t sub, uint32_t cp)
+{
+    uint32_t format = f.u16(sub);
+    if (format == 12) {
+        uint32_t groups = f.u32(sub + 12);
+        for (uint32_t g = 0; g < groups; g++) {
+            size_t group = sub + 16 + g * 12;
+            if (cp >= f.u32(group) && cp <= f.u32(group + 4)) {
+                return f.u32(group + 8) + cp - f.u32(group);
+            }
+        }
+        return 0;
+    }
+    if (format != 4 || cp > 0xFFFF) {
+        return 0;
+    }
+    uint32_t segCount = f.u16(sub + 6) / 2;
+    size_t ends = sub + 14;
+    size_t starts = ends + segCount * 2 + 2;
+    size_t deltas = starts + segCount * 2;
+    size_t rangeOffsets = deltas + segCount * 2;
+    for (uint32_t s = 0; s < segCount; s++) {
+        if (cp > f.u16(ends + s * 2)) {
+            continue;
+        }
+        uint32_t start = f.u16(starts + s * 2);
+        if (cp < start) {
+            return 0;
+        }
+        uint32_t delta = f.u16(deltas + s * 2);
+        uint32_t rangeOffset = f.u16(rangeOffsets + s * 2);
+        if (rangeOffset == 0) {
+            return (cp + delta) & 0xFFFF;
+        }
+        uint32_t glyph = f.u16(rangeOffsets + s * 2 + rangeOffset + (cp - start) * 2);
+        return glyph ? (glyph + delta) & 0xFFFF : 0;
+    }
+    return 0;
+}
+
+static std::string postScriptName(const FontFile &f, size_t name)
+{
+    uint32_t count = f.u16(name + 2);
+    size_t strings = name + f.u16(name + 4);
+    for (uint32_t i = 0; i < count; i++) {
+        size_t record = name + 6 + i * 12;
+        if (f.u16(record + 6) != 6) {
+            continue;
+        }
+        uint32_t platform = f.u16(record);
+        uint32_t length = f.u16(record + 8);
+        size_t at = strings + f.u16(record + 10);
+        std::string result;
+        for (uint32_t c = 0; c < length; c += platform == 1 ? 1 : 2) {
+            result.push_back((char)(platform == 1 ? f.u8(at + c) : f.u16(at + c)));
+        }
+        return result;
+    }
+    return "";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: advance-table FONT_FILE [FONT_INDEX]\n");
+        return 2;
+    }
+    std::string bytes;
+    std::string error;
+    if (!readWholeFile(argv[1], &bytes, &error)) {
+        fprintf(stderr, "advance-table: %s\n", error.c_str());
+        return 1;
+    }
+    FontFile f(bytes);
+    size_t font = 0;
+    if (bytes.compare(0, 4, "ttcf") == 0) {
+        uint32_t index = argc == 3 ? (uint32_t)atoi(argv[2]) : 0;
+        if (index >= f.u32(8)) {
+            fprintf(stderr, "advance-table: the collection has %u fonts\n", f.u32(8));
+            return 1;
+        }
+        font = f.u32(12 + index * 4);
+    }
+
+    size_t head, hhea, hmtx, cmap, name, length;
+    if (!findTable(f, font, "head", &head, &length) || !findTable(f, font, "hhea", &hhea, &length)
+        || !findTable(f, font, "hmtx", &hmtx, &length) || !findTable(f, font, "cmap", &cmap, &length)) {
+        fprintf(stderr, "advance-table: %s is not a TrueType or OpenType font\n", argv[1]);
+        return 1;
+    }
+    // The full repertoire subtable if there is one, else the BMP one.
+    size_t sub = 0;
+    uint32_t subScore = 0;
+    for (uint32_t i = 0; i < f.u16(cmap + 2); i++) {
+        size_t record = cmap + 4 + i * 8;
+        uint32_t platform = f.u16(record);
+        uint32_t encoding = f.u16(record + 2);
+        uint32_t format = f.u16(cmap + f.u32(record + 4));
+        uint32_t score = format == 12 ? 2 : format == 4 ? 1 : 0;
+        if ((platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10))) && score > subScore) {
+            sub = cmap + f.u32(record + 4);
+            subScore = score;
+        }
+    }
+    if (subScore == 0) {
+        fprintf(stderr, "advance-table: %s has no Unicode cmap\n", argv[1]);
+        return 1;
+    }
+
+    AdvanceTable table;
+    table.font = findTable(f, font, "name", &name, &length) ? postScriptName(f, name) : "";
+    table.unitsPerEm = f.u16(head + 18);
+    table.ascent = (uint32_t)std::max(0, f.s16(hhea + 4));
+    table.descent = (uint32_t)std::max(0, -f.s16(hhea + 6));
+    table.leading = (uint32_t)std::max(0, f.s16(hhea + 8));
+    uint32_t metrics = f.u16(hhea + 34);
+    if (metrics == 0) {
+        fprintf(stderr, "advance-table: %s has no horizontal metrics\n", argv[1]);
+        return 1;
+    }
+    // Glyphs past the last metric share its advance.
+    table.defaultAdvance = f.u16(hmtx);
+    for (size_t r = 0; r < sizeof(kAdvanceRanges) / sizeof(kAdvanceRanges[0]); r++) {
+        for (uint32_t cp = kAdvanceRanges[r].first; cp <= kAdvanceRanges[r].last; cp++) {
+            uint32_t glyph = glyphOf(f, sub, cp);
+            if (glyph == 0) {
+                continue;
+            }
+            uint32_t advance = f.u16(hmtx + std::min(glyph, metrics - 1) * 4);
+            if (advance) {
+                if (table.advances.size() <= cp) {
+                    table.advances.resize(cp + 1, 0);
+                }
+                table.advances[cp] = (uint16_t)advance;
+            }
+        }
+    }
+
+    std::string out = "# advance-table " + std::string(strrchr(argv[1], '/') ? strrchr(argv[1], '/') + 1 : argv[1])
+        + "\n";
+    std::string body;
+    writeAdvanceTable(table, &body);
+    out += body;
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
@@ -0,0 +1,822 @@
+//
+//  canticos-build.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Offline builder for the artifacts the app maps at runtime.
+//
+//      canticos-build [-j JOBS] [--blocks] SOURCE_DIR OUTPUT_DIR
+//      canticos-build --verify SOURCE_DIR OUTPUT_DIR
+//
+//  SOURCE_DIR holds indice.txt and c1.txt ... cN.txt, and sinonimos.csv if
+//  the search has synonyms. With a livros.txt (see Catalog.h) it is the
+//  main book of a catalog, and every other book is in a subdirectory named
+//  by its key; each book's artifacts are named after its key, and
+//  livros.txt is copied beside them. The index is built by JOBS threads (default:
+//  one per core). With --blocks the hymn texts are also written compressed
+//  (HymnBlocks.h); the app does not read them yet, so they are left out of
+//  its bundle. Every artifact carries its format version, and the same
+//  source gives the same bytes whatever the number of jobs. --verify reopens
+//  the artifacts in OUTPUT_DIR, the blocks when there are any, checks them
+//  against the loose files, and checks that a build with one job reproduces
+//  them byte for byte.
+//
+
+#include "Catalog.h"
+#include "Corpus.h"
+#include "HymnBlocks.h"
+#include "IndexMerge.h"
+#include "MappedFile.h"
+#include "SearchIndex.h"
+#include "SourceBook.h"
+#include "SpellIndex.h"
+#include "Stemmer.h"
+#include "Thesaurus.h"
+#include "TitleTable.h"
+#include "TitleTrie.h"
+#include "Tokenizer.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: canticos-build [-j JOBS] [--blocks] [--verify] SOURCE_DIR OUTPUT_DIR\n");
+    return 2;
+}
+
+// The artifacts, in the order they are written and reported.
+enum ArtifactKind {
+    kBlocksArtifact,
+    kCorpusArtifact,
+    kIndexArtifact,
+    kSpellArtifact,
+    kThesaurusArtifact,
+    kTitlesArtifact,
+    kTrieArtifact,
+    kArtifactCount
+};
+
+struct Artifact {
+    std::string name;
+    uint32_t version;
+    std::string bytes;
+    double seconds;
+    std::string phases;     // how the seconds went, for the index
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// On a pool of the jobs, the caller among them. The bytes do not depend
+// on the number of jobs.
+static void buildIndex(const SourceBook *book, unsigned jobs, Artifact *index)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    WorkerPool pool(jobs - 1);
+    IndexBuildTimes times;
+    canticos::buildIndex(book->count(), [book](uint32_t number, Slice *title, Slice *body) {
+        *title = Slice(book->titles[number - 1]);
+        *body = Slice(book->bodies[number - 1]);
+    }, &pool, &index->bytes, &times);
+    index->seconds = secondsSince(start);
+    char phases[128];
+    snprintf(phases, sizeof(phases), " (tokenize %.2f s, merge %.2f s, write %.2f s)", times.tokenize, times.merge,
+             times.write);
+    index->phases = phases;
+}
+
+static void buildCorpus(const SourceBook *book, Artifact *corpus, Artifact *titles, Artifact *blocks)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    packCorpus(*book, &corpus->bytes);
+    corpus->seconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    buildTitleTable(*book, &titles->bytes);
+    titles->seconds = secondsSince(start);
+
+    if (blocks) {
+        start = std::chrono::steady_clock::now();
+        buildHymnBlocks(*book, &blocks->bytes);
+        blocks->seconds = secondsSince(start);
+    }
+}
+
+static void buildTrie(const SourceBook *book, Artifact *trie)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TitleTrieBuilder builder;
+    for (uint32_t n = 1; n <= book->count(); n++) {
+        builder.addHymn(n, titleWithoutNumber(Slice(book->titles[n - 1])), firstLyricLine(Slice(book->bodies[n - 1])));
+    }
+    builder.serialize(&trie->bytes);
+    trie->seconds = secondsSince(start);
+}
+
+// Every artifact of the book, in memory, named after its catalog key; the
+// blocks are left unnamed unless asked for. The corpus with the title
+// table and the blocks, and the trie, are built on threads of their own
+// while the index takes the jobs; the spelling file and the thesaurus
+// follow from the index.
+static bool buildArtifacts(const SourceBook &book, const std::string &key, unsigned jobs, bool blocks,
+                           Artifact *artifacts, std::string *error)
+{
+    static const char *const kExtensions[kArtifactCount] = {
+        ".blocks", ".corpus", ".index", ".spell", ".thesaurus", ".titles", ".trie"
+    };
+    static const uint32_t kVersions[kArtifactCount] = {
+        kHymnBlocksVersion, kCorpusVersion, kIndexVersion, kSpellVersion, kThesaurusVersion, kTitleTableVersion, kTrieVersion
+    };
+    for (size_t a = 0; a < kArtifactCount; a++) {
+        artifacts[a].name = a != kBlocksArtifact || blocks ? key + kExtensions[a] : std::string();
+        artifacts[a].version = kVersions[a];
+        artifacts[a].bytes.clear();
+        artifacts[a].seconds = 0;
+        artifacts[a].phases.clear();
+    }
+    std::vector<SynonymLine> synonyms;
+    if (!parseSynonyms(Slice(book.synonyms), &synonyms, error)) {
+        *error = "sinonimos.csv: " + *error;
+        return false;
+    }
+
+    std::thread corpus(buildCorpus, &book, &artifacts[kCorpusArtifact], &artifacts[kTitlesArtifact],
+                       blocks ? &artifacts[kBlocksArtifact] : NULL);
+    std::thread trie(buildTrie, &book, &artifacts[kTrieArtifact]);
+    buildIndex(&book, jobs, &artifacts[kIndexArtifact]);
+    SearchIndex index;
+    bool ok = index.openMemory(artifacts[kIndexArtifact].bytes.data(), artifacts[kIndexArtifact].bytes.size(), error);
+    if (ok) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        buildSpellIndex(index, &artifacts[kSpellArtifact].bytes);
+        artifacts[kSpellArtifact].seconds = secondsSince(start);
+
+        // Written even without sinonimos.csv, so the app always finds one.
+        start = std::chrono::steady_clock::now();
+        buildThesaurus(index, synonyms, &artifacts[kThesaurusArtifact].bytes);
+        artifacts[kThesaurusArtifact].seconds = secondsSince(start);
+    }
+    corpus.join();
+    trie.join();
+    return ok;
+}
+
+static int buildBook(const SourceBook &book, const std::string &key, const std::string &outDir, unsigned jobs,
+                     bool blocks)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string error;
+    Artifact artifacts[kArtifactCount];
+    if (!buildArtifacts(book, key, jobs, blocks, artifacts, &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    for (size_t a = 0; a < kArtifactCount; a++) {
+        const Artifact &artifact = artifacts[a];
+        if (artifact.name.empty()) {
+            continue;
+        }
+        if (!writeWholeFile(outDir + "/" + artifact.name, artifact.bytes, &error)) {
+            fprintf(stderr, "canticos-build: %s\n", error.c_str());
+            return 1;
+        }
+        printf("%s: version %u, %zu bytes, %.2f s%s\n", artifact.name.c_str(), artifact.version,
+               artifact.bytes.size(), artifact.seconds, artifact.phases.c_str());
+    }
+    printf("%s: %u hymns in %.2f s with %u jobs\n", key.c_str(), book.count(), secondsSince(start), jobs);
+    return 0;
+}
+
+// The books of the catalog one after another, each with all the jobs, and
+// livros.txt beside their artifacts when the source has one.
+static int build(const std::string &sourceDir, const std::string &outDir, unsigned jobs, bool blocks)
+{
+    std::string error;
+    std::vector<CatalogBook> books;
+    if (!loadCatalog(sourceDir, &books, &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    for (size_t b = 0; b < books.size(); b++) {
+        SourceBook book;
+        if (!loadSourceBook(catalogSourceDir(sourceDir, books, b), &book, &error)) {
+            fprintf(stderr, "canticos-build: %s\n", error.c_str());
+            return 1;
+        }
+        if (buildBook(book, books[b].key, outDir, jobs, blocks)) {
+            return 1;
+        }
+    }
+    std::string catalog;
+    struct stat info;
+    if (stat((sourceDir + "/" + kCatalogFileName).c_str(), &info) == 0
+        && (!readWholeFile(sourceDir + "/" + kCatalogFileName, &catalog, &error)
+            || !writeWholeFile(outDir + "/" + kCatalogFileName, catalog, &error))) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static size_t wordCount(Slice text)
+{
+    size_t count = 0;
+    Tokenizer tokenizer(text);
+    Token token;
+    while (tokenizer.next(&token)) {
+        count++;
+    }
+    return count;
+}
+
+static Slice firstLine(Slice text)
+{
+    size_t end = 0;
+    while (end < text.size && text.data[end] != '\r' && text.data[end] != '\n') {
+        end++;
+    }
+    return Slice(text.data, end);
+}
+
+static bool contains(const std::vector<SearchHit> &hits, uint32_t number)
+{
+    for (size_t i = 0; i < hits.size(); i++) {
+        if (hits[i].number == number) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Byte range of a UTF-16 range of text; empty when it does not fit.
+static Slice bytesOf(Slice text, TextRange range)
+{
+    const uint8_t *p = (const uint8_t *)text.data;
+    const uint8_t *end = p + text.size;
+    const uint8_t *start = NULL;
+    uint32_t units = 0;
+    while (p < end && units < range.location + range.length) {
+        if (units == range.location) {
+            start = p;
+        }
+        uint32_t cp;
+        p += decodeUtf8(p, end, &cp);
+        units += cp > 0xFFFF ? 2 : 1;
+    }
+    if (units != range.location + range.length || (!start && range.length)) {
+        return Slice();
+    }
+    return Slice((const char *)start, (const char *)p - (const char *)start);
+}
+
+// The ranges highlighted for the words of query in text must be exactly
+// the words of text with the same terms, but for those of unindexed (the
+// title line a body starts with).
+static bool highlightsMatch(const SearchIndex &index, uint32_t number, HighlightText which, Slice text,
+                            Slice unindexed, Slice query)
+{
+    std::vector<std::string> wanted;
+    Tokenizer words(query);
+    Token token;
+    char term[kMaxTermBytes];
+    while (words.next(&token)) {
+        wanted.push_back(std::string(term, normalizeTerm(token.text, term)));
+    }
+    size_t expected = 0;
+    Tokenizer all(text);
+    while (all.next(&token)) {
+        std::string word(term, normalizeTerm(token.text, term));
+        expected += std::find(wanted.begin(), wanted.end(), word) != wanted.end();
+    }
+    Tokenizer skipped(unindexed);
+    while (skipped.next(&token)) {
+        std::string word(term, normalizeTerm(token.text, term));
+        expected -= std::find(wanted.begin(), wanted.end(), word) != wanted.end();
+    }
+
+    TextRange ranges[256];
+    size_t count = index.highlight(query, number, which, ranges, 256);
+    if (count != std::min(expected, (size_t)256)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        Slice bytes = bytesOf(text, ranges[i]);
+        std::string word(term, normalizeTerm(bytes, term));
+        if (bytes.empty() || std::find(wanted.begin(), wanted.end(), word) == wanted.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int verifyIndex(const SourceBook &book, const Corpus &corpus, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    SearchIndex index;
+    if (!index.open((outDir + "/" + key + ".index").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Every hymn must be found by the words of its own title.
+    int failures = 0;
+    SearchOptions options;
+    options.limit = book.count();
+    std::vector<SearchHit> hits;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        index.search(Slice(book.titles[n - 1]), options, &hits);
+        if (!contains(hits, n)) {
+            fprintf(stderr, "%s.index: hymn %u not found by its title\n", key.c_str(), n);
+            failures++;
+        }
+    }
+
+    // And by its first lyric line searched as a phrase, which walks the
+    // positions and, for common words, the skip entries; the stems of the
+    // line must sit at the same positions.
+    SearchOptions phrase = options;
+    phrase.mode = SearchOptions::Phrase;
+    SearchOptions stemmed = phrase;
+    stemmed.stemming = true;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        Slice line = corpus.stanzaCount(n) ? firstLine(corpus.stanza(n, 0).text) : Slice();
+        if (wordCount(line) == 0) {
+            continue;
+        }
+        index.search(line, phrase, &hits);
+        bool found = contains(hits, n);
+        index.search(line, stemmed, &hits);
+        if (!found || !contains(hits, n)) {
+            fprintf(stderr, "%s.index: hymn %u not found by the phrase \"%.*s\"%s\n", key.c_str(), n,
+                    (int)line.size, line.data, found ? " stemmed" : "");
+            failures++;
+        }
+    }
+
+    // Highlights of the title in the title, and of the first line in the
+    // body, must land on the words they name.
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        Slice line = corpus.stanzaCount(n) ? firstLine(corpus.stanza(n, 0).text) : Slice();
+        if (!highlightsMatch(index, n, kHighlightTitle, corpus.title(n), Slice(), corpus.title(n))
+            || !highlightsMatch(index, n, kHighlightBody, corpus.body(n), corpus.titleLine(n), line)) {
+            fprintf(stderr, "%s.index: highlights of hymn %u are off\n", key.c_str(), n);
+            failures++;
+        }
+    }
+    if (index.docCount() != book.count()) {
+        fprintf(stderr, "%s.index: %u documents, source has %u\n", key.c_str(), index.docCount(), book.count());
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.index: %u terms, every title and first line finds its hymn and is highlighted\n", key.c_str(),
+           index.termCount());
+    return 0;
+}
+
+static int verifyTrie(const SourceBook &book, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    TitleTrie trie;
+    if (!trie.open((outDir + "/" + key + ".trie").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Every title must be suggested for itself, unless as many others
+    // start the same way (a big book has many "ALELUIA"s), and for the
+    // first three letters of each of its words.
+    int failures = 0;
+    uint32_t crowded = 0;
+    Suggestion suggestions[TitleTrie::kMaxSuggestions];
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        Slice title = titleWithoutNumber(Slice(book.titles[n - 1]));
+        size_t count = trie.suggest(title, suggestions, TitleTrie::kMaxSuggestions);
+        bool found = false;
+        for (size_t i = 0; i < count; i++) {
+            found = found || (suggestions[i].number == n && suggestions[i].text == title);
+        }
+        if (!found && count == TitleTrie::kMaxSuggestions) {
+            crowded++;
+        } else if (!found) {
+            fprintf(stderr, "%s.trie: title of hymn %u is not suggested for itself\n", key.c_str(), n);
+            failures++;
+        }
+        Tokenizer words(title);
+        Token word;
+        while (words.next(&word)) {
+            const uint8_t *p = (const uint8_t *)word.text.data;
+            const uint8_t *end = p + word.text.size;
+            for (int letters = 0; letters < 3 && p < end; letters++) {
+                uint32_t cp;
+                p += decodeUtf8(p, end, &cp);
+            }
+            Slice fragment(word.text.data, (size_t)(p - (const uint8_t *)word.text.data));
+            if (trie.suggest(fragment, suggestions, 1) == 0) {
+                fprintf(stderr, "%s.trie: no suggestion for a word of hymn %u\n", key.c_str(), n);
+                failures++;
+            }
+        }
+    }
+    if (failures) {
+        return 1;
+    }
+    if (crowded) {
+        printf("%s.trie: every title is suggested for itself and its words, %u among %zu others as good\n", key.c_str(),
+               crowded, TitleTrie::kMaxSuggestions);
+        return 0;
+    }
+    printf("%s.trie: every title is suggested for itself and its words\n", key.c_str());
+    return 0;
+}
+
+static int verifySpell(const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    SearchIndex index;
+    SpellIndex spell;
+    if (!index.open((outDir + "/" + key + ".index").c_str(), &error)
+        || !spell.open((outDir + "/" + key + ".spell").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    if (spell.termCount() != index.termCount()) {
+        fprintf(stderr, "%s.spell: %u terms, index has %u\n", key.c_str(), spell.termCount(), index.termCount());
+        return 1;
+    }
+
+    // Every term must correct to itself, and every term of five letters or
+    // more must come back when its last letter is dropped.
+    int failures = 0;
+    Speller speller(index, spell);
+    SpellCorrection corrections[32];
+    for (uint32_t t = 0; t < index.termCount(); t++) {
+        Slice text = index.termText(index.term(t));
+        if (isStemTerm(text)) {
+            continue;
+        }
+        size_t count = speller.correct(text, corrections, 1);
+        if (count == 0 || corrections[0].term != t || corrections[0].distance != 0) {
+            fprintf(stderr, "%s.spell: \"%.*s\" does not correct to itself\n", key.c_str(), (int)text.size, text.data);
+            failures++;
+            continue;
+        }
+        if (text.size < 5 || ((unsigned char)text.data[text.size - 1] & 0x80)) {
+            continue;
+        }
+        count = speller.correct(Slice(text.data, text.size - 1), corrections, 32);
+        bool found = false;
+        for (size_t i = 0; i < count; i++) {
+            found = found || corrections[i].term == t;
+        }
+        if (!found) {
+            fprintf(stderr, "%s.spell: \"%.*s\" not found without its last letter\n", key.c_str(), (int)text.size,
+                    text.data);
+            failures++;
+        }
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.spell: every term is corrected back from a dropped letter\n", key.c_str());
+    return 0;
+}
+
+static bool hasSynonym(const Thesaurus &thesaurus, const SearchIndex &index, const IndexTerm *word,
+                       const IndexTerm *synonym)
+{
+    uint32_t count;
+    const uint32_t *synonyms = thesaurus.synonyms(index.termIndex(*word), &count);
+    return std::find(synonyms, synonyms + count, index.termIndex(*synonym)) != synonyms + count;
+}
+
+static int verifyThesaurus(const SourceBook &book, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    SearchIndex index;
+    Thesaurus thesaurus;
+    std::vector<SynonymLine> lines;
+    if (!index.open((outDir + "/" + key + ".index").c_str(), &error)
+        || !thesaurus.open((outDir + "/" + key + ".thesaurus").c_str(), &error)
+        || !parseSynonyms(Slice(book.synonyms), &lines, &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    if (thesaurus.termCount() != index.termCount()) {
+        fprintf(stderr, "%s.thesaurus: %u terms, index has %u\n", key.c_str(), thesaurus.termCount(),
+                index.termCount());
+        return 1;
+    }
+
+    // Only the words of sinonimos.csv and their stems have synonyms.
+    int failures = 0;
+    uint32_t entries = 0;
+    for (uint32_t t = 0; t < index.termCount(); t++) {
+        uint32_t count;
+        entries += thesaurus.synonyms(t, &count) != NULL;
+    }
+    if (entries != thesaurus.entryCount() || entries > 2 * lines.size()) {
+        fprintf(stderr, "%s.thesaurus: %u terms have synonyms, %zu lines\n", key.c_str(), entries, lines.size());
+        failures++;
+    }
+
+    // Every synonym of a line must be listed for the word, stem for stem,
+    // and searching for the word must find every hymn that has the synonym.
+    SearchOptions options;
+    options.limit = book.count();
+    options.thesaurus = &thesaurus;
+    std::vector<SearchHit> hits;
+    char stem[kMaxTermBytes];
+    for (size_t l = 0; l < lines.size(); l++) {
+        const SynonymLine &line = lines[l];
+        const IndexTerm *word = index.find(Slice(line[0]));
+        const IndexTerm *wordStem = index.find(Slice(stem, stemIndexTerm(Slice(line[0]), stem)));
+        if (!word) {
+            continue;
+        }
+        index.search(Slice(line[0]), options, &hits);
+        for (size_t s = 1; s < line.size(); s++) {
+            const IndexTerm *synonym = index.find(Slice(line[s]));
+            const IndexTerm *synonymStem = index.find(Slice(stem, stemIndexTerm(Slice(line[s]), stem)));
+            if (!synonym) {
+                continue;
+            }
+            bool found = hasSynonym(thesaurus, index, word, synonym)
+                && (wordStem == synonymStem || hasSynonym(thesaurus, index, wordStem, synonymStem));
+            PostingCursor c = index.cursor(*synonym);
+            while (found && c.next()) {
+                found = contains(hits, c.doc);
+            }
+            if (!found) {
+                fprintf(stderr, "%s.thesaurus: \"%s\" does not find \"%s\"\n", key.c_str(), line[0].c_str(),
+                        line[s].c_str());
+                failures++;
+            }
+        }
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.thesaurus: %u entries, every word finds the hymns of its synonyms\n", key.c_str(),
+           thesaurus.entryCount());
+    return 0;
+}
+
+static int verifyStanzas(const SourceBook &book, const Corpus &corpus, const std::string &key)
+{
+    // Title line and stanzas must cover every word of the text once, in
+    // order, and a repeat must point at an earlier stanza.
+    int failures = 0;
+    size_t refrains = 0;
+    size_t repeats = 0;
+    for (uint32_t n = 1; n <= book.count() && n <= corpus.count(); n++) {
+        Slice body = corpus.body(n);
+        size_t words = wordCount(corpus.titleLine(n));
+        const char *after = corpus.titleLine(n).end();
+        bool ordered = !corpus.titleLine(n).empty();
+        for (uint32_t i = 0; i < corpus.stanzaCount(n); i++) {
+            Stanza stanza = corpus.stanza(n, i);
+            words += wordCount(stanza.text);
+            refrains += stanza.refrain;
+            repeats += stanza.repeat;
+            if (stanza.repeat) {
+                bool earlier = false;
+                for (uint32_t k = 0; k < i; k++) {
+                    earlier = earlier || corpus.stanza(n, k).text.data == stanza.text.data;
+                }
+                ordered = ordered && earlier;
+            } else {
+                ordered = ordered && stanza.text.data >= after && stanza.lineCount > 0
+                    && stanza.utf16Offset == utf16Length(Slice(body.data, stanza.text.data - body.data))
+                    && stanza.utf16Size == utf16Length(stanza.text);
+                after = stanza.text.end();
+            }
+        }
+        if (!ordered || words != wordCount(body)) {
+            fprintf(stderr, "c%u.txt: stanzas do not cover the text\n", n);
+            failures++;
+        }
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.corpus: stanzas cover every text, %zu refrains, %zu repeats\n", key.c_str(), refrains, repeats);
+    return 0;
+}
+
+static int verifyTitles(const SourceBook &book, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    TitleTable titles;
+    if (!titles.open((outDir + "/" + key + ".titles").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    int failures = 0;
+    if (titles.count() != book.count()) {
+        fprintf(stderr, "%s.titles: %u rows, source has %u\n", key.c_str(), titles.count(), book.count());
+        failures++;
+    }
+    for (uint32_t n = 1; n <= book.count() && n <= titles.count(); n++) {
+        if (titles.title(n) != Slice(book.titles[n - 1])) {
+            fprintf(stderr, "%s.titles: row %u differs from indice.txt\n", key.c_str(), n);
+            failures++;
+        }
+    }
+    if (!titles.title(0).empty() || !titles.title(book.count() + 1).empty()) {
+        fprintf(stderr, "%s.titles: out of range rows are not rejected\n", key.c_str());
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.titles: %u rows byte-identical to indice.txt\n", key.c_str(), titles.count());
+    return 0;
+}
+
+static int verifyBlocks(const SourceBook &book, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    HymnBlocks blocks;
+    if (!blocks.open((outDir + "/" + key + ".blocks").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    int failures = 0;
+    if (blocks.count() != book.count()) {
+        fprintf(stderr, "%s.blocks: %u blocks, source has %u\n", key.c_str(), blocks.count(), book.count());
+        failures++;
+    }
+    size_t raw = 0;
+    size_t packed = blocks.dictionary().size;
+    std::string text;
+    for (uint32_t n = 1; n <= book.count() && n <= blocks.count(); n++) {
+        if (!blocks.text(n, &text) || text != book.bodies[n - 1]) {
+            fprintf(stderr, "%s.blocks: hymn %u differs from c%u.txt\n", key.c_str(), n, n);
+            failures++;
+        }
+        raw += book.bodies[n - 1].size();
+        packed += blocks.block(n).size;
+    }
+    if (blocks.text(0, &text) || blocks.text(book.count() + 1, &text)) {
+        fprintf(stderr, "%s.blocks: out of range hymns are not rejected\n", key.c_str());
+        failures++;
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s.blocks: %u hymns byte-identical to source, %.2fx with a %zu byte dictionary\n", key.c_str(),
+           blocks.count(), (double)raw / std::max<size_t>(packed, 1), blocks.dictionary().size);
+    return 0;
+}
+
+static int verifyReproducible(const SourceBook &book, const std::string &outDir, const std::string &key, bool blocks)
+{
+    std::string error;
+    Artifact artifacts[kArtifactCount];
+    if (!buildArtifacts(book, key, 1, blocks, artifacts, &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    int failures = 0;
+    for (size_t a = 0; a < kArtifactCount; a++) {
+        if (artifacts[a].name.empty()) {
+            continue;
+        }
+        std::string bytes;
+        if (!readWholeFile(outDir + "/" + artifacts[a].name, &bytes, &error)) {
+            fprintf(stderr, "canticos-build: %s\n", error.c_str());
+            return 1;
+        }
+        if (bytes != artifacts[a].bytes) {
+            fprintf(stderr, "%s: differs from a build with one job\n", artifacts[a].name.c_str());
+            failures++;
+        }
+    }
+    if (failures) {
+        return 1;
+    }
+    printf("%s: every artifact is reproduced byte for byte by a build with one job\n", key.c_str());
+    return 0;
+}
+
+static int verifyBook(const SourceBook &book, const std::string &outDir, const std::string &key)
+{
+    std::string error;
+    Corpus corpus;
+    if (!corpus.open((outDir + "/" + key + ".corpus").c_str(), &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+
+    int failures = 0;
+    if (corpus.count() != book.count()) {
+        fprintf(stderr, "hymn count: corpus has %u, source has %u\n", corpus.count(), book.count());
+        failures++;
+    }
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        if (corpus.body(n) != Slice(book.bodies[n - 1])) {
+            fprintf(stderr, "c%u.txt: body differs\n", n);
+            failures++;
+        }
+        if (corpus.title(n) != Slice(book.titles[n - 1])) {
+            fprintf(stderr, "indice.txt: title of hymn %u differs\n", n);
+            failures++;
+        }
+    }
+    if (verifyStanzas(book, corpus, key)) {
+        failures++;
+    }
+    if (corpus.contains(0) || corpus.contains(book.count() + 1) || !corpus.body(book.count() + 1).empty()) {
+        fprintf(stderr, "out of range numbers are not rejected\n");
+        failures++;
+    }
+
+    if (failures) {
+        fprintf(stderr, "%s.corpus: %d mismatches\n", key.c_str(), failures);
+        return 1;
+    }
+    printf("%s.corpus: %u hymns byte-identical to source\n", key.c_str(), book.count());
+    // The blocks are only there when the build was asked for them.
+    struct stat info;
+    bool blocks = stat((outDir + "/" + key + ".blocks").c_str(), &info) == 0;
+    return verifyIndex(book, corpus, outDir, key) || verifyTrie(book, outDir, key) || verifySpell(outDir, key)
+        || verifyThesaurus(book, outDir, key) || verifyTitles(book, outDir, key)
+        || (blocks && verifyBlocks(book, outDir, key)) || verifyReproducible(book, outDir, key, blocks);
+}
+
+static int verify(const std::string &sourceDir, const std::string &outDir)
+{
+    std::string error;
+    std::vector<CatalogBook> books;
+    if (!loadCatalog(sourceDir, &books, &error)) {
+        fprintf(stderr, "canticos-build: %s\n", error.c_str());
+        return 1;
+    }
+    struct stat info;
+    if (stat((sourceDir + "/" + kCatalogFileName).c_str(), &info) == 0) {
+        std::string source;
+        std::string copy;
+        if (!readWholeFile(sourceDir + "/" + kCatalogFileName, &source, &error)
+            || !readWholeFile(outDir + "/" + kCatalogFileName, &copy, &error)) {
+            fprintf(stderr, "canticos-build: %s\n", error.c_str());
+            return 1;
+        }
+        if (copy != source) {
+            fprintf(stderr, "%s: differs from source\n", kCatalogFileName);
+            return 1;
+        }
+        printf("%s: %zu books\n", kCatalogFileName, books.size());
+    }
+    for (size_t b = 0; b < books.size(); b++) {
+        SourceBook book;
+        if (!loadSourceBook(catalogSourceDir(sourceDir, books, b), &book, &error)) {
+            fprintf(stderr, "canticos-build: %s\n", error.c_str());
+            return 1;
+        }
+        if (verifyBook(book, outDir, books[b].key)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool verifying = false;
+    bool blocks = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--verify") == 0) {
+            verifying = true;
+        } else if (strcmp(argv[arg], "--blocks") == 0) {
+            blocks = true;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            jobs = (unsigned)std::max(1, atoi(argv[++arg]));
+        } else {
+            return usage();
+        }
+    }
+    if (argc - arg != 2) {
+        return usage();
+    }
+    std::string sourceDir = argv[arg];
+    std::string outDir = argv[arg + 1];
+    return verifying ? verify(sourceDir, outDir) : build(sourceDir, outDir, jobs, blocks);
+}
@@ -0,0 +1,329 @@
+//
+//  canticos-search.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Runs queries against the artifacts written by canticos-build, the same
+//  way the app does, and reports how long each one took.
+//
+//      canticos-search [-n LIMIT] [--any|--phrase] [--stem] [--synonyms [--synonym-weight W]] [--highlight] [--suggest] [--type] [--spell suggest|auto] [--repeat N] [--trace PREFIX] [--book KEY] ARTIFACT_DIR [QUERY...]
+//
+//  Without QUERY arguments, queries are read from stdin, one per line.
+//  --any matches hymns with any of the words, --phrase only those with all
+//  of them in a row; quotes and NEAR/k work in every mode.
+//  --stem matches the words sharing each query word's stem.
+//  --synonyms expands plain words with the book's thesaurus, their synonyms
+//  scoring W (default 0.5) times what the word would.
+//  --highlight also reads where the query's words are in the text of the
+//  first hit, as UTF-16 ranges like the app gets them.
+//  --suggest treats each query as a typed fragment and lists completions.
+//  --type replays each query one character at a time through an
+//  incremental search session, then backspaces it away, and reports the
+//  latency of every keystroke.
+//  --spell suggest searches the query as typed and proposes a spelling for
+//  its unknown words; --spell auto searches the corrected query instead.
+//  --trace PREFIX writes the latency histograms of the searches,
+//  suggestions and keystrokes to PREFIX.json and their spans to
+//  PREFIX.trace.json (Chrome trace), in a build with CANTICOS_TRACE.
+//  --book KEY searches that book of a catalog (KEY.corpus, KEY.index...)
+//  rather than livro.
+//
+
+#include "Catalog.h"
+#include "Corpus.h"
+#include "IncrementalSearch.h"
+#include "SearchIndex.h"
+#include "SpellIndex.h"
+#include "Thesaurus.h"
+#include "TitleTrie.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+static int usage()
+{
+    fprintf(stderr, "usage: canticos-search [-n LIMIT] [--any|--phrase] [--stem] [--synonyms [--synonym-weight W]] [--highlight] [--suggest] [--type] [--spell suggest|auto] [--repeat N] [--trace PREFIX] [--book KEY] ARTIFACT_DIR [QUERY...]\n");
+    return 2;
+}
+
+enum Spelling { NoSpelling, SuggestSpelling, AutoSpelling };
+
+struct Session {
+    Corpus corpus;
+    SearchIndex index;
+    TitleTrie trie;
+    SpellIndex spell;
+    Thesaurus thesaurus;
+    SearchOptions options;
+    bool suggesting;
+    bool typing;
+    bool highlighting;
+    Spelling spelling;
+    int repeat;
+};
+
+// The query to search for, after spelling correction if asked for.
+static std::string spellCheck(Session &session, const std::string &query)
+{
+    if (session.spelling == NoSpelling) {
+        return query;
+    }
+    Speller speller(session.index, session.spell);
+    std::string suggested;
+    bool changed = false;
+    double best = 1e30;
+    for (int r = 0; r < session.repeat; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        changed = speller.suggestQuery(Slice(query), &suggested);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, us);
+    }
+    if (!changed) {
+        return query;
+    }
+    if (session.spelling == SuggestSpelling) {
+        printf("did you mean \"%s\"? (%.1f us)\n", suggested.c_str(), best);
+        return query;
+    }
+    printf("corrected \"%s\" to \"%s\" (%.1f us)\n", query.c_str(), suggested.c_str(), best);
+    return suggested;
+}
+
+static void type(Session &session, const std::string &query)
+{
+    // Prefixes of the query on code point boundaries, typed and then
+    // erased again.
+    std::vector<size_t> lengths;
+    for (size_t i = 1; i <= query.size(); i++) {
+        if (i == query.size() || ((unsigned char)query[i] & 0xC0) != 0x80) {
+            lengths.push_back(i);
+        }
+    }
+    for (size_t i = lengths.size(); i-- > 1;) {
+        lengths.push_back(lengths[i - 1]);
+    }
+    lengths.push_back(0);
+
+    IncrementalSearch search(session.index);
+    std::vector<SearchHit> hits;
+    printf("\"%s\"\n", query.c_str());
+    for (int r = 0; r < session.repeat; r++) {
+        search.reset();
+        for (size_t i = 0; i < lengths.size(); i++) {
+            CANTICOS_TRACE_SCOPE(span, kTraceTypeSearch);
+            search.update(Slice(query.data(), lengths[i]), session.options.limit, &hits);
+            CANTICOS_TRACE_ARG(span, hits.size());
+            if (r == session.repeat - 1) {
+                const KeystrokeStats &stats = search.stats();
+                printf("  %-40.*s %8zu candidates %10.1f us\n",
+                       (int)lengths[i], query.data(), stats.lastCandidates, stats.lastMicros);
+            }
+        }
+    }
+    const KeystrokeStats &stats = search.stats();
+    printf("  %llu keystrokes: %llu reused, %llu narrowed, %llu from scratch; mean %.1f us, max %.1f us, %llu over %.0f us\n",
+           (unsigned long long)stats.keystrokes, (unsigned long long)stats.reused,
+           (unsigned long long)stats.narrowed, (unsigned long long)stats.fromScratch,
+           stats.totalMicros / std::max<uint64_t>(stats.keystrokes, 1), stats.maxMicros,
+           (unsigned long long)stats.overBudget, kKeystrokeBudgetMicros);
+}
+
+static void suggest(Session &session, const std::string &fragment)
+{
+    Suggestion suggestions[TitleTrie::kMaxSuggestions];
+    size_t limit = std::min(session.options.limit, TitleTrie::kMaxSuggestions);
+    size_t count = 0;
+    double best = 1e30;
+    double total = 0;
+    for (int r = 0; r < session.repeat; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CANTICOS_TRACE_SCOPE(span, kTraceSuggest);
+        count = session.trie.suggest(Slice(fragment), suggestions, limit);
+        CANTICOS_TRACE_ARG(span, count);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, us);
+        total += us;
+    }
+
+    printf("\"%s\": %zu suggestions, %.2f us (best %.2f us over %d runs)\n",
+           fragment.c_str(), count, total / session.repeat, best, session.repeat);
+    for (size_t i = 0; i < count; i++) {
+        printf("%6u  %.*s\n", suggestions[i].number, (int)suggestions[i].text.size, suggestions[i].text.data);
+    }
+}
+
+static void highlight(Session &session, const std::string &query, uint32_t number)
+{
+    static const size_t kMaxRanges = 256;
+    TextRange ranges[kMaxRanges];
+    size_t count = 0;
+    double best = 1e30;
+    double total = 0;
+    for (int r = 0; r < session.repeat; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        count = session.index.highlight(Slice(query), number, kHighlightBody, ranges, kMaxRanges,
+                                        session.options.stemming, session.options.thesaurus);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, us);
+        total += us;
+    }
+
+    uint32_t lines = 0;
+    for (uint32_t i = 0; i < session.corpus.stanzaCount(number); i++) {
+        lines += session.corpus.stanza(number, i).lineCount;
+    }
+    printf("highlight %u (%u lines): %zu ranges, %.2f us (best %.2f us over %d runs)\n",
+           number, lines, count, total / session.repeat, best, session.repeat);
+    for (size_t i = 0; i < count; i++) {
+        printf("%s%u+%u", i % 10 ? " " : "    ", ranges[i].location, ranges[i].length);
+        if (i % 10 == 9 || i + 1 == count) {
+            printf("\n");
+        }
+    }
+}
+
+static void run(Session &session, const std::string &typed)
+{
+    if (session.suggesting) {
+        suggest(session, typed);
+        return;
+    }
+    if (session.typing) {
+        type(session, typed);
+        return;
+    }
+    std::string query = spellCheck(session, typed);
+
+    std::vector<SearchHit> hits;
+    double best = 1e30;
+    double total = 0;
+    for (int r = 0; r < session.repeat; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CANTICOS_TRACE_SCOPE(span, kTraceQuery);
+        session.index.search(Slice(query), session.options, &hits);
+        CANTICOS_TRACE_ARG(span, hits.size());
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, us);
+        total += us;
+    }
+
+    printf("\"%s\": %zu hits, %.1f us (best %.1f us over %d runs)\n",
+           query.c_str(), hits.size(), total / session.repeat, best, session.repeat);
+    for (size_t i = 0; i < hits.size(); i++) {
+        Slice title = session.corpus.title(hits[i].number);
+        printf("%6u %8.3f  %.*s\n", hits[i].number, hits[i].score, (int)title.size, title.data);
+    }
+    if (session.highlighting && !hits.empty()) {
+        highlight(session, query, hits[0].number);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Session session;
+    session.suggesting = false;
+    session.typing = false;
+    session.highlighting = false;
+    session.spelling = NoSpelling;
+    session.repeat = 1;
+
+    bool synonyms = false;
+    const char *tracePrefix = NULL;
+    std::string book = kMainBookKey;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            session.options.limit = (size_t)atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--any") == 0) {
+            session.options.mode = SearchOptions::AnyWord;
+        } else if (strcmp(argv[arg], "--phrase") == 0) {
+            session.options.mode = SearchOptions::Phrase;
+        } else if (strcmp(argv[arg], "--stem") == 0) {
+            session.options.stemming = true;
+        } else if (strcmp(argv[arg], "--synonyms") == 0) {
+            synonyms = true;
+        } else if (strcmp(argv[arg], "--synonym-weight") == 0 && arg + 1 < argc) {
+            session.options.synonymWeight = (float)atof(argv[++arg]);
+        } else if (strcmp(argv[arg], "--highlight") == 0) {
+            session.highlighting = true;
+        } else if (strcmp(argv[arg], "--suggest") == 0) {
+            session.suggesting = true;
+        } else if (strcmp(argv[arg], "--type") == 0) {
+            session.typing = true;
+        } else if (strcmp(argv[arg], "--spell") == 0 && arg + 1 < argc) {
+            arg++;
+            if (strcmp(argv[arg], "suggest") == 0) {
+                session.spelling = SuggestSpelling;
+            } else if (strcmp(argv[arg], "auto") == 0) {
+                session.spelling = AutoSpelling;
+            } else {
+                return usage();
+            }
+        } else if (strcmp(argv[arg], "--repeat") == 0 && arg + 1 < argc) {
+            session.repeat = std::max(1, atoi(argv[++arg]));
+        } else if (strcmp(argv[arg], "--trace") == 0 && arg + 1 < argc) {
+            tracePrefix = argv[++arg];
+        } else if (strcmp(argv[arg], "--book") == 0 && arg + 1 < argc) {
+            book = argv[++arg];
+        } else {
+            return usage();
+        }
+    }
+    if (arg >= argc) {
+        return usage();
+    }
+    if (tracePrefix && !CANTICOS_TRACE) {
+        fprintf(stderr, "canticos-search: --trace needs a build with CANTICOS_TRACE\n");
+        return 1;
+    }
+
+    std::string dir = argv[arg++];
+    std::string error;
+    if (!session.corpus.open((dir + "/" + book + ".corpus").c_str(), &error)
+        || !session.index.open((dir + "/" + book + ".index").c_str(), &error)
+        || !session.trie.open((dir + "/" + book + ".trie").c_str(), &error)
+        || !session.spell.open((dir + "/" + book + ".spell").c_str(), &error)
+        || (synonyms && !session.thesaurus.open((dir + "/" + book + ".thesaurus").c_str(), &error))) {
+        fprintf(stderr, "canticos-search: %s\n", error.c_str());
+        return 1;
+    }
+    if (synonyms) {
+        session.options.thesaurus = &session.thesaurus;
+    }
+
+    if (arg < argc) {
+        for (; arg < argc; arg++) {
+            run(session, argv[arg]);
+        }
+    } else {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            if (!line.empty()) {
+                run(session, line);
+            }
+        }
+    }
+
+    if (tracePrefix) {
+        std::string json;
+        traceJson(&json);
+        std::string chrome;
+        traceChrome(&chrome);
+        if (!writeWholeFile(std::string(tracePrefix) + ".json", json, &error)
+            || !writeWholeFile(std::string(tracePrefix) + ".trace.json", chrome, &error)) {
+            fprintf(stderr, "canticos-search: %s\n", error.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,404 @@
+//
+//  canticos-synth.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Writes a made-up hymnal shaped like a real one, for trying the builder
+//  and the search at sizes the book will not reach.
+//
+//      canticos-synth [--seed N] SOURCE_DIR OUTPUT_DIR COUNT
+//
+//  Learns from the hymns in SOURCE_DIR, then writes COUNT hymns (10k, 100k
+//  and 1M are read as such) to OUTPUT_DIR as indice.txt and c1.txt ...
+//  cN.txt, one at a time, so memory stays that of the model. The same
+//  source and seed (default 1) give the same files. What is learned:
+//
+//  - the stanza pattern of each hymn, taken whole: how many stanzas, which
+//    are refrains, and which refrains are written out again and where;
+//  - lines per stanza and words per line, for refrains and verses apart;
+//  - the words, by how often each follows the one before, in capital lines
+//    and in the others apart, so refrains stay in capitals and phrases
+//    like "povo de Deus" come out as often as they go in;
+//  - whether the title repeats the first line, and words per title;
+//  - the line endings of each file, CR, LF or CRLF.
+//
+//  Words keep their punctuation ("Senhor," "aleluia!"), as the tokenizer
+//  and the highlighting meet them. sinonimos.csv is copied over.
+//
+
+#include "MappedFile.h"
+#include "SourceBook.h"
+#include "Stanza.h"
+#include "Tokenizer.h"
+
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace canticos;
+
+static void usage()
+{
+    fprintf(stderr, "usage: canticos-synth [--seed N] SOURCE_DIR OUTPUT_DIR COUNT\n");
+}
+
+// splitmix64: the same numbers on every platform, unlike the
+// distributions of <random>.
+class Random {
+public:
+    explicit Random(uint64_t seed) : _state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // Uniform in [0, n).
+    uint32_t below(size_t n) { return n ? (uint32_t)(next() % n) : 0; }
+    bool chance(double p) { return (next() >> 11) * (1.0 / 9007199254740992.0) < p; }
+
+private:
+    uint64_t _state;
+};
+
+// Picks from what was seen as often as it was seen: every observation is
+// kept, so a draw is one index.
+template <typename T> struct Observed {
+    std::vector<T> values;
+
+    void add(const T &value) { values.push_back(value); }
+    bool empty() const { return values.empty(); }
+    const T &draw(Random *random) const { return values[random->below(values.size())]; }
+};
+
+// Words by the word before them; word 0 starts a line.
+class WordChain {
+public:
+    WordChain() : _words(1) {}
+
+    void addLine(const std::vector<std::string> &line)
+    {
+        uint32_t previous = 0;
+        for (size_t i = 0; i < line.size(); i++) {
+            uint32_t id = idOf(line[i]);
+            _next[previous].add(id);
+            _all.add(id);
+            previous = id;
+        }
+    }
+
+    // Words of a line: mostly following the word before, now and then any
+    // word at all, which keeps the lines from copying the source.
+    void line(size_t count, Random *random, std::string *out) const
+    {
+        uint32_t previous = 0;
+        for (size_t i = 0; i < count && !_all.empty(); i++) {
+            std::unordered_map<uint32_t, Observed<uint32_t> >::const_iterator next = _next.find(previous);
+            uint32_t id = next != _next.end() && !random->chance(kJump) ? next->second.draw(random) : _all.draw(random);
+            if (i) {
+                *out += ' ';
+            }
+            *out += _words[id];
+            previous = id;
+        }
+    }
+
+    size_t vocabulary() const { return _words.size() - 1; }
+    bool empty() const { return _all.empty(); }
+
+private:
+    static const double kJump;
+
+    uint32_t idOf(const std::string &word)
+    {
+        std::unordered_map<std::string, uint32_t>::iterator it = _ids.find(word);
+        if (it != _ids.end()) {
+            return it->second;
+        }
+        _ids[word] = (uint32_t)_words.size();
+        _words.push_back(word);
+        return (uint32_t)_words.size() - 1;
+    }
+
+    std::vector<std::string> _words;
+    std::unordered_map<std::string, uint32_t> _ids;
+    std::unordered_map<uint32_t, Observed<uint32_t> > _next;
+    Observed<uint32_t> _all;
+};
+
+const double WordChain::kJump = 0.15;
+
+// A stanza of a pattern: a new verse, a new refrain, or the stanza at an
+// earlier index written out again.
+static const int kNewVerse = -1;
+static const int kNewRefrain = -2;
+
+struct Model {
+    Observed<std::vector<int> > patterns;
+    Observed<uint32_t> refrainLines;
+    Observed<uint32_t> verseLines;
+    Observed<uint32_t> capitalWords;
+    Observed<uint32_t> lowerWords;
+    Observed<uint32_t> titleWords;
+    Observed<std::string> lineEnds;
+    WordChain capitals;
+    WordChain lowers;
+    uint32_t hymns;
+    uint32_t titleIsFirstLine;
+    uint32_t endsWithLineEnd;
+    uint64_t lines;
+
+    Model() : hymns(0), titleIsFirstLine(0), endsWithLineEnd(0), lines(0) {}
+};
+
+static std::vector<std::string> splitWords(Slice line)
+{
+    std::vector<std::string> words;
+    size_t i = 0;
+    while (i < line.size) {
+        while (i < line.size && (line.data[i] == ' ' || line.data[i] == '\t')) {
+            i++;
+        }
+        size_t start = i;
+        while (i < line.size && line.data[i] != ' ' && line.data[i] != '\t') {
+            i++;
+        }
+        if (i > start) {
+            words.push_back(std::string(line.data + start, i - start));
+        }
+    }
+    return words;
+}
+
+static std::string lineEndOf(Slice body)
+{
+    for (size_t i = 0; i < body.size; i++) {
+        if (body.data[i] == '\n') {
+            return "\n";
+        }
+        if (body.data[i] == '\r') {
+            return i + 1 < body.size && body.data[i + 1] == '\n' ? "\r\n" : "\r";
+        }
+    }
+    return "\n";
+}
+
+static void learnHymn(Slice title, Slice body, Model *model)
+{
+    HymnStructure structure;
+    parseHymn(body, &structure);
+    if (structure.stanzas.empty()) {
+        return;
+    }
+    model->hymns++;
+    model->lineEnds.add(lineEndOf(body));
+    if (body.size && (body.data[body.size - 1] == '\n' || body.data[body.size - 1] == '\r')) {
+        model->endsWithLineEnd++;
+    }
+    Slice bare = titleWithoutNumber(title);
+    model->titleWords.add((uint32_t)splitWords(bare).size());
+    if (bare == firstLyricLine(body)) {
+        model->titleIsFirstLine++;
+    }
+
+    std::vector<int> pattern;
+    for (size_t i = 0; i < structure.stanzas.size(); i++) {
+        const StanzaSpan &span = structure.stanzas[i];
+        if (span.flags & kStanzaRepeat) {
+            int earlier = kNewVerse;
+            for (size_t k = 0; k < i; k++) {
+                if (structure.stanzas[k].offset == span.offset && !(structure.stanzas[k].flags & kStanzaRepeat)) {
+                    earlier = (int)k;
+                    break;
+                }
+            }
+            if (earlier != kNewVerse) {
+                pattern.push_back(earlier);
+                continue;
+            }
+        }
+        bool refrain = (span.flags & kStanzaRefrain) != 0;
+        pattern.push_back(refrain ? kNewRefrain : kNewVerse);
+        (refrain ? model->refrainLines : model->verseLines).add(span.lineCount);
+
+        Slice text(body.data + span.offset, span.size);
+        size_t start = 0;
+        while (start < text.size) {
+            size_t end = start;
+            while (end < text.size && text.data[end] != '\r' && text.data[end] != '\n') {
+                end++;
+            }
+            Slice line(text.data + start, end - start);
+            start = end + 1;
+            std::vector<std::string> words = splitWords(line);
+            if (words.empty()) {
+                continue;
+            }
+            model->lines++;
+            bool capital = isCapitalLine(line);
+            (capital ? model->capitalWords : model->lowerWords).add((uint32_t)words.size());
+            (capital ? model->capitals : model->lowers).addLine(words);
+        }
+    }
+    model->patterns.add(pattern);
+}
+
+// One hymn's cN.txt, and its title for indice.txt.
+static void makeHymn(const Model &model, uint32_t number, Random *random, std::string *body, std::string *title)
+{
+    const std::vector<int> &pattern = model.patterns.draw(random);
+    const std::string &end = model.lineEnds.draw(random);
+    std::vector<std::string> stanzas(pattern.size());
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] >= 0) {
+            stanzas[i] = stanzas[pattern[i]];
+            continue;
+        }
+        bool refrain = pattern[i] == kNewRefrain && !model.capitals.empty();
+        const Observed<uint32_t> &lineCounts = refrain || model.verseLines.empty() ? model.refrainLines
+                                                                                   : model.verseLines;
+        uint32_t lines = lineCounts.empty() ? 4 : lineCounts.draw(random);
+        for (uint32_t l = 0; l < lines; l++) {
+            if (l) {
+                stanzas[i] += end;
+            }
+            const Observed<uint32_t> &wordCounts = refrain ? model.capitalWords : model.lowerWords;
+            (refrain ? model.capitals : model.lowers).line(wordCounts.draw(random), random, &stanzas[i]);
+        }
+    }
+
+    char numbered[16];
+    snprintf(numbered, sizeof(numbered), "%u. ", number);
+    title->assign(numbered);
+    bool firstLine = !stanzas.empty() && random->below(model.hymns) < model.titleIsFirstLine
+        && isCapitalLine(Slice(stanzas[0]));
+    if (firstLine) {
+        *title += stanzas[0].substr(0, stanzas[0].find_first_of("\r\n"));
+    }
+    // A title of dots alone could never be typed; a few more tries find
+    // one with a word.
+    size_t prefix = strlen(numbered);
+    Token word;
+    for (int tries = 0; tries < 16 && !Tokenizer(Slice(title->data() + prefix, title->size() - prefix)).next(&word);
+         tries++) {
+        title->resize(prefix);
+        model.capitals.line(std::max<uint32_t>(1, model.titleWords.draw(random)), random, title);
+    }
+
+    *body = *title + end + end;
+    for (size_t i = 0; i < stanzas.size(); i++) {
+        if (i) {
+            *body += end + end;
+        }
+        *body += stanzas[i];
+    }
+    if (random->below(model.hymns) < model.endsWithLineEnd) {
+        *body += end;
+    }
+}
+
+// 10k, 100k, 1M, or a plain number; 0 if not a count.
+static uint32_t parseCount(const char *text)
+{
+    char *end;
+    unsigned long count = strtoul(text, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        count *= 1000;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        count *= 1000000;
+        end++;
+    }
+    return *end || count > 0xFFFFFFFFul ? 0 : (uint32_t)count;
+}
+
+static bool writeFile(const std::string &path, const std::string &bytes)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+    return fclose(f) == 0 && ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t seed = 1;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "--seed") == 0) {
+        seed = strtoull(argv[arg + 1], NULL, 10);
+        arg += 2;
+    }
+    if (argc - arg != 3) {
+        usage();
+        return 2;
+    }
+    std::string sourceDir = argv[arg];
+    std::string outDir = argv[arg + 1];
+    uint32_t count = parseCount(argv[arg + 2]);
+    if (count == 0) {
+        usage();
+        return 2;
+    }
+
+    SourceBook book;
+    std::string error;
+    if (!loadSourceBook(sourceDir, &book, &error)) {
+        fprintf(stderr, "canticos-synth: %s\n", error.c_str());
+        return 1;
+    }
+    Model model;
+    for (uint32_t n = 1; n <= book.count(); n++) {
+        learnHymn(Slice(book.titles[n - 1]), Slice(book.bodies[n - 1]), &model);
+    }
+    if (model.patterns.empty() || model.lowers.empty()) {
+        fprintf(stderr, "canticos-synth: no stanzas to learn from in %s\n", sourceDir.c_str());
+        return 1;
+    }
+    fprintf(stderr, "learned %u hymns: %zu patterns, %llu lines, %zu words in capitals, %zu in the others\n",
+            model.hymns, model.patterns.values.size(), (unsigned long long)model.lines, model.capitals.vocabulary(),
+            model.lowers.vocabulary());
+
+    if (mkdir(outDir.c_str(), 0777) != 0 && errno != EEXIST) {
+        fprintf(stderr, "canticos-synth: cannot create %s: %s\n", outDir.c_str(), strerror(errno));
+        return 1;
+    }
+    FILE *index = fopen(sourceIndexPath(outDir).c_str(), "wb");
+    if (!index) {
+        fprintf(stderr, "canticos-synth: cannot write %s\n", sourceIndexPath(outDir).c_str());
+        return 1;
+    }
+    Random random(seed);
+    std::string body;
+    std::string title;
+    uint64_t bytes = 0;
+    for (uint32_t n = 1; n <= count; n++) {
+        makeHymn(model, n, &random, &body, &title);
+        if (!writeFile(sourceBodyPath(outDir, n), body)) {
+            fprintf(stderr, "canticos-synth: cannot write %s\n", sourceBodyPath(outDir, n).c_str());
+            fclose(index);
+            return 1;
+        }
+        fprintf(index, "%s\n", title.c_str());
+        bytes += body.size();
+    }
+    if (fclose(index) != 0) {
+        fprintf(stderr, "canticos-synth: cannot write %s\n", sourceIndexPath(outDir).c_str());
+        return 1;
+    }
+    if (!book.synonyms.empty() && !writeFile(sourceSynonymsPath(outDir), book.synonyms)) {
+        fprintf(stderr, "canticos-synth: cannot write %s\n", sourceSynonymsPath(outDir).c_str());
+        return 1;
+    }
+    fprintf(stderr, "wrote %u hymns, %llu bytes, to %s\n", count, (unsigned long long)bytes, outDir.c_str());
+    return 0;
+}
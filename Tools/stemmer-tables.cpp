@@ -0,0 +1,244 @@
+//
+//  stemmer-tables.cpp
+//  LivroDeCanticos
+//
+//  Copyright (c) 2013 Pedro Barroso. All rights reserved.
+//
+//  Compiles the RSLP rules of Core/StemmerRules.inc into the tables that
+//  Stemmer.cpp walks. The build runs it; nothing else should.
+//
+//      stemmer-tables OUTPUT_FILE
+//
+//  Suffixes, replacements and exceptions are folded like index terms. Each
+//  step becomes a trie over its reversed suffixes, laid out breadth first
+//  so a node's edges are contiguous and sorted; a node where a suffix ends
+//  lists its rules in table order.
+//
+
+#include "Fold.h"
+#include "Stemmer.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace canticos;
+
+struct SourceRule {
+    StemStep step;
+    const char *suffix;
+    unsigned minStem;
+    const char *replacement;
+    const char *exceptions;
+};
+
+static const SourceRule kSourceRules[] = {
+#define STEM_RULE(step, suffix, minStem, replacement, exceptions) \
+    { kStem##step, suffix, minStem, replacement, exceptions },
+#include "StemmerRules.inc"
+};
+
+struct Rule {
+    uint32_t order;
+    uint32_t minStem;
+    std::string suffix;
+    std::string replacement;
+    std::vector<std::string> exceptions;   // sorted
+};
+
+struct Node {
+    std::map<unsigned char, uint32_t> children;
+    std::vector<uint32_t> rules;           // indexes into the rules, in order
+};
+
+static std::string folded(const char *text)
+{
+    std::string out(strlen(text), '\0');
+    out.resize(foldUtf8(text, out.size(), &out[0]));
+    return out;
+}
+
+static std::vector<std::string> words(const char *text)
+{
+    std::vector<std::string> out;
+    const char *p = text;
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != ' ') {
+            end++;
+        }
+        if (end > p) {
+            out.push_back(folded(std::string(p, end).c_str()));
+        }
+        p = *end ? end + 1 : end;
+    }
+    return out;
+}
+
+static void appendLiteral(std::string *out, const std::string &text)
+{
+    out->push_back('"');
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 'a' && c <= 'z') {
+            out->push_back((char)c);
+        } else {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\%03o", c);
+            *out += escaped;
+        }
+    }
+    out->push_back('"');
+}
+
+// Offset of text in the string pool, adding it the first time.
+static uint32_t intern(const std::string &text, std::string *strings, std::map<std::string, uint32_t> *offsets)
+{
+    std::map<std::string, uint32_t>::iterator it = offsets->find(text);
+    if (it == offsets->end()) {
+        it = offsets->insert(std::make_pair(text, (uint32_t)strings->size())).first;
+        *strings += text;
+    }
+    return it->second;
+}
+
+static bool fail(const char *why, const std::string &what)
+{
+    fprintf(stderr, "stemmer-tables: %s: \"%s\"\n", why, what.c_str());
+    return false;
+}
+
+static bool compile(std::string *out)
+{
+    std::vector<Rule> rules;
+    std::vector<Node> nodes(kStemStepCount);   // node s is the root of step s
+    for (size_t i = 0; i < sizeof(kSourceRules) / sizeof(kSourceRules[0]); i++) {
+        const SourceRule &source = kSourceRules[i];
+        Rule rule;
+        rule.order = (uint32_t)i;
+        rule.minStem = source.minStem;
+        rule.suffix = folded(source.suffix);
+        rule.replacement = folded(source.replacement);
+        rule.exceptions = words(source.exceptions);
+        std::sort(rule.exceptions.begin(), rule.exceptions.end());
+        rule.exceptions.erase(std::unique(rule.exceptions.begin(), rule.exceptions.end()), rule.exceptions.end());
+        if (rule.suffix.empty()) {
+            return fail("empty suffix", source.suffix);
+        }
+        if (rule.replacement.size() > rule.suffix.size()) {
+            return fail("replacement longer than its suffix", source.suffix);
+        }
+        uint32_t node = source.step;
+        for (size_t k = rule.suffix.size(); k-- > 0;) {
+            unsigned char c = (unsigned char)rule.suffix[k];
+            std::map<unsigned char, uint32_t>::iterator it = nodes[node].children.find(c);
+            if (it == nodes[node].children.end()) {
+                uint32_t child = (uint32_t)nodes.size();
+                nodes[node].children[c] = child;
+                nodes.push_back(Node());
+                node = child;
+            } else {
+                node = it->second;
+            }
+        }
+        nodes[node].rules.push_back((uint32_t)rules.size());
+        rules.push_back(rule);
+    }
+
+    // Breadth first from the roots, which keep their numbers.
+    std::vector<uint32_t> layout;
+    std::vector<uint32_t> slot(nodes.size());
+    for (uint32_t s = 0; s < kStemStepCount; s++) {
+        slot[s] = (uint32_t)layout.size();
+        layout.push_back(s);
+    }
+    for (size_t i = 0; i < layout.size(); i++) {
+        const Node &node = nodes[layout[i]];
+        for (std::map<unsigned char, uint32_t>::const_iterator it = node.children.begin(); it != node.children.end();
+             ++it) {
+            slot[it->second] = (uint32_t)layout.size();
+            layout.push_back(it->second);
+        }
+    }
+
+    std::string nodeRows;
+    std::string edgeRows;
+    std::string ruleRows;
+    std::string exceptionRows;
+    std::string strings;
+    std::map<std::string, uint32_t> stringOffsets;
+    uint32_t edgeCount = 0;
+    uint32_t ruleCount = 0;
+    uint32_t exceptionCount = 0;
+    char row[128];
+    for (size_t i = 0; i < layout.size(); i++) {
+        const Node &node = nodes[layout[i]];
+        snprintf(row, sizeof(row), "    { %u, %u, %u, %u },\n", edgeCount, ruleCount, (unsigned)node.children.size(),
+                 (unsigned)node.rules.size());
+        nodeRows += row;
+        for (std::map<unsigned char, uint32_t>::const_iterator it = node.children.begin(); it != node.children.end();
+             ++it) {
+            snprintf(row, sizeof(row), "    { %u, %u },\n", it->first, slot[it->second]);
+            edgeRows += row;
+            edgeCount++;
+        }
+        for (size_t r = 0; r < node.rules.size(); r++) {
+            const Rule &rule = rules[node.rules[r]];
+            uint32_t replacement = intern(rule.replacement, &strings, &stringOffsets);
+            snprintf(row, sizeof(row), "    { %u, %u, %u, %u, %u, %u, %u },\n", rule.order, rule.minStem,
+                     (unsigned)rule.suffix.size(), replacement, (unsigned)rule.replacement.size(), exceptionCount,
+                     (unsigned)rule.exceptions.size());
+            ruleRows += row;
+            ruleCount++;
+            for (size_t e = 0; e < rule.exceptions.size(); e++) {
+                snprintf(row, sizeof(row), "    { %u, %u },\n", intern(rule.exceptions[e], &strings, &stringOffsets),
+                         (unsigned)rule.exceptions[e].size());
+                exceptionRows += row;
+                exceptionCount++;
+            }
+        }
+    }
+    if (layout.size() > 0xFFFF || edgeCount > 0xFFFF || ruleCount > 0xFFFF || exceptionCount > 0xFFFF
+        || strings.size() > 0xFFFF) {
+        return fail("tables too large for 16 bit indexes", "StemmerRules.inc");
+    }
+
+    snprintf(row, sizeof(row), "// %u rules, %zu trie nodes, %u edges, %u exceptions.\n\n", ruleCount, layout.size(),
+             edgeCount, exceptionCount);
+    *out = "// Generated by stemmer-tables from StemmerRules.inc; do not edit.\n";
+    *out += row;
+    *out += "static const StemNode kStemNodes[] = {\n" + nodeRows + "};\n\n";
+    *out += "static const StemEdge kStemEdges[] = {\n" + edgeRows + "};\n\n";
+    *out += "static const StemRule kStemRules[] = {\n" + ruleRows + "};\n\n";
+    *out += "static const StemString kStemExceptions[] = {\n" + exceptionRows + "};\n\n";
+    *out += "static const char kStemStrings[] =\n";
+    for (size_t i = 0; i < strings.size(); i += 64) {
+        *out += "    ";
+        appendLiteral(out, strings.substr(i, 64));
+        *out += "\n";
+    }
+    *out += "    ;\n";
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: stemmer-tables OUTPUT_FILE\n");
+        return 2;
+    }
+    std::string tables;
+    if (!compile(&tables)) {
+        return 1;
+    }
+    FILE *f = fopen(argv[1], "wb");
+    if (!f || fwrite(tables.data(), 1, tables.size(), f) != tables.size() || fclose(f) != 0) {
+        fprintf(stderr, "stemmer-tables: cannot write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+#  xcode-build-artifacts.sh
+#  LivroDeCanticos
+#
+#  Run Script phases of the LivroDeCanticos target: builds canticos-build
+#  for the host and writes the packed artifacts into the app bundle, those
+#  of every book when LivroDeCanticos has a livros.txt (Core/Catalog.h);
+#  with "tables", before the sources are compiled, generates the stemmer
+#  tables into host-tools/generated, which is on the header search path.
+#
+
+set -e
+
+# Xcode exports the iOS SDK settings; the builder is a host tool.
+unset SDKROOT IPHONEOS_DEPLOYMENT_TARGET
+
+HOST_BUILD="${DERIVED_FILE_DIR}/host-tools"
+RESOURCES="${TARGET_BUILD_DIR}/${UNLOCALIZED_RESOURCES_FOLDER_PATH}"
+
+cmake -S "${SRCROOT}" -B "${HOST_BUILD}" -DCMAKE_BUILD_TYPE=Release > /dev/null
+if [ "$1" = "tables" ]; then
+    cmake --build "${HOST_BUILD}" --target stemmer-tables-inc
+    exit 0
+fi
+cmake --build "${HOST_BUILD}" --target canticos-build
+mkdir -p "${RESOURCES}"
+# Nothing in the app reads the hymn blocks yet; drop those of older builds.
+rm -f "${RESOURCES}"/*.blocks
+"${HOST_BUILD}/canticos-build" "${SRCROOT}/LivroDeCanticos" "${RESOURCES}"